@@ -0,0 +1,926 @@
+// the-story-bench : microbenchmarks of the hot paths of the-story
+//
+// - submit      : State::submit with 1M submissions from Gen::Submissions, for several IP/user/slot distributions
+//                 and the first submission of a new period, alone, with the rotation of the submission log
+//                 and with the commit of the submission as well
+// - slot-update : Slot::addVotes + Slot::update for slots with 10 to 100k words
+// - output      : State::update + State::output for states with 10k, 100k and 1M slots,
+//                 once with all slots changed and once with 1% of the slots changed
+// - deserialize : Storage::deserializeAll for the current and the legacy period file format,
+//                 Storage::deserializeOne for pending submission files
+// - convert-ip  : convertIPAddress
+// - lexicon     : word validation with Lexicon::contains, through the ingest socket and with "grep -Fx" as
+//                 done by submit.php before, Dictionary::find for comparison
+//
+// for each benchmark the median and the minimum time per operation over several repetitions are reported,
+// together with the allocations per operation and the peak RSS of the process during the benchmark
+// the results are also written as JSON, so they can be compared between commits
+//
+// command line arguments:
+//    -h, --help : print help
+//    -o, --output : output JSON file (default: the-story-bench.json)
+//    -f, --filter : run only the benchmarks which name contains this string
+//    -s, --seed : seed of the generated workloads (default: 1234)
+//    -r, --repetitions : number of repetitions of each benchmark (default: 5)
+//   -wf, --words-file : dictionary file for the lexicon benchmarks (default: generated words)
+
+#include "types.h"
+#include "dictionary.h"
+#include "generator.h"
+#include "storage.h"
+#include "utils.h"
+#include "lexicon.h"
+#include "ingest.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// count the allocations of the benchmarked code
+// the counters are atomic because of the server thread of the socket benchmark
+namespace {
+
+std::atomic<int64_t> g_nAllocs { 0 };
+std::atomic<int64_t> g_nAllocBytes { 0 };
+
+void * countedAlloc(size_t size) {
+    g_nAllocs.fetch_add(1, std::memory_order_relaxed);
+    g_nAllocBytes.fetch_add(size, std::memory_order_relaxed);
+
+    if (void * p = std::malloc(size == 0 ? 1 : size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+}
+
+void * operator new(size_t size) { return countedAlloc(size); }
+void * operator new[](size_t size) { return countedAlloc(size); }
+void operator delete(void * p) noexcept { std::free(p); }
+void operator delete[](void * p) noexcept { std::free(p); }
+void operator delete(void * p, size_t) noexcept { std::free(p); }
+void operator delete[](void * p, size_t) noexcept { std::free(p); }
+
+namespace {
+
+enum CLIArgument {
+    EHelp,
+    EOutput,
+    EFilter,
+    ESeed,
+    ERepetitions,
+    EWordsFile,
+};
+
+using TCLIArguments = std::map<CLIArgument, std::string>;
+
+constexpr int kNumInputs = 1000000;
+constexpr int kNumPendingFiles = 1000;
+constexpr int kWordsPerSlot = 20;
+constexpr int kTopWords = 10;
+
+// the generated workloads start at this period, so that the first periods have a few thousand users
+constexpr TPeriodId kStartPeriodId = 70;
+
+// reset the peak RSS of the process, returns false if not supported
+bool resetPeakRSS() {
+    std::ofstream file("/proc/self/clear_refs");
+    file << "5";
+    return file.good();
+}
+
+// peak RSS of the process in kB
+int64_t getPeakRSS() {
+    std::ifstream file("/proc/self/status");
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0) {
+            return std::atoll(line.c_str() + 6);
+        }
+    }
+
+    // fallback: never reset, so this is the peak of the whole run
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss/1024;
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+struct Result {
+    std::string name;
+
+    int64_t nOps = 0;
+
+    double nsPerOp    = 0.0; // median over the repetitions
+    double nsPerOpMin = 0.0;
+
+    double allocsPerOp = 0.0;
+    double bytesPerOp  = 0.0;
+
+    int64_t peakRSS_kB = 0;
+};
+
+struct Benchmark {
+    std::string name;
+
+    // number of operations performed by a single call of run
+    int64_t nOps;
+
+    // prepare a repetition, not measured
+    std::function<void()> setup;
+
+    // the measured code
+    std::function<void()> run;
+};
+
+class Runner {
+public:
+    Runner(std::string filter, int nRepetitions) : m_filter(std::move(filter)), m_nRepetitions(nRepetitions) {}
+
+    bool enabled(const std::string & name) const {
+        return m_filter.empty() || name.find(m_filter) != std::string::npos;
+    }
+
+    void run(const Benchmark & benchmark) {
+        if (enabled(benchmark.name) == false) {
+            return;
+        }
+
+        Result result;
+        result.name = benchmark.name;
+        result.nOps = benchmark.nOps;
+
+        std::vector<double> times;
+        int64_t nAllocs = 0;
+        int64_t nAllocBytes = 0;
+
+        resetPeakRSS();
+
+        for (int i = 0; i < m_nRepetitions; ++i) {
+            if (benchmark.setup) {
+                benchmark.setup();
+            }
+
+            const int64_t nAllocs0 = g_nAllocs;
+            const int64_t nAllocBytes0 = g_nAllocBytes;
+            const auto tStart = std::chrono::steady_clock::now();
+
+            benchmark.run();
+
+            const auto tEnd = std::chrono::steady_clock::now();
+
+            // the allocations are deterministic except for the buffers that are reused between repetitions,
+            // so report the steady state of the last repetition
+            nAllocs = g_nAllocs - nAllocs0;
+            nAllocBytes = g_nAllocBytes - nAllocBytes0;
+
+            times.push_back(std::chrono::duration<double, std::nano>(tEnd - tStart).count()/benchmark.nOps);
+        }
+
+        std::sort(times.begin(), times.end());
+
+        result.nsPerOp     = times[times.size()/2];
+        result.nsPerOpMin  = times.front();
+        result.allocsPerOp = double(nAllocs)/benchmark.nOps;
+        result.bytesPerOp  = double(nAllocBytes)/benchmark.nOps;
+        result.peakRSS_kB  = getPeakRSS();
+
+        printf("%-36s %10lld %14.1f %14.1f %12.3f %12.1f %12lld\n",
+               result.name.c_str(), (long long) result.nOps,
+               result.nsPerOp, result.nsPerOpMin,
+               result.allocsPerOp, result.bytesPerOp,
+               (long long) result.peakRSS_kB);
+        fflush(stdout);
+
+        m_results.push_back(std::move(result));
+    }
+
+    static void printHeader() {
+        printf("%-36s %10s %14s %14s %12s %12s %12s\n", "benchmark", "ops", "ns/op", "ns/op (min)", "allocs/op", "bytes/op", "peak RSS [kB]");
+    }
+
+    bool write(const std::string & fileName, int seed) const {
+        std::string out;
+        JSONWriter json(out);
+
+        auto number = [&](double v) {
+            char buf[32];
+            snprintf(buf, sizeof(buf), "%.3f", v);
+            json.raw(buf);
+        };
+
+        json.beginObject();
+        json.key("seed");        json.value((int64_t) seed);
+        json.key("repetitions"); json.value((int64_t) m_nRepetitions);
+        json.key("benchmarks");
+        json.beginArray();
+        for (const auto & result : m_results) {
+            json.beginObject();
+            json.key("name");          json.value(result.name);
+            json.key("ops");           json.value(result.nOps);
+            json.key("ns_per_op");     number(result.nsPerOp);
+            json.key("ns_per_op_min"); number(result.nsPerOpMin);
+            json.key("allocs_per_op"); number(result.allocsPerOp);
+            json.key("bytes_per_op");  number(result.bytesPerOp);
+            json.key("peak_rss_kb");   json.value(result.peakRSS_kB);
+            json.endObject();
+        }
+        json.endArray();
+        json.endObject();
+        out += '\n';
+
+        return Utils::writeFile(fileName, out);
+    }
+
+private:
+    std::string m_filter;
+    int m_nRepetitions;
+
+    std::vector<Result> m_results;
+};
+
+std::string ipToString(TIPAddress ip) {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%u.%u.%u.%u", (ip >> 24) & 0xff, (ip >> 16) & 0xff, (ip >> 8) & 0xff, ip & 0xff);
+    return buf;
+}
+
+// the order of submissions as they would arrive at the server
+// a shadow state provides the number of active slots, so that all generated submissions are accepted
+std::vector<SubmissionInput> generateSubmissions(int seed, Gen::Submissions::Parameters parameters, bool uniformSlots) {
+    parameters.seed = seed;
+    parameters.verbose = false;
+
+    std::mt19937 rng(seed);
+
+    Gen::Submissions gen(parameters);
+    gen.setPeriod(kStartPeriodId);
+
+    State shadow;
+    shadow.init();
+    shadow.curPeriodId = kStartPeriodId;
+
+    std::vector<SubmissionInput> inputs;
+    inputs.reserve(kNumInputs);
+    while ((int) inputs.size() < kNumInputs) {
+        auto input = gen.next(shadow.slots.size());
+        if (uniformSlots) {
+            input.slotId = rng()%shadow.slots.size();
+        }
+
+        shadow.submit(input, nullptr);
+        inputs.push_back(input);
+    }
+
+    return inputs;
+}
+
+void benchSubmit(Runner & runner, int seed, const std::string & tmpDir) {
+    struct Workload {
+        const char * name;
+        Gen::Submissions::Parameters parameters;
+        bool uniformSlots;
+    };
+
+    Gen::Submissions::Parameters distinctIPs;
+    distinctIPs.avgUsersPerIP = 1.0f;
+    distinctIPs.avgSubmissionsPerUserPerPeriod = 1.0f;
+
+    Gen::Submissions::Parameters sharedIPs;
+    sharedIPs.avgUsersPerIP = 64.0f;
+
+    // carrier-grade NAT: thousands of users behind a single address
+    Gen::Submissions::Parameters cgnatIPs;
+    cgnatIPs.avgUsersPerIP = 4096.0f;
+
+    Gen::Submissions::Parameters edits;
+    edits.avgSubmissionsPerUserPerPeriod = 20.0f;
+
+    const Workload workloads[] = {
+        { "default",       {},          false },
+        { "distinct-ips",  distinctIPs, false },
+        { "shared-ips",    sharedIPs,   false },
+        { "cgnat-ips",     cgnatIPs,    false },
+        { "edits",         edits,       false },
+        { "uniform-slots", {},          true  },
+    };
+
+    for (const auto & workload : workloads) {
+        const std::string name = std::string("submit/") + workload.name;
+        if (runner.enabled(name) == false) {
+            continue;
+        }
+
+        const auto inputs = generateSubmissions(seed, workload.parameters, workload.uniformSlots);
+
+        State state;
+        runner.run({ name, (int64_t) inputs.size(),
+            [&]() {
+                state = State();
+                state.init();
+                state.curPeriodId = kStartPeriodId;
+            },
+            [&]() {
+                for (const auto & input : inputs) {
+                    state.submit(input, nullptr);
+                }
+            }
+        });
+    }
+
+    // the users at kStartPeriodId are capped by maxUsers, so all submissions fall into a single full-size period
+    Gen::Submissions::Parameters singlePeriod;
+    singlePeriod.coeffUsersScale = 1.2f;
+
+    // a whole period of submissions on a state that has already been through a period of the same size
+    if (runner.enabled("submit/next-period")) {
+        auto inputs = generateSubmissions(seed, singlePeriod, false);
+        for (auto & input : inputs) {
+            input.timestamp_s %= State::secondsInPeriod;
+        }
+
+        State state;
+        TPeriodId periodId = kStartPeriodId;
+
+        auto submitPeriod = [&]() {
+            const TTimestamp t0 = periodId*State::secondsInPeriod;
+            for (auto input : inputs) {
+                input.timestamp_s += t0;
+                state.submit(input, nullptr);
+            }
+            periodId++;
+        };
+
+        runner.run({ "submit/next-period", (int64_t) inputs.size(),
+            [&]() {
+                state = State();
+                state.init();
+                state.curPeriodId = periodId;
+                submitPeriod();
+            },
+            submitPeriod
+        });
+    }
+
+    // the first submission of a new period, after a period with all generated submissions
+    if (runner.enabled("submit/rollover")) {
+        auto inputs = generateSubmissions(seed, singlePeriod, false);
+        for (auto & input : inputs) {
+            input.timestamp_s = kStartPeriodId*State::secondsInPeriod + input.timestamp_s%State::secondsInPeriod;
+        }
+
+        auto next = inputs.front();
+        next.timestamp_s = (kStartPeriodId + 1)*State::secondsInPeriod;
+
+        State state;
+        runner.run({ "submit/rollover", 1,
+            [&]() {
+                state = State();
+                state.init();
+                state.curPeriodId = kStartPeriodId;
+                for (const auto & input : inputs) {
+                    state.submit(input, nullptr);
+                }
+            },
+            [&]() {
+                state.submit(next, nullptr);
+            }
+        });
+    }
+
+    // the first submission of a new period through the apply stage, as in the daemon: State::submit with the rotation
+    // of the submission log to the period log, which is what the rest of the batch waits for, and with the commit
+    // of the submission with the default fsync policy, which is what the submission waits for
+    for (const bool withCommit : { false, true }) {
+        const std::string name = withCommit ? "submit/rollover-commit" : "submit/rollover-log";
+        if (runner.enabled(name) == false) {
+            continue;
+        }
+
+        auto inputs = generateSubmissions(seed, singlePeriod, false);
+        for (auto & input : inputs) {
+            input.timestamp_s = kStartPeriodId*State::secondsInPeriod + input.timestamp_s%State::secondsInPeriod;
+        }
+
+        auto next = inputs.front();
+        next.timestamp_s = (kStartPeriodId + 1)*State::secondsInPeriod;
+
+        const std::string prefix = "rollover";
+
+        State state;
+        std::unique_ptr<SubmissionLog> log;
+        runner.run({ name, 1,
+            [&]() {
+                log.reset();
+                std::filesystem::remove(Storage::periodLogFileName(tmpDir, prefix, kStartPeriodId));
+                std::filesystem::remove(Storage::logFileName(tmpDir, prefix));
+
+                SubmissionLog::Parameters parameters;
+                parameters.fileName = Storage::logFileName(tmpDir, prefix);
+
+                log = std::make_unique<SubmissionLog>(parameters);
+                log->open();
+
+                state = State();
+                state.init();
+                state.curPeriodId = kStartPeriodId;
+                for (const auto & input : inputs) {
+                    state.submit(input, nullptr);
+                    log->append(input);
+                }
+                log->commit();
+            },
+            [&]() {
+                state.submit(next, [&](TPeriodId periodId) {
+                    if (log->rotate(Storage::periodLogFileName(tmpDir, prefix, periodId)) == false) {
+                        fprintf(stderr, "Failed to rotate the submission log\n");
+                    }
+                });
+                log->append(next);
+                if (withCommit) {
+                    log->commit();
+                }
+            }
+        });
+
+        log.reset();
+    }
+}
+
+void benchSlotUpdate(Runner & runner, int seed) {
+    constexpr int kNumOps = 200000;
+
+    for (int nWords : { 10, 100, 1000, 10000, 100000 }) {
+        const std::string name = "slot-update/words=" + std::to_string(nWords);
+        if (runner.enabled(name) == false) {
+            continue;
+        }
+
+        std::mt19937 rng(seed);
+
+        std::vector<TWordId> wordIds(nWords);
+        for (int i = 0; i < nWords; ++i) {
+            wordIds[i] = Dictionary::intern("word" + std::to_string(i));
+        }
+
+        // the votes follow the generated submissions: a few words get most of the votes
+        std::vector<TWordId> ops(kNumOps);
+        for (auto & wordId : ops) {
+            wordId = wordIds[std::min<int>(nWords - 1, std::abs(std::normal_distribution<float>(0.0f, 0.1f*nWords)(rng)))];
+        }
+
+        Slot slot;
+        for (int i = 0; i < nWords; ++i) {
+            slot.addVotes(wordIds[i], rng()%100000);
+        }
+
+        // each operation adds a vote to a word and refreshes the top words
+        runner.run({ name, kNumOps,
+            nullptr,
+            [&]() {
+                for (const auto wordId : ops) {
+                    slot.addVotes(wordId, 1000);
+                    slot.update(kTopWords);
+                }
+            }
+        });
+    }
+}
+
+void fillState(State & state, int nSlots, std::mt19937 & rng) {
+    std::vector<TWordId> wordIds;
+    for (int i = 0; i < 1000; ++i) {
+        wordIds.push_back(Dictionary::intern("word" + std::to_string(i)));
+    }
+
+    state.slots.resize(nSlots);
+    for (int i = 0; i < nSlots; ++i) {
+        auto & slot = state.slots[i];
+        slot.statistics.votes = rng()%1000;
+        slot.statistics.submissions = rng()%2000;
+        for (int j = 0; j < kWordsPerSlot; ++j) {
+            slot.addVotes(wordIds[rng()%wordIds.size()], rng()%100000);
+        }
+    }
+}
+
+void markDirty(State & state, int nDirty, std::mt19937 & rng) {
+    for (int i = 0; i < nDirty; ++i) {
+        const TSlotId slotId = rng()%state.slots.size();
+        auto & slot = state.slots[slotId];
+        slot.addVotes(slot.statistics.topVoted.empty() ? 0 : slot.statistics.topVoted.back().first, 1000);
+        if (slot.dirty == false) {
+            slot.dirty = true;
+            state.dirtySlots.push_back(slotId);
+        }
+    }
+}
+
+void benchOutput(Runner & runner, int seed) {
+    for (int nSlots : { 10000, 100000, 1000000 }) {
+        const std::string nameAll     = "output/slots=" + std::to_string(nSlots) + "/dirty=all";
+        const std::string namePartial = "output/slots=" + std::to_string(nSlots) + "/dirty=1%";
+        if (runner.enabled(nameAll) == false && runner.enabled(namePartial) == false) {
+            continue;
+        }
+
+        std::mt19937 rng(seed);
+
+        State state;
+        fillState(state, nSlots, rng);
+
+        // the output buffer is reused between documents, as by the publisher
+        std::string out;
+
+        // each operation is a full document
+        runner.run({ nameAll, 1,
+            [&]() {
+                for (int i = 0; i < nSlots; ++i) {
+                    if (state.slots[i].dirty == false) {
+                        state.slots[i].dirty = true;
+                        state.dirtySlots.push_back(i);
+                    }
+                }
+            },
+            [&]() {
+                state.update(kTopWords);
+                out.clear();
+                state.output(out);
+            }
+        });
+
+        state.update(kTopWords);
+
+        runner.run({ namePartial, 1,
+            [&]() {
+                markDirty(state, nSlots/100, rng);
+            },
+            [&]() {
+                state.update(kTopWords);
+                out.clear();
+                state.output(out);
+            }
+        });
+    }
+}
+
+void benchDeserialize(Runner & runner, int seed, const std::string & tmpDir) {
+    const bool enabledAll = runner.enabled("deserialize-all/period") || runner.enabled("deserialize-all/legacy");
+    const bool enabledOne = runner.enabled("deserialize-one");
+    if (enabledAll == false && enabledOne == false) {
+        return;
+    }
+
+    const auto inputs = generateSubmissions(seed, {}, false);
+
+    if (enabledAll) {
+        const std::string fileName       = tmpDir + "/period.bin";
+        const std::string fileNameLegacy = tmpDir + "/period-legacy.bin";
+
+        Storage::serialize(inputs, fileName);
+        Storage::serializeLegacy(inputs, fileNameLegacy);
+
+        // the files are read once in advance, so they are measured from the page cache
+        for (const auto & [name, file] : { std::make_pair("deserialize-all/period", fileName),
+                                           std::make_pair("deserialize-all/legacy", fileNameLegacy) }) {
+            Storage::deserializeAll(file);
+
+            // each operation is a single record
+            runner.run({ name, (int64_t) inputs.size(),
+                nullptr,
+                [&, file = file]() {
+                    if (Storage::deserializeAll(file).size() != inputs.size()) {
+                        fprintf(stderr, "Failed to read '%s'\n", file.c_str());
+                    }
+                }
+            });
+        }
+    }
+
+    if (enabledOne) {
+        std::vector<std::string> fileNames;
+        for (int i = 0; i < kNumPendingFiles; ++i) {
+            const auto & input = inputs[i];
+
+            fileNames.push_back(tmpDir + "/pending-" + std::to_string(i));
+
+            std::ofstream file(fileNames.back());
+            file << input.timestamp_s << " " << ipToString(input.ip) << " " << input.slotId << " " << input.userId << " " << Dictionary::word(input.wordId);
+        }
+
+        SubmissionInput entry;
+        runner.run({ "deserialize-one", (int64_t) fileNames.size(),
+            nullptr,
+            [&]() {
+                for (const auto & fileName : fileNames) {
+                    if (Storage::deserializeOne(fileName, entry) == false) {
+                        fprintf(stderr, "Failed to read '%s'\n", fileName.c_str());
+                    }
+                }
+            }
+        });
+    }
+}
+
+void benchConvertIP(Runner & runner, int seed) {
+    if (runner.enabled("convert-ip") == false) {
+        return;
+    }
+
+    std::mt19937 rng(seed);
+
+    std::vector<std::string> ipStrs(kNumInputs);
+    for (auto & ipStr : ipStrs) {
+        ipStr = ipToString(rng());
+    }
+
+    // the sum keeps the conversions from being optimized away
+    volatile TIPAddress sum = 0;
+    runner.run({ "convert-ip", (int64_t) ipStrs.size(),
+        nullptr,
+        [&]() {
+            for (const auto & ipStr : ipStrs) {
+                TIPAddress ip = 0;
+                convertIPAddress(ipStr, ip);
+                sum += ip;
+            }
+        }
+    });
+}
+
+void benchLexicon(Runner & runner, int seed, const std::string & tmpDir, std::string wordsFile) {
+    const char * kNames[] = { "lexicon/load", "lexicon/contains", "lexicon/socket", "lexicon/grep", "dictionary/find" };
+    if (std::none_of(std::begin(kNames), std::end(kNames), [&](const char * name) { return runner.enabled(name); })) {
+        return;
+    }
+
+    std::mt19937 rng(seed);
+
+    // random words with the length distribution of words-alpha.txt
+    if (wordsFile.empty()) {
+        wordsFile = tmpDir + "/words.txt";
+
+        std::ofstream file(wordsFile);
+        for (int i = 0; i < 370000; ++i) {
+            const int n = std::clamp((int) std::normal_distribution<float>(9.4f, 3.0f)(rng), 1, 24);
+            for (int j = 0; j < n; ++j) {
+                file << (char) ('a' + rng()%26);
+            }
+            file << '\n';
+        }
+    }
+
+    std::vector<std::string> words;
+    {
+        std::ifstream file(wordsFile);
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line.empty() == false && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (line.empty() == false) {
+                words.push_back(line);
+            }
+        }
+    }
+
+    if (words.empty()) {
+        fprintf(stderr, "No words in '%s'\n", wordsFile.c_str());
+        return;
+    }
+
+    // half of the queries are valid words, the other half are typos of valid words
+    std::vector<std::string> queries(kNumInputs);
+    for (int i = 0; i < kNumInputs; ++i) {
+        queries[i] = words[rng()%words.size()];
+        if (i % 2 == 1) {
+            queries[i][rng()%queries[i].size()] = 'a' + rng()%26;
+            queries[i] += 'q';
+        }
+    }
+
+    Lexicon lexicon;
+    runner.run({ "lexicon/load", 1,
+        nullptr,
+        [&]() {
+            lexicon.load(wordsFile);
+        }
+    });
+    lexicon.load(wordsFile);
+
+    printf("%-36s %lu words, %.1f MB\n", "", lexicon.size(), lexicon.memoryUsage()/1024.0/1024.0);
+
+    // the number of valid words keeps the lookups from being optimized away
+    volatile int nFound = 0;
+
+    runner.run({ "lexicon/contains", (int64_t) queries.size(),
+        nullptr,
+        [&]() {
+            for (const auto & query : queries) {
+                nFound += lexicon.contains(query);
+            }
+        }
+    });
+
+    if (runner.enabled("dictionary/find")) {
+        Dictionary::load(wordsFile);
+
+        runner.run({ "dictionary/find", (int64_t) queries.size(),
+            nullptr,
+            [&]() {
+                for (const auto & query : queries) {
+                    nFound += Dictionary::find(query) != kInvalidWordId;
+                }
+            }
+        });
+    }
+
+    // a connection and a round trip per validation request, as made by submit.php
+    if (runner.enabled("lexicon/socket")) {
+        constexpr int kNumRequests = 10000;
+
+        IngestServer::Parameters parameters;
+        parameters.unixSocketPath = tmpDir + "/ingest.sock";
+        parameters.lexicon = &lexicon;
+
+        IngestServer server(parameters, nullptr);
+        if (server.start() == false) {
+            fprintf(stderr, "Failed to start the ingest server\n");
+            return;
+        }
+
+        std::vector<std::string> requests(kNumRequests);
+        for (int i = 0; i < kNumRequests; ++i) {
+            const auto & query = queries[i];
+            const uint32_t size = query.size() + 1;
+            requests[i].append((const char *) &size, sizeof(size));
+            requests[i] += 'v';
+            requests[i] += query;
+        }
+
+        sockaddr_un addr {};
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, parameters.unixSocketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+        runner.run({ "lexicon/socket", kNumRequests,
+            nullptr,
+            [&]() {
+                for (const auto & request : requests) {
+                    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+                    if (fd < 0 || connect(fd, (sockaddr *) &addr, sizeof(addr)) != 0) {
+                        fprintf(stderr, "Failed to connect to '%s'\n", addr.sun_path);
+                        return;
+                    }
+
+                    char reply = 0;
+                    if (write(fd, request.data(), request.size()) != (ssize_t) request.size() || read(fd, &reply, 1) != 1) {
+                        fprintf(stderr, "Validation request failed\n");
+                    }
+                    nFound += reply == '1';
+
+                    close(fd);
+                }
+            }
+        });
+    }
+
+    // a process per validation request, as submit.php did before
+    if (runner.enabled("lexicon/grep")) {
+        constexpr int kNumRequests = 20;
+
+        std::vector<std::string> commands(kNumRequests);
+        for (int i = 0; i < kNumRequests; ++i) {
+            commands[i] = "grep -Fx '" + queries[i] + "' '" + wordsFile + "'";
+        }
+
+        runner.run({ "lexicon/grep", kNumRequests,
+            nullptr,
+            [&]() {
+                for (const auto & command : commands) {
+                    FILE * pipe = popen(command.c_str(), "r");
+                    if (pipe == nullptr) {
+                        fprintf(stderr, "Failed to run '%s'\n", command.c_str());
+                        break;
+                    }
+
+                    char buf[64];
+                    nFound += fread(buf, 1, sizeof(buf), pipe) > 0;
+                    pclose(pipe);
+                }
+            }
+        });
+    }
+}
+
+TCLIArguments parseCmdArguments(int argc, char ** argv) {
+    const std::map<std::string, CLIArgument> kArgs = {
+        { "-h",            EHelp },
+        { "--help",        EHelp },
+        { "-o",            EOutput },
+        { "--output",      EOutput },
+        { "-f",            EFilter },
+        { "--filter",      EFilter },
+        { "-s",            ESeed },
+        { "--seed",        ESeed },
+        { "-r",            ERepetitions },
+        { "--repetitions", ERepetitions },
+        { "-wf",           EWordsFile },
+        { "--words-file",  EWordsFile },
+    };
+
+    TCLIArguments res;
+    for (int i = 1; i < argc; ++i) {
+        const auto it = kArgs.find(argv[i]);
+        if (it == kArgs.end()) {
+            fprintf(stderr, "Unknown argument: %s\n", argv[i]);
+            res[EHelp] = "";
+            break;
+        }
+
+        if (it->second == EHelp) {
+            res[EHelp] = "";
+            break;
+        }
+
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Missing value for argument: %s\n", argv[i]);
+            res[EHelp] = "";
+            break;
+        }
+
+        res[it->second] = argv[++i];
+    }
+
+    return res;
+}
+
+void printHelp(const char * name) {
+    printf("Usage: %s [options]\n", name);
+    printf("Options:\n");
+    printf("  -h, --help : print help\n");
+    printf("  -o, --output : output JSON file (default: the-story-bench.json)\n");
+    printf("  -f, --filter : run only the benchmarks which name contains this string\n");
+    printf("  -s, --seed : seed of the generated workloads (default: 1234)\n");
+    printf("  -r, --repetitions : number of repetitions of each benchmark (default: 5)\n");
+    printf(" -wf, --words-file : dictionary file for the lexicon benchmarks (default: generated words)\n");
+}
+
+}
+
+int main(int argc, char ** argv) {
+    const auto args = parseCmdArguments(argc, argv);
+    if (args.count(EHelp)) {
+        printHelp(argv[0]);
+        return 0;
+    }
+
+    const std::string fileName = args.count(EOutput) ? args.at(EOutput) : "the-story-bench.json";
+    const std::string filter   = args.count(EFilter) ? args.at(EFilter) : "";
+    const int seed             = args.count(ESeed) ? std::atoi(args.at(ESeed).c_str()) : 1234;
+    const int nRepetitions     = args.count(ERepetitions) ? std::max(1, std::atoi(args.at(ERepetitions).c_str())) : 5;
+
+    const std::string tmpDir = (std::filesystem::temp_directory_path()/("the-story-bench-" + std::to_string(getpid()))).string();
+    std::filesystem::create_directories(tmpDir);
+
+    Runner runner(filter, nRepetitions);
+    Runner::printHeader();
+
+    benchSubmit(runner, seed, tmpDir);
+    benchSlotUpdate(runner, seed);
+    benchOutput(runner, seed);
+    benchDeserialize(runner, seed, tmpDir);
+    benchConvertIP(runner, seed);
+    benchLexicon(runner, seed, tmpDir, args.count(EWordsFile) ? args.at(EWordsFile) : "");
+
+    std::filesystem::remove_all(tmpDir);
+
+    if (runner.write(fileName, seed) == false) {
+        fprintf(stderr, "Failed to write '%s'\n", fileName.c_str());
+        return 1;
+    }
+
+    printf("Results written to '%s'\n", fileName.c_str());
+
+    return 0;
+}
@@ -0,0 +1,136 @@
+#include "dictionary.h"
+
+#include "flat_map.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+
+namespace {
+
+struct StringHash {
+    uint64_t operator()(std::string_view s) const {
+        // FNV-1a
+        uint64_t h = 0xcbf29ce484222325ull;
+        for (auto c : s) {
+            h ^= (uint8_t) c;
+            h *= 0x100000001b3ull;
+        }
+        return h;
+    }
+};
+
+struct Data {
+    static constexpr size_t kChunkSize = 64*1024;
+
+    std::shared_mutex mutex;
+
+    // word characters are stored in fixed-size chunks that are never reallocated
+    std::vector<std::unique_ptr<char[]>> chunks;
+    size_t chunkUsed = kChunkSize;
+
+    std::vector<std::string_view> words;
+    FlatMap<std::string_view, TWordId, StringHash> ids;
+
+    TWordId add(std::string_view word) {
+        if (chunkUsed + word.size() > kChunkSize) {
+            chunks.emplace_back(new char[std::max(kChunkSize, word.size())]);
+            chunkUsed = 0;
+        }
+
+        char * dst = chunks.back().get() + chunkUsed;
+        memcpy(dst, word.data(), word.size());
+        chunkUsed += word.size();
+
+        const TWordId id = (TWordId) words.size();
+        words.emplace_back(dst, word.size());
+        ids.insert(words.back(), id);
+
+        return id;
+    }
+};
+
+Data & data() {
+    static Data result;
+    return result;
+}
+
+}
+
+namespace Dictionary {
+
+int64_t load(const std::string & fileName) {
+    std::ifstream file(fileName);
+    if (file.is_open() == false) {
+        return -1;
+    }
+
+    auto & d = data();
+    std::unique_lock lock(d.mutex);
+
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() == false && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.empty() || d.ids.find(line)) {
+            continue;
+        }
+        d.add(line);
+    }
+
+    return d.words.size();
+}
+
+TWordId intern(std::string_view word) {
+    auto & d = data();
+
+    {
+        std::shared_lock lock(d.mutex);
+        if (auto id = d.ids.find(word)) {
+            return *id;
+        }
+    }
+
+    std::unique_lock lock(d.mutex);
+    if (auto id = d.ids.find(word)) {
+        return *id;
+    }
+
+    return d.add(word);
+}
+
+TWordId find(std::string_view word) {
+    auto & d = data();
+    std::shared_lock lock(d.mutex);
+
+    if (auto id = d.ids.find(word)) {
+        return *id;
+    }
+
+    return kInvalidWordId;
+}
+
+std::string_view word(TWordId id) {
+    auto & d = data();
+    std::shared_lock lock(d.mutex);
+
+    if (id >= d.words.size()) {
+        return {};
+    }
+
+    return d.words[id];
+}
+
+size_t size() {
+    auto & d = data();
+    std::shared_lock lock(d.mutex);
+
+    return d.words.size();
+}
+
+}
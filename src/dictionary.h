@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+using TWordId = uint32_t;
+
+constexpr TWordId kInvalidWordId = UINT32_MAX;
+
+// global word interning table
+// - maps each distinct word to a dense 32-bit id
+// - ids are never reused and the word strings are never moved, so a
+//   string_view returned by word() stays valid for the lifetime of the process
+// - safe to use from multiple threads
+namespace Dictionary {
+
+// preload the words from a text file with one word per line
+// returns the number of words in the dictionary after loading or -1 on error
+int64_t load(const std::string & fileName);
+
+// get the id of the word, adding it to the dictionary if needed
+TWordId intern(std::string_view word);
+
+// get the id of the word or kInvalidWordId if it is not in the dictionary
+TWordId find(std::string_view word);
+
+// get the word for the given id
+std::string_view word(TWordId id);
+
+// total number of words in the dictionary
+size_t size();
+
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <utility>
+
+// 64-bit integer hash (splitmix64 finalizer)
+inline uint64_t hash64(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return x;
+}
+
+template <typename TKey>
+struct FlatHash {
+    uint64_t operator()(const TKey & key) const { return hash64((uint64_t) key); }
+};
+
+// open-addressing hash map with linear probing
+// - keys and values are stored inline in a single contiguous array
+// - single elements cannot be erased, the map can only be cleared as a whole
+// - clearing takes constant time: each entry is tagged with the generation it was inserted in,
+//   and entries of older generations count as empty
+// - pointers to values are invalidated when the map grows
+template <typename TKey, typename TValue, typename THash = FlatHash<TKey>>
+class FlatMap {
+public:
+    size_t size() const { return m_size; }
+    size_t capacity() const { return m_entries.size(); }
+    size_t memoryUsage() const { return m_entries.capacity()*sizeof(Entry); }
+    bool empty() const { return m_size == 0; }
+
+    TValue * find(const TKey & key) {
+        if (m_size == 0) {
+            return nullptr;
+        }
+
+        const size_t mask = m_entries.size() - 1;
+        for (size_t i = THash()(key) & mask; ; i = (i + 1) & mask) {
+            auto & entry = m_entries[i];
+            if (entry.generation != m_generation) {
+                return nullptr;
+            }
+            if (entry.key == key) {
+                return &entry.value;
+            }
+        }
+    }
+
+    const TValue * find(const TKey & key) const {
+        return const_cast<FlatMap *>(this)->find(key);
+    }
+
+    // insert the value if the key is not present
+    // returns the value stored for the key and whether it was inserted
+    std::pair<TValue *, bool> insert(const TKey & key, const TValue & value = TValue()) {
+        if (4*(m_size + 1) > 3*m_entries.size()) {
+            // the capacity depends only on the number of keys, not on how often existing keys are looked up
+            if (auto * existing = find(key)) {
+                return { existing, false };
+            }
+            rehash(m_entries.empty() ? 16 : 2*m_entries.size());
+        }
+
+        const size_t mask = m_entries.size() - 1;
+        for (size_t i = THash()(key) & mask; ; i = (i + 1) & mask) {
+            auto & entry = m_entries[i];
+            if (entry.generation != m_generation) {
+                entry.generation = m_generation;
+                entry.key = key;
+                entry.value = value;
+                ++m_size;
+                return { &entry.value, true };
+            }
+            if (entry.key == key) {
+                return { &entry.value, false };
+            }
+        }
+    }
+
+    // remove all elements, keeping the allocated memory
+    void clear() {
+        if (m_size == 0) {
+            return;
+        }
+        m_size = 0;
+
+        // the entries have to be reset only when the generation wraps around
+        if (++m_generation == 0) {
+            for (auto & entry : m_entries) {
+                entry.generation = 0;
+            }
+            m_generation = 1;
+        }
+    }
+
+    void reserve(size_t n) {
+        size_t cap = 16;
+        while (3*cap < 4*n) {
+            cap *= 2;
+        }
+        if (cap > m_entries.size()) {
+            rehash(cap);
+        }
+    }
+
+    template <typename F>
+    void forEach(F && f) const {
+        for (const auto & entry : m_entries) {
+            if (entry.generation == m_generation) {
+                f(entry.key, entry.value);
+            }
+        }
+    }
+
+private:
+    struct Entry {
+        uint32_t generation = 0;
+        TKey key;
+        TValue value;
+    };
+
+    void rehash(size_t cap) {
+        std::vector<Entry> old(cap);
+        old.swap(m_entries);
+
+        const size_t mask = m_entries.size() - 1;
+        for (auto & entry : old) {
+            if (entry.generation != m_generation) {
+                continue;
+            }
+            size_t i = THash()(entry.key) & mask;
+            while (m_entries[i].generation == m_generation) {
+                i = (i + 1) & mask;
+            }
+            m_entries[i] = std::move(entry);
+        }
+    }
+
+    size_t m_size = 0;
+    uint32_t m_generation = 1;
+    std::vector<Entry> m_entries;
+};
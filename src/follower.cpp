@@ -0,0 +1,325 @@
+#include "follower.h"
+
+#include "replay.h"
+#include "storage.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <limits>
+#include <map>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace {
+
+// the period files and period logs in the data folder, by period
+struct StoredPeriod {
+    std::string periodFile;
+    std::string periodLog;
+};
+
+std::map<TPeriodId, StoredPeriod> getStoredPeriods(const std::string & dataFolder, const std::string & prefix) {
+    std::map<TPeriodId, StoredPeriod> result;
+
+    std::error_code ec;
+    for (const auto & entry : std::filesystem::directory_iterator(dataFolder, ec)) {
+        const std::string name = entry.path().filename().string();
+
+        // "<prefix>-<periodId>.bin" or "<prefix>-<periodId>.wal"
+        const TPeriodId periodId = Storage::periodIdFromFileName(name);
+        if (periodId < 0 || name.size() < prefix.size() + 6 || name.compare(0, prefix.size() + 1, prefix + "-") != 0 ||
+            name.find('-', prefix.size() + 1) != std::string::npos) {
+            continue;
+        }
+
+        const std::string extension = entry.path().extension().string();
+        if (extension == ".bin") {
+            result[periodId].periodFile = entry.path().string();
+        } else if (extension == ".wal") {
+            result[periodId].periodLog = entry.path().string();
+        }
+    }
+
+    return result;
+}
+
+// bytes before the read position of the log that are compared by the next poll
+constexpr size_t kLogTailSize = 64;
+
+int64_t msSince(const struct timespec & t) {
+    const auto tNow = std::chrono::system_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(tNow).count() - (1000ll*t.tv_sec + t.tv_nsec/1000000);
+}
+
+}
+
+struct LogFollower::Impl {
+    Parameters parameters;
+    Statistics statistics;
+
+    std::string logFileName;
+
+    // position in the history
+    TPeriodId periodId = -1;
+    int64_t nPeriodRecords = 0;
+
+    // the log that is being read, records of the current period to skip in it and the end of the records read so far
+    ino_t logInode = 0;
+    int64_t logSkip = 0;
+    uint64_t logOffset = 0;
+
+    // size of the log and the bytes before logOffset as of the last read, they change if the log is reset in place
+    off_t logSize = 0;
+    std::string logTail;
+
+    // the period file or period log that was read last, so that it is read again only if it has grown
+    struct StoredPosition {
+        std::string fileName;
+        ino_t inode = 0;
+        off_t size = 0;
+        uint64_t offset = 0;  // end of the records read so far, period logs only
+        int64_t nRecords = 0; // records of its period read so far
+    };
+
+    StoredPosition storedPosition;
+
+    std::vector<SubmissionInput> entries;
+
+    // true if the log is the one that was read, with the records read so far still in place
+    // a daemon that stores the period without rotating the log truncates it, which keeps the inode
+    bool isSameLog(int fd, const struct stat & st) const {
+        if (st.st_ino != logInode || st.st_size < logSize) {
+            return false;
+        }
+
+        // it might have grown past the previous size again since it was truncated
+        std::string tail(logTail.size(), '\0');
+        return ::pread(fd, tail.data(), tail.size(), logOffset - tail.size()) == (ssize_t) tail.size() && tail == logTail;
+    }
+
+    void readLogTail(int fd) {
+        logTail.resize(std::min<uint64_t>(logOffset, kLogTailSize));
+        if (::pread(fd, logTail.data(), logTail.size(), logOffset - logTail.size()) != (ssize_t) logTail.size()) {
+            // the next poll reads the log from the start
+            logInode = 0;
+        }
+    }
+
+    // apply the record unless it is already applied, skip counts the records of the current period
+    // that are still to be skipped in the file that is being read
+    bool offer(const SubmissionInput & entry, int64_t & skip, const CBOnRecord & onRecord) {
+        const TPeriodId entryPeriodId = entry.timestamp_s/State::secondsInPeriod;
+        if (entryPeriodId < periodId) {
+            return false;
+        }
+
+        if (entryPeriodId == periodId && skip > 0) {
+            skip--;
+            return false;
+        }
+
+        if (entryPeriodId > periodId) {
+            periodId = entryPeriodId;
+            nPeriodRecords = 0;
+            skip = 0;
+        }
+
+        nPeriodRecords++;
+        onRecord(entry);
+
+        return true;
+    }
+
+    // the records of the periods that have ended since the log was read, they are in the period logs
+    // until the period files are written
+    int64_t pollStored(const CBOnRecord & onRecord, int64_t & lastWriteAge_ms) {
+        int64_t result = 0;
+
+        for (const auto & [storedPeriodId, stored] : getStoredPeriods(parameters.dataFolder, parameters.prefix)) {
+            if (storedPeriodId < periodId) {
+                continue;
+            }
+
+            // a period file is complete once it exists, it replaces the period log
+            const bool isPeriodFile = stored.periodFile.empty() == false;
+            const std::string & fileName = isPeriodFile ? stored.periodFile : stored.periodLog;
+
+            const int fd = ::open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                // written to the period file in the meantime, read by the next poll
+                continue;
+            }
+
+            struct stat st;
+            if (::fstat(fd, &st) != 0) {
+                ::close(fd);
+                continue;
+            }
+
+            // continue after the records that were read before, if it is the same file and it has not been truncated
+            auto & position = storedPosition;
+            if (position.fileName != fileName || position.inode != st.st_ino || position.size > st.st_size) {
+                position = { fileName, st.st_ino, 0, 0, 0 };
+            } else if (isPeriodFile || position.size == st.st_size) {
+                ::close(fd);
+                continue;
+            }
+
+            entries.clear();
+            if (isPeriodFile) {
+                entries = Storage::deserializeAll(fileName);
+            } else if (SubmissionLog::readFrom(fd, position.offset, entries) == false) {
+                fprintf(stderr, "LogFollower: invalid period log '%s'\n", fileName.c_str());
+            }
+            ::close(fd);
+
+            // the records of the period that were read before are applied or skipped already
+            int64_t skip = storedPeriodId == periodId ? std::max<int64_t>(0, nPeriodRecords - position.nRecords) : 0;
+            int64_t nApplied = 0;
+            for (const auto & entry : entries) {
+                nApplied += offer(entry, skip, onRecord);
+                position.nRecords += (TPeriodId) (entry.timestamp_s/State::secondsInPeriod) == storedPeriodId;
+            }
+
+            position.size = st.st_size;
+
+            if (nApplied > 0) {
+                lastWriteAge_ms = std::min(lastWriteAge_ms, msSince(st.st_mtim));
+            }
+
+            result += nApplied;
+        }
+
+        return result;
+    }
+};
+
+LogFollower::LogFollower(Parameters parameters) : m_impl(new Impl()) {
+    m_impl->parameters = std::move(parameters);
+    m_impl->logFileName = Storage::logFileName(m_impl->parameters.dataFolder, m_impl->parameters.prefix);
+}
+
+LogFollower::~LogFollower() = default;
+
+TPeriodId LogFollower::restore(State & state, int nThreads, const State::CBOnNewPeriodStart & onNewPeriodStart) {
+    const auto tStart = std::chrono::steady_clock::now();
+
+    const auto & dataFolder = m_impl->parameters.dataFolder;
+    const auto & prefix = m_impl->parameters.prefix;
+
+    TPeriodId lastStoredPeriodId = -1;
+
+    {
+        const auto snapshotFileName = Storage::snapshotFileName(dataFolder, prefix);
+
+        Storage::SnapshotInfo info;
+        if (Storage::loadSnapshot(state, info, snapshotFileName)) {
+            lastStoredPeriodId = info.lastStoredPeriodId;
+            m_impl->periodId = state.curPeriodId;
+            m_impl->nPeriodRecords = info.nCurPeriodRecords;
+
+            printf("Loaded snapshot '%s', last stored period id: %d, records of period %d: %ld\n",
+                   snapshotFileName.c_str(), lastStoredPeriodId, m_impl->periodId, m_impl->nPeriodRecords);
+        }
+    }
+
+    // the period logs and the log are read by poll()
+    std::vector<Replay::File> files;
+    for (const auto & [periodId, stored] : getStoredPeriods(dataFolder, prefix)) {
+        if (periodId <= lastStoredPeriodId || periodId < m_impl->periodId || stored.periodFile.empty()) {
+            continue;
+        }
+
+        files.push_back({ stored.periodFile, periodId == m_impl->periodId ? (uint64_t) m_impl->nPeriodRecords : 0 });
+    }
+
+    const auto statistics = Replay::apply(state, files, nThreads, onNewPeriodStart);
+
+    // the last file continues the position, unless it could not be read
+    if (statistics.nFiles > 0) {
+        m_impl->periodId = Storage::periodIdFromFileName(statistics.lastFileName);
+        m_impl->nPeriodRecords = statistics.nLastFileRecords;
+    }
+
+    const auto tEnd = std::chrono::steady_clock::now();
+    printf("Restored the state from '%s' in %.3f s, %ld records from %d period files\n",
+           dataFolder.c_str(), std::chrono::duration<double>(tEnd - tStart).count(), statistics.nRecords, statistics.nFiles);
+
+    return m_impl->periodId;
+}
+
+int64_t LogFollower::poll(const CBOnRecord & onRecord) {
+    auto & impl = *m_impl;
+
+    int64_t result = 0;
+
+    // age of the newest write that contained new records
+    int64_t lastWriteAge_ms = std::numeric_limits<int64_t>::max();
+
+    // the descriptor keeps the file that was checked, even if the log is rotated meanwhile
+    const int fd = ::open(impl.logFileName.c_str(), O_RDONLY | O_CLOEXEC);
+
+    struct stat st;
+    const bool hasLog = fd >= 0 && ::fstat(fd, &st) == 0;
+
+    // a new log: the rest of the records of the current period are in its period log or period file now
+    if (hasLog == false || impl.isSameLog(fd, st) == false) {
+        result += impl.pollStored(onRecord, lastWriteAge_ms);
+
+        impl.logInode = hasLog ? st.st_ino : 0;
+        impl.logOffset = 0;
+        impl.logSize = 0;
+        impl.logTail.clear();
+        impl.logSkip = impl.nPeriodRecords;
+    }
+
+    if (hasLog) {
+        const uint64_t offset = impl.logOffset;
+
+        impl.entries.clear();
+        if (SubmissionLog::readFrom(fd, impl.logOffset, impl.entries) == false) {
+            fprintf(stderr, "LogFollower: invalid submission log '%s'\n", impl.logFileName.c_str());
+        }
+
+        impl.logSize = st.st_size;
+        if (impl.logOffset != offset) {
+            impl.readLogTail(fd);
+        }
+
+        // a later period: the rest of the current one is stored by now, even if the log was reset in place
+        // before the poll could see it. the records that were read might be stored in the meantime as well
+        if (impl.entries.empty() == false && (TPeriodId) (impl.entries.front().timestamp_s/State::secondsInPeriod) > impl.periodId) {
+            result += impl.pollStored(onRecord, lastWriteAge_ms);
+            impl.logSkip = impl.nPeriodRecords;
+        }
+
+        int64_t nApplied = 0;
+        for (const auto & entry : impl.entries) {
+            nApplied += impl.offer(entry, impl.logSkip, onRecord);
+        }
+
+        if (nApplied > 0) {
+            lastWriteAge_ms = std::min(lastWriteAge_ms, msSince(st.st_mtim));
+        }
+
+        result += nApplied;
+    }
+
+    if (fd >= 0) {
+        ::close(fd);
+    }
+
+    impl.statistics.nRecords += result;
+    impl.statistics.lagRecords = result;
+    impl.statistics.lag_ms = result > 0 ? std::max<int64_t>(0, lastWriteAge_ms) : 0;
+
+    return result;
+}
+
+const LogFollower::Statistics & LogFollower::statistics() const {
+    return m_impl->statistics;
+}
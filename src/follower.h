@@ -0,0 +1,51 @@
+#pragma once
+
+#include "types.h"
+
+#include <functional>
+#include <memory>
+#include <string>
+
+// follows the submission history that another daemon writes to its data folder, see storage.h
+// - restore() rebuilds the state from the snapshot and the period files, like the daemon does on startup
+// - poll() applies the records added since then: from the period logs and period files of the periods that have ended,
+//   and from the log of the current period as it grows
+// - the position in the history is the current period and the number of its records that have been applied, so each
+//   record is applied once, whether it is read from the log, from the period log or from the period file
+// - never writes to the data folder, a record at the end of the log that is not complete yet is read by the next poll
+class LogFollower {
+public:
+    struct Parameters {
+        std::string dataFolder;
+        std::string prefix;
+    };
+
+    struct Statistics {
+        int64_t nRecords = 0; // applied by poll()
+
+        // records that had been written but not applied when the last poll started
+        int64_t lagRecords = 0;
+
+        // time from the last write that the last poll found to applying it, 0 if it found no new records
+        int64_t lag_ms = 0;
+    };
+
+    using CBOnRecord = std::function<void(const SubmissionInput & entry)>;
+
+    LogFollower(Parameters parameters);
+    ~LogFollower();
+
+    // restore the state from the snapshot and the period files, replaying the files on up to nThreads threads
+    // returns the id of the last period
+    TPeriodId restore(State & state, int nThreads, const State::CBOnNewPeriodStart & onNewPeriodStart);
+
+    // call onRecord for each record added to the history since the last call, in order
+    // returns the number of records
+    int64_t poll(const CBOnRecord & onRecord);
+
+    const Statistics & statistics() const;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> m_impl;
+};
@@ -0,0 +1,466 @@
+// the-story-gen : generates realistic submission workloads for load testing
+//
+// the submissions come from Gen::Submissions, so the same seed and parameters always produce the same records
+// a shadow State provides the number of active slots, so that all generated submissions would be accepted
+//
+// the records are written in one of the following forms:
+// - period files : with -df and -p, one period file per period, as written by the-story
+// - pending files: with -pf, one file per submission, as written by submit.php
+// - text         : otherwise, "<timestamp> <ip> <slotId> <userId> <word>" lines to stdout, as read by the-story-send
+//
+// the files are written by -j writer threads, while the main thread generates the next records
+//
+// command line arguments:
+//    -h, --help : print help
+//    -n, --num-submissions : number of submissions to generate (default: 1000000)
+//    -s, --seed : seed of the workload (default: 1234)
+//   -sp, --start-period : period of the first submission (default: the current period)
+//   -df, --data-folder : folder for the period files
+//    -p, --prefix : prefix of the period files
+//   -pf, --pending-folder : folder for the pending files
+//   -wf, --words-file : words with one word per line, e.g. words-alpha.txt (default: a small built-in list)
+//    -z, --zipf-exponent : popularity of the k-th most popular word is proportional to 1/k^z (default: 1.0)
+//   -mu, --max-users : maximum number of users (default: 1048576)
+//  -ipu, --users-per-ip : average number of users per household IP (default: 4)
+//  -nat, --nat-fraction : fraction of the users behind carrier-grade NATs (default: 0)
+//   -ns, --nat-size : users per carrier-grade NAT (default: 4096)
+//  -spu, --submissions-per-user : average submissions per user per period (default: 5)
+//    -e, --edit-ratio : probability that a user edits its previous submission of the period (default: 0.2)
+//    -r, --revote-ratio : probability that a user repeats its previous submission of the period (default: 0.05)
+//   -sd, --slot-decay : fraction of the new votes for the newest slot, less by the same factor for each older slot (default: 0.3)
+//    -j, --threads : number of writer threads (default: 4)
+
+#include "types.h"
+#include "dictionary.h"
+#include "generator.h"
+#include "storage.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <ctime>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+enum CLIArgument {
+    EHelp,
+    ENumSubmissions,
+    ESeed,
+    EStartPeriod,
+    EDataFolder,
+    EPrefix,
+    EPendingFolder,
+    EWordsFile,
+    EZipfExponent,
+    EMaxUsers,
+    EUsersPerIP,
+    ENATFraction,
+    ENATSize,
+    ESubmissionsPerUser,
+    EEditRatio,
+    ERevoteRatio,
+    ESlotDecay,
+    EThreads,
+};
+
+using TCLIArguments = std::map<CLIArgument, std::string>;
+
+// pending files are handed to the writers in batches of this size
+constexpr int kPendingBatchSize = 4096;
+
+// jobs that have not been taken by a writer yet, per writer
+// bounds the memory when the writers cannot keep up with the generator
+constexpr size_t kMaxQueuedJobsPerThread = 2;
+
+// runs the jobs on a fixed number of threads, in no particular order
+class Writers {
+public:
+    using Job = std::function<bool()>;
+
+    Writers(int nThreads) {
+        for (int i = 0; i < nThreads; ++i) {
+            m_threads.emplace_back([this]() { worker(); });
+        }
+    }
+
+    ~Writers() {
+        finish();
+    }
+
+    // blocks while the queue is full
+    void push(Job && job) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cvSpace.wait(lock, [this]() { return m_jobs.size() < kMaxQueuedJobsPerThread*m_threads.size(); });
+        m_jobs.push_back(std::move(job));
+        m_cvJobs.notify_one();
+    }
+
+    // waits for all jobs, returns the number of failed jobs
+    int finish() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_done = true;
+        }
+        m_cvJobs.notify_all();
+
+        for (auto & thread : m_threads) {
+            thread.join();
+        }
+        m_threads.clear();
+
+        return m_nFailed;
+    }
+
+private:
+    void worker() {
+        while (true) {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cvJobs.wait(lock, [this]() { return m_done || m_jobs.empty() == false; });
+                if (m_jobs.empty()) {
+                    return;
+                }
+
+                job = std::move(m_jobs.front());
+                m_jobs.pop_front();
+            }
+            m_cvSpace.notify_one();
+
+            if (job() == false) {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_nFailed++;
+            }
+        }
+    }
+
+    std::mutex m_mutex;
+    std::condition_variable m_cvJobs;
+    std::condition_variable m_cvSpace;
+    std::deque<Job> m_jobs;
+    std::vector<std::thread> m_threads;
+    bool m_done = false;
+    int m_nFailed = 0;
+};
+
+// the text record, as parsed by SubmissionInput::parse(std::string_view)
+void appendText(std::string & out, const SubmissionInput & input) {
+    const auto word = Dictionary::word(input.wordId);
+
+    char buf[64];
+    const int n = snprintf(buf, sizeof(buf), "%u %u.%u.%u.%u %d %d ",
+                           input.timestamp_s,
+                           (input.ip >> 24) & 0xff, (input.ip >> 16) & 0xff, (input.ip >> 8) & 0xff, input.ip & 0xff,
+                           input.slotId, input.userId);
+    out.append(buf, n);
+    out.append(word.data(), word.size());
+}
+
+// makes the batches of pending files visible in the order in which they were generated
+// the daemon processes the pending files sorted by name, so a later file must not appear before an earlier one
+struct PendingOrder {
+    std::mutex mutex;
+    std::condition_variable cv;
+    int64_t nextBatch = 0;
+};
+
+// write each submission as a pending file: written as t<name> and renamed to s<name>, like submit.php
+// - the files are named "<seed>-<index>" with a zero padded index, so that the names sort in generation order
+// - the files of a batch are written in parallel with the other batches, only the renames wait for the previous batch
+bool writePendingFiles(const std::string & pendingFolder, const std::vector<SubmissionInput> & inputs,
+                       uint64_t seed, int64_t firstId, int64_t batchId, PendingOrder & order) {
+    bool ok = true;
+
+    std::vector<std::string> names;
+    names.reserve(inputs.size());
+
+    std::string text;
+    for (size_t i = 0; i < inputs.size() && ok; ++i) {
+        text.clear();
+        appendText(text, inputs[i]);
+
+        char name[64];
+        snprintf(name, sizeof(name), "%llu-%012lld", (unsigned long long) seed, (long long) (firstId + i));
+        names.push_back(name);
+
+        const std::string tmpName = pendingFolder + "/t" + name;
+
+        FILE * file = fopen(tmpName.c_str(), "wb");
+        ok = file != nullptr && fwrite(text.data(), 1, text.size(), file) == text.size();
+        if ((file && fclose(file) != 0) || ok == false) {
+            fprintf(stderr, "Failed to write '%s'\n", tmpName.c_str());
+            ok = false;
+        }
+    }
+
+    std::unique_lock<std::mutex> lock(order.mutex);
+    order.cv.wait(lock, [&]() { return order.nextBatch == batchId; });
+
+    for (size_t i = 0; i < names.size() && ok; ++i) {
+        const std::string tmpName = pendingFolder + "/t" + names[i];
+        if (std::rename(tmpName.c_str(), (pendingFolder + "/s" + names[i]).c_str()) != 0) {
+            fprintf(stderr, "Failed to rename '%s'\n", tmpName.c_str());
+            ok = false;
+        }
+    }
+
+    // the next batch goes ahead even if this one failed, the error is reported by the return value
+    order.nextBatch++;
+    order.cv.notify_all();
+
+    return ok;
+}
+
+}
+
+TCLIArguments parseCmdArguments(int argc, char ** argv) {
+    const std::map<std::string, CLIArgument> kArgs = {
+        { "-h",                     EHelp },
+        { "--help",                 EHelp },
+        { "-n",                     ENumSubmissions },
+        { "--num-submissions",      ENumSubmissions },
+        { "-s",                     ESeed },
+        { "--seed",                 ESeed },
+        { "-sp",                    EStartPeriod },
+        { "--start-period",         EStartPeriod },
+        { "-df",                    EDataFolder },
+        { "--data-folder",          EDataFolder },
+        { "-p",                     EPrefix },
+        { "--prefix",               EPrefix },
+        { "-pf",                    EPendingFolder },
+        { "--pending-folder",       EPendingFolder },
+        { "-wf",                    EWordsFile },
+        { "--words-file",           EWordsFile },
+        { "-z",                     EZipfExponent },
+        { "--zipf-exponent",        EZipfExponent },
+        { "-mu",                    EMaxUsers },
+        { "--max-users",            EMaxUsers },
+        { "-ipu",                   EUsersPerIP },
+        { "--users-per-ip",         EUsersPerIP },
+        { "-nat",                   ENATFraction },
+        { "--nat-fraction",         ENATFraction },
+        { "-ns",                    ENATSize },
+        { "--nat-size",             ENATSize },
+        { "-spu",                   ESubmissionsPerUser },
+        { "--submissions-per-user", ESubmissionsPerUser },
+        { "-e",                     EEditRatio },
+        { "--edit-ratio",           EEditRatio },
+        { "-r",                     ERevoteRatio },
+        { "--revote-ratio",         ERevoteRatio },
+        { "-sd",                    ESlotDecay },
+        { "--slot-decay",           ESlotDecay },
+        { "-j",                     EThreads },
+        { "--threads",              EThreads },
+    };
+
+    TCLIArguments res;
+    for (int i = 1; i < argc; ++i) {
+        const auto it = kArgs.find(argv[i]);
+        if (it == kArgs.end()) {
+            fprintf(stderr, "Unknown argument: %s\n", argv[i]);
+            res[EHelp] = "";
+            break;
+        }
+
+        if (it->second == EHelp) {
+            res[EHelp] = "";
+            break;
+        }
+
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Missing value for argument: %s\n", argv[i]);
+            res[EHelp] = "";
+            break;
+        }
+
+        res[it->second] = argv[++i];
+    }
+
+    return res;
+}
+
+void printHelp(const char * name) {
+    printf("Usage: %s [options]\n", name);
+    printf("Options:\n");
+    printf("    -h, --help : print help\n");
+    printf("    -n, --num-submissions : number of submissions to generate (default: 1000000)\n");
+    printf("    -s, --seed : seed of the workload (default: 1234)\n");
+    printf("   -sp, --start-period : period of the first submission (default: the current period)\n");
+    printf("   -df, --data-folder : folder for the period files\n");
+    printf("    -p, --prefix : prefix of the period files\n");
+    printf("   -pf, --pending-folder : folder for the pending files\n");
+    printf("   -wf, --words-file : words with one word per line, e.g. words-alpha.txt (default: a small built-in list)\n");
+    printf("    -z, --zipf-exponent : popularity of the k-th most popular word is proportional to 1/k^z (default: 1.0)\n");
+    printf("   -mu, --max-users : maximum number of users (default: 1048576)\n");
+    printf("  -ipu, --users-per-ip : average number of users per household IP (default: 4)\n");
+    printf("  -nat, --nat-fraction : fraction of the users behind carrier-grade NATs (default: 0)\n");
+    printf("   -ns, --nat-size : users per carrier-grade NAT (default: 4096)\n");
+    printf("  -spu, --submissions-per-user : average submissions per user per period (default: 5)\n");
+    printf("    -e, --edit-ratio : probability that a user edits its previous submission of the period (default: 0.2)\n");
+    printf("    -r, --revote-ratio : probability that a user repeats its previous submission of the period (default: 0.05)\n");
+    printf("   -sd, --slot-decay : fraction of the new votes for the newest slot, less by the same factor for each older slot (default: 0.3)\n");
+    printf("    -j, --threads : number of writer threads (default: 4)\n");
+    printf("\n");
+    printf("Without -df/-p or -pf, the submissions are printed to stdout\n");
+    printf("\n");
+    printf("Example:\n");
+    printf("  %s -n 10000000 -s 42 -df ./data -p the-story -wf words-alpha.txt -nat 0.1\n", name);
+}
+
+int main(int argc, char ** argv) {
+    const auto args = parseCmdArguments(argc, argv);
+    if (args.count(EHelp)) {
+        printHelp(argv[0]);
+        return 0;
+    }
+
+    const auto get = [&](CLIArgument arg, const char * def) {
+        return args.count(arg) ? args.at(arg) : std::string(def);
+    };
+
+    const bool toPeriodFiles  = args.count(EDataFolder) && args.count(EPrefix);
+    const bool toPendingFiles = args.count(EPendingFolder);
+
+    if (toPeriodFiles && toPendingFiles) {
+        fprintf(stderr, "Specify either the period files (-df, -p) or the pending folder (-pf)\n");
+        return 1;
+    }
+
+    // with text output, the progress goes to stderr so that it does not mix with the records
+    FILE * log = toPeriodFiles || toPendingFiles ? stdout : stderr;
+
+    const int64_t nSubmissions = std::stoll(get(ENumSubmissions, "1000000"));
+    const int nThreads = std::max(1, std::stoi(get(EThreads, "4")));
+
+    Gen::Submissions::Parameters parameters;
+    parameters.seed                           = std::stoull(get(ESeed, "1234"));
+    parameters.maxUsers                       = std::stoi(get(EMaxUsers, "1048576"));
+    parameters.avgUsersPerIP                  = std::stof(get(EUsersPerIP, "4"));
+    parameters.natFraction                    = std::stof(get(ENATFraction, "0"));
+    parameters.natSize                        = std::stoi(get(ENATSize, "4096"));
+    parameters.avgSubmissionsPerUserPerPeriod = std::stof(get(ESubmissionsPerUser, "5"));
+    parameters.editRatio                      = std::stof(get(EEditRatio, "0.2"));
+    parameters.revoteRatio                    = std::stof(get(ERevoteRatio, "0.05"));
+    parameters.slotDecay                      = std::stof(get(ESlotDecay, "0.3"));
+    parameters.verbose                        = false;
+
+    if (args.count(EWordsFile)) {
+        auto words = std::make_shared<Gen::Words>();
+        if (words->load(args.at(EWordsFile), std::stof(get(EZipfExponent, "1.0")), parameters.seed) == false) {
+            fprintf(stderr, "Failed to load words from '%s'\n", args.at(EWordsFile).c_str());
+            return 1;
+        }
+        fprintf(log, "Loaded %d words from '%s'\n", (int) words->size(), args.at(EWordsFile).c_str());
+
+        parameters.words = std::move(words);
+    }
+
+    const TPeriodId startPeriodId = args.count(EStartPeriod) ?
+        std::stoi(args.at(EStartPeriod)) : (TPeriodId) (time(nullptr)/State::secondsInPeriod);
+
+    const std::string dataFolder    = get(EDataFolder, "");
+    const std::string prefix        = get(EPrefix, "");
+    const std::string pendingFolder = get(EPendingFolder, "");
+
+    if (toPeriodFiles) {
+        std::filesystem::create_directories(dataFolder);
+    }
+    if (toPendingFiles) {
+        std::filesystem::create_directories(pendingFolder);
+    }
+
+    Gen::Submissions gen(parameters);
+    gen.setPeriod(startPeriodId);
+
+    State shadow;
+    shadow.init();
+    shadow.curPeriodId = startPeriodId;
+
+    PendingOrder pendingOrder;
+    Writers writers(nThreads);
+
+    // records not handed to the writers yet: the current period or the current batch of pending files
+    std::vector<SubmissionInput> batch;
+    int64_t nextPendingId = 0;
+    int64_t nPendingBatches = 0;
+
+    const auto flush = [&](TPeriodId periodId) {
+        if (batch.empty()) {
+            return;
+        }
+
+        if (toPeriodFiles) {
+            const auto fileName = Storage::periodFileName(dataFolder, prefix, periodId);
+            fprintf(log, "Period %d: %d submissions, %d slots -> '%s'\n", periodId, (int) batch.size(), (int) shadow.slots.size(), fileName.c_str());
+
+            writers.push([inputs = std::move(batch), fileName]() {
+                if (Storage::serialize(inputs, fileName) == false) {
+                    fprintf(stderr, "Failed to write '%s'\n", fileName.c_str());
+                    return false;
+                }
+                return true;
+            });
+        } else {
+            const int64_t firstId = nextPendingId;
+            nextPendingId += batch.size();
+
+            writers.push([inputs = std::move(batch), firstId, batchId = nPendingBatches++, &pendingFolder, &parameters, &pendingOrder]() {
+                return writePendingFiles(pendingFolder, inputs, parameters.seed, firstId, batchId, pendingOrder);
+            });
+        }
+
+        batch = {};
+    };
+
+    std::string text;
+
+    const auto tStart = std::chrono::steady_clock::now();
+
+    for (int64_t i = 0; i < nSubmissions; ++i) {
+        const auto input = gen.next(shadow.slots.size());
+
+        shadow.submit(input, [&](TPeriodId periodId) {
+            if (toPeriodFiles) {
+                flush(periodId);
+            } else if (toPendingFiles == false) {
+                fprintf(log, "Period %d: %d slots\n", periodId, (int) shadow.slots.size());
+            }
+        });
+
+        if (toPeriodFiles || toPendingFiles) {
+            batch.push_back(input);
+            if (toPendingFiles && (int) batch.size() == kPendingBatchSize) {
+                flush(shadow.curPeriodId);
+            }
+        } else {
+            appendText(text, input);
+            text += '\n';
+            if (text.size() > 64*1024) {
+                fwrite(text.data(), 1, text.size(), stdout);
+                text.clear();
+            }
+        }
+    }
+
+    flush(shadow.curPeriodId);
+    fwrite(text.data(), 1, text.size(), stdout);
+    fflush(stdout);
+
+    const int nFailed = writers.finish();
+
+    const auto tEnd = std::chrono::steady_clock::now();
+    const double elapsed_s = std::chrono::duration<double>(tEnd - tStart).count();
+
+    fprintf(log, "Generated %ld submissions in %.3f s (%.0f submissions/s)\n",
+            (long) nSubmissions, elapsed_s, nSubmissions/std::max(elapsed_s, 1e-9));
+
+    return nFailed == 0 ? 0 : 2;
+}
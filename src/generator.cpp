@@ -1,117 +1,266 @@
 #include "generator.h"
 
+#include "dictionary.h"
+#include "utils.h"
+
+#include <algorithm>
 #include <cmath>
 
+namespace {
+
+const std::vector<std::string_view> kDefaultWords = {
+    "apple", "banana", "orange", "pear", "grape", "strawberry", "watermelon", "cherry", "peach",
+    "kiwi", "pineapple", "mango", "coconut", "avocado", "papaya", "plum", "lemon", "lime",
+};
+
+// uniform in [0, 1)
+double uniform(Gen::Rng & rng) {
+    return (rng() >> 11)*(1.0/9007199254740992.0);
+}
+
+// uniform in [0, n)
+uint32_t uniform(Gen::Rng & rng, uint32_t n) {
+    return (uint32_t) (((rng() >> 32)*n) >> 32);
+}
+
+}
+
 namespace Gen {
 
-// generate random normally distributed number
-float frandNormal() {
-    float u1 = (float)rand() / (float)RAND_MAX;
-    float u2 = (float)rand() / (float)RAND_MAX;
-    float randStdNormal = sqrt(-2.0*log(u1))*cos(2.0*M_PI*u2);
-    return randStdNormal;
+struct Words::Impl {
+    std::vector<TWordId> wordIds;
+
+    // alias table: slot i yields wordIds[i] with probability prob[i], otherwise wordIds[alias[i]]
+    std::vector<float> prob;
+    std::vector<uint32_t> alias;
+};
+
+Words::Words() : m_impl(new Impl()) {}
+
+Words::~Words() = default;
+
+bool Words::load(const std::string & fileName, float exponent, uint64_t seed) {
+    std::string data;
+    std::vector<std::string_view> words;
+    if (Utils::readWords(fileName, data, words) == false) {
+        return false;
+    }
+
+    build(words, exponent, seed);
+
+    return size() > 0;
+}
+
+void Words::build(const std::vector<std::string_view> & words, float exponent, uint64_t seed) {
+    auto & impl = *m_impl;
+
+    impl.wordIds.clear();
+    for (const auto & word : words) {
+        if (word.empty() || word.size() > (size_t) kMaxWordLength) {
+            continue;
+        }
+        impl.wordIds.push_back(Dictionary::intern(word));
+    }
+
+    Rng rng(seed);
+    std::shuffle(impl.wordIds.begin(), impl.wordIds.end(), rng);
+
+    const uint32_t n = (uint32_t) impl.wordIds.size();
+
+    std::vector<double> p(n);
+    double sum = 0.0;
+    for (uint32_t i = 0; i < n; ++i) {
+        p[i] = 1.0/std::pow(i + 1.0, exponent);
+        sum += p[i];
+    }
+
+    // Vose's alias method: pair each slot with less than the average probability with one that has more
+    std::vector<uint32_t> small;
+    std::vector<uint32_t> large;
+    for (uint32_t i = 0; i < n; ++i) {
+        p[i] *= n/sum;
+        (p[i] < 1.0 ? small : large).push_back(i);
+    }
+
+    impl.prob.assign(n, 1.0f);
+    impl.alias.resize(n);
+    for (uint32_t i = 0; i < n; ++i) {
+        impl.alias[i] = i;
+    }
+
+    while (small.empty() == false && large.empty() == false) {
+        const uint32_t s = small.back();
+        small.pop_back();
+        const uint32_t l = large.back();
+
+        impl.prob[s] = (float) p[s];
+        impl.alias[s] = l;
+
+        p[l] -= 1.0 - p[s];
+        if (p[l] < 1.0) {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
 }
 
-float frandGaussian(float mean) {
-    return mean + 0.33f*mean*frandNormal();
+TWordId Words::sample(Rng & rng) const {
+    const auto & impl = *m_impl;
+
+    const uint64_t r = rng();
+    const uint32_t i = (uint32_t) (((r >> 32)*impl.wordIds.size()) >> 32);
+    const float u = (uint32_t) r*(1.0f/4294967296.0f);
+
+    return u < impl.prob[i] ? impl.wordIds[i] : impl.wordIds[impl.alias[i]];
 }
 
-float frandGaussian(float mean, float sigma) {
-    return mean + sigma*frandNormal();
+size_t Words::size() const {
+    return m_impl->wordIds.size();
 }
 
 struct Submissions::Impl {
     struct User {
         TIPAddress ip;
         TUserId userId;
+
+        // previous submission, slotId is -1 if none
+        TPeriodId periodId;
+        TSlotId slotId;
+        TWordId wordId;
     };
 
-    int32_t curPeriodId = 0;
-    int32_t submissionId = 0;
+    Parameters parameters;
+    Rng rng;
+
+    // the period generated next and the progress in the current one
+    TPeriodId nextPeriodId = 0;
+    TPeriodId periodId = 0;
+    int64_t nSubmissions = 0;
+    int64_t submissionId = 0;
+
+    std::vector<User> users;
+
+    // the IP of the next new user and how many more users it gets
+    TIPAddress ip = 0;
+    int32_t nLeftAtIP = 0;
+    TUserId nextUserId = 0;
+
+    // probability that a new IP is a NAT, so that NATs hold natFraction of the users
+    double pNAT = 0.0;
 
     int32_t usersAtPeriod(TPeriodId periodId) const {
-        return 10.0*std::pow(parameters.coeffUsersScale, periodId);
+        const double n = 10.0*std::pow(parameters.coeffUsersScale, periodId);
+        return (int32_t) std::max(1.0, std::min<double>(parameters.maxUsers, n));
     }
 
-    Parameters parameters;
+    void addUser() {
+        if (nLeftAtIP <= 0) {
+            do {
+                ip = (TIPAddress) rng();
+            } while (ip == 0);
 
-    std::vector<User> users;
-    std::vector<SubmissionInput> submissions;
+            if (uniform(rng) < pNAT) {
+                nLeftAtIP = parameters.natSize;
+            } else {
+                const float avg = parameters.avgUsersPerIP;
+                nLeftAtIP = std::max(1.0f, std::round(avg + 0.33f*avg*std::normal_distribution<float>()(rng)));
+            }
+
+            nextUserId = (TUserId) rng();
+        }
+
+        users.push_back(User { ip, nextUserId++, -1, -1, 0 });
+        nLeftAtIP--;
+    }
+
+    void startPeriod(int32_t nSlots) {
+        periodId = nextPeriodId++;
+
+        const int32_t nUsers = usersAtPeriod(periodId);
+        while ((int32_t) users.size() < nUsers) {
+            addUser();
+        }
+
+        nSubmissions = std::max<int64_t>(1, std::llround(users.size()*parameters.avgSubmissionsPerUserPerPeriod));
+        submissionId = 0;
+
+        if (parameters.verbose) {
+            printf("Generating %ld submissions for period %d. Users = %d, Slots = %d\n",
+                   nSubmissions, periodId, (int) users.size(), nSlots);
+        }
+    }
 };
 
 Submissions::Submissions(Parameters parameters) : m_impl(new Impl()) {
-    m_impl->parameters = parameters;
+    auto & impl = *m_impl;
+
+    impl.parameters = parameters;
+    impl.rng.seed(parameters.seed);
+
+    if (impl.parameters.words == nullptr) {
+        auto words = std::make_shared<Words>();
+        words->build(kDefaultWords, 1.0f, parameters.seed);
+        impl.parameters.words = std::move(words);
+    }
+
+    const double f = std::clamp(parameters.natFraction, 0.0f, 1.0f);
+    const double avg = std::max(1.0f, parameters.avgUsersPerIP);
+    impl.pNAT = f >= 1.0 ? 1.0 : f*avg/(parameters.natSize*(1.0 - f) + f*avg);
 }
 
 Submissions::~Submissions() = default;
 
 SubmissionInput Submissions::next(int32_t nSlots) {
-    if (m_impl->submissionId >= (int32_t) m_impl->submissions.size()) {
-        m_impl->submissions.clear();
-        m_impl->submissionId = 0;
-
-        {
-            const auto nOld = m_impl->users.size();
-            m_impl->users.resize(m_impl->usersAtPeriod(m_impl->curPeriodId));
-
-            TIPAddress ip;
-            int32_t nRepeat = 0;
-
-            for (int i = nOld; i < (int) m_impl->users.size(); ++i) {
-                if (nRepeat <= 0) {
-                    ip = Gen::ip();
-                    nRepeat = std::max(1.0f, frandGaussian(m_impl->parameters.avgUsersPerIP));
-                }
-
-                m_impl->users[i].ip = ip;
-                m_impl->users[i].userId = Gen::userId();
-                nRepeat--;
-            }
-        }
+    auto & impl = *m_impl;
+    const auto & parameters = impl.parameters;
 
-        for (int i = 0; i < (int) m_impl->users.size(); ++i) {
-            const auto & user = m_impl->users[i];
-
-            const auto nSubmissions = std::max(1.0f, frandGaussian(m_impl->parameters.avgSubmissionsPerUserPerPeriod));
-            for (int j = 0; j < (int) nSubmissions; ++j) {
-                SubmissionInput submission;
-                submission.ip = user.ip;
-                submission.slotId = frandGaussian(nSlots, 3); // vote primarily for the last slots
-                if (submission.slotId >= nSlots) {
-                    submission.slotId = 2*nSlots - submission.slotId - 1;
-                }
-                if (submission.slotId < 0) {
-                    submission.slotId = 0;
-                }
-                submission.userId = user.userId;
-                submission.word = Gen::word();
-
-                m_impl->submissions.push_back(std::move(submission));
-            }
-        }
+    if (impl.submissionId >= impl.nSubmissions) {
+        impl.startPeriod(nSlots);
+    }
 
-        {
-            const double avgSubmissionTime = double(State::secondsInPeriod)/m_impl->submissions.size();
-            for (int i = 0; i < (int) m_impl->submissions.size(); ++i) {
-                auto & submission = m_impl->submissions[i];
+    auto & rng = impl.rng;
+    auto & user = impl.users[uniform(rng, (uint32_t) impl.users.size())];
 
-                submission.timestamp_s = State::secondsInPeriod*m_impl->curPeriodId + i*avgSubmissionTime;
-            }
-        }
+    SubmissionInput result;
+    result.timestamp_s = State::secondsInPeriod*impl.periodId + (impl.submissionId*State::secondsInPeriod)/impl.nSubmissions;
+    result.ip = user.ip;
+    result.userId = user.userId;
+
+    impl.submissionId++;
 
-        printf("Generated %d submissions for period %d. Users = %d, Slots = %d\n",
-               (int) m_impl->submissions.size(),
-               m_impl->curPeriodId,
-               (int) m_impl->users.size(), nSlots);
+    const bool hasPrevious = user.periodId == impl.periodId && user.slotId >= 0 && user.slotId < nSlots;
 
-        m_impl->curPeriodId++;
+    const double r = uniform(rng);
+    if (hasPrevious && r < parameters.revoteRatio) {
+        result.slotId = user.slotId;
+        result.wordId = user.wordId;
+    } else if (hasPrevious && r < parameters.revoteRatio + parameters.editRatio) {
+        result.slotId = user.slotId;
+        result.wordId = parameters.words->sample(rng);
+
+        // a few retries, so that small word lists can still produce an actual edit
+        for (int i = 0; i < 4 && result.wordId == user.wordId; ++i) {
+            result.wordId = parameters.words->sample(rng);
+        }
+    } else {
+        // geometric distance from the newest slot
+        const double decay = std::clamp(parameters.slotDecay, 1e-6f, 1.0f);
+        const int32_t k = decay >= 1.0 ? 0 : (int32_t) std::min<double>(nSlots, std::floor(std::log(1.0 - uniform(rng))/std::log(1.0 - decay)));
+
+        result.slotId = std::max(0, nSlots - 1 - k);
+        result.wordId = parameters.words->sample(rng);
     }
 
-    return m_impl->submissions[m_impl->submissionId++];
+    user.periodId = impl.periodId;
+    user.slotId = result.slotId;
+    user.wordId = result.wordId;
+
+    return result;
 }
 
 void Submissions::setPeriod(TPeriodId periodId) {
-    m_impl->curPeriodId = periodId;
+    m_impl->nextPeriodId = periodId;
+    m_impl->submissionId = m_impl->nSubmissions;
 }
 
 }
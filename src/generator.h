@@ -3,21 +3,80 @@
 #include "types.h"
 
 #include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
 
 namespace Gen {
 
+using Rng = std::mt19937_64;
+
+// words with Zipf popularity: the k-th most popular word is picked with probability proportional to 1/k^exponent
+// - the popularity ranks are assigned to the words in a random order given by the seed
+// - sampling is O(1) via an alias table, so large word lists (e.g. words-alpha.txt) cost the same as small ones
+// - safe to share between generators once built
+class Words {
+public:
+    Words();
+    ~Words();
+
+    // load the words from a text file with one word per line
+    // returns false if the file cannot be read or has no words
+    bool load(const std::string & fileName, float exponent, uint64_t seed);
+
+    // the words are interned in the Dictionary
+    void build(const std::vector<std::string_view> & words, float exponent, uint64_t seed);
+
+    TWordId sample(Rng & rng) const;
+
+    size_t size() const;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> m_impl;
+};
+
+// deterministic stream of submissions, ordered by time
+// - a period has round(nUsers*avgSubmissionsPerUserPerPeriod) submissions, evenly spread over the period,
+//   each by a random user, so the memory is O(users) no matter how long the simulation runs
+// - a user either repeats or edits its previous submission of the period, or votes for a new slot
 class Submissions {
 public:
     struct Parameters {
+        uint64_t seed = 1234;
+
+        // users at period p: min(maxUsers, 10*coeffUsersScale^p)
         float coeffUsersScale = 1.10f;
+        int32_t maxUsers = 1 << 20;
 
+        // users behind the same IP: households around avgUsersPerIP,
+        // and carrier-grade NATs with natSize users that hold natFraction of all users
         float avgUsersPerIP = 4.0f;
+        float natFraction = 0.0f;
+        int32_t natSize = 4096;
+
         float avgSubmissionsPerUserPerPeriod = 5.0f;
+
+        // probability that a user who already voted in the period edits the word of its previous submission,
+        // or repeats it as it is
+        float editRatio = 0.2f;
+        float revoteRatio = 0.05f;
+
+        // hot slots: the newest slot gets this fraction of the new votes, each older slot (1 - slotDecay) times less
+        float slotDecay = 0.3f;
+
+        // popularity of the words, a small built-in list of words if not set
+        std::shared_ptr<const Words> words;
+
+        // print a line for each generated period
+        bool verbose = true;
     };
 
     Submissions(Parameters parameters);
     ~Submissions();
 
+    // nSlots is the number of active slots, the generated slot ids are always below it
     SubmissionInput next(int32_t nSlots);
 
     void setPeriod(TPeriodId periodId);
@@ -0,0 +1,584 @@
+#include "http.h"
+
+#include "net.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <zlib.h>
+
+namespace {
+
+bool gzip(const std::string & data, int level, std::string & out) {
+    z_stream zs {};
+
+    // 16 + 15: gzip header and the largest window
+    if (deflateInit2(&zs, level, Z_DEFLATED, 16 + 15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+
+    out.resize(deflateBound(&zs, data.size()));
+
+    zs.next_in = (Bytef *) data.data();
+    zs.avail_in = data.size();
+    zs.next_out = (Bytef *) out.data();
+    zs.avail_out = out.size();
+
+    const int res = deflate(&zs, Z_FINISH);
+    deflateEnd(&zs);
+
+    if (res != Z_STREAM_END) {
+        out.clear();
+        return false;
+    }
+
+    out.resize(zs.total_out);
+
+    return true;
+}
+
+std::string_view trim(std::string_view str) {
+    while (str.empty() == false && (str.front() == ' ' || str.front() == '\t')) {
+        str.remove_prefix(1);
+    }
+    while (str.empty() == false && (str.back() == ' ' || str.back() == '\t')) {
+        str.remove_suffix(1);
+    }
+    return str;
+}
+
+bool equalsIgnoreCase(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (tolower((unsigned char) a[i]) != tolower((unsigned char) b[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// call f with each element of a comma separated header value, e.g. "gzip, deflate;q=0.5"
+template <typename F>
+void forEachToken(std::string_view list, F && f) {
+    while (list.empty() == false) {
+        const auto pos = list.find(',');
+        const auto token = trim(list.substr(0, pos));
+        if (token.empty() == false) {
+            f(token);
+        }
+        if (pos == std::string_view::npos) {
+            break;
+        }
+        list.remove_prefix(pos + 1);
+    }
+}
+
+// "gzip" is listed in Accept-Encoding without q=0
+bool acceptsGzip(std::string_view acceptEncoding) {
+    bool result = false;
+    forEachToken(acceptEncoding, [&](std::string_view token) {
+        const auto pos = token.find(';');
+        if (equalsIgnoreCase(trim(token.substr(0, pos)), "gzip") == false) {
+            return;
+        }
+
+        result = true;
+        if (pos != std::string_view::npos) {
+            auto param = trim(token.substr(pos + 1));
+            if (param.size() >= 2 && (param[0] == 'q' || param[0] == 'Q') && param[1] == '=') {
+                result = strtod(std::string(param.substr(2)).c_str(), nullptr) > 0.0;
+            }
+        }
+    });
+
+    return result;
+}
+
+// If-None-Match matches any of the ETags, weak comparison as required for GET
+bool matchesETag(std::string_view ifNoneMatch, const std::string & etag, const std::string & etagGzip) {
+    bool result = false;
+    forEachToken(ifNoneMatch, [&](std::string_view token) {
+        if (token.size() > 2 && token[0] == 'W' && token[1] == '/') {
+            token.remove_prefix(2);
+        }
+        if (token == "*" || token == etag || (etagGzip.empty() == false && token == etagGzip)) {
+            result = true;
+        }
+    });
+
+    return result;
+}
+
+}
+
+struct HttpServer::Impl {
+    using Clock = std::chrono::steady_clock;
+
+    // a request header larger than this is rejected
+    static constexpr size_t kMaxRequestSize = 16*1024;
+
+    struct Document {
+        std::string body;
+        std::string bodyGzip; // empty if the document is not compressed
+
+        std::string etag;
+        std::string etagGzip;
+
+        bool immutable = false;
+    };
+
+    struct Client {
+        int fd = -1;
+        std::string in;
+
+        // the response being written: the header followed by the body of a document
+        // the document is kept alive while it is written, even if it has been replaced in the meantime
+        bool responding = false;
+        std::string header;
+        std::shared_ptr<const Document> document;
+        const std::string * body = nullptr;
+        size_t offset = 0;
+
+        // close the connection after the response
+        bool closeAfter = false;
+
+        Clock::time_point tLastActive;
+    };
+
+    Parameters parameters;
+
+    int listenFd = -1;
+    std::vector<Client> clients;
+
+    int wakeFd[2] = { -1, -1 };
+
+    std::atomic<bool> running { false };
+    std::thread worker;
+
+    mutable std::mutex mutex;
+    std::map<std::string, std::shared_ptr<const Document>, std::less<>> documents;
+    Statistics statistics;
+
+    // statistics of the current iteration, added to the shared ones at its end
+    Statistics delta;
+
+    // "Date" header, formatted once per second
+    time_t dateTime = 0;
+    char date[64] = {};
+
+    const char * httpDate() {
+        const time_t t = time(nullptr);
+        if (t != dateTime) {
+            dateTime = t;
+
+            tm gmt {};
+            gmtime_r(&t, &gmt);
+            strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &gmt);
+        }
+        return date;
+    }
+
+    void respond(Client & client, int status, const char * reason, std::shared_ptr<const Document> document, bool isHead, bool useGzip) {
+        auto & header = client.header;
+        header.clear();
+
+        header += "HTTP/1.1 ";
+        header += std::to_string(status);
+        header += ' ';
+        header += reason;
+        header += "\r\nDate: ";
+        header += httpDate();
+        header += "\r\nServer: the-story\r\n";
+
+        const std::string * body = nullptr;
+        if (document) {
+            body = useGzip ? &document->bodyGzip : &document->body;
+
+            header += "ETag: ";
+            header += useGzip ? document->etagGzip : document->etag;
+            header += "\r\nCache-Control: ";
+            header += document->immutable ? "public, max-age=31536000, immutable" : "no-cache";
+            header += "\r\n";
+            if (document->bodyGzip.empty() == false) {
+                header += "Vary: Accept-Encoding\r\n";
+            }
+            if (status == 200) {
+                header += "Content-Type: application/json\r\n";
+                if (useGzip) {
+                    header += "Content-Encoding: gzip\r\n";
+                }
+            }
+        }
+
+        if (status == 405) {
+            header += "Allow: GET, HEAD\r\n";
+        }
+
+        // 304 has no body, but the length of the 200 response is not needed either
+        if (status != 304) {
+            header += "Content-Length: ";
+            header += std::to_string(status == 200 ? body->size() : 0);
+            header += "\r\n";
+        }
+
+        header += client.closeAfter ? "Connection: close\r\n\r\n" : "Connection: keep-alive\r\n\r\n";
+
+        client.responding = true;
+        client.document = status == 200 && isHead == false ? std::move(document) : nullptr;
+        client.body = client.document ? body : nullptr;
+        client.offset = 0;
+
+        delta.nRequests++;
+        if (status == 304) {
+            delta.nNotModified++;
+        }
+        if (client.document && useGzip) {
+            delta.nGzip++;
+        }
+    }
+
+    // parse the request at the start of the input buffer, if it is complete, and prepare its response
+    // returns false if the connection must be closed right away
+    bool process(Client & client) {
+        const auto end = client.in.find("\r\n\r\n");
+        if (end == std::string::npos) {
+            return client.in.size() <= kMaxRequestSize;
+        }
+
+        const std::string_view request(client.in.data(), end);
+
+        // request line: "<method> <target> <version>"
+        auto lineEnd = request.find("\r\n");
+        const auto line = request.substr(0, lineEnd);
+
+        const auto sp0 = line.find(' ');
+        const auto sp1 = sp0 == std::string_view::npos ? std::string_view::npos : line.find(' ', sp0 + 1);
+        if (sp1 == std::string_view::npos) {
+            client.in.clear();
+            client.closeAfter = true;
+            respond(client, 400, "Bad Request", nullptr, false, false);
+            return true;
+        }
+
+        const auto method = line.substr(0, sp0);
+        auto target = line.substr(sp0 + 1, sp1 - sp0 - 1);
+        const auto version = line.substr(sp1 + 1);
+
+        // the query string, e.g. "?nocache=<time>" of older pages, is not part of the document name
+        target = target.substr(0, target.find('?'));
+
+        std::string_view ifNoneMatch;
+        std::string_view acceptEncoding;
+        bool hasBody = false;
+
+        client.closeAfter = version != "HTTP/1.1";
+
+        while (lineEnd != std::string_view::npos) {
+            const auto begin = lineEnd + 2;
+            lineEnd = request.find("\r\n", begin);
+
+            const auto header = request.substr(begin, lineEnd == std::string_view::npos ? std::string_view::npos : lineEnd - begin);
+            const auto colon = header.find(':');
+            if (colon == std::string_view::npos) {
+                continue;
+            }
+
+            const auto name = header.substr(0, colon);
+            const auto value = trim(header.substr(colon + 1));
+
+            if (equalsIgnoreCase(name, "If-None-Match")) {
+                ifNoneMatch = value;
+            } else if (equalsIgnoreCase(name, "Accept-Encoding")) {
+                acceptEncoding = value;
+            } else if (equalsIgnoreCase(name, "Connection")) {
+                forEachToken(value, [&](std::string_view token) {
+                    if (equalsIgnoreCase(token, "close")) {
+                        client.closeAfter = true;
+                    } else if (equalsIgnoreCase(token, "keep-alive")) {
+                        client.closeAfter = false;
+                    }
+                });
+            } else if ((equalsIgnoreCase(name, "Content-Length") && value != "0") || equalsIgnoreCase(name, "Transfer-Encoding")) {
+                hasBody = true;
+            }
+        }
+
+        const bool isGet = method == "GET";
+        const bool isHead = method == "HEAD";
+
+        std::shared_ptr<const Document> document;
+        if (isGet || isHead) {
+            std::lock_guard lock(mutex);
+            const auto it = documents.find(target);
+            if (it != documents.end()) {
+                document = it->second;
+            }
+        }
+
+        const bool useGzip = document && document->bodyGzip.empty() == false && acceptsGzip(acceptEncoding);
+        const bool notModified = document && ifNoneMatch.empty() == false && matchesETag(ifNoneMatch, document->etag, document->etagGzip);
+
+        // the views into the input buffer are not used anymore
+        client.in.erase(0, end + 4);
+
+        // requests with a body are not supported, the body would be taken for the next request
+        if (hasBody) {
+            client.in.clear();
+            client.closeAfter = true;
+            respond(client, 400, "Bad Request", nullptr, false, false);
+        } else if (isGet == false && isHead == false) {
+            respond(client, 405, "Method Not Allowed", nullptr, false, false);
+        } else if (document == nullptr) {
+            respond(client, 404, "Not Found", nullptr, false, false);
+        } else if (notModified) {
+            respond(client, 304, "Not Modified", std::move(document), isHead, useGzip);
+        } else {
+            respond(client, 200, "OK", std::move(document), isHead, useGzip);
+        }
+
+        return true;
+    }
+
+    // write as much of the response as possible and process the next requests of the client
+    // returns false if the connection must be closed
+    bool flush(Client & client) {
+        while (true) {
+            if (client.responding == false) {
+                if (process(client) == false) {
+                    return false;
+                }
+                if (client.responding == false) {
+                    return true;
+                }
+            }
+
+            const size_t headerSize = client.header.size();
+            const size_t bodySize = client.body ? client.body->size() : 0;
+
+            if (client.offset == headerSize + bodySize) {
+                client.responding = false;
+                client.document = nullptr;
+                client.body = nullptr;
+
+                if (client.closeAfter) {
+                    return false;
+                }
+                continue;
+            }
+
+            iovec iov[2];
+            int n = 0;
+            if (client.offset < headerSize) {
+                iov[n++] = { client.header.data() + client.offset, headerSize - client.offset };
+            }
+            const size_t bodyOffset = client.offset > headerSize ? client.offset - headerSize : 0;
+            if (bodyOffset < bodySize) {
+                iov[n++] = { (void *) (client.body->data() + bodyOffset), bodySize - bodyOffset };
+            }
+
+            msghdr msg {};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = n;
+
+            // a client that went away must not raise SIGPIPE
+            const auto res = sendmsg(client.fd, &msg, MSG_NOSIGNAL);
+            if (res < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    return true;
+                }
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+
+            client.offset += res;
+            delta.nBytesSent += res;
+        }
+    }
+
+    void run() {
+        std::vector<pollfd> pfds;
+        char buffer[16*1024];
+
+        while (running) {
+            pfds.clear();
+            pfds.push_back({ wakeFd[0], POLLIN, 0 });
+            pfds.push_back({ listenFd, POLLIN, 0 });
+            for (const auto & client : clients) {
+                pfds.push_back({ client.fd, (short) (client.responding ? POLLOUT : POLLIN), 0 });
+            }
+
+            // wake up now and then to close the idle connections
+            if (poll(pfds.data(), pfds.size(), clients.empty() ? -1 : 1000) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                fprintf(stderr, "HttpServer: poll failed: %s\n", strerror(errno));
+                break;
+            }
+
+            const auto tNow = Clock::now();
+
+            // new connections
+            if (pfds[1].revents & POLLIN) {
+                while (true) {
+                    const int fd = accept(listenFd, nullptr, nullptr);
+                    if (fd < 0) {
+                        break;
+                    }
+                    if ((int32_t) clients.size() >= parameters.maxConnections) {
+                        close(fd);
+                        continue;
+                    }
+
+                    Net::setNonBlocking(fd);
+
+                    Client client;
+                    client.fd = fd;
+                    client.tLastActive = tNow;
+                    clients.push_back(std::move(client));
+
+                    delta.nConnections++;
+                }
+            }
+
+            // the newly accepted clients are polled in the next iteration
+            const size_t offset = 2;
+            const size_t nPolled = pfds.size() - offset;
+            for (size_t i = 0; i < nPolled; ++i) {
+                auto & client = clients[i];
+                if ((pfds[offset + i].revents & (POLLIN | POLLOUT | POLLHUP | POLLERR)) == 0) {
+                    if (client.responding == false && tNow - client.tLastActive > std::chrono::milliseconds(parameters.keepAliveTimeout_ms)) {
+                        close(client.fd);
+                        client.fd = -1;
+                    }
+                    continue;
+                }
+
+                client.tLastActive = tNow;
+
+                bool alive = true;
+                if (client.responding == false) {
+                    while (true) {
+                        const auto n = read(client.fd, buffer, sizeof(buffer));
+                        if (n > 0) {
+                            client.in.append(buffer, n);
+                            if (client.in.size() > kMaxRequestSize) {
+                                break;
+                            }
+                            continue;
+                        }
+                        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                            break;
+                        }
+                        alive = false;
+                        break;
+                    }
+                }
+
+                if (alive == false || flush(client) == false) {
+                    close(client.fd);
+                    client.fd = -1;
+                }
+            }
+
+            clients.erase(std::remove_if(clients.begin(), clients.end(), [](const Client & c) { return c.fd < 0; }), clients.end());
+
+            {
+                std::lock_guard lock(mutex);
+                statistics.nConnections += delta.nConnections;
+                statistics.nRequests    += delta.nRequests;
+                statistics.nNotModified += delta.nNotModified;
+                statistics.nGzip        += delta.nGzip;
+                statistics.nBytesSent   += delta.nBytesSent;
+            }
+            delta = {};
+        }
+    }
+};
+
+HttpServer::HttpServer(Parameters parameters) : m_impl(new Impl()) {
+    m_impl->parameters = std::move(parameters);
+}
+
+HttpServer::~HttpServer() {
+    if (m_impl->running) {
+        m_impl->running = false;
+        const char c = 0;
+        [[maybe_unused]] auto res = write(m_impl->wakeFd[1], &c, 1);
+        m_impl->worker.join();
+    }
+
+    for (const auto & client : m_impl->clients) {
+        close(client.fd);
+    }
+    if (m_impl->listenFd >= 0) {
+        close(m_impl->listenFd);
+    }
+    for (auto fd : m_impl->wakeFd) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+}
+
+bool HttpServer::start() {
+    m_impl->listenFd = Net::listenTCP(m_impl->parameters.tcpPort, 1024);
+    if (m_impl->listenFd < 0) {
+        return false;
+    }
+
+    if (pipe(m_impl->wakeFd) != 0) {
+        return false;
+    }
+
+    m_impl->running = true;
+    m_impl->worker = std::thread([this] { m_impl->run(); });
+
+    return true;
+}
+
+void HttpServer::set(const std::string & path, const std::string & body, int64_t revision, bool immutable) {
+    auto document = std::make_shared<Impl::Document>();
+
+    document->body = body;
+    document->etag = "\"" + std::to_string(revision) + "\"";
+    document->immutable = immutable;
+
+    // a compressed copy that is not smaller is of no use
+    if (body.size() >= m_impl->parameters.minCompressSize &&
+        gzip(body, m_impl->parameters.compressionLevel, document->bodyGzip) && document->bodyGzip.size() < body.size()) {
+        document->etagGzip = "\"" + std::to_string(revision) + "-gzip\"";
+    } else {
+        document->bodyGzip.clear();
+    }
+
+    std::lock_guard lock(m_impl->mutex);
+    m_impl->documents[path] = std::move(document);
+}
+
+void HttpServer::remove(const std::string & path) {
+    std::lock_guard lock(m_impl->mutex);
+    m_impl->documents.erase(path);
+}
+
+HttpServer::Statistics HttpServer::statistics() const {
+    std::lock_guard lock(m_impl->mutex);
+    return m_impl->statistics;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// minimal HTTP/1.1 server for the published statistics, serving them from memory
+// - answers GET and HEAD for the documents set with set(), e.g. "/stats.json" and "/stats-chunk-3-17.json",
+//   the query string is ignored
+// - each document has an ETag built from its revision, a request with a matching If-None-Match gets
+//   304 Not Modified without a body
+// - the gzip copy of a document is made once in set(), clients that accept gzip get it without any work
+//   per request
+// - listens on a loopback TCP port only, it is meant to be behind the public web server
+// - persistent connections, served by a single background thread
+class HttpServer {
+public:
+    struct Parameters {
+        int tcpPort = 0;
+
+        // zlib level of the gzip copies
+        int compressionLevel = 6;
+
+        // documents smaller than this are sent as they are
+        size_t minCompressSize = 256;
+
+        // new connections beyond this are closed right away
+        int32_t maxConnections = 4096;
+
+        // idle persistent connections are closed after this time
+        int32_t keepAliveTimeout_ms = 60*1000;
+    };
+
+    struct Statistics {
+        int64_t nConnections = 0;
+        int64_t nRequests    = 0;
+        int64_t nNotModified = 0; // 304 responses
+        int64_t nGzip        = 0; // responses with the gzip copy
+        int64_t nBytesSent   = 0;
+    };
+
+    HttpServer(Parameters parameters);
+    ~HttpServer();
+
+    // open the socket and start the server thread
+    bool start();
+
+    // add or replace the document at path, thread-safe
+    // immutable documents can be cached by the clients forever, the others are revalidated on every request
+    void set(const std::string & path, const std::string & body, int64_t revision, bool immutable);
+
+    // remove the document at path, thread-safe
+    void remove(const std::string & path);
+
+    Statistics statistics() const;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> m_impl;
+};
@@ -0,0 +1,354 @@
+#include "ingest.h"
+
+#include "net.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+struct IngestServer::Impl {
+    // a client that does not read the replies is disconnected
+    static constexpr size_t kMaxPendingReply = 64*1024;
+
+    struct Client {
+        int fd;
+        std::string buffer;
+
+        // replies not written yet
+        std::string out;
+    };
+
+    Parameters parameters;
+    CBOnReceived onReceived;
+
+    // rejects the words that are not in the lexicon before they are interned, empty without a lexicon
+    SubmissionInput::CBIsValidWord isValidWord;
+
+    std::vector<int> listenFds;
+    std::vector<Client> clients;
+
+    int wakeFd[2] = { -1, -1 };
+
+    std::atomic<bool> running { false };
+    std::thread worker;
+
+    mutable std::mutex mutex;
+    std::deque<SubmissionInput> queue;
+    Statistics statistics;
+
+    // set while the queue is full, drain() wakes the server thread once there is room again
+    bool paused = false;
+
+    // the number of submissions that can be queued right now
+    size_t room() {
+        std::lock_guard lock(mutex);
+        paused = queue.size() >= parameters.maxQueued;
+
+        return paused ? 0 : parameters.maxQueued - queue.size();
+    }
+
+    // parse complete messages from the client buffer, until there are maxInputs inputs
+    // the rest of the messages stays in the buffer
+    // returns false if the client sent a malformed message
+    bool process(Client & client, std::vector<SubmissionInput> & inputs, size_t maxInputs, int64_t & nRejected) {
+        size_t pos = 0;
+        bool ok = true;
+
+        while (inputs.size() < maxInputs && client.buffer.size() - pos >= sizeof(uint32_t)) {
+            uint32_t size;
+            memcpy(&size, client.buffer.data() + pos, sizeof(size));
+            if (size == 0 || size > kMaxMessageSize) {
+                ok = false;
+                break;
+            }
+
+            if (client.buffer.size() - pos < sizeof(uint32_t) + size) {
+                break;
+            }
+
+            const char * payload = client.buffer.data() + pos + sizeof(uint32_t);
+            pos += sizeof(uint32_t) + size;
+
+            if (payload[0] == 'v') {
+                const auto & lexicon = parameters.lexicon;
+                client.out += lexicon == nullptr ? '?' : lexicon->contains(std::string_view(payload + 1, size - 1)) ? '1' : '0';
+                continue;
+            }
+
+            SubmissionInput input;
+            bool parsed = false;
+            switch (payload[0]) {
+                case 't': parsed = input.parse(std::string_view(payload + 1, size - 1), isValidWord); break;
+                case 'b': parsed = input.parse(payload + 1, size - 1, isValidWord); break;
+            };
+
+            if (parsed) {
+                inputs.push_back(input);
+            } else {
+                nRejected++;
+            }
+        }
+
+        client.buffer.erase(0, pos);
+
+        return ok;
+    }
+
+    // write as much of the pending replies as possible
+    // returns false if the connection is broken
+    bool flush(Client & client) {
+        while (client.out.empty() == false) {
+            // a client that went away must not raise SIGPIPE
+            const auto n = send(client.fd, client.out.data(), client.out.size(), MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    break;
+                }
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            client.out.erase(0, n);
+        }
+
+        return client.out.size() <= kMaxPendingReply;
+    }
+
+    void run() {
+        std::vector<pollfd> pfds;
+        std::vector<size_t> polled; // client of each polled descriptor after the listening ones
+        std::vector<short> revents;
+        std::vector<SubmissionInput> inputs;
+        char buffer[64*1024];
+
+        while (running) {
+            // the drained submissions only make room, so it is at least this much until the next iteration
+            const size_t nRoom = room();
+
+            // while the queue is full the clients are polled only for the pending replies
+            pfds.clear();
+            polled.clear();
+            pfds.push_back({ wakeFd[0], POLLIN, 0 });
+            for (auto fd : listenFds) {
+                pfds.push_back({ fd, POLLIN, 0 });
+            }
+            for (size_t i = 0; i < clients.size(); ++i) {
+                const short events = (nRoom > 0 ? POLLIN : 0) | (clients[i].out.empty() ? 0 : POLLOUT);
+                if (events != 0) {
+                    pfds.push_back({ clients[i].fd, events, 0 });
+                    polled.push_back(i);
+                }
+            }
+
+            if (poll(pfds.data(), pfds.size(), -1) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                fprintf(stderr, "IngestServer: poll failed: %s\n", strerror(errno));
+                break;
+            }
+
+            if (pfds[0].revents & POLLIN) {
+                char wake[64];
+                [[maybe_unused]] auto res = read(wakeFd[0], wake, sizeof(wake));
+            }
+
+            int64_t nConnections = 0;
+            int64_t nRejected = 0;
+
+            const size_t nClients = clients.size();
+            revents.assign(nClients, 0);
+            for (size_t i = 0; i < polled.size(); ++i) {
+                revents[polled[i]] = pfds[1 + listenFds.size() + i].revents;
+            }
+
+            // new connections
+            for (size_t i = 0; i < listenFds.size(); ++i) {
+                if ((pfds[1 + i].revents & POLLIN) == 0) {
+                    continue;
+                }
+                while (true) {
+                    const int fd = accept(listenFds[i], nullptr, nullptr);
+                    if (fd < 0) {
+                        break;
+                    }
+                    Net::setNonBlocking(fd);
+                    clients.push_back({ fd, {}, {} });
+                    nConnections++;
+                }
+            }
+
+            // incoming data and the messages left in the buffers while the queue was full
+            // the newly accepted clients are polled in the next iteration
+            for (size_t i = 0; i < nClients; ++i) {
+                auto & client = clients[i];
+                const bool hasBuffered = nRoom > inputs.size() && client.buffer.size() >= sizeof(uint32_t);
+                if ((revents[i] & (POLLIN | POLLOUT | POLLHUP | POLLERR)) == 0 && hasBuffered == false) {
+                    continue;
+                }
+
+                bool malformed = process(client, inputs, nRoom, nRejected) == false;
+                bool alive = malformed == false;
+
+                // the rest is read once there is room, so the end of the file is only seen after all messages are processed
+                while (alive && inputs.size() < nRoom) {
+                    const auto n = read(client.fd, buffer, sizeof(buffer));
+                    if (n > 0) {
+                        client.buffer.append(buffer, n);
+                        malformed = process(client, inputs, nRoom, nRejected) == false;
+                        alive = malformed == false;
+                        continue;
+                    }
+                    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                        break;
+                    }
+                    alive = false;
+                }
+
+                if (malformed) {
+                    fprintf(stderr, "IngestServer: closing client after malformed message\n");
+                }
+
+                // reply to the requests, also when the client has closed its side of the connection
+                if (flush(client) == false) {
+                    alive = false;
+                }
+
+                if (alive == false) {
+                    close(client.fd);
+                    client.fd = -1;
+                }
+            }
+
+            clients.erase(std::remove_if(clients.begin(), clients.end(), [](const Client & c) { return c.fd < 0; }), clients.end());
+
+            if (inputs.empty() && nConnections == 0 && nRejected == 0) {
+                continue;
+            }
+
+            const bool received = inputs.empty() == false;
+            {
+                std::lock_guard lock(mutex);
+                statistics.nConnections += nConnections;
+                statistics.nReceived    += inputs.size();
+                statistics.nRejected    += nRejected;
+                queue.insert(queue.end(), inputs.begin(), inputs.end());
+                statistics.nMaxQueued = std::max<int64_t>(statistics.nMaxQueued, queue.size());
+            }
+            inputs.clear();
+
+            if (received && onReceived) {
+                onReceived();
+            }
+        }
+    }
+};
+
+IngestServer::IngestServer(Parameters parameters, CBOnReceived && onReceived) : m_impl(new Impl()) {
+    m_impl->parameters = std::move(parameters);
+    m_impl->onReceived = std::move(onReceived);
+
+    if (const Lexicon * lexicon = m_impl->parameters.lexicon) {
+        m_impl->isValidWord = [lexicon](std::string_view word) { return lexicon->contains(word); };
+    }
+}
+
+IngestServer::~IngestServer() {
+    if (m_impl->running) {
+        m_impl->running = false;
+        const char c = 0;
+        [[maybe_unused]] auto res = write(m_impl->wakeFd[1], &c, 1);
+        m_impl->worker.join();
+    }
+
+    for (const auto & client : m_impl->clients) {
+        close(client.fd);
+    }
+    for (auto fd : m_impl->listenFds) {
+        close(fd);
+    }
+    for (auto fd : m_impl->wakeFd) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    if (m_impl->parameters.unixSocketPath.empty() == false) {
+        unlink(m_impl->parameters.unixSocketPath.c_str());
+    }
+}
+
+bool IngestServer::start() {
+    if (m_impl->parameters.unixSocketPath.empty() == false) {
+        const int fd = Net::listenUnix(m_impl->parameters.unixSocketPath);
+        if (fd < 0) {
+            return false;
+        }
+        m_impl->listenFds.push_back(fd);
+    }
+
+    if (m_impl->parameters.tcpPort > 0) {
+        const int fd = Net::listenTCP(m_impl->parameters.tcpPort);
+        if (fd < 0) {
+            return false;
+        }
+        m_impl->listenFds.push_back(fd);
+    }
+
+    if (pipe(m_impl->wakeFd) != 0) {
+        return false;
+    }
+
+    // drain() must not block if the server thread is behind with reading the wake ups
+    Net::setNonBlocking(m_impl->wakeFd[1]);
+
+    m_impl->running = true;
+    m_impl->worker = std::thread([this] { m_impl->run(); });
+
+    return true;
+}
+
+size_t IngestServer::drain(std::vector<SubmissionInput> & inputs, size_t maxInputs) {
+    auto & impl = *m_impl;
+
+    bool wake = false;
+    size_t nQueued = 0;
+    {
+        std::lock_guard lock(impl.mutex);
+
+        const size_t n = std::min(maxInputs, impl.queue.size());
+        inputs.insert(inputs.end(), impl.queue.begin(), impl.queue.begin() + n);
+        impl.queue.erase(impl.queue.begin(), impl.queue.begin() + n);
+
+        nQueued = impl.queue.size();
+        if (impl.paused && nQueued < impl.parameters.maxQueued) {
+            impl.paused = false;
+            wake = true;
+        }
+    }
+
+    // the server thread reads the clients again
+    if (wake) {
+        const char c = 0;
+        [[maybe_unused]] auto res = write(impl.wakeFd[1], &c, 1);
+    }
+
+    return nQueued;
+}
+
+IngestServer::Statistics IngestServer::statistics() const {
+    std::lock_guard lock(m_impl->mutex);
+
+    auto result = m_impl->statistics;
+    result.nQueued = m_impl->queue.size();
+
+    return result;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "types.h"
+#include "lexicon.h"
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// local ingestion endpoint for submissions, bypassing the pending folder
+// - listens on a Unix domain socket and/or on a loopback TCP port
+// - each message is a little-endian uint32 payload length followed by the payload
+// - the first byte of the payload is the record type:
+//   't' : text record "<timestamp> <ip> <slotId> <userId> <word>", same as the pending files
+//   'b' : binary record, same layout as SubmissionInput::serialize()
+//   'v' : validation request "<word>", answered with a single byte:
+//         '1' if the word is in the lexicon, '0' if it is not and '?' if there is no lexicon
+// - with a lexicon, submissions of words that are not in it are rejected before the word is interned
+// - connections sending malformed messages are closed
+// - received submissions are queued by a background thread and collected with drain()
+// - the clients are not read while the queue is full, so the senders are held back by the socket buffers
+class IngestServer {
+public:
+    struct Parameters {
+        std::string unixSocketPath; // empty - disabled
+        int tcpPort = 0;            // 0 - disabled
+
+        // valid words, nullptr - accept all words
+        const Lexicon * lexicon = nullptr;
+
+        // submissions that have been received but not drained yet
+        size_t maxQueued = 64*1024;
+    };
+
+    struct Statistics {
+        int64_t nConnections = 0;
+        int64_t nReceived    = 0;
+        int64_t nRejected    = 0;
+
+        // submissions waiting for drain() right now, and the most that have been waiting
+        int64_t nQueued    = 0;
+        int64_t nMaxQueued = 0;
+    };
+
+    static constexpr uint32_t kMaxMessageSize = 1024;
+
+    // called from the server thread after new submissions have been queued
+    using CBOnReceived = std::function<void()>;
+
+    IngestServer(Parameters parameters, CBOnReceived && onReceived);
+    ~IngestServer();
+
+    // open the sockets and start the server thread
+    bool start();
+
+    // move up to maxInputs queued submissions to the end of inputs, in the order of arrival
+    // returns the number of submissions that are still queued
+    size_t drain(std::vector<SubmissionInput> & inputs, size_t maxInputs);
+
+    Statistics statistics() const;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> m_impl;
+};
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <charconv>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// minimal streaming JSON writer
+// - appends minified JSON to a caller-owned buffer, so the buffer capacity can be reused between documents
+// - commas between values are inserted automatically
+// - no validation of the document structure, the caller is responsible for matching begin/end calls
+class JSONWriter {
+public:
+    JSONWriter(std::string & out) : m_out(out) {}
+
+    void beginObject() { separate(); m_out += '{'; m_needComma = false; }
+    void endObject()   { m_out += '}'; m_needComma = true; }
+    void beginArray()  { separate(); m_out += '['; m_needComma = false; }
+    void endArray()    { m_out += ']'; m_needComma = true; }
+
+    void key(std::string_view name) {
+        separate();
+        string(name);
+        m_out += ':';
+        m_needComma = false;
+    }
+
+    void value(int64_t v) {
+        separate();
+        char buf[24];
+        const auto res = std::to_chars(buf, buf + sizeof(buf), v);
+        m_out.append(buf, res.ptr);
+        m_needComma = true;
+    }
+
+    void value(std::string_view v) {
+        separate();
+        string(v);
+        m_needComma = true;
+    }
+
+    // already serialized JSON value
+    void raw(std::string_view json) {
+        separate();
+        m_out += json;
+        m_needComma = true;
+    }
+
+private:
+    void separate() {
+        if (m_needComma) {
+            m_out += ',';
+        }
+    }
+
+    void string(std::string_view s) {
+        static const char * kHex = "0123456789abcdef";
+
+        m_out += '"';
+        for (const char c : s) {
+            switch (c) {
+                case '"':  m_out += "\\\""; break;
+                case '\\': m_out += "\\\\"; break;
+                case '\n': m_out += "\\n";  break;
+                case '\r': m_out += "\\r";  break;
+                case '\t': m_out += "\\t";  break;
+                default:
+                    if ((unsigned char) c < 0x20) {
+                        m_out += "\\u00";
+                        m_out += kHex[c >> 4];
+                        m_out += kHex[c & 0xf];
+                    } else {
+                        m_out += c;
+                    }
+            }
+        }
+        m_out += '"';
+    }
+
+    std::string & m_out;
+    bool m_needComma = false;
+};
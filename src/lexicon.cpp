@@ -0,0 +1,180 @@
+#include "lexicon.h"
+
+#include "flat_map.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace {
+
+// average number of words per bucket
+constexpr size_t kWordsPerBucket = 4;
+
+uint64_t hashWord(std::string_view word) {
+    // FNV-1a
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (auto c : word) {
+        h ^= (uint8_t) c;
+        h *= 0x100000001b3ull;
+    }
+    return hash64(h);
+}
+
+// map a hash to [0, n) without a division
+uint32_t reduce(uint64_t h, uint32_t n) {
+    return (uint32_t) (((h >> 32)*n) >> 32);
+}
+
+uint32_t bucketOf(uint64_t h, uint32_t nBuckets) {
+    return reduce(h, nBuckets);
+}
+
+uint32_t slotOf(uint64_t h, uint32_t seed, uint32_t nSlots) {
+    return reduce(hash64(h ^ (0x9e3779b97f4a7c15ull*(seed + 1))), nSlots);
+}
+
+}
+
+struct Lexicon::Impl {
+    size_t nWords = 0;
+
+    // displacement seed of each bucket
+    std::vector<uint32_t> seeds;
+
+    // the word in slot i is arena[offsets[i], offsets[i + 1]), empty slots have no characters
+    std::vector<uint32_t> offsets;
+    std::string arena;
+};
+
+Lexicon::Lexicon() : m_impl(new Impl()) {}
+
+Lexicon::~Lexicon() = default;
+
+bool Lexicon::load(const std::string & fileName) {
+    std::string data;
+    std::vector<std::string_view> words;
+    if (Utils::readWords(fileName, data, words) == false) {
+        return false;
+    }
+
+    build(std::move(words));
+
+    return true;
+}
+
+void Lexicon::build(std::vector<std::string_view> words) {
+    std::sort(words.begin(), words.end());
+    words.erase(std::unique(words.begin(), words.end()), words.end());
+    words.erase(std::remove(words.begin(), words.end(), std::string_view()), words.end());
+
+    auto & impl = *m_impl;
+
+    const uint32_t nWords   = (uint32_t) words.size();
+    const uint32_t nBuckets = std::max<uint32_t>(1, (nWords + kWordsPerBucket - 1)/kWordsPerBucket);
+    const uint32_t nSlots   = std::max<uint32_t>(1, nWords + nWords/8);
+
+    // group the words by bucket: the words of bucket b are bucketWords[bucketBegin[b], bucketBegin[b + 1])
+    std::vector<uint64_t> hashes(nWords);
+    std::vector<uint32_t> bucketBegin(nBuckets + 1, 0);
+    for (uint32_t i = 0; i < nWords; ++i) {
+        hashes[i] = hashWord(words[i]);
+        bucketBegin[bucketOf(hashes[i], nBuckets) + 1]++;
+    }
+    for (uint32_t b = 0; b < nBuckets; ++b) {
+        bucketBegin[b + 1] += bucketBegin[b];
+    }
+
+    std::vector<uint32_t> bucketWords(nWords);
+    {
+        std::vector<uint32_t> pos(bucketBegin.begin(), bucketBegin.end() - 1);
+        for (uint32_t i = 0; i < nWords; ++i) {
+            bucketWords[pos[bucketOf(hashes[i], nBuckets)]++] = i;
+        }
+    }
+
+    auto bucketSize = [&](uint32_t b) { return bucketBegin[b + 1] - bucketBegin[b]; };
+
+    // place the large buckets first, while most slots are still free
+    std::vector<uint32_t> order(nBuckets);
+    for (uint32_t i = 0; i < nBuckets; ++i) {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return bucketSize(a) > bucketSize(b);
+    });
+
+    constexpr uint32_t kEmpty = UINT32_MAX;
+
+    std::vector<uint32_t> slotWord(nSlots, kEmpty);
+    std::vector<uint32_t> candidate;
+
+    impl.seeds.assign(nBuckets, 0);
+    for (const auto b : order) {
+        const uint32_t * bucket = bucketWords.data() + bucketBegin[b];
+        const uint32_t n = bucketSize(b);
+        if (n == 0) {
+            break;
+        }
+
+        // find a seed that maps all words of the bucket to distinct free slots
+        for (uint32_t seed = 0; ; ++seed) {
+            candidate.clear();
+
+            bool ok = true;
+            for (uint32_t i = 0; i < n; ++i) {
+                const auto slot = slotOf(hashes[bucket[i]], seed, nSlots);
+                if (slotWord[slot] != kEmpty || std::find(candidate.begin(), candidate.end(), slot) != candidate.end()) {
+                    ok = false;
+                    break;
+                }
+                candidate.push_back(slot);
+            }
+
+            if (ok) {
+                for (uint32_t i = 0; i < n; ++i) {
+                    slotWord[candidate[i]] = bucket[i];
+                }
+                impl.seeds[b] = seed;
+                break;
+            }
+        }
+    }
+
+    impl.nWords = nWords;
+    impl.offsets.resize(nSlots + 1);
+    impl.arena.clear();
+    for (uint32_t i = 0; i < nSlots; ++i) {
+        impl.offsets[i] = (uint32_t) impl.arena.size();
+        if (slotWord[i] != kEmpty) {
+            impl.arena += words[slotWord[i]];
+        }
+    }
+    impl.offsets[nSlots] = (uint32_t) impl.arena.size();
+    impl.arena.shrink_to_fit();
+}
+
+bool Lexicon::contains(std::string_view word) const {
+    const auto & impl = *m_impl;
+    if (impl.nWords == 0 || word.empty()) {
+        return false;
+    }
+
+    const uint32_t nSlots = (uint32_t) impl.offsets.size() - 1;
+
+    const uint64_t h = hashWord(word);
+    const uint32_t slot = slotOf(h, impl.seeds[bucketOf(h, (uint32_t) impl.seeds.size())], nSlots);
+
+    const uint32_t begin = impl.offsets[slot];
+    const uint32_t end   = impl.offsets[slot + 1];
+
+    return word == std::string_view(impl.arena.data() + begin, end - begin);
+}
+
+size_t Lexicon::size() const {
+    return m_impl->nWords;
+}
+
+size_t Lexicon::memoryUsage() const {
+    return m_impl->seeds.size()*sizeof(uint32_t) + m_impl->offsets.size()*sizeof(uint32_t) + m_impl->arena.size();
+}
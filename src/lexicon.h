@@ -0,0 +1,36 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// immutable set of the valid words, used to validate submissions
+// - the words are indexed by a perfect hash table built with hash-and-displace: a lookup hashes the word,
+//   picks the displacement of its bucket and compares the word with the single candidate in the resulting slot
+// - the words are stored in a single string arena in slot order, so the table needs ~5.5 bytes per word
+//   on top of the characters (about 5 MB for words-alpha.txt)
+// - safe to use from multiple threads once built
+class Lexicon {
+public:
+    Lexicon();
+    ~Lexicon();
+
+    // load the words from a text file with one word per line
+    // returns false if the file cannot be read
+    bool load(const std::string & fileName);
+
+    // build from a list of words, duplicates and empty words are ignored
+    void build(std::vector<std::string_view> words);
+
+    bool contains(std::string_view word) const;
+
+    size_t size() const;
+
+    // bytes used by the table and the word arena
+    size_t memoryUsage() const;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> m_impl;
+};
@@ -0,0 +1,474 @@
+// the-story-load : end-to-end load test of a running the-story daemon
+//
+// replays recorded period files into the pending folder of the daemon and watches the published statistics,
+// measuring how long a submission takes from its pending file to the head document (stats.json)
+//
+// - the records keep their relative timing, compressed by the speed-up factor, and are moved to a fresh period
+//   (-sp), so that the daemon counts all of them as new submissions
+// - a shadow State replays the same records, so the tool knows at which "submissions" count of the head
+//   document each record is included. the latency is measured for the records that increase the count,
+//   i.e. the first submission of a user for a slot in the period
+// - the backlog builds up when the oldest submission not yet published is older than -bl seconds, the sustained
+//   rate is the rate of published submissions until then
+//
+// run the daemon with a scratch data folder, e.g.:
+//   the-story -df /tmp/load/data -p load -pf /tmp/load/pending -sf /tmp/load/stats.json
+//   the-story-load -df ./data -p the-story -pf /tmp/load/pending -sf /tmp/load/stats.json -x 100
+//
+// command line arguments:
+//    -h, --help : print help
+//   -df, --data-folder : folder with the recorded period files
+//    -p, --prefix : prefix of the period files (e.g. "<prefix>-<periodId>.bin")
+//   -fp, --first-period : first period file to replay (default: the first one in the folder)
+//   -lp, --last-period : last period file to replay (default: the last one in the folder)
+//   -pf, --pending-folder : pending folder of the daemon, or comma separated pending folders of ingestion shards,
+//                           each record goes to the shard of its IP (see Shard::ofIP) and -sf is the stats file of the coordinator
+//   -sf, --stats-file : head document published by the daemon
+//    -x, --speed-up : replay speed relative to the recorded timestamps, 0 for as fast as possible (default: 1)
+//    -n, --num-submissions : replay at most this many submissions (default: all)
+//   -sp, --start-period : period to replay the first period file in (default: the current period)
+//   -bl, --backlog : age in seconds of the oldest unpublished submission at which the backlog counts as built up (default: 5)
+//    -t, --timeout : seconds to wait for the last submissions to be published (default: 30)
+
+#include "types.h"
+#include "dictionary.h"
+#include "storage.h"
+#include "shard.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+enum CLIArgument {
+    EHelp,
+    EDataFolder,
+    EPrefix,
+    EFirstPeriod,
+    ELastPeriod,
+    EPendingFolder,
+    EStatsFile,
+    ESpeedUp,
+    ENumSubmissions,
+    EStartPeriod,
+    EBacklog,
+    ETimeout,
+};
+
+using TCLIArguments = std::map<CLIArgument, std::string>;
+
+using Clock = std::chrono::steady_clock;
+
+// the global counters at the start of the head document
+struct Head {
+    int64_t submissions = 0;
+    int32_t nSlots = 0;
+};
+
+bool readValue(const char * buffer, const char * key, int64_t & value) {
+    const char * pos = strstr(buffer, key);
+    if (pos == nullptr) {
+        return false;
+    }
+
+    value = strtoll(pos + strlen(key), nullptr, 10);
+    return true;
+}
+
+// returns false if the file does not exist or is being written
+bool readHead(const std::string & fileName, Head & head) {
+    std::ifstream file(fileName);
+    if (file.is_open() == false) {
+        return false;
+    }
+
+    // the global counters are at the start of the document
+    char buffer[512] = {};
+    file.read(buffer, sizeof(buffer) - 1);
+
+    int64_t nSlots = 0;
+    if (readValue(buffer, "\"submissions\":", head.submissions) == false || readValue(buffer, "\"nSlots\":", nSlots) == false) {
+        return false;
+    }
+    head.nSlots = nSlots;
+
+    return true;
+}
+
+// write a pending file as submit.php does: "t<name>" renamed to "s<name>"
+bool writePendingFile(const std::string & pendingFolder, const SubmissionInput & input, int64_t id) {
+    const auto word = Dictionary::word(input.wordId);
+
+    char text[128];
+    const int n = snprintf(text, sizeof(text), "%u %u.%u.%u.%u %d %d %.*s",
+                           input.timestamp_s,
+                           (input.ip >> 24) & 0xff, (input.ip >> 16) & 0xff, (input.ip >> 8) & 0xff, input.ip & 0xff,
+                           input.slotId, input.userId, (int) word.size(), word.data());
+
+    // zero padded, so that the daemon processes the files in replay order
+    char name[64];
+    snprintf(name, sizeof(name), "load-%012lld", (long long) id);
+
+    const std::string tmpName = pendingFolder + "/t" + name;
+
+    FILE * file = fopen(tmpName.c_str(), "wb");
+    bool ok = file != nullptr && fwrite(text, 1, n, file) == (size_t) n;
+    if ((file && fclose(file) != 0) || ok == false) {
+        fprintf(stderr, "Failed to write '%s'\n", tmpName.c_str());
+        return false;
+    }
+
+    if (std::rename(tmpName.c_str(), (pendingFolder + "/s" + name).c_str()) != 0) {
+        fprintf(stderr, "Failed to rename '%s'\n", tmpName.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+double percentile(const std::vector<double> & sorted, double p) {
+    if (sorted.empty()) {
+        return 0.0;
+    }
+
+    return sorted[std::min(sorted.size() - 1, (size_t) (p*sorted.size()))];
+}
+
+}
+
+TCLIArguments parseCmdArguments(int argc, char ** argv) {
+    const std::map<std::string, CLIArgument> kArgs = {
+        { "-h",                EHelp },
+        { "--help",            EHelp },
+        { "-df",               EDataFolder },
+        { "--data-folder",     EDataFolder },
+        { "-p",                EPrefix },
+        { "--prefix",          EPrefix },
+        { "-fp",               EFirstPeriod },
+        { "--first-period",    EFirstPeriod },
+        { "-lp",               ELastPeriod },
+        { "--last-period",     ELastPeriod },
+        { "-pf",               EPendingFolder },
+        { "--pending-folder",  EPendingFolder },
+        { "-sf",               EStatsFile },
+        { "--stats-file",      EStatsFile },
+        { "-x",                ESpeedUp },
+        { "--speed-up",        ESpeedUp },
+        { "-n",                ENumSubmissions },
+        { "--num-submissions", ENumSubmissions },
+        { "-sp",               EStartPeriod },
+        { "--start-period",    EStartPeriod },
+        { "-bl",               EBacklog },
+        { "--backlog",         EBacklog },
+        { "-t",                ETimeout },
+        { "--timeout",         ETimeout },
+    };
+
+    TCLIArguments res;
+    for (int i = 1; i < argc; ++i) {
+        const auto it = kArgs.find(argv[i]);
+        if (it == kArgs.end()) {
+            fprintf(stderr, "Unknown argument: %s\n", argv[i]);
+            res[EHelp] = "";
+            break;
+        }
+
+        if (it->second == EHelp) {
+            res[EHelp] = "";
+            break;
+        }
+
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Missing value for argument: %s\n", argv[i]);
+            res[EHelp] = "";
+            break;
+        }
+
+        res[it->second] = argv[++i];
+    }
+
+    return res;
+}
+
+void printHelp(const char * name) {
+    printf("Usage: %s -df <data-folder> -p <prefix> -pf <pending-folder> -sf <stats-file> [options]\n", name);
+    printf("Options:\n");
+    printf("   -h, --help : print help\n");
+    printf("  -df, --data-folder : folder with the recorded period files\n");
+    printf("   -p, --prefix : prefix of the period files (e.g. \"<prefix>-<periodId>.bin\")\n");
+    printf("  -fp, --first-period : first period file to replay (default: the first one in the folder)\n");
+    printf("  -lp, --last-period : last period file to replay (default: the last one in the folder)\n");
+    printf("  -pf, --pending-folder : pending folder of the daemon, or comma separated pending folders of ingestion shards,\n");
+    printf("                          each record goes to the shard of its IP and -sf is the stats file of the coordinator\n");
+    printf("  -sf, --stats-file : head document published by the daemon\n");
+    printf("   -x, --speed-up : replay speed relative to the recorded timestamps, 0 for as fast as possible (default: 1)\n");
+    printf("   -n, --num-submissions : replay at most this many submissions (default: all)\n");
+    printf("  -sp, --start-period : period to replay the first period file in (default: the current period)\n");
+    printf("  -bl, --backlog : age in seconds of the oldest unpublished submission at which the backlog counts as built up (default: 5)\n");
+    printf("   -t, --timeout : seconds to wait for the last submissions to be published (default: 30)\n");
+}
+
+int main(int argc, char ** argv) {
+    const auto args = parseCmdArguments(argc, argv);
+    if (args.count(EHelp) || args.count(EDataFolder) == 0 || args.count(EPrefix) == 0 ||
+        args.count(EPendingFolder) == 0 || args.count(EStatsFile) == 0) {
+        printHelp(argv[0]);
+        return args.count(EHelp) ? 0 : 1;
+    }
+
+    const std::string dataFolder    = args.at(EDataFolder);
+    const std::string prefix        = args.at(EPrefix);
+    std::vector<std::string> pendingFolders;
+    {
+        const std::string & list = args.at(EPendingFolder);
+        for (size_t pos = 0; pos <= list.size(); ) {
+            const size_t end = std::min(list.find(',', pos), list.size());
+            if (end > pos) {
+                pendingFolders.push_back(list.substr(pos, end - pos));
+            }
+            pos = end + 1;
+        }
+    }
+    if (pendingFolders.empty()) {
+        printHelp(argv[0]);
+        return 1;
+    }
+    const std::string statsFile     = args.at(EStatsFile);
+
+    const double speedUp    = args.count(ESpeedUp) ? std::stod(args.at(ESpeedUp)) : 1.0;
+    const double backlog_s  = args.count(EBacklog) ? std::stod(args.at(EBacklog)) : 5.0;
+    const double timeout_s  = args.count(ETimeout) ? std::stod(args.at(ETimeout)) : 30.0;
+    const int64_t nMax      = args.count(ENumSubmissions) ? std::stoll(args.at(ENumSubmissions)) : INT64_MAX;
+    const TPeriodId startPeriodId = args.count(EStartPeriod) ?
+        std::stoi(args.at(EStartPeriod)) : (TPeriodId) (time(nullptr)/State::secondsInPeriod);
+
+    // the recorded period files, in period order
+    std::map<TPeriodId, std::string> periodFiles;
+    for (const auto & entry : std::filesystem::directory_iterator(dataFolder)) {
+        const auto fileName = entry.path().filename().string();
+        if (fileName.rfind(prefix + "-", 0) != 0 || entry.path().extension() != ".bin") {
+            continue;
+        }
+
+        const TPeriodId periodId = Storage::periodIdFromFileName(fileName);
+        if (periodId < 0 ||
+            (args.count(EFirstPeriod) && periodId < std::stoi(args.at(EFirstPeriod))) ||
+            (args.count(ELastPeriod)  && periodId > std::stoi(args.at(ELastPeriod)))) {
+            continue;
+        }
+        periodFiles[periodId] = entry.path().string();
+    }
+
+    if (periodFiles.empty()) {
+        fprintf(stderr, "No period files '%s-*.bin' in '%s'\n", prefix.c_str(), dataFolder.c_str());
+        return 1;
+    }
+
+    Head head;
+    if (readHead(statsFile, head) == false) {
+        fprintf(stderr, "Failed to read '%s', is the daemon running?\n", statsFile.c_str());
+        return 1;
+    }
+
+    // load the records and move them to the replay periods
+    const TPeriodId firstPeriodId = periodFiles.begin()->first;
+
+    std::vector<SubmissionInput> inputs;
+    for (const auto & [periodId, fileName] : periodFiles) {
+        auto entries = Storage::deserializeAll(fileName);
+        printf("Loaded %d submissions from '%s'\n", (int) entries.size(), fileName.c_str());
+
+        const TTimestamp shift = (TTimestamp) (startPeriodId - firstPeriodId)*State::secondsInPeriod;
+        for (auto & entry : entries) {
+            entry.timestamp_s += shift;
+        }
+        inputs.insert(inputs.end(), entries.begin(), entries.end());
+
+        if ((int64_t) inputs.size() >= nMax) {
+            inputs.resize(nMax);
+            break;
+        }
+    }
+
+    // the head document count at which each record is published
+    // the shadow starts with the slots of the daemon, so that every record is accepted by both
+    State shadow;
+    shadow.init();
+    shadow.resizeSlots(head.nSlots);
+    shadow.curPeriodId = inputs.empty() ? startPeriodId : inputs.front().timestamp_s/State::secondsInPeriod;
+
+    // for each measured record: its index in inputs
+    std::vector<int64_t> measured;
+    for (int64_t i = 0; i < (int64_t) inputs.size(); ++i) {
+        const auto nBefore = shadow.statistics.submissions;
+        if (shadow.submit(inputs[i], nullptr) == false) {
+            fprintf(stderr, "The records are not valid for the slots of the daemon, replay the period files from the first one\n");
+            return 1;
+        }
+        if (shadow.statistics.submissions > nBefore) {
+            measured.push_back(i);
+        }
+    }
+
+    printf("Replaying %d submissions (%d measured) at %gx, starting with period %d\n",
+           (int) inputs.size(), (int) measured.size(), speedUp, startPeriodId);
+
+    // send times of the measured records, published to the watcher by nSent
+    std::vector<double> tSent(measured.size());
+    std::atomic<int64_t> nSent { 0 };
+    std::atomic<int64_t> nSentRecords { 0 };
+    std::atomic<bool> sending { true };
+    std::atomic<bool> failed { false };
+
+    const auto tStart = Clock::now();
+    const auto elapsed = [&]() { return std::chrono::duration<double>(Clock::now() - tStart).count(); };
+
+    double maxLag_s = 0.0;
+
+    std::thread sender([&]() {
+        const TTimestamp t0 = inputs.empty() ? 0 : inputs.front().timestamp_s;
+
+        int64_t iMeasured = 0;
+        for (int64_t i = 0; i < (int64_t) inputs.size(); ++i) {
+            if (speedUp > 0.0) {
+                const double due_s = (inputs[i].timestamp_s - t0)/speedUp;
+                const double now_s = elapsed();
+                if (due_s > now_s) {
+                    std::this_thread::sleep_for(std::chrono::duration<double>(due_s - now_s));
+                } else {
+                    maxLag_s = std::max(maxLag_s, now_s - due_s);
+                }
+            }
+
+            const auto & pendingFolder = pendingFolders[Shard::ofIP(inputs[i].ip, (int32_t) pendingFolders.size())];
+            if (writePendingFile(pendingFolder, inputs[i], i) == false) {
+                failed = true;
+                break;
+            }
+
+            if (iMeasured < (int64_t) measured.size() && measured[iMeasured] == i) {
+                tSent[iMeasured] = elapsed();
+                nSent.store(++iMeasured, std::memory_order_release);
+            }
+            nSentRecords.store(i + 1, std::memory_order_relaxed);
+        }
+
+        sending = false;
+    });
+
+    // watch the head document
+    std::vector<double> latencies;
+    latencies.reserve(measured.size());
+
+    int64_t nPublished = 0;
+    double tLastPublished = 0.0;
+
+    // the state of the last report
+    double tReport = 0.0;
+    int64_t nSentRecordsReport = 0;
+    int64_t nPublishedRecordsReport = 0;
+    size_t nLatenciesReport = 0;
+
+    // published records and time when the backlog first built up, -1 if it did not
+    int64_t nPublishedRecordsBacklog = -1;
+    double tBacklog = -1.0;
+
+    std::filesystem::file_time_type lastWrite;
+
+    printf("\n");
+    printf("%8s %12s %12s %10s %12s %12s\n", "time [s]", "sent/s", "published/s", "backlog", "p50 [ms]", "p99 [ms]");
+
+    while (true) {
+        const double now_s = elapsed();
+        const int64_t nSentNow = nSent.load(std::memory_order_acquire);
+
+        std::error_code ec;
+        const auto curWrite = std::filesystem::last_write_time(statsFile, ec);
+
+        Head cur;
+        if (!ec && curWrite != lastWrite && readHead(statsFile, cur)) {
+            lastWrite = curWrite;
+
+            const int64_t n = std::min(nSentNow, cur.submissions - head.submissions);
+            for (; nPublished < n; ++nPublished) {
+                latencies.push_back(now_s - tSent[nPublished]);
+            }
+            if (n > 0) {
+                tLastPublished = now_s;
+            }
+        }
+
+        const int64_t nPublishedRecords = nPublished > 0 ? measured[nPublished - 1] + 1 : 0;
+
+        // the oldest measured record that is not published yet
+        if (tBacklog < 0.0 && nPublished < nSentNow && now_s - tSent[nPublished] > backlog_s) {
+            tBacklog = now_s;
+            nPublishedRecordsBacklog = nPublishedRecords;
+        }
+
+        if (now_s - tReport >= 1.0) {
+            const double dt = now_s - tReport;
+            const int64_t nSentRecordsNow = nSentRecords.load(std::memory_order_relaxed);
+
+            std::vector<double> recent(latencies.begin() + nLatenciesReport, latencies.end());
+            std::sort(recent.begin(), recent.end());
+
+            printf("%8.1f %12.0f %12.0f %10d %12.1f %12.1f\n", now_s,
+                   (nSentRecordsNow - nSentRecordsReport)/dt,
+                   (nPublishedRecords - nPublishedRecordsReport)/dt,
+                   (int) (nSentRecordsNow - nPublishedRecords),
+                   1e3*percentile(recent, 0.50), 1e3*percentile(recent, 0.99));
+
+            tReport = now_s;
+            nSentRecordsReport = nSentRecordsNow;
+            nPublishedRecordsReport = nPublishedRecords;
+            nLatenciesReport = latencies.size();
+        }
+
+        if (nPublished == (int64_t) measured.size() || failed) {
+            break;
+        }
+
+        // the daemon is not catching up, e.g. because it rejects some of the records
+        const double tLastSent = nSentNow > 0 ? tSent[nSentNow - 1] : 0.0;
+        if (sending == false && now_s - std::max(tLastPublished, tLastSent) > timeout_s) {
+            fprintf(stderr, "Timeout: %d of %d measured submissions not published\n",
+                    (int) (measured.size() - nPublished), (int) measured.size());
+            break;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    sender.join();
+
+    const int64_t nPublishedRecords = nPublished > 0 ? measured[nPublished - 1] + 1 : 0;
+
+    std::sort(latencies.begin(), latencies.end());
+
+    printf("\n");
+    printf("Submissions sent:      %d, max lag behind the schedule: %.3f s\n", (int) nSentRecords.load(), maxLag_s);
+    printf("Submissions published: %d\n", (int) nPublishedRecords);
+    printf("Latency:               p50 %.1f ms, p99 %.1f ms, max %.1f ms (%d measured)\n",
+           1e3*percentile(latencies, 0.50), 1e3*percentile(latencies, 0.99),
+           latencies.empty() ? 0.0 : 1e3*latencies.back(), (int) latencies.size());
+
+    if (tBacklog < 0.0) {
+        printf("Sustained:             %.0f submissions/s, no backlog\n", nPublishedRecords/std::max(tLastPublished, 1e-9));
+    } else {
+        printf("Sustained:             %.0f submissions/s, the backlog built up after %.1f s\n",
+               nPublishedRecordsBacklog/std::max(tBacklog, 1e-9), tBacklog);
+    }
+
+    return failed || nPublished < (int64_t) measured.size() ? 2 : 0;
+}
@@ -4,42 +4,18 @@
 #include "types.h"
 #include "utils.h"
 #include "generator.h"
+#include "watcher.h"
+#include "storage.h"
+#include "lexicon.h"
+#include "worker_pool.h"
+#include "story.h"
 
 #include <cstdio>
 #include <chrono>
 #include <thread>
-#include <regex>
-#include <functional>
+#include <fstream>
 #include <filesystem>
-
-// get files in folder by regex
-std::vector<std::string> getFiles(const std::string & folder, const std::string & regex) {
-    std::vector<std::string> files;
-
-    for (const auto & entry : std::filesystem::directory_iterator(folder)) {
-        if (entry.is_regular_file()) {
-            std::regex r(regex);
-            if (std::regex_match(entry.path().string(), r)) {
-                files.push_back(entry.path().string());
-            }
-        }
-    }
-
-    return files;
-}
-
-// remove files
-int removeFiles(const std::vector<std::string> & files) {
-    int count = 0;
-
-    for (const auto & file : files) {
-        if (std::filesystem::remove(file)) {
-            count++;
-        }
-    }
-
-    return count;
-}
+#include <set>
 
 // rename file
 bool renameFile(const std::string & oldName, const std::string & newName) {
@@ -53,66 +29,31 @@ bool renameFile(const std::string & oldName, const std::string & newName) {
     return true;
 }
 
-// serialize vector of SubmissionInput to a binary file
-void serialize(const std::vector<SubmissionInput> & entries, const std::string & fileName) {
-    std::ofstream file(fileName, std::ios::binary);
-
-    // output number of elements
-    const size_t numElements = entries.size();
-    file.write((char *)&numElements, sizeof(numElements));
-
-    // output each element
-    for (const auto & entry : entries) {
-        entry.serialize(file);
-    }
-}
-
-// get SubmissionInput vector from a binary file
-std::vector<SubmissionInput> deserializeAll(const std::string & fileName) {
-    std::vector<SubmissionInput> entries;
-
-    std::ifstream file(fileName, std::ios::binary);
-
-    // read number of elements
-    size_t numElements;
-    file.read((char *)&numElements, sizeof(numElements));
-    entries.resize(numElements);
-
-    // read each element
-    for (uint32_t i = 0; i < numElements; ++i) {
-        entries[i].deserialize(file);
-    }
-
-    return entries;
-}
-
-SubmissionInput deserializeOne(const std::string & fileName) {
-    std::ifstream file(fileName);
-
-    SubmissionInput entry;
-    file >> entry.timestamp_s;
-    {
-        std::string tmp;
-        file >> tmp;
-        convertIPAddress(tmp, entry.ip);
-    }
-    file >> entry.slotId;
-    file >> entry.userId;
-    file >> entry.word;
-
-    return entry;
-}
-
 // command line arguments:
 //    -h, --help : print help
 //    -p, --prefix : input file prefix (e.g. "<prefix>-<periodId>.bin")
 //   -os, --statistics-output : statistics output file (e.g. "stats.json")
 //   -tv, --top-voted : number of top voted words to output for a slot (e.g. "10")
 //   -ns, --num-submissions : number of submissions to generete (e.g. "100000")
-//   -sf, --stats-file : output filename for statistics (e.g. "stats.json")
+//   -sf, --stats-file : output filename for statistics (e.g. "stats.json"), the slot chunks are written next to it
 //  -sim, --simulation : run simulation
 //   -df, --data-folder : data folder with binary input files
 //   -pf, --pending-folder : folder with pending submissions
+//   -wf, --words-file : dictionary file with one word per line (e.g. "words-alpha.txt"), submissions of other words are rejected
+//   -us, --unix-socket : accept submissions on a Unix domain socket (e.g. "/tmp/the-story.sock")
+//   -tp, --tcp-port : accept submissions on a loopback TCP port (e.g. "7001")
+//   -hp, --http-port : serve the statistics from memory over HTTP on a loopback TCP port (e.g. "8001")
+//   -fs, --fsync : fsync policy for the submission log: "batch", "none" or "<N>ms" (default: "batch")
+//   -si, --snapshot-interval : also write a state snapshot every N minutes (default: only at period rollover)
+//   -cv, --convert : convert the legacy period files in the data folder to the current format
+//    -j, --threads : number of threads for replaying the period files on startup (default: 1)
+//   -mf, --metrics-file : write runtime metrics in the Prometheus text format to this file every second (e.g. "the-story.prom")
+//   -cf, --config : run the stories of this config file in a single process, see loadConfig()
+//    -w, --workers : number of worker threads shared by the stories (default: 3 per story, up to the number of cores)
+//   -cp, --coordinator-port : run as an ingestion shard, sending the changes of the state to the coordinator on this loopback TCP port
+//   -sp, --shard-port : run as the coordinator of the ingestion shards that connect on this loopback TCP port, see shard.h
+//   -fo, --follow : follow the daemon that writes the data folder and prefix as a read replica, or as a hot standby that takes over
+//                   when the daemon stops if a pending folder or an ingest endpoint is given, see Story
 
 // define an enum for the command line arguments
 // parse the command line arguments into a map of the enum and the argument as a string
@@ -127,52 +68,45 @@ enum CLIArgument {
     ESimulate,
     EDataFolder,
     EPendingFolder,
+    EWordsFile,
+    EUnixSocket,
+    ETCPPort,
+    EHttpPort,
+    EFsync,
+    ESnapshotInterval,
+    EConvert,
+    EThreads,
+    EMetricsFile,
+    EConfig,
+    EWorkers,
+    ECoordinatorPort,
+    EShardPort,
+    EFollow,
 };
 
 using TCLIArguments = std::map<CLIArgument, std::string>;
 
-// return last processed periodId
-TPeriodId processOld(State & state, const std::string & dataFolder, const std::string & prefix) {
-    TPeriodId lastPeriodId = 0;
-
-    // check if data folder exists
-    if (!std::filesystem::exists(dataFolder)) {
-        printf("Error: data folder \"%s\" does not exist\n", dataFolder.c_str());
-        return lastPeriodId;
-    }
-
-    printf("Reading input files from '%s'\n", dataFolder.c_str());
-    printf("Input file prefix: '%s'\n", prefix.c_str());
 
-    // get all files in the data folder and sort them by name
-    std::vector<std::string> files = getFiles(dataFolder, ".*" + prefix + "-\\d+\\.bin");
-
-    // sort the files by name
-    std::sort(files.begin(), files.end());
+size_t getTopVoted(const TCLIArguments & args) {
+    return args.count(CLIArgument::ETopVoted) ? std::stoi(args.at(CLIArgument::ETopVoted)) : 10;
+}
 
-    printf("Found %lu files\n", files.size());
-    for (const auto & file : files) {
-        printf("Processing data from '%s' ...\n", file.c_str());
-        std::vector<SubmissionInput> entries = deserializeAll(file);
-
-        for (auto & entry : entries) {
-            printf(" - processing word: '%s'\n", entry.word.c_str());
-            state.submit(std::move(entry), [&](TPeriodId periodId) {
-                lastPeriodId = periodId;
-            });
-        }
-    }
+int getThreads(const TCLIArguments & args) {
+    return args.count(CLIArgument::EThreads) ? std::max(1, std::stoi(args.at(CLIArgument::EThreads))) : 1;
+}
 
-    return lastPeriodId;
+std::string getStatsFile(const TCLIArguments & args) {
+    return args.count(CLIArgument::EStatsFile) ? args.at(CLIArgument::EStatsFile) : "stats.json";
 }
 
+// write the complete statistics to a single file
 void writeStats(const State & state, const TCLIArguments & args) {
-    const size_t nTopWordsPerSlot = args.count(CLIArgument::ETopVoted) ? std::stoi(args.at(CLIArgument::ETopVoted)) : 10;
-    const std::string statsFile = args.count(CLIArgument::EStatsFile) ? args.at(CLIArgument::EStatsFile) : "stats.json";
+    const std::string statsFile = getStatsFile(args);
 
     printf("Writing statistics to '%s'\n", statsFile.c_str());
-    state.output(statsFile + ".tmp", nTopWordsPerSlot);
-    renameFile(statsFile + ".tmp", statsFile);
+    if (state.output(statsFile + ".tmp")) {
+        renameFile(statsFile + ".tmp", statsFile);
+    }
 }
 
 int runSimulation(State state, TCLIArguments args) {
@@ -180,7 +114,7 @@ int runSimulation(State state, TCLIArguments args) {
 
     // if data folder and prefix are specified, read and process the input files
     if (args.count(CLIArgument::EDataFolder) && args.count(CLIArgument::EPrefix)) {
-        lastPeriodId = processOld(state, args.at(CLIArgument::EDataFolder), args.at(CLIArgument::EPrefix));
+        lastPeriodId = processOld(state, args.at(CLIArgument::EDataFolder), args.at(CLIArgument::EPrefix), getThreads(args));
     } else {
         printf("Skipping data processing.\n");
     }
@@ -208,13 +142,10 @@ int runSimulation(State state, TCLIArguments args) {
                 const std::string prefix = args.at(CLIArgument::EPrefix);
 
                 // serialize the current period input
-                // periodId in the filename is padded to 5 digits
-                const auto periodIdStr = std::to_string(periodId);
-                const auto periodIdStrPadded = std::string(5 - periodIdStr.size(), '0') + periodIdStr;
-                const std::string fileName = dataFolder + "/" + prefix + "-" + periodIdStrPadded + ".bin";
-
-                serialize(curPeriodInput, fileName);
+                Storage::serialize(curPeriodInput, Storage::periodFileName(dataFolder, prefix, periodId));
             }
+
+            curPeriodInput.clear();
         });
 
         curPeriodInput.push_back(std::move(input));
@@ -229,88 +160,387 @@ int runSimulation(State state, TCLIArguments args) {
         printf("Time to process %d submissions: %.3f s\n", nSubmissions, std::chrono::duration<double>(tEnd - tStart).count());
     }
 
-    state.update();
+    state.update(getTopVoted(args));
     writeStats(state, args);
 
     return 0;
 }
 
-int run(State state, TCLIArguments args) {
-    TPeriodId lastPeriodId = 0;
+int runConvert(TCLIArguments args) {
+    const auto & dataFolder = args.at(CLIArgument::EDataFolder);
+    const auto & prefix = args.at(CLIArgument::EPrefix);
 
-    // if data folder and prefix are specified, read and process the input files
-    if (args.count(CLIArgument::EDataFolder) && args.count(CLIArgument::EPrefix)) {
-        lastPeriodId = processOld(state, args.at(CLIArgument::EDataFolder), args.at(CLIArgument::EPrefix));
-    } else {
-        printf("Skipping data processing.\n");
+    auto files = Utils::getFiles(dataFolder, prefix + "-\\d+\\.bin");
+    std::sort(files.begin(), files.end());
+
+    int nConverted = 0;
+    for (const auto & file : files) {
+        if (Storage::isLegacy(file) == false) {
+            continue;
+        }
+
+        const auto sizeOld = std::filesystem::file_size(file);
+        if (Storage::convert(file) == false) {
+            fprintf(stderr, "Failed to convert '%s'\n", file.c_str());
+            return 1;
+        }
+        const auto sizeNew = std::filesystem::file_size(file);
+
+        printf("Converted '%s' (%lu -> %lu bytes)\n", file.c_str(), (unsigned long) sizeOld, (unsigned long) sizeNew);
+        nConverted++;
     }
 
-    printf("Last period id: %d\n", lastPeriodId);
+    printf("Converted %d of %d files\n", nConverted, (int) files.size());
 
-    std::vector<SubmissionInput> curPeriodInput;
+    return 0;
+}
 
-    state.update();
-    writeStats(state, args);
+// options that can be set for each story in the config file, by their long name
+const std::map<std::string, CLIArgument> kStoryOptions = {
+    { "data-folder",       CLIArgument::EDataFolder },
+    { "prefix",            CLIArgument::EPrefix },
+    { "pending-folder",    CLIArgument::EPendingFolder },
+    { "stats-file",        CLIArgument::EStatsFile },
+    { "words-file",        CLIArgument::EWordsFile },
+    { "unix-socket",       CLIArgument::EUnixSocket },
+    { "tcp-port",          CLIArgument::ETCPPort },
+    { "http-port",         CLIArgument::EHttpPort },
+    { "top-voted",         CLIArgument::ETopVoted },
+    { "fsync",             CLIArgument::EFsync },
+    { "snapshot-interval", CLIArgument::ESnapshotInterval },
+    { "metrics-file",      CLIArgument::EMetricsFile },
+    { "coordinator-port",  CLIArgument::ECoordinatorPort },
+    { "shard-port",        CLIArgument::EShardPort },
+    { "follow",            CLIArgument::EFollow },
+};
 
-    while (true) {
-        auto files = getFiles(args.at(CLIArgument::EPendingFolder), ".*s.*");
-
-        if (files.size() > 0) {
-            // sort the files by name
-            std::sort(files.begin(), files.end());
-
-            for (int i = 0; i < (int) files.size(); ++i) {
-                const auto & fileName = files[i];
-                printf("Processing pending submission from '%s' ...\n", fileName.c_str());
-
-                auto entry = deserializeOne(fileName);
-
-                printf("word = '%s'\n", entry.word.c_str());
-                state.submit(entry, [&](TPeriodId periodId) {
-                    printf("New period has started, old period id: %d\n", periodId);
-
-                    if (curPeriodInput.empty()) {
-                        printf("No submissions in current period.\n");
-                        return;
-                    }
-
-                    if (args.count(CLIArgument::EDataFolder) && args.count(CLIArgument::EPrefix)) {
-                        const std::string dataFolder = args.at(CLIArgument::EDataFolder);
-                        const std::string prefix = args.at(CLIArgument::EPrefix);
-
-                        // serialize the current period input
-                        // periodId in the filename is padded to 5 digits
-                        const auto periodIdStr = std::to_string(periodId);
-                        const auto periodIdStrPadded = std::string(5 - periodIdStr.size(), '0') + periodIdStr;
-                        const std::string fileName = dataFolder + "/" + prefix + "-" + periodIdStrPadded + ".bin";
-
-                        printf("Writing %lu entries to file '%s'\n", curPeriodInput.size(), fileName.c_str());
-                        serialize(curPeriodInput, fileName);
-                        curPeriodInput.clear();
-                    } else {
-                        printf("Skipping input storage\n");
-                    }
-                });
-                curPeriodInput.push_back(std::move(entry));
+// command line options that are the defaults of the stories in the config file
+const std::vector<CLIArgument> kStoryDefaults = {
+    CLIArgument::EWordsFile,
+    CLIArgument::ETopVoted,
+    CLIArgument::EFsync,
+    CLIArgument::ESnapshotInterval,
+    CLIArgument::EThreads,
+};
+
+// read the stories from a config file with a section for each story:
+//
+//   # comment
+//   [en]
+//   data-folder = ./data-en
+//   prefix = the-story
+//   pending-folder = ./pending-en
+//   stats-file = ./www/en/stats.json
+//
+// returns false if the file cannot be read or is not valid
+bool loadConfig(const std::string & fileName, const TCLIArguments & args, std::vector<std::pair<std::string, TCLIArguments>> & stories) {
+    std::ifstream file(fileName);
+    if (file.is_open() == false) {
+        fprintf(stderr, "Failed to open config file '%s'\n", fileName.c_str());
+        return false;
+    }
+
+    auto trim = [](const std::string & str) {
+        const auto begin = str.find_first_not_of(" \t\r");
+        const auto end = str.find_last_not_of(" \t\r");
+        return begin == std::string::npos ? std::string() : str.substr(begin, end - begin + 1);
+    };
+
+    std::string line;
+    int lineId = 0;
+    while (std::getline(file, line)) {
+        lineId++;
+
+        line = trim(line);
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        if (line.front() == '[' && line.back() == ']') {
+            const std::string name = trim(line.substr(1, line.size() - 2));
+            if (name.empty()) {
+                fprintf(stderr, "%s:%d: empty story name\n", fileName.c_str(), lineId);
+                return false;
+            }
+            for (const auto & story : stories) {
+                if (story.first == name) {
+                    fprintf(stderr, "%s:%d: duplicate story '%s'\n", fileName.c_str(), lineId, name.c_str());
+                    return false;
+                }
+            }
+
+            TCLIArguments storyArgs;
+            for (const auto & arg : kStoryDefaults) {
+                if (args.count(arg)) {
+                    storyArgs[arg] = args.at(arg);
+                }
             }
 
-            {
-                printf("Removing %d files\n", (int) files.size());
+            stories.emplace_back(name, std::move(storyArgs));
+            continue;
+        }
+
+        const auto pos = line.find('=');
+        if (pos == std::string::npos || stories.empty()) {
+            fprintf(stderr, "%s:%d: expected '[<story>]' or '<option> = <value>'\n", fileName.c_str(), lineId);
+            return false;
+        }
+
+        const std::string key = trim(line.substr(0, pos));
+        if (kStoryOptions.count(key) == 0) {
+            fprintf(stderr, "%s:%d: unknown option '%s'\n", fileName.c_str(), lineId, key.c_str());
+            return false;
+        }
+
+        stories.back().second[kStoryOptions.at(key)] = trim(line.substr(pos + 1));
+    }
+
+    if (stories.empty()) {
+        fprintf(stderr, "No stories in config file '%s'\n", fileName.c_str());
+        return false;
+    }
+
+    // the stories must not share any of their files
+    for (int i = 0; i < (int) stories.size(); ++i) {
+        const auto & [name, storyArgs] = stories[i];
+        if (storyArgs.count(CLIArgument::ECoordinatorPort) && storyArgs.count(CLIArgument::EShardPort)) {
+            fprintf(stderr, "Story '%s' cannot be both a shard and the coordinator\n", name.c_str());
+            return false;
+        }
+
+        if (storyArgs.count(CLIArgument::EFollow) && (storyArgs.count(CLIArgument::ECoordinatorPort) || storyArgs.count(CLIArgument::EShardPort))) {
+            fprintf(stderr, "Story '%s' cannot follow another daemon and be a shard or the coordinator\n", name.c_str());
+            return false;
+        }
 
-                const auto nRemoved = removeFiles(files);
-                if (nRemoved != (int) files.size()) {
-                    fprintf(stderr, "Warning: %lu files were not removed\n", files.size() - nRemoved);
+        if (storyArgs.count(CLIArgument::EFollow) && (storyArgs.count(CLIArgument::EDataFolder) == 0 || storyArgs.count(CLIArgument::EPrefix) == 0)) {
+            fprintf(stderr, "Story '%s' has no data folder and prefix to follow\n", name.c_str());
+            return false;
+        }
+
+        if (storyArgs.count(CLIArgument::EPendingFolder) == 0 && storyArgs.count(CLIArgument::EShardPort) == 0 && storyArgs.count(CLIArgument::EFollow) == 0) {
+            fprintf(stderr, "Story '%s' has no pending folder\n", name.c_str());
+            return false;
+        }
+
+        for (int j = 0; j < i; ++j) {
+            const auto & other = stories[j].second;
+            for (const auto & arg : { CLIArgument::EPendingFolder, CLIArgument::EStatsFile, CLIArgument::EUnixSocket, CLIArgument::ETCPPort, CLIArgument::EHttpPort, CLIArgument::EMetricsFile, CLIArgument::EShardPort }) {
+                if (storyArgs.count(arg) && other.count(arg) && storyArgs.at(arg) == other.at(arg)) {
+                    fprintf(stderr, "Stories '%s' and '%s' have the same '%s'\n", stories[j].first.c_str(), name.c_str(), storyArgs.at(arg).c_str());
+                    return false;
                 }
             }
+            if (getStatsFile(storyArgs) == getStatsFile(other)) {
+                fprintf(stderr, "Stories '%s' and '%s' have the same stats file\n", stories[j].first.c_str(), name.c_str());
+                return false;
+            }
+            if (storyArgs.count(CLIArgument::EDataFolder) && storyArgs.count(CLIArgument::EPrefix) &&
+                other.count(CLIArgument::EDataFolder) && other.count(CLIArgument::EPrefix) &&
+                std::filesystem::path(storyArgs.at(CLIArgument::EDataFolder)) / storyArgs.at(CLIArgument::EPrefix) ==
+                std::filesystem::path(other.at(CLIArgument::EDataFolder)) / other.at(CLIArgument::EPrefix)) {
+                fprintf(stderr, "Stories '%s' and '%s' have the same data folder and prefix\n", stories[j].first.c_str(), name.c_str());
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
 
-            state.update();
-            writeStats(state, args);
+// the parameters of a story from its command line or config file arguments
+// returns false if they are not valid
+bool getStoryParameters(const TCLIArguments & args, Story::Parameters & parameters) {
+    if (args.count(CLIArgument::EDataFolder) && args.count(CLIArgument::EPrefix)) {
+        parameters.dataFolder = args.at(CLIArgument::EDataFolder);
+        parameters.prefix = args.at(CLIArgument::EPrefix);
+    }
+
+    if (args.count(CLIArgument::EPendingFolder)) {
+        parameters.pendingFolder = args.at(CLIArgument::EPendingFolder);
+    }
+
+    parameters.statsFile = getStatsFile(args);
+    parameters.topVoted = getTopVoted(args);
+
+    if (args.count(CLIArgument::EUnixSocket)) {
+        parameters.unixSocketPath = args.at(CLIArgument::EUnixSocket);
+    }
+    if (args.count(CLIArgument::ETCPPort)) {
+        parameters.tcpPort = std::stoi(args.at(CLIArgument::ETCPPort));
+    }
+    if (args.count(CLIArgument::EHttpPort)) {
+        parameters.httpPort = std::stoi(args.at(CLIArgument::EHttpPort));
+    }
+
+    if (args.count(CLIArgument::EFsync)) {
+        SubmissionLog::Parameters logParameters;
+        if (SubmissionLog::parseFsyncPolicy(args.at(CLIArgument::EFsync), logParameters) == false) {
+            fprintf(stderr, "Invalid fsync policy '%s'\n", args.at(CLIArgument::EFsync).c_str());
+            return false;
         }
+        parameters.fsyncPolicy = logParameters.fsyncPolicy;
+        parameters.fsyncInterval_ms = logParameters.fsyncInterval_ms;
+    }
 
-        std::this_thread::sleep_for(std::chrono::seconds(1));
+    if (args.count(CLIArgument::ESnapshotInterval)) {
+        parameters.snapshotInterval_ms = 60*1000*std::stoi(args.at(CLIArgument::ESnapshotInterval));
     }
 
-    return 0;
+    parameters.nThreads = getThreads(args);
+
+    if (args.count(CLIArgument::EMetricsFile)) {
+        parameters.metricsFile = args.at(CLIArgument::EMetricsFile);
+    }
+
+    if (args.count(CLIArgument::ECoordinatorPort)) {
+        parameters.coordinatorPort = std::stoi(args.at(CLIArgument::ECoordinatorPort));
+    }
+    if (args.count(CLIArgument::EShardPort)) {
+        parameters.shardPort = std::stoi(args.at(CLIArgument::EShardPort));
+    }
+
+    parameters.follow = args.count(CLIArgument::EFollow) > 0;
+
+    return true;
+}
+
+// run the stories until the process is stopped or one of the stories stops, returns the exit code of the process
+// the stories share one watcher for their pending folders and one pool of workers for their pipelines
+int run(std::vector<std::pair<std::string, TCLIArguments>> config, int nWorkers) {
+    constexpr int kReportInterval_ms = 10000;
+
+    WorkerPool pool(nWorkers);
+
+    // a story that stops wakes up the loop below
+    Watcher watcher;
+
+    // stories with the same words file share the lexicon, it is destroyed after the stories that use it
+    std::map<std::string, std::unique_ptr<Lexicon>> lexicons;
+
+    std::vector<std::unique_ptr<Story>> stories;
+
+    for (const auto & [name, args] : config) {
+        if (name.empty() == false) {
+            printf("Starting story '%s'\n", name.c_str());
+        }
+
+        Story::Parameters parameters;
+        if (getStoryParameters(args, parameters) == false) {
+            return 5;
+        }
+
+        if (args.count(CLIArgument::EWordsFile)) {
+            const auto & fileName = args.at(CLIArgument::EWordsFile);
+
+            auto & entry = lexicons[fileName];
+            if (entry == nullptr) {
+                const auto tStart = std::chrono::steady_clock::now();
+
+                entry = std::make_unique<Lexicon>();
+                if (entry->load(fileName) == false) {
+                    fprintf(stderr, "Failed to load words file '%s'\n", fileName.c_str());
+                    return 3;
+                }
+
+                const auto tEnd = std::chrono::steady_clock::now();
+                printf("Built lexicon with %lu words in %.3f s, %.1f MB\n",
+                       entry->size(), std::chrono::duration<double>(tEnd - tStart).count(), entry->memoryUsage()/1024.0/1024.0);
+            }
+            parameters.lexicon = entry.get();
+        }
+
+        stories.push_back(std::make_unique<Story>(name, std::move(parameters), pool, [&watcher]() { watcher.wake(); }));
+
+        const int res = stories.back()->init();
+        if (res != 0) {
+            return res;
+        }
+    }
+
+    // start watching before the initial scan so that no submission is missed
+    for (const auto & story : stories) {
+        if (story->pendingFolder().empty()) {
+            continue;
+        }
+        watcher.add(story->pendingFolder());
+        printf("%sWatching '%s' for submissions (%s)\n", story->tag().c_str(), story->pendingFolder().c_str(), watcher.isEventDriven() ? "inotify" : "polling");
+    }
+
+    // throughput and latency of each story that had submissions since the previous report
+    WorkerPool::TaskId reportTask = -1;
+    reportTask = pool.add([&]() {
+        for (const auto & story : stories) {
+            story->report();
+        }
+
+        pool.scheduleAt(reportTask, std::chrono::steady_clock::now() + std::chrono::milliseconds(kReportInterval_ms));
+    });
+    pool.scheduleAt(reportTask, std::chrono::steady_clock::now() + std::chrono::milliseconds(kReportInterval_ms));
+
+    printf("Running %d %s on %d workers\n", (int) stories.size(), stories.size() == 1 ? "story" : "stories", pool.nThreads());
+
+    pool.start();
+
+    for (const auto & story : stories) {
+        story->start();
+    }
+
+    // with event notifications, the folders are rescanned only occasionally as a fallback
+    const int scanInterval_ms = watcher.isEventDriven() ? 30000 : 1000;
+    auto tLastScan = std::chrono::steady_clock::now();
+
+    int exitCode = 0;
+
+    std::vector<std::string> files;
+    while (true) {
+        files.clear();
+        bool needScan = watcher.wait(scanInterval_ms, files) == false;
+
+        for (const auto & story : stories) {
+            if (story->exitCode() != 0) {
+                exitCode = story->exitCode();
+                break;
+            }
+        }
+        if (exitCode != 0) {
+            break;
+        }
+
+        needScan = needScan || std::chrono::steady_clock::now() - tLastScan > std::chrono::milliseconds(scanInterval_ms);
+
+        if (needScan) {
+            tLastScan = std::chrono::steady_clock::now();
+            for (const auto & story : stories) {
+                story->notify({}, true);
+            }
+            continue;
+        }
+
+        for (const auto & story : stories) {
+            const auto & folder = story->pendingFolder();
+            if (folder.empty()) {
+                continue;
+            }
+
+            std::vector<std::string> storyFiles;
+            for (auto & file : files) {
+                if (file.size() > folder.size() && file.compare(0, folder.size(), folder) == 0 && file[folder.size()] == '/') {
+                    storyFiles.push_back(std::move(file));
+                }
+            }
+            if (storyFiles.size() > 0) {
+                story->notify(std::move(storyFiles), false);
+            }
+        }
+    }
+
+    // the workers are joined before the stories are destroyed
+    pool.stop();
+
+    printf("Stopped with exit code %d\n", exitCode);
+
+    return exitCode;
 }
 
 int main([[maybe_unused]] int argc, [[maybe_unused]] char ** argv) {
@@ -344,6 +574,46 @@ int main([[maybe_unused]] int argc, [[maybe_unused]] char ** argv) {
         } else if (std::string(argv[i]) == "-pf" || std::string(argv[i]) == "--pending-folder") {
             args[CLIArgument::EPendingFolder] = argv[i + 1];
             ++i;
+        } else if (std::string(argv[i]) == "-wf" || std::string(argv[i]) == "--words-file") {
+            args[CLIArgument::EWordsFile] = argv[i + 1];
+            ++i;
+        } else if (std::string(argv[i]) == "-us" || std::string(argv[i]) == "--unix-socket") {
+            args[CLIArgument::EUnixSocket] = argv[i + 1];
+            ++i;
+        } else if (std::string(argv[i]) == "-tp" || std::string(argv[i]) == "--tcp-port") {
+            args[CLIArgument::ETCPPort] = argv[i + 1];
+            ++i;
+        } else if (std::string(argv[i]) == "-hp" || std::string(argv[i]) == "--http-port") {
+            args[CLIArgument::EHttpPort] = argv[i + 1];
+            ++i;
+        } else if (std::string(argv[i]) == "-si" || std::string(argv[i]) == "--snapshot-interval") {
+            args[CLIArgument::ESnapshotInterval] = argv[i + 1];
+            ++i;
+        } else if (std::string(argv[i]) == "-fs" || std::string(argv[i]) == "--fsync") {
+            args[CLIArgument::EFsync] = argv[i + 1];
+            ++i;
+        } else if (std::string(argv[i]) == "-cv" || std::string(argv[i]) == "--convert") {
+            args[CLIArgument::EConvert] = "true";
+        } else if (std::string(argv[i]) == "-j" || std::string(argv[i]) == "--threads") {
+            args[CLIArgument::EThreads] = argv[i + 1];
+            ++i;
+        } else if (std::string(argv[i]) == "-mf" || std::string(argv[i]) == "--metrics-file") {
+            args[CLIArgument::EMetricsFile] = argv[i + 1];
+            ++i;
+        } else if (std::string(argv[i]) == "-cf" || std::string(argv[i]) == "--config") {
+            args[CLIArgument::EConfig] = argv[i + 1];
+            ++i;
+        } else if (std::string(argv[i]) == "-w" || std::string(argv[i]) == "--workers") {
+            args[CLIArgument::EWorkers] = argv[i + 1];
+            ++i;
+        } else if (std::string(argv[i]) == "-cp" || std::string(argv[i]) == "--coordinator-port") {
+            args[CLIArgument::ECoordinatorPort] = argv[i + 1];
+            ++i;
+        } else if (std::string(argv[i]) == "-sp" || std::string(argv[i]) == "--shard-port") {
+            args[CLIArgument::EShardPort] = argv[i + 1];
+            ++i;
+        } else if (std::string(argv[i]) == "-fo" || std::string(argv[i]) == "--follow") {
+            args[CLIArgument::EFollow] = "true";
         }
     }
 
@@ -356,29 +626,115 @@ int main([[maybe_unused]] int argc, [[maybe_unused]] char ** argv) {
         printf("   -os, --statistics-output : statistics output file (e.g. \"stats.json\")\n");
         printf("   -tv, --top-voted : number of top voted words to output for a slot (e.g. \"10\")\n");
         printf("   -ns, --num-submissions : number of submissions to generete (e.g. \"1e6\")\n");
-        printf("   -sf, --stats-file : output filename for statistics (e.g. \"stats.json\")\n");
+        printf("   -sf, --stats-file : output filename for statistics (e.g. \"stats.json\"), the slot chunks are written next to it\n");
         printf("  -sim, --simulation : run simulation\n");
         printf("   -df, --data-folder : data folder with binary input files\n");
         printf("   -pf, --pending-folder : folder with pending submissions\n");
+        printf("   -wf, --words-file : dictionary file with one word per line (e.g. \"words-alpha.txt\"), submissions of other words are rejected\n");
+        printf("   -us, --unix-socket : accept submissions on a Unix domain socket (e.g. \"/tmp/the-story.sock\")\n");
+        printf("   -tp, --tcp-port : accept submissions on a loopback TCP port (e.g. \"7001\")\n");
+        printf("   -hp, --http-port : serve the statistics from memory over HTTP on a loopback TCP port (e.g. \"8001\")\n");
+        printf("   -fs, --fsync : fsync policy for the submission log: \"batch\", \"none\" or \"<N>ms\" (default: \"batch\")\n");
+        printf("   -si, --snapshot-interval : also write a state snapshot every N minutes (default: only at period rollover)\n");
+        printf("   -cv, --convert : convert the legacy period files in the data folder to the current format\n");
+        printf("    -j, --threads : number of threads for replaying the period files on startup (default: 1)\n");
+        printf("   -mf, --metrics-file : write runtime metrics in the Prometheus text format to this file every second (e.g. \"the-story.prom\")\n");
+        printf("   -cf, --config : run the stories of this config file in a single process, one section per story:\n");
+        printf("                   \"[<name>]\" followed by \"<option> = <value>\" lines with the long names of -df, -p, -pf, -sf, -wf, -us, -tp, -hp, -tv, -fs, -si, -mf, -cp, -sp, -fo (\"follow = true\")\n");
+        printf("                   -wf, -tv, -fs, -si and -j given on the command line are the defaults of the stories\n");
+        printf("    -w, --workers : number of worker threads shared by the stories (default: 3 per story, up to the number of cores)\n");
+        printf("   -cp, --coordinator-port : run as an ingestion shard, sending the changes of the state to the coordinator on this loopback TCP port\n");
+        printf("   -sp, --shard-port : run as the coordinator of the ingestion shards that connect on this loopback TCP port, see shard.h\n");
+        printf("   -fo, --follow : follow the daemon that writes the data folder and prefix as a read replica, or as a hot standby that takes over\n");
+        printf("                   when the daemon stops if a pending folder or an ingest endpoint is given\n");
         printf("\n");
         printf("Example:\n");
-        printf("  %s -df ./data -pf ./pending -p the-story -os stats.json -tv 10 -ns 100000 -sf stats.json\n", argv[0]);
+        printf("  %s -df ./data -pf ./pending -p the-story -os stats.json -tv 10 -ns 100000 -sf stats.json -wf words-alpha.txt\n", argv[0]);
+        printf("  %s -cf the-story.conf -wf words-alpha.txt\n", argv[0]);
+        printf("  %s -sp 9000 -sf stats.json -wf words-alpha.txt\n", argv[0]);
+        printf("  %s -cp 9000 -df ./data-0 -p the-story -pf ./pending-0 -wf words-alpha.txt\n", argv[0]);
+        printf("  %s -fo -df ./data -p the-story -sf ./replica/stats.json -wf words-alpha.txt\n", argv[0]);
+        printf("  %s -fo -df ./data -p the-story -pf ./pending -sf stats.json -wf words-alpha.txt\n", argv[0]);
         printf("\n");
 
         return 1;
     }
 
+    // preload the dictionary so that the common words get dense ids
+    if (args.count(CLIArgument::EWordsFile) > 0) {
+        const auto nWords = Dictionary::load(args.at(CLIArgument::EWordsFile));
+        if (nWords < 0) {
+            fprintf(stderr, "Failed to load words file '%s'\n", args.at(CLIArgument::EWordsFile).c_str());
+            return 3;
+        }
+        printf("Loaded %ld words from '%s'\n", nWords, args.at(CLIArgument::EWordsFile).c_str());
+    }
+
     State state;
     state.init();
 
+    if (args.count(EConvert) > 0) {
+        if (args.count(CLIArgument::EDataFolder) == 0 || args.count(CLIArgument::EPrefix) == 0) {
+            printf("Data folder and prefix are required for conversion.\n");
+            return 2;
+        }
+        return runConvert(std::move(args));
+    }
+
     if (args.count(ESimulate) > 0) {
         runSimulation(std::move(state), std::move(args));
     } else {
-        if (args.count(CLIArgument::EPendingFolder) == 0) {
-            printf("Pending folder is not specified.\n");
-            return 2;
+        std::vector<std::pair<std::string, TCLIArguments>> stories;
+        if (args.count(CLIArgument::EConfig) > 0) {
+            if (loadConfig(args.at(CLIArgument::EConfig), args, stories) == false) {
+                return 2;
+            }
+
+            // the words files of the stories that are not preloaded above
+            std::set<std::string> wordsFiles;
+            for (const auto & story : stories) {
+                if (story.second.count(CLIArgument::EWordsFile)) {
+                    wordsFiles.insert(story.second.at(CLIArgument::EWordsFile));
+                }
+            }
+            if (args.count(CLIArgument::EWordsFile) > 0) {
+                wordsFiles.erase(args.at(CLIArgument::EWordsFile));
+            }
+            for (const auto & fileName : wordsFiles) {
+                const auto nWords = Dictionary::load(fileName);
+                if (nWords < 0) {
+                    fprintf(stderr, "Failed to load words file '%s'\n", fileName.c_str());
+                    return 3;
+                }
+                printf("Loaded %ld words from '%s'\n", nWords, fileName.c_str());
+            }
+        } else {
+            if (args.count(CLIArgument::EPendingFolder) == 0 && args.count(CLIArgument::EShardPort) == 0 && args.count(CLIArgument::EFollow) == 0) {
+                printf("Pending folder is not specified.\n");
+                return 2;
+            }
+            if (args.count(CLIArgument::ECoordinatorPort) && args.count(CLIArgument::EShardPort)) {
+                printf("A shard cannot be the coordinator as well.\n");
+                return 2;
+            }
+            if (args.count(CLIArgument::EFollow) && (args.count(CLIArgument::ECoordinatorPort) || args.count(CLIArgument::EShardPort))) {
+                printf("A follower cannot be a shard or the coordinator.\n");
+                return 2;
+            }
+            if (args.count(CLIArgument::EFollow) && (args.count(CLIArgument::EDataFolder) == 0 || args.count(CLIArgument::EPrefix) == 0)) {
+                printf("The data folder and prefix to follow are not specified.\n");
+                return 2;
+            }
+            stories.emplace_back("", args);
         }
-        run(std::move(state), std::move(args));
+
+        // one worker per pipeline stage of each story, up to the number of cores
+        int nWorkers = std::min<int>(3*stories.size(), std::max(3u, std::thread::hardware_concurrency()));
+        if (args.count(CLIArgument::EWorkers) > 0) {
+            nWorkers = std::max(1, std::stoi(args.at(CLIArgument::EWorkers)));
+        }
+
+        return run(std::move(stories), nWorkers);
     }
 
     //for (int k = 0; k < std::log2(1e7); ++k) {
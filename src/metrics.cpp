@@ -0,0 +1,243 @@
+#include "metrics.h"
+
+#include "utils.h"
+
+#include <cmath>
+#include <cstdio>
+
+namespace {
+
+void appendf(std::string & out, const char * format, double v) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), format, v);
+    out += buf;
+}
+
+void header(std::string & out, const char * name, const char * type, const char * help) {
+    out += "# HELP ";
+    out += name;
+    out += ' ';
+    out += help;
+    out += "\n# TYPE ";
+    out += name;
+    out += ' ';
+    out += type;
+    out += '\n';
+}
+
+// labels of a sample: the story label, if any, followed by the given ones, e.g. {story="en",le="0.1"}
+std::string labels(const std::string & story, const std::string & other) {
+    if (story.empty() && other.empty()) {
+        return "";
+    }
+
+    std::string result = "{";
+    if (story.empty() == false) {
+        result += "story=\"" + story + "\"";
+        if (other.empty() == false) {
+            result += ',';
+        }
+    }
+    result += other;
+    result += '}';
+
+    return result;
+}
+
+void sample(std::string & out, const std::string & name, const std::string & labels, double v) {
+    out += name;
+    out += labels;
+    appendf(out, " %.10g\n", v);
+}
+
+void metric(std::string & out, const std::string & story, const char * name, const char * type, const char * help, double v) {
+    header(out, name, type, help);
+    sample(out, name, labels(story, ""), v);
+}
+
+}
+
+const double Metrics::Histogram::kBounds[Metrics::Histogram::kNumBuckets] = {
+    0.00001, 0.000025, 0.00005,
+    0.0001,  0.00025,  0.0005,
+    0.001,   0.0025,   0.005,
+    0.01,    0.025,    0.05,
+    0.1,     0.25,     0.5,
+    1.0,     2.5,      5.0,
+    10.0,
+};
+
+void Metrics::Histogram::observe(Clock::duration duration) {
+    const double t = std::chrono::duration<double>(duration).count();
+
+    int i = 0;
+    while (i < kNumBuckets && t > kBounds[i]) {
+        ++i;
+    }
+
+    m_counts[i].fetch_add(1, std::memory_order_relaxed);
+    m_sum_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count(), std::memory_order_relaxed);
+}
+
+void Metrics::Histogram::counts(uint64_t (&counts)[kNumBuckets + 1]) const {
+    for (int i = 0; i <= kNumBuckets; ++i) {
+        counts[i] = m_counts[i].load(std::memory_order_relaxed);
+    }
+}
+
+double Metrics::Histogram::quantile(const uint64_t (&counts)[kNumBuckets + 1], double q) {
+    uint64_t total = 0;
+    for (int i = 0; i <= kNumBuckets; ++i) {
+        total += counts[i];
+    }
+
+    uint64_t sum = 0;
+    for (int i = 0; i < kNumBuckets; ++i) {
+        sum += counts[i];
+        if (sum >= q*total) {
+            return kBounds[i];
+        }
+    }
+
+    return INFINITY;
+}
+
+Metrics::Metrics(const std::string & story) : m_story(story), m_tStart(Clock::now()), m_tLastWrite(m_tStart), m_tLastSummary(m_tStart) {}
+
+bool Metrics::write(const std::string & fileName) {
+    const auto tNow = Clock::now();
+    const double dt = std::chrono::duration<double>(tNow - m_tLastWrite).count();
+
+    const int64_t curVotes = votes.load(std::memory_order_relaxed);
+    const int64_t curApplied = nApplied.load(std::memory_order_relaxed);
+
+    auto & out = m_buffer;
+    out.clear();
+
+    metric(out, m_story, "the_story_uptime_seconds", "gauge", "Time since the start of the process.",
+           std::chrono::duration<double>(tNow - m_tStart).count());
+    metric(out, m_story, "the_story_resident_memory_bytes", "gauge", "Resident set size of the process.",
+           (double) Utils::getMemoryUsage());
+    metric(out, m_story, "the_story_period_memory_bytes", "gauge", "Memory reserved for the submissions of the current period.",
+           (double) periodMemory.load(std::memory_order_relaxed));
+
+    // a large free heap compared to the used one means fragmentation
+    int64_t heapInUse = 0;
+    int64_t heapFree = 0;
+    if (Utils::getHeapUsage(heapInUse, heapFree)) {
+        metric(out, m_story, "the_story_heap_in_use_bytes", "gauge", "Bytes allocated with malloc and in use.", (double) heapInUse);
+        metric(out, m_story, "the_story_heap_free_bytes", "gauge", "Bytes freed but still held by malloc.", (double) heapFree);
+    }
+
+    metric(out, m_story, "the_story_votes", "gauge", "Total number of votes.", (double) curVotes);
+    metric(out, m_story, "the_story_submissions", "gauge", "Total number of submissions.", (double) submissions.load(std::memory_order_relaxed));
+    metric(out, m_story, "the_story_slots", "gauge", "Number of active slots.", (double) slots.load(std::memory_order_relaxed));
+
+    // the rates are meaningful only if the file is written regularly, prefer rate() on the counters
+    metric(out, m_story, "the_story_votes_per_second", "gauge", "New votes per second since the previous update of the metrics.",
+           dt > 0.0 ? (curVotes - m_lastVotes)/dt : 0.0);
+    metric(out, m_story, "the_story_submissions_applied_per_second", "gauge", "Applied submissions per second since the previous update of the metrics.",
+           dt > 0.0 ? (curApplied - m_lastApplied)/dt : 0.0);
+
+    metric(out, m_story, "the_story_submissions_applied_total", "counter", "Submissions applied to the state since the start of the process.", (double) curApplied);
+    metric(out, m_story, "the_story_submissions_rejected_total", "counter", "Submissions rejected by the state.", (double) nRejected.load(std::memory_order_relaxed));
+
+    header(out, "the_story_submissions_invalid_total", "counter", "Malformed submissions by source.");
+    sample(out, "the_story_submissions_invalid_total", labels(m_story, "source=\"pending\""), (double) nInvalidPending.load(std::memory_order_relaxed));
+    sample(out, "the_story_submissions_invalid_total", labels(m_story, "source=\"socket\""),  (double) nInvalidSocket.load(std::memory_order_relaxed));
+
+    metric(out, m_story, "the_story_http_requests_total", "counter", "Requests to the HTTP server.", (double) httpRequests.load(std::memory_order_relaxed));
+    metric(out, m_story, "the_story_http_not_modified_total", "counter", "HTTP requests answered with 304 Not Modified.", (double) httpNotModified.load(std::memory_order_relaxed));
+    metric(out, m_story, "the_story_http_sent_bytes_total", "counter", "Bytes sent by the HTTP server.", (double) httpBytesSent.load(std::memory_order_relaxed));
+
+    metric(out, m_story, "the_story_backlog_submissions", "gauge", "Submissions read but not applied yet.", (double) backlog.load(std::memory_order_relaxed));
+
+    metric(out, m_story, "the_story_follower_lag_records", "gauge", "Records of the followed history that were not applied yet at the last poll.",
+           (double) followerLagRecords.load(std::memory_order_relaxed));
+    metric(out, m_story, "the_story_follower_lag_seconds", "gauge", "Time from the last write of the followed history to applying it.",
+           followerLag_ms.load(std::memory_order_relaxed)*1e-3);
+
+    header(out, "the_story_queue_depth", "gauge", "Items waiting in the queues between the pipeline stages.");
+    sample(out, "the_story_queue_depth", labels(m_story, "queue=\"ingest\""),  (double) ingestQueueDepth.load(std::memory_order_relaxed));
+    sample(out, "the_story_queue_depth", labels(m_story, "queue=\"read\""),    (double) readQueueDepth.load(std::memory_order_relaxed));
+    sample(out, "the_story_queue_depth", labels(m_story, "queue=\"publish\""), (double) publishQueueDepth.load(std::memory_order_relaxed));
+
+    auto histogram = [&](const char * name, const char * help, const Histogram & h) {
+        header(out, name, "histogram", help);
+
+        const std::string bucket = std::string(name) + "_bucket";
+
+        // the buckets are read one by one, so under load the count can be slightly off from the sum
+        uint64_t count = 0;
+        for (int i = 0; i <= Histogram::kNumBuckets; ++i) {
+            count += h.m_counts[i].load(std::memory_order_relaxed);
+
+            char le[32];
+            if (i < Histogram::kNumBuckets) {
+                snprintf(le, sizeof(le), "le=\"%g\"", Histogram::kBounds[i]);
+            } else {
+                snprintf(le, sizeof(le), "le=\"+Inf\"");
+            }
+            sample(out, bucket, labels(m_story, le), (double) count);
+        }
+
+        sample(out, std::string(name) + "_sum",   labels(m_story, ""), h.m_sum_ns.load(std::memory_order_relaxed)*1e-9);
+        sample(out, std::string(name) + "_count", labels(m_story, ""), (double) count);
+    };
+
+    histogram("the_story_batch_submit_seconds", "Time to apply a batch of submissions to the state.", batchSubmit);
+    histogram("the_story_batch_update_seconds", "Time to refresh the changed slots after a batch.", batchUpdate);
+    histogram("the_story_batch_output_seconds", "Time to write a revision of the statistics.", batchOutput);
+    histogram("the_story_period_rollover_seconds", "Time to store the submissions of a period at its end.", periodRollover);
+    histogram("the_story_submission_latency_seconds", "Time from reading the oldest submission of a revision to publishing the revision.", submissionLatency);
+
+    m_tLastWrite = tNow;
+    m_lastVotes = curVotes;
+    m_lastApplied = curApplied;
+
+    // the file must never be read partially written
+    const std::string fileNameTmp = fileName + ".tmp";
+    if (Utils::writeFile(fileNameTmp, out) == false) {
+        return false;
+    }
+
+    if (std::rename(fileNameTmp.c_str(), fileName.c_str()) != 0) {
+        fprintf(stderr, "Failed to rename '%s' to '%s'\n", fileNameTmp.c_str(), fileName.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+std::string Metrics::summary() {
+    const auto tNow = Clock::now();
+    const double dt = std::chrono::duration<double>(tNow - m_tLastSummary).count();
+
+    const int64_t curApplied = nApplied.load(std::memory_order_relaxed);
+
+    uint64_t curLatency[Histogram::kNumBuckets + 1];
+    submissionLatency.counts(curLatency);
+
+    uint64_t latency[Histogram::kNumBuckets + 1];
+    uint64_t nRevisions = 0;
+    for (int i = 0; i <= Histogram::kNumBuckets; ++i) {
+        latency[i] = curLatency[i] - m_lastSummaryLatency[i];
+        m_lastSummaryLatency[i] = curLatency[i];
+        nRevisions += latency[i];
+    }
+
+    char buf[256];
+    if (nRevisions > 0) {
+        snprintf(buf, sizeof(buf), "%.0f submissions/s, %lu revisions, latency p50 <= %g ms, p99 <= %g ms, backlog %ld",
+                 dt > 0.0 ? (curApplied - m_lastSummaryApplied)/dt : 0.0, (unsigned long) nRevisions,
+                 1e3*Histogram::quantile(latency, 0.50), 1e3*Histogram::quantile(latency, 0.99), backlog.load(std::memory_order_relaxed));
+    } else {
+        snprintf(buf, sizeof(buf), "%.0f submissions/s, no revisions, backlog %ld",
+                 dt > 0.0 ? (curApplied - m_lastSummaryApplied)/dt : 0.0, backlog.load(std::memory_order_relaxed));
+    }
+
+    m_tLastSummary = tNow;
+    m_lastSummaryApplied = curApplied;
+
+    return buf;
+}
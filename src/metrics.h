@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// runtime metrics of the daemon, written as a text file in the Prometheus exposition format
+// (e.g. for the textfile collector of node_exporter)
+// - the values are updated with relaxed atomic operations from any thread, so recording a value
+//   on the hot path costs a few nanoseconds and never blocks
+// - the text is rendered by write(), which is called periodically from a single thread off the hot path
+// - the daemon keeps one instance per story, the samples of a named story carry a story="<name>" label
+class Metrics {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // latency histogram with fixed buckets from 10 us to 10 s
+    class Histogram {
+    public:
+        static constexpr int kNumBuckets = 19;
+
+        // upper bounds of the buckets in seconds, followed by an implicit +Inf bucket
+        static const double kBounds[kNumBuckets];
+
+        void observe(Clock::duration duration);
+
+        // time since tStart
+        void observe(Clock::time_point tStart) { observe(Clock::now() - tStart); }
+
+        // number of observations in each bucket so far
+        void counts(uint64_t (&counts)[kNumBuckets + 1]) const;
+
+        // upper bound of the bucket that contains the q-quantile, e.g. of the difference of two counts() calls
+        static double quantile(const uint64_t (&counts)[kNumBuckets + 1], double q);
+
+    private:
+        friend class Metrics;
+
+        std::atomic<uint64_t> m_counts[kNumBuckets + 1] = {};
+        std::atomic<uint64_t> m_sum_ns { 0 };
+    };
+
+    // counters
+    std::atomic<int64_t> nApplied        { 0 }; // submissions applied to the state
+    std::atomic<int64_t> nRejected       { 0 }; // submissions rejected by the state, e.g. for an inactive slot
+    std::atomic<int64_t> nInvalidPending { 0 }; // malformed pending submission files
+    std::atomic<int64_t> nInvalidSocket  { 0 }; // malformed messages on the ingest server
+    std::atomic<int64_t> httpRequests    { 0 }; // requests to the HTTP server
+    std::atomic<int64_t> httpNotModified { 0 }; // requests answered with 304 Not Modified
+    std::atomic<int64_t> httpBytesSent   { 0 };
+
+    // gauges
+    std::atomic<int64_t> backlog           { 0 }; // submissions read but not applied yet
+    std::atomic<int64_t> ingestQueueDepth  { 0 }; // submissions of the ingest server waiting for the read stage
+    std::atomic<int64_t> readQueueDepth    { 0 }; // batches waiting for the apply stage
+    std::atomic<int64_t> publishQueueDepth { 0 }; // updates waiting for the publisher
+    std::atomic<int64_t> votes             { 0 };
+    std::atomic<int64_t> submissions       { 0 };
+    std::atomic<int64_t> slots             { 0 };
+    std::atomic<int64_t> periodMemory      { 0 }; // bytes reserved for the submissions of the current period
+
+    // followers only, see LogFollower::Statistics
+    std::atomic<int64_t> followerLagRecords { 0 };
+    std::atomic<int64_t> followerLag_ms     { 0 };
+
+    // per batch latencies of the pipeline stages
+    Histogram batchSubmit; // applying the submissions of a batch to the state
+    Histogram batchUpdate; // refreshing the changed slots and copying them for the publisher
+    Histogram batchOutput; // writing a revision of the statistics
+
+    // storing the period file and resetting the log at the start of a new period
+    Histogram periodRollover;
+
+    // from reading the oldest submission of a revision to publishing the revision
+    Histogram submissionLatency;
+
+    Metrics(const std::string & story = "");
+
+    // render the metrics and replace the file atomically
+    // the rates (votes/sec, submissions/sec) are computed over the interval since the previous call
+    bool write(const std::string & fileName);
+
+    // one line with the throughput, the submission latency and the backlog since the previous call
+    std::string summary();
+
+private:
+    std::string m_story;
+
+    Clock::time_point m_tStart;
+    Clock::time_point m_tLastWrite;
+
+    int64_t m_lastVotes = 0;
+    int64_t m_lastApplied = 0;
+
+    Clock::time_point m_tLastSummary;
+    int64_t m_lastSummaryApplied = 0;
+    uint64_t m_lastSummaryLatency[Histogram::kNumBuckets + 1] = {};
+
+    std::string m_buffer;
+};
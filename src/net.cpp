@@ -0,0 +1,136 @@
+#include "net.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+namespace {
+
+sockaddr_in loopback(int port) {
+    sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    return addr;
+}
+
+}
+
+namespace Net {
+
+bool setNonBlocking(int fd) {
+    const int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+int listenTCP(int port, int backlog) {
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    const int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    // accept only local connections
+    const sockaddr_in addr = loopback(port);
+
+    if (bind(fd, (sockaddr *) &addr, sizeof(addr)) != 0 || listen(fd, backlog) != 0 || setNonBlocking(fd) == false) {
+        fprintf(stderr, "Failed to listen on 127.0.0.1:%d: %s\n", port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int listenUnix(const std::string & path, int backlog) {
+    sockaddr_un addr {};
+    if (path.size() >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Unix socket path is too long: '%s'\n", path.c_str());
+        return -1;
+    }
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    // remove stale socket from a previous run
+    unlink(path.c_str());
+
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    if (bind(fd, (sockaddr *) &addr, sizeof(addr)) != 0 || listen(fd, backlog) != 0 || setNonBlocking(fd) == false) {
+        fprintf(stderr, "Failed to listen on '%s': %s\n", path.c_str(), strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int connectTCP(int port) {
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    const sockaddr_in addr = loopback(port);
+
+    if (connect(fd, (sockaddr *) &addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int connectUnix(const std::string & path) {
+    sockaddr_un addr {};
+    if (path.size() >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    if (connect(fd, (sockaddr *) &addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+bool sendAll(int fd, const std::string & data) {
+    size_t pos = 0;
+    while (pos < data.size()) {
+        const auto n = send(fd, data.data() + pos, data.size() - pos, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        pos += n;
+    }
+
+    return true;
+}
+
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <string>
+
+// sockets of the daemon and its tools, the TCP sockets use only the loopback interface
+namespace Net {
+
+bool setNonBlocking(int fd);
+
+// non-blocking listening sockets, return -1 on failure
+// a stale Unix socket file of a previous run is replaced
+int listenTCP(int port, int backlog = 128);
+int listenUnix(const std::string & path, int backlog = 128);
+
+// blocking connections, return -1 if the peer cannot be reached
+int connectTCP(int port);
+int connectUnix(const std::string & path);
+
+// write all of the data to a blocking socket, returns false if the connection is broken
+// a peer that went away does not raise SIGPIPE
+bool sendAll(int fd, const std::string & data);
+
+}
@@ -0,0 +1,373 @@
+#include "publisher.h"
+
+#include "utils.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+
+namespace {
+
+// revision of an existing head document, 0 if there is none
+int64_t readRevision(const std::string & fileName) {
+    std::ifstream file(fileName);
+    if (file.is_open() == false) {
+        return 0;
+    }
+
+    // the key is at the start of the document, no need to read all of it
+    char buffer[256] = {};
+    file.read(buffer, sizeof(buffer) - 1);
+
+    const char * key = "\"revision\":";
+    const char * pos = strstr(buffer, key);
+    if (pos == nullptr) {
+        return 0;
+    }
+
+    return std::max(0LL, strtoll(pos + strlen(key), nullptr, 10));
+}
+
+}
+
+struct StatsPublisher::Impl {
+    Parameters parameters;
+    Statistics statistics;
+
+    // "<folder>/<stem>.json"
+    std::filesystem::path folder;
+    std::string stem;
+
+    int64_t revision = 0;
+    int64_t firstRevision = -1;
+
+    // revision of the current and of the previous file of each chunk
+    // the previous file is kept for clients that fetched the head just before it changed
+    std::vector<int64_t> chunkRevisions;
+    std::vector<int64_t> prevChunkRevisions;
+
+    // slots changed by the last publications, newest at the back
+    std::deque<std::vector<TSlotId>> history;
+
+    // chunks that could not be written, retried by the next publication
+    std::vector<int32_t> failedChunks;
+
+    FlatMap<TSlotId, bool> recentSet;
+    std::vector<TSlotId> recent;
+
+    // the published JSON of each slot
+    std::vector<std::string> slotJSON;
+
+    std::string buffer;
+
+    std::string chunkPrefix() const {
+        return stem + "-chunk-";
+    }
+
+    std::string chunkName(int32_t chunkId, int64_t chunkRevision) const {
+        return chunkPrefix() + std::to_string(chunkId) + "-" + std::to_string(chunkRevision) + ".json";
+    }
+
+    std::string chunkFileName(int32_t chunkId, int64_t chunkRevision) const {
+        return (folder / chunkName(chunkId, chunkRevision)).string();
+    }
+
+    bool writeChunk(int32_t chunkId) {
+        const int32_t begin = chunkId*parameters.slotsPerChunk;
+        const int32_t end = std::min<int32_t>(begin + parameters.slotsPerChunk, slotJSON.size());
+
+        buffer.clear();
+        JSONWriter json(buffer);
+
+        json.beginObject();
+        json.key("chunk");    json.value((int64_t) chunkId);
+        json.key("revision"); json.value(revision);
+
+        json.key("slots");
+        json.beginArray();
+        for (int32_t i = begin; i < end; ++i) {
+            json.raw(slotJSON[i]);
+        }
+        json.endArray();
+
+        json.endObject();
+
+        statistics.nChunksWritten++;
+        statistics.nBytesChunks += buffer.size();
+
+        if (parameters.onWrite) {
+            parameters.onWrite(chunkName(chunkId, revision), buffer, revision, true);
+        }
+
+        return Utils::writeFile(chunkFileName(chunkId, revision), buffer);
+    }
+
+    // collect the slots of the newest publications, returns the revision after which all changes are included
+    int64_t collectRecent() {
+        recent.clear();
+        recentSet.clear();
+
+        int64_t since = revision;
+        for (auto it = history.rbegin(); it != history.rend(); ++it) {
+            int32_t nNew = 0;
+            for (auto slotId : *it) {
+                if (recentSet.find(slotId) == nullptr) {
+                    nNew++;
+                }
+            }
+
+            // a publication is either included completely or not at all
+            if ((int32_t) recent.size() + nNew > parameters.nMaxRecentSlots) {
+                break;
+            }
+
+            for (auto slotId : *it) {
+                if (recentSet.insert(slotId, true).second) {
+                    recent.push_back(slotId);
+                }
+            }
+
+            since--;
+        }
+
+        return since;
+    }
+
+    bool writeHead(const Update & update) {
+        const int64_t since = collectRecent();
+
+        buffer.clear();
+        JSONWriter json(buffer);
+
+        json.beginObject();
+        json.key("revision");      json.value(revision);
+        json.key("votes");         json.value(update.votes);
+        json.key("submissions");   json.value(update.submissions);
+        json.key("next");          json.value(update.next);
+        json.key("ips");           json.value(update.ips);
+        json.key("nSlots");        json.value((int64_t) slotJSON.size());
+        json.key("slotsPerChunk"); json.value((int64_t) parameters.slotsPerChunk);
+        json.key("chunkPrefix");   json.value(chunkPrefix());
+
+        json.key("chunks");
+        json.beginArray();
+        for (auto chunkRevision : chunkRevisions) {
+            json.value(chunkRevision);
+        }
+        json.endArray();
+
+        json.key("since");
+        json.value(since);
+
+        json.key("recent");
+        json.beginArray();
+        for (auto slotId : recent) {
+            json.raw(slotJSON[slotId]);
+        }
+        json.endArray();
+
+        // last, so that the global counters stay at the start of the document
+        if (update.activity.empty() == false) {
+            json.key("activity");
+            json.raw(update.activity);
+        }
+
+        json.endObject();
+
+        statistics.nBytesHead = buffer.size();
+
+        if (parameters.onWrite) {
+            parameters.onWrite(std::filesystem::path(parameters.fileName).filename().string(), buffer, revision, false);
+        }
+
+        const auto fileName = parameters.fileName;
+        if (Utils::writeFile(fileName + ".tmp", buffer) == false) {
+            return false;
+        }
+
+        std::error_code ec;
+        std::filesystem::rename(fileName + ".tmp", fileName, ec);
+        if (ec) {
+            fprintf(stderr, "Failed to rename '%s.tmp' to '%s': %s\n", fileName.c_str(), fileName.c_str(), ec.message().c_str());
+            return false;
+        }
+
+        return true;
+    }
+
+    // remove the chunk files of previous runs, which are not referenced by the new head
+    void removeStaleChunks() {
+        const auto prefix = chunkPrefix();
+
+        std::error_code ec;
+        for (const auto & entry : std::filesystem::directory_iterator(folder.empty() ? "." : folder, ec)) {
+            const auto name = entry.path().filename().string();
+            if (name.compare(0, prefix.size(), prefix) != 0 || name.size() < 5 || name.compare(name.size() - 5, 5, ".json") != 0) {
+                continue;
+            }
+
+            // "<prefix><chunk>-<revision>.json"
+            const auto pos = name.rfind('-');
+            const int64_t chunkRevision = strtoll(name.c_str() + pos + 1, nullptr, 10);
+            if (chunkRevision < firstRevision) {
+                std::filesystem::remove(entry.path(), ec);
+            }
+        }
+    }
+};
+
+StatsPublisher::StatsPublisher(Parameters parameters) : m_impl(new Impl()) {
+    const std::filesystem::path path(parameters.fileName);
+
+    m_impl->folder = path.parent_path();
+    m_impl->stem = path.stem().string();
+    m_impl->revision = readRevision(parameters.fileName);
+    m_impl->parameters = std::move(parameters);
+}
+
+StatsPublisher::~StatsPublisher() {
+}
+
+void StatsPublisher::Update::collect(const State & state, const std::vector<TSlotId> & updatedSlots) {
+    votes       = state.statistics.votes;
+    submissions = state.statistics.submissions;
+    next        = state.votesNeeded(state.activeSlots() + 1);
+    ips         = state.statistics.uniqueIPs;
+    nSlots      = state.slots.size();
+
+    activity.clear();
+    JSONWriter activityWriter(activity);
+    state.outputActivity(activityWriter);
+
+    std::string json;
+    for (auto slotId : updatedSlots) {
+        json.clear();
+        JSONWriter writer(json);
+        state.outputSlot(writer, slotId);
+        slots.emplace_back(slotId, json);
+    }
+}
+
+void StatsPublisher::Update::merge(Update && other) {
+    votes       = other.votes;
+    submissions = other.submissions;
+    next        = other.next;
+    ips         = other.ips;
+    nSlots      = other.nSlots;
+    activity    = std::move(other.activity);
+    tRead       = std::min(tRead, other.tRead);
+
+    // the newer JSON of a slot is applied last
+    if (slots.empty()) {
+        slots = std::move(other.slots);
+    } else {
+        slots.insert(slots.end(), std::make_move_iterator(other.slots.begin()), std::make_move_iterator(other.slots.end()));
+    }
+}
+
+bool StatsPublisher::publish(const State & state, const std::vector<TSlotId> & updatedSlots) {
+    Update update;
+    update.collect(state, updatedSlots);
+
+    return publish(std::move(update));
+}
+
+bool StatsPublisher::publish(Update && update) {
+    auto & impl = *m_impl;
+
+    impl.revision++;
+
+    const int32_t nSlots = update.nSlots;
+    const int32_t nChunks = (nSlots + impl.parameters.slotsPerChunk - 1)/impl.parameters.slotsPerChunk;
+
+    impl.slotJSON.resize(nSlots);
+    impl.chunkRevisions.resize(nChunks, -1);
+    impl.prevChunkRevisions.resize(nChunks, -1);
+
+    std::vector<TSlotId> updatedSlots;
+    for (auto & [slotId, json] : update.slots) {
+        if (slotId >= nSlots) {
+            continue;
+        }
+
+        impl.slotJSON[slotId] = std::move(json);
+        updatedSlots.push_back(slotId);
+    }
+
+    // a slot can be changed by several of the merged updates
+    std::sort(updatedSlots.begin(), updatedSlots.end());
+    updatedSlots.erase(std::unique(updatedSlots.begin(), updatedSlots.end()), updatedSlots.end());
+
+    // everything is new to a client that has seen only the previous run
+    const bool isFirst = impl.firstRevision < 0;
+    if (isFirst) {
+        impl.firstRevision = impl.revision;
+
+        updatedSlots.resize(nSlots);
+        for (int32_t i = 0; i < nSlots; ++i) {
+            updatedSlots[i] = i;
+        }
+    }
+
+    impl.history.push_back(std::move(updatedSlots));
+    while ((int32_t) impl.history.size() > impl.parameters.nRecentRevisions) {
+        impl.history.pop_front();
+    }
+
+    std::vector<int32_t> changedChunks;
+    auto markChanged = [&](int32_t chunkId) {
+        if (impl.chunkRevisions[chunkId] == impl.revision) {
+            return;
+        }
+
+        // keep the current file as the previous one
+        if (impl.prevChunkRevisions[chunkId] >= 0) {
+            std::error_code ec;
+            std::filesystem::remove(impl.chunkFileName(chunkId, impl.prevChunkRevisions[chunkId]), ec);
+
+            if (impl.parameters.onRemove) {
+                impl.parameters.onRemove(impl.chunkName(chunkId, impl.prevChunkRevisions[chunkId]));
+            }
+        }
+        impl.prevChunkRevisions[chunkId] = impl.chunkRevisions[chunkId];
+        impl.chunkRevisions[chunkId] = impl.revision;
+
+        changedChunks.push_back(chunkId);
+    };
+
+    for (auto slotId : impl.history.back()) {
+        markChanged(slotId/impl.parameters.slotsPerChunk);
+    }
+    for (auto chunkId : impl.failedChunks) {
+        markChanged(chunkId);
+    }
+    impl.failedChunks.clear();
+
+    // the chunks are written before the head that references them
+    bool ok = true;
+    for (auto chunkId : changedChunks) {
+        if (impl.writeChunk(chunkId) == false) {
+            impl.failedChunks.push_back(chunkId);
+            ok = false;
+        }
+    }
+
+    ok = ok && impl.writeHead(update);
+
+    if (ok && isFirst) {
+        impl.removeStaleChunks();
+    }
+
+    return ok;
+}
+
+int64_t StatsPublisher::revision() const {
+    return m_impl->revision;
+}
+
+const StatsPublisher::Statistics & StatsPublisher::statistics() const {
+    return m_impl->statistics;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "types.h"
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// publishes the statistics for the web page incrementally
+// - the slots are split in chunks of slotsPerChunk slots, each chunk is written to an immutable file
+//   "<stats>-chunk-<chunk>-<revision>.json" whenever one of its slots changes, so the files can be cached
+// - the head document "<stats>.json" contains the global statistics, the current revision of each chunk and
+//   the slots changed since revision "since", so clients that are up to date do not need to fetch any chunk
+//   and, at its end, the recent activity (see State::outputActivity())
+// - every publication increments the revision, the revision continues from the existing head document after a restart
+class StatsPublisher {
+public:
+    // called with the name of each written document, e.g. "stats.json", its contents and revision,
+    // immutable for the chunks
+    using CBOnWrite = std::function<void(const std::string & name, const std::string & data, int64_t revision, bool immutable)>;
+
+    // called with the name of each removed document
+    using CBOnRemove = std::function<void(const std::string & name)>;
+
+    struct Parameters {
+        std::string fileName = "stats.json";
+
+        // e.g. for serving the documents from memory, see HttpServer
+        CBOnWrite onWrite;
+        CBOnRemove onRemove;
+
+        int32_t slotsPerChunk = 256;
+
+        // the head contains the slots changed in up to this many recent publications ...
+        int32_t nRecentRevisions = 32;
+
+        // ... as long as they are no more than this many slots
+        int32_t nMaxRecentSlots = 32;
+    };
+
+    struct Statistics {
+        int64_t nChunksWritten = 0;
+        int64_t nBytesHead     = 0; // size of the last head document
+        int64_t nBytesChunks   = 0; // total size of the written chunks
+    };
+
+    // the data of a publication, copied from the state so that it can be published on another thread
+    struct Update {
+        int64_t votes       = 0;
+        int64_t submissions = 0;
+        int64_t next        = 0;
+        int64_t ips         = 0;
+        int32_t nSlots      = 0;
+
+        // JSON of the recent activity, see State::outputActivity()
+        std::string activity;
+
+        // JSON of the changed slots
+        std::vector<std::pair<TSlotId, std::string>> slots;
+
+        // when the oldest submission contained in the update was read, for measuring the latency
+        std::chrono::steady_clock::time_point tRead = std::chrono::steady_clock::time_point::max();
+
+        // copy the global statistics and the slots changed by State::update()
+        void collect(const State & state, const std::vector<TSlotId> & updatedSlots);
+
+        // combine with a newer update
+        void merge(Update && other);
+    };
+
+    StatsPublisher(Parameters parameters);
+    ~StatsPublisher();
+
+    // publish a new revision
+    bool publish(Update && update);
+
+    // publish a new revision directly from the state, updatedSlots are the slots changed since the last publication
+    bool publish(const State & state, const std::vector<TSlotId> & updatedSlots);
+
+    int64_t revision() const;
+
+    const Statistics & statistics() const;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> m_impl;
+};
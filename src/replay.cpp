@@ -0,0 +1,505 @@
+#include "replay.h"
+
+#include "storage.h"
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <thread>
+
+namespace {
+
+// the records of a period file
+struct Source {
+    PeriodFile file;
+
+    // legacy files are read into memory
+    bool isLegacy = false;
+    std::vector<SubmissionInput> entries;
+
+    SubmissionInput input(uint64_t i) const {
+        return isLegacy ? entries[i] : file.input(i);
+    }
+};
+
+// consecutive records from the same period, possibly from several files
+struct Run {
+    struct Range {
+        const Source * source;
+        uint64_t begin;
+        uint64_t end;
+    };
+
+    TPeriodId periodId = 0;
+    uint64_t nRecords = 0;
+    std::vector<Range> ranges;
+
+    // if all slot ids are below the number of active slots, State::submit accepts all records
+    TSlotId minSlotId = std::numeric_limits<TSlotId>::max();
+    TSlotId maxSlotId = std::numeric_limits<TSlotId>::min();
+
+    // set by the sequential pass
+    bool hasAccepted = false;
+    int32_t nSlotsAfter = 0;
+
+    // indices of the records rejected by State::submit, in increasing order
+    std::vector<uint64_t> rejected;
+
+    // f(index, input) for each record, index counts from the start of the run
+    template <typename F>
+    void forEach(F && f) const {
+        uint64_t index = 0;
+        for (const auto & range : ranges) {
+            for (uint64_t i = range.begin; i < range.end; ++i) {
+                f(index++, range.source->input(i));
+            }
+        }
+    }
+};
+
+// contribution of the accepted records of a run from the IPs of a single partition
+struct Delta {
+    struct SlotData {
+        TSlotId slotId;
+        int32_t votes;
+        int32_t submissions;
+
+        // last record for the slot
+        uint64_t lastIndex;
+        TTimestamp lastTimestamp_s;
+    };
+
+    struct WordData {
+        // first record with the word for the slot, the words are added to the slots in this order
+        uint64_t firstIndex;
+        TSlotId slotId;
+        TWordId wordId;
+        int64_t votes_mv;
+    };
+
+    int64_t votes       = 0;
+    int64_t submissions = 0;
+    int64_t uniqueIPs   = 0;
+
+    // split by slotId % number of buckets, so that the slots can be updated in parallel
+    std::vector<std::vector<SlotData>> slots;
+    std::vector<std::vector<WordData>> words;
+};
+
+uint64_t packSlotWord(TSlotId slotId, TWordId wordId) {
+    return (uint64_t(uint32_t(slotId)) << 32) | wordId;
+}
+
+// run f(i) for i in [0, n) on nThreads threads
+template <typename F>
+void parallelFor(int nThreads, int n, F && f) {
+    std::atomic<int> next { 0 };
+
+    std::vector<std::thread> workers;
+    for (int t = 0; t < std::min(nThreads, n); ++t) {
+        workers.emplace_back([&]() {
+            for (int i = next++; i < n; i = next++) {
+                f(i);
+            }
+        });
+    }
+
+    for (auto & worker : workers) {
+        worker.join();
+    }
+}
+
+// the final state of each (ip, slot) group of the period determines its contribution:
+// a word of the last submissions of c of its n users gets State::share_mv(c, n) millivotes
+Delta computeDelta(const Run & run, int partition, int nPartitions, int nBuckets) {
+    FlatMap<uint64_t, int32_t> groups;
+    FlatMap<State::SubmissionKey, TWordId, State::SubmissionKeyHash> users;
+    FlatMap<TIPAddress, bool> ips;
+
+    FlatMap<TSlotId, int32_t> slotIndex;
+    std::vector<Delta::SlotData> slots;
+
+    FlatMap<uint64_t, int32_t> wordIndex;
+    std::vector<Delta::WordData> words;
+
+    auto itRejected = run.rejected.begin();
+    run.forEach([&](uint64_t index, const SubmissionInput & input) {
+        if (itRejected != run.rejected.end() && *itRejected == index) {
+            ++itRejected;
+            return;
+        }
+
+        // rejected in any case, the sequential pass takes care of it
+        if (input.slotId < 0) {
+            return;
+        }
+
+        if (nPartitions > 1 && (int) (hash64(input.ip) % nPartitions) != partition) {
+            return;
+        }
+
+        const uint64_t ipSlot = State::packIPSlot(input.ip, input.slotId);
+
+        auto [nUsers, isNewGroup] = groups.insert(ipSlot, 0);
+        if (isNewGroup) {
+            ips.insert(input.ip);
+        }
+
+        auto [wordId, isNewUser] = users.insert({ ipSlot, input.userId }, input.wordId);
+        if (isNewUser) {
+            (*nUsers)++;
+        } else {
+            *wordId = input.wordId;
+        }
+
+        auto [si, isNewSlot] = slotIndex.insert(input.slotId, (int32_t) slots.size());
+        if (isNewSlot) {
+            slots.push_back({ input.slotId, 0, 0, 0, 0 });
+        }
+        slots[*si].lastIndex = index;
+        slots[*si].lastTimestamp_s = input.timestamp_s;
+
+        if (wordIndex.insert(packSlotWord(input.slotId, input.wordId), (int32_t) words.size()).second) {
+            words.push_back({ index, input.slotId, input.wordId, 0 });
+        }
+    });
+
+    groups.forEach([&](uint64_t ipSlot, int32_t) {
+        slots[*slotIndex.find(TSlotId(uint32_t(ipSlot)))].votes++;
+    });
+
+    FlatMap<State::GroupWordKey, int32_t, State::GroupWordKeyHash> groupWords;
+    users.forEach([&](const State::SubmissionKey & key, TWordId wordId) {
+        slots[*slotIndex.find(TSlotId(uint32_t(key.ipSlot)))].submissions++;
+        (*groupWords.insert({ key.ipSlot, wordId }, 0).first)++;
+    });
+
+    groupWords.forEach([&](const State::GroupWordKey & key, int32_t nUsers) {
+        const TSlotId slotId = TSlotId(uint32_t(key.ipSlot));
+        words[*wordIndex.find(packSlotWord(slotId, key.wordId))].votes_mv += State::share_mv(nUsers, *groups.find(key.ipSlot));
+    });
+
+    Delta result;
+    result.votes       = groups.size();
+    result.submissions = users.size();
+    result.uniqueIPs   = ips.size();
+
+    result.slots.resize(nBuckets);
+    for (const auto & slot : slots) {
+        result.slots[slot.slotId % nBuckets].push_back(slot);
+    }
+
+    // keeps the order of the first occurrence within each bucket
+    result.words.resize(nBuckets);
+    for (const auto & word : words) {
+        result.words[word.slotId % nBuckets].push_back(word);
+    }
+
+    return result;
+}
+
+}
+
+namespace Replay {
+
+Statistics apply(State & state, const std::vector<File> & files, int nThreads, const State::CBOnNewPeriodStart & onNewPeriodStart) {
+    Statistics statistics;
+
+    auto submit = [&](const SubmissionInput & input) {
+        state.submit(input, [&](TPeriodId periodId) {
+            if (onNewPeriodStart) {
+                onNewPeriodStart(periodId);
+            }
+        });
+    };
+
+    // the files are opened in order, so the words are interned in the same order as by the sequential replay
+    std::vector<std::unique_ptr<Source>> sources;
+    std::vector<Run::Range> ranges;
+    for (const auto & file : files) {
+        auto source = std::make_unique<Source>();
+
+        uint64_t nRecords = 0;
+        if (source->file.open(file.fileName)) {
+            nRecords = source->file.nRecords();
+            printf("Processing %lu entries from '%s' ...\n", nRecords - std::min(file.nSkip, nRecords), file.fileName.c_str());
+        } else if (Storage::isLegacy(file.fileName)) {
+            source->isLegacy = true;
+            source->entries = Storage::deserializeAll(file.fileName);
+            nRecords = source->entries.size();
+            printf("Processing %lu entries from legacy file '%s' (use --convert to upgrade it) ...\n", nRecords, file.fileName.c_str());
+        } else {
+            fprintf(stderr, "Error: failed to read '%s'\n", file.fileName.c_str());
+            continue;
+        }
+
+        statistics.nFiles++;
+        statistics.lastFileName = file.fileName;
+        statistics.nLastFileRecords = nRecords;
+
+        if (file.nSkip < nRecords) {
+            ranges.push_back({ source.get(), file.nSkip, nRecords });
+            statistics.nRecords += nRecords - file.nSkip;
+        }
+
+        sources.push_back(std::move(source));
+    }
+
+    if (nThreads <= 1) {
+        for (const auto & range : ranges) {
+            for (uint64_t i = range.begin; i < range.end; ++i) {
+                submit(range.source->input(i));
+            }
+        }
+
+        return statistics;
+    }
+
+    // split the files into runs, each file on its own and then joining the runs at the file boundaries
+    std::vector<std::vector<Run>> fileRuns(ranges.size());
+    parallelFor(nThreads, (int) ranges.size(), [&](int i) {
+        const auto & range = ranges[i];
+        for (uint64_t j = range.begin; j < range.end; ++j) {
+            const auto input = range.source->input(j);
+            const TPeriodId periodId = input.timestamp_s/State::secondsInPeriod;
+
+            auto & runs = fileRuns[i];
+            if (runs.empty() || runs.back().periodId != periodId) {
+                runs.emplace_back();
+                runs.back().periodId = periodId;
+                runs.back().ranges.push_back({ range.source, j, j });
+            }
+
+            auto & run = runs.back();
+            run.ranges.back().end = j + 1;
+            run.nRecords++;
+            run.minSlotId = std::min(run.minSlotId, input.slotId);
+            run.maxSlotId = std::max(run.maxSlotId, input.slotId);
+        }
+    });
+
+    std::vector<Run> runs;
+    for (auto & cur : fileRuns) {
+        for (auto & run : cur) {
+            if (runs.empty() || runs.back().periodId != run.periodId) {
+                runs.push_back(std::move(run));
+                continue;
+            }
+
+            auto & last = runs.back();
+            last.ranges.insert(last.ranges.end(), run.ranges.begin(), run.ranges.end());
+            last.nRecords += run.nRecords;
+            last.minSlotId = std::min(last.minSlotId, run.minSlotId);
+            last.maxSlotId = std::max(last.maxSlotId, run.maxSlotId);
+        }
+    }
+    fileRuns.clear();
+
+    const int nRuns = runs.size();
+    statistics.nRuns = nRuns;
+
+    // a run that continues the current period of the state needs its lookup tables
+    const int first = nRuns > 0 && runs[0].periodId == state.curPeriodId ? 1 : 0;
+    for (int r = 0; r < first; ++r) {
+        runs[r].forEach([&](uint64_t, const SubmissionInput & input) { submit(input); });
+        statistics.nSequentialRecords += runs[r].nRecords;
+    }
+
+    // the runs in [first, nRuns - 1) are candidates for the parallel replay, the last run is submitted one by one
+    const int nCandidates = std::max(0, nRuns - 1 - first);
+    if (nCandidates == 0) {
+        for (int r = first; r < nRuns; ++r) {
+            runs[r].forEach([&](uint64_t, const SubmissionInput & input) { submit(input); });
+            statistics.nSequentialRecords += runs[r].nRecords;
+        }
+
+        return statistics;
+    }
+
+    // with few runs, each of them is split by IP hash as well
+    const int nBuckets = nThreads;
+    const int nPartitions = std::min(nThreads, (2*nThreads + nCandidates - 1)/nCandidates);
+    statistics.nPartitions = nPartitions;
+
+    std::vector<Delta> deltas(nRuns*nPartitions);
+    auto computeDeltas = [&](const std::vector<int> & runIds) {
+        parallelFor(nThreads, (int) runIds.size()*nPartitions, [&](int i) {
+            const int r = runIds[i/nPartitions];
+            const int p = i%nPartitions;
+            deltas[r*nPartitions + p] = computeDelta(runs[r], p, nPartitions, nBuckets);
+        });
+    };
+
+    {
+        std::vector<int> runIds;
+        for (int r = first; r < first + nCandidates; ++r) {
+            runIds.push_back(r);
+        }
+        computeDeltas(runIds);
+    }
+
+    // sequential pass: apply the slot growth rule and find the rejected records
+    // the replay in parallel stops at the first run that continues the period of the previous one,
+    // which happens only if all records of the runs in between are rejected
+    int lastAccepted = -1;
+    {
+        TPeriodId curPeriodId = state.curPeriodId;
+        int64_t votes = state.statistics.votes;
+        int32_t nSlots = state.slots.size();
+
+        std::vector<int> recompute;
+        for (int r = first; r < nRuns; ++r) {
+            auto & run = runs[r];
+            if (run.periodId == curPeriodId) {
+                break;
+            }
+
+            const bool isLast = r == nRuns - 1;
+
+            if (run.minSlotId >= 0 && run.maxSlotId < nSlots) {
+                run.hasAccepted = true;
+
+                if (isLast == false) {
+                    for (int p = 0; p < nPartitions; ++p) {
+                        votes += deltas[r*nPartitions + p].votes;
+                    }
+                    nSlots = std::max(nSlots, state.activeSlots(votes));
+                }
+            } else {
+                // same checks as State::submit, in the order of the records
+                FlatMap<uint64_t, bool> groups;
+                run.forEach([&](uint64_t index, const SubmissionInput & input) {
+                    if (input.slotId < 0 || input.slotId >= nSlots) {
+                        run.rejected.push_back(index);
+                        return;
+                    }
+
+                    run.hasAccepted = true;
+
+                    if (groups.insert(State::packIPSlot(input.ip, input.slotId)).second) {
+                        votes++;
+                        nSlots = std::max(nSlots, state.activeSlots(votes));
+                    }
+                });
+
+                if (run.rejected.size() > 0 && isLast == false) {
+                    recompute.push_back(r);
+                }
+            }
+
+            run.nSlotsAfter = nSlots;
+
+            if (run.hasAccepted) {
+                curPeriodId = run.periodId;
+                lastAccepted = r;
+            }
+        }
+
+        computeDeltas(recompute);
+    }
+
+    // the lookup tables of the current period at the end are built by State::submit
+    const int last = std::max(first, lastAccepted);
+
+    bool hasAccepted = false;
+    for (int r = first; r < last; ++r) {
+        const auto & run = runs[r];
+        if (run.hasAccepted == false) {
+            continue;
+        }
+
+        hasAccepted = true;
+
+        if (run.rejected.size() > 0) {
+            fprintf(stderr, "Rejected %lu records of period %d with invalid slot ids\n", run.rejected.size(), run.periodId);
+        }
+
+        if (onNewPeriodStart) {
+            onNewPeriodStart(state.curPeriodId);
+        }
+        state.curPeriodId = run.periodId;
+
+        for (int p = 0; p < nPartitions; ++p) {
+            const auto & delta = deltas[r*nPartitions + p];
+            state.statistics.votes       += delta.votes;
+            state.statistics.submissions += delta.submissions;
+            state.statistics.uniqueIPs   += delta.uniqueIPs;
+        }
+
+        statistics.nParallelRuns++;
+    }
+
+    if (hasAccepted) {
+        state.submissions.clear();
+        state.submissionIndex.clear();
+        state.groups.clear();
+        state.groupCounts.clear();
+        state.groupCountsFree = -1;
+        state.groupWords.clear();
+        state.groupWordIndex.clear();
+        state.ips.clear();
+
+        if (runs[last - 1].nSlotsAfter > (int32_t) state.slots.size()) {
+            state.resizeSlots(runs[last - 1].nSlotsAfter);
+        }
+    }
+
+    // add the contributions to the slots, each bucket of slots on its own thread
+    std::vector<std::vector<TSlotId>> dirtySlots(nBuckets);
+    parallelFor(nThreads, hasAccepted ? nBuckets : 0, [&](int bucket) {
+        std::vector<Delta::WordData> words;
+        std::vector<Delta::SlotData> slots;
+
+        for (int r = first; r < last; ++r) {
+            if (runs[r].hasAccepted == false) {
+                continue;
+            }
+
+            words.clear();
+            slots.clear();
+            for (int p = 0; p < nPartitions; ++p) {
+                const auto & delta = deltas[r*nPartitions + p];
+                words.insert(words.end(), delta.words[bucket].begin(), delta.words[bucket].end());
+                slots.insert(slots.end(), delta.slots[bucket].begin(), delta.slots[bucket].end());
+            }
+
+            if (nPartitions > 1) {
+                std::sort(words.begin(), words.end(), [](const auto & a, const auto & b) { return a.firstIndex < b.firstIndex; });
+                std::sort(slots.begin(), slots.end(), [](const auto & a, const auto & b) { return a.lastIndex < b.lastIndex; });
+            }
+
+            for (const auto & word : words) {
+                auto & slot = state.slots[word.slotId];
+                if (slot.dirty == false) {
+                    dirtySlots[bucket].push_back(word.slotId);
+                }
+                slot.addVotes(word.wordId, word.votes_mv);
+            }
+
+            for (const auto & data : slots) {
+                auto & slot = state.slots[data.slotId];
+                slot.statistics.votes       += data.votes;
+                slot.statistics.submissions += data.submissions;
+                slot.statistics.lastSubmissionTimestamp_s = data.lastTimestamp_s;
+            }
+        }
+    });
+
+    for (const auto & slotIds : dirtySlots) {
+        state.dirtySlots.insert(state.dirtySlots.end(), slotIds.begin(), slotIds.end());
+    }
+
+    for (const auto & slot : state.slots) {
+        state.statistics.lastSubmissionTimestamp_s = std::max(state.statistics.lastSubmissionTimestamp_s, slot.statistics.lastSubmissionTimestamp_s);
+    }
+
+    for (int r = last; r < nRuns; ++r) {
+        runs[r].forEach([&](uint64_t, const SubmissionInput & input) { submit(input); });
+        statistics.nSequentialRecords += runs[r].nRecords;
+    }
+
+    return statistics;
+}
+
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "types.h"
+
+#include <string>
+#include <vector>
+
+// replay of the stored submission history into a state
+//
+// with more than one thread the records are not submitted one by one. instead:
+// - the records are split into runs of consecutive records from the same period
+// - the contribution of each run is computed on its own, partitioned by IP hash if there are few runs.
+//   this works because the (ip, slot) deduplication depends only on the records of a single period
+//   and the votes of the words are sums of the contributions of the final submissions
+// - a sequential pass over the runs applies the slot growth rule and finds the records that
+//   State::submit would reject, recomputing the runs that contain such records
+// - the contributions are added to the slots in the order of the runs, partitioned by slot
+// - the run that continues the current period of the state and the last run are submitted
+//   one by one, since their per-period lookup tables have to be part of the result
+// the resulting state is identical to the one from the sequential replay
+namespace Replay {
+
+// a period file to replay, the first nSkip records are already contained in the state
+struct File {
+    std::string fileName;
+    uint64_t nSkip = 0;
+};
+
+struct Statistics {
+    int32_t nFiles   = 0; // files that could be read
+    int64_t nRecords = 0;
+
+    // the last file that could be read and the number of its records, including the skipped ones
+    std::string lastFileName;
+    int64_t nLastFileRecords = 0;
+
+    // parallel replay only
+    int32_t nRuns              = 0;
+    int32_t nParallelRuns      = 0;
+    int32_t nPartitions        = 0; // IP hash partitions of each run
+    int64_t nSequentialRecords = 0; // records submitted one by one
+};
+
+// submit the records of the files in order, using up to nThreads threads
+Statistics apply(State & state, const std::vector<File> & files, int nThreads, const State::CBOnNewPeriodStart & onNewPeriodStart);
+
+}
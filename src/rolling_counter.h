@@ -0,0 +1,90 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+// number of events in each of the last N intervals of T seconds, in constant memory
+// - the intervals are aligned to multiples of T and kept in a ring buffer that ends with the interval of the newest
+//   event, the buckets of older intervals are reused as the time moves forward
+// - adding an event is O(1), moving forward clears the skipped buckets once, at most N of them
+// - events older than the window are ignored
+template <int N, int T>
+class RollingCounter {
+public:
+    static constexpr int kIntervals = N;
+    static constexpr int kIntervalSeconds = T;
+
+    void add(uint32_t t_s, int32_t n = 1) {
+        const uint32_t interval = t_s/T;
+        if (interval == m_last) {
+            m_counts[m_lastBucket] += n;
+            m_total += n;
+            return;
+        }
+
+        if (interval > m_last) {
+            advance(interval);
+        } else if (m_last - interval >= (uint32_t) N) {
+            return;
+        }
+
+        m_counts[interval % N] += n;
+        m_total += n;
+    }
+
+    // events in the N intervals that end with the interval of t_s
+    int64_t sum(uint32_t t_s) const {
+        const uint32_t interval = t_s/T;
+        if (interval <= m_last) {
+            return m_total;
+        }
+        if (interval - m_last >= (uint32_t) N) {
+            return 0;
+        }
+
+        // the bucket of interval i still holds the events of interval i - N
+        int64_t result = m_total;
+        for (uint32_t i = m_last + 1; i <= interval; ++i) {
+            result -= m_counts[i % N];
+        }
+
+        return result;
+    }
+
+    // events in the interval k intervals before the interval of t_s
+    int32_t get(uint32_t t_s, int k) const {
+        if (t_s/T < (uint32_t) k) {
+            return 0;
+        }
+
+        const uint32_t interval = t_s/T - k;
+        if (interval > m_last || m_last - interval >= (uint32_t) N) {
+            return 0;
+        }
+
+        return m_counts[interval % N];
+    }
+
+private:
+    void advance(uint32_t interval) {
+        if (interval - m_last >= (uint32_t) N) {
+            m_counts.fill(0);
+            m_total = 0;
+        } else {
+            for (uint32_t i = m_last + 1; i <= interval; ++i) {
+                m_total -= m_counts[i % N];
+                m_counts[i % N] = 0;
+            }
+        }
+
+        m_last = interval;
+        m_lastBucket = interval % N;
+    }
+
+    // the newest interval and its bucket
+    uint32_t m_last = 0;
+    uint32_t m_lastBucket = 0;
+
+    int64_t m_total = 0;
+    std::array<int32_t, N> m_counts {};
+};
@@ -0,0 +1,130 @@
+// the-story-send : test client for the ingest socket of the-story
+//
+// sends submissions as length-prefixed records (see ingest.h)
+// - by default, reads text records "<timestamp> <ip> <slotId> <userId> <word>" from stdin, one per line
+// - with -n, generates random submissions and reports the achieved rate
+
+#include "net.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+void appendText(std::string & out, const std::string & text) {
+    const uint32_t size = 1 + text.size();
+    out.append((const char *) &size, sizeof(size));
+    out += 't';
+    out += text;
+}
+
+void appendBinary(std::string & out, uint32_t timestamp_s, uint32_t ip, int32_t slotId, uint16_t userId, const std::string & word) {
+    const uint32_t length = word.size();
+    const uint32_t size = 1 + 4 + 4 + 4 + 2 + 4 + length;
+    out.append((const char *) &size, sizeof(size));
+    out += 'b';
+    out.append((const char *) &timestamp_s, 4);
+    out.append((const char *) &ip,          4);
+    out.append((const char *) &slotId,      4);
+    out.append((const char *) &userId,      2);
+    out.append((const char *) &length,      4);
+    out += word;
+}
+
+int main(int argc, char ** argv) {
+    std::string unixSocket;
+    int tcpPort = 0;
+    int nSubmissions = 0;
+    int nSlots = 3;
+    bool binary = false;
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if ((arg == "-us" || arg == "--unix-socket") && i + 1 < argc) {
+            unixSocket = argv[++i];
+        } else if ((arg == "-tp" || arg == "--tcp-port") && i + 1 < argc) {
+            tcpPort = std::stoi(argv[++i]);
+        } else if ((arg == "-n" || arg == "--num-submissions") && i + 1 < argc) {
+            nSubmissions = std::stoi(argv[++i]);
+        } else if ((arg == "-s" || arg == "--slots") && i + 1 < argc) {
+            nSlots = std::stoi(argv[++i]);
+        } else if (arg == "-b" || arg == "--binary") {
+            binary = true;
+        } else {
+            printf("Usage: %s [-us <unix-socket> | -tp <tcp-port>] [-n <num-submissions>] [-s <slots>] [-b]\n", argv[0]);
+            printf("\n");
+            printf("  Without -n, reads \"<timestamp> <ip> <slotId> <userId> <word>\" lines from stdin\n");
+            printf("  -b : send generated submissions as binary records\n");
+            return 1;
+        }
+    }
+
+    const int fd = unixSocket.empty() ? Net::connectTCP(tcpPort) : Net::connectUnix(unixSocket);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to connect: %s\n", strerror(errno));
+        return 2;
+    }
+
+    std::string out;
+    int nSent = 0;
+
+    const auto tStart = std::chrono::steady_clock::now();
+
+    if (nSubmissions > 0) {
+        static const char * kWords[] = { "apple", "banana", "cherry", "grape", "lemon", "mango", "peach", "plum" };
+
+        const uint32_t now = time(nullptr);
+        for (int i = 0; i < nSubmissions; ++i) {
+            const uint32_t ip = 0x0a000000 | (rand() & 0xffff);
+            const int32_t slotId = rand()%nSlots;
+            const uint16_t userId = rand()%8;
+            const std::string word = kWords[rand()%(sizeof(kWords)/sizeof(kWords[0]))];
+
+            if (binary) {
+                appendBinary(out, now, ip, slotId, userId, word);
+            } else {
+                char text[128];
+                snprintf(text, sizeof(text), "%u %u.%u.%u.%u %d %d %s", now, ip >> 24, (ip >> 16) & 0xff, (ip >> 8) & 0xff, ip & 0xff, slotId, userId, word.c_str());
+                appendText(out, text);
+            }
+            nSent++;
+
+            if (out.size() > 64*1024) {
+                if (Net::sendAll(fd, out) == false) {
+                    break;
+                }
+                out.clear();
+            }
+        }
+    } else {
+        std::string line;
+        while (std::getline(std::cin, line)) {
+            if (line.empty()) {
+                continue;
+            }
+            appendText(out, line);
+            nSent++;
+
+            if (Net::sendAll(fd, out) == false) {
+                break;
+            }
+            out.clear();
+        }
+    }
+
+    if (Net::sendAll(fd, out) == false) {
+        fprintf(stderr, "Failed to send: %s\n", strerror(errno));
+    }
+    close(fd);
+
+    const double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+    printf("Sent %d submissions in %.3f s (%.0f / s)\n", nSent, t, nSent/t);
+
+    return 0;
+}
@@ -0,0 +1,899 @@
+#include "shard.h"
+
+#include "net.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+namespace {
+
+// start a message in out, the payload is appended by the caller and the length is set by endMessage()
+void beginMessage(std::string & out, char type) {
+    out.clear();
+    out.append(sizeof(uint32_t), '\0');
+    out += type;
+}
+
+void endMessage(std::string & out) {
+    const uint32_t size = out.size() - sizeof(uint32_t);
+    memcpy(out.data(), &size, sizeof(size));
+}
+
+template <typename T>
+void append(std::string & out, const T & value) {
+    out.append((const char *) &value, sizeof(T));
+}
+
+// split the complete messages off the front of the buffer, f(payload, size) returns false for a malformed one
+// returns false if the buffer has a malformed message
+template <typename F>
+bool forEachMessage(std::string & buffer, F && f) {
+    size_t pos = 0;
+    bool ok = true;
+
+    while (buffer.size() - pos >= sizeof(uint32_t)) {
+        uint32_t size;
+        memcpy(&size, buffer.data() + pos, sizeof(size));
+        if (size == 0 || size > Shard::kMaxMessageSize) {
+            ok = false;
+            break;
+        }
+
+        if (buffer.size() - pos < sizeof(uint32_t) + size) {
+            break;
+        }
+
+        const char * payload = buffer.data() + pos + sizeof(uint32_t);
+        pos += sizeof(uint32_t) + size;
+
+        if (f(payload, size) == false) {
+            ok = false;
+            break;
+        }
+    }
+
+    buffer.erase(0, pos);
+
+    return ok;
+}
+
+}
+
+//
+// ShardClient
+//
+
+struct ShardClient::Impl {
+    // the connection is closed if the coordinator takes nothing of the queued messages for this long
+    static constexpr int kSendTimeout_ms = 10000;
+
+    Parameters parameters;
+    CBOnReceived onReceived;
+
+    int fd = -1;
+    int wakeFd[2] = { -1, -1 };
+
+    // sends the queued messages and receives the replies, so the calling thread never waits for the coordinator
+    std::thread worker;
+
+    // the message being built by the calling thread
+    std::string message;
+
+    mutable std::mutex mutex;
+
+    bool connected = false;
+
+    // messages not taken by the worker yet
+    std::string queued;
+
+    int64_t otherVotes = 0;
+
+    bool hasRequest = false;
+    uint32_t requestGeneration = 0;
+
+    void wake() {
+        const char c = 0;
+        [[maybe_unused]] auto res = write(wakeFd[1], &c, 1);
+    }
+
+    void disconnect() {
+        if (fd < 0) {
+            return;
+        }
+
+        // wakes up the worker
+        shutdown(fd, SHUT_RDWR);
+        if (worker.joinable()) {
+            worker.join();
+        }
+        close(fd);
+        fd = -1;
+
+        std::lock_guard lock(mutex);
+        connected = false;
+        queued.clear();
+    }
+
+    // queue the message for the worker, returns false if the connection is lost
+    bool sendMessage() {
+        endMessage(message);
+
+        {
+            std::lock_guard lock(mutex);
+            if (connected == false) {
+                return false;
+            }
+
+            if (queued.empty()) {
+                queued.swap(message);
+            } else {
+                queued += message;
+            }
+        }
+
+        wake();
+
+        return true;
+    }
+
+    // returns false if the connection is closed or the coordinator sent a malformed message
+    bool receive(std::string & buffer) {
+        char data[4096];
+
+        bool received = false;
+        bool ok = true;
+        while (ok) {
+            const auto n = read(fd, data, sizeof(data));
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            }
+            if (n <= 0) {
+                ok = false;
+                break;
+            }
+            buffer.append(data, n);
+
+            ok = forEachMessage(buffer, [&](const char * payload, uint32_t size) {
+                std::lock_guard lock(mutex);
+                if (payload[0] == 'v' && size == 1 + 2*sizeof(int64_t)) {
+                    int64_t votes, ownVotes;
+                    memcpy(&votes,    payload + 1, sizeof(int64_t));
+                    memcpy(&ownVotes, payload + 1 + sizeof(int64_t), sizeof(int64_t));
+                    otherVotes = votes - ownVotes;
+                } else if (payload[0] == 'r' && size == 1 + sizeof(uint32_t)) {
+                    memcpy(&requestGeneration, payload + 1, sizeof(uint32_t));
+                    hasRequest = true;
+                } else {
+                    return false;
+                }
+                received = true;
+                return true;
+            });
+
+            if (ok == false) {
+                fprintf(stderr, "ShardClient: malformed message from the coordinator\n");
+            }
+        }
+
+        if (received && onReceived) {
+            onReceived();
+        }
+
+        return ok;
+    }
+
+    void run() {
+        std::string buffer;
+
+        // the messages taken from the queue, written up to pos
+        std::string out;
+        size_t pos = 0;
+        auto tProgress = std::chrono::steady_clock::now();
+
+        char drain[64];
+
+        while (true) {
+            if (pos == out.size()) {
+                out.clear();
+                pos = 0;
+
+                std::lock_guard lock(mutex);
+                out.swap(queued);
+                tProgress = std::chrono::steady_clock::now();
+            }
+
+            int timeout_ms = -1;
+            if (pos < out.size()) {
+                const auto tNow = std::chrono::steady_clock::now();
+                timeout_ms = std::max<int>(0, std::chrono::duration_cast<std::chrono::milliseconds>(
+                    tProgress + std::chrono::milliseconds(kSendTimeout_ms) - tNow).count());
+                if (timeout_ms == 0) {
+                    fprintf(stderr, "ShardClient: the coordinator does not read the messages, closing the connection\n");
+                    break;
+                }
+            }
+
+            pollfd pfds[2] = {
+                { wakeFd[0], POLLIN, 0 },
+                { fd, (short) (pos < out.size() ? POLLIN | POLLOUT : POLLIN), 0 },
+            };
+
+            if (poll(pfds, 2, timeout_ms) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                fprintf(stderr, "ShardClient: poll failed: %s\n", strerror(errno));
+                break;
+            }
+
+            if (pfds[0].revents & POLLIN) {
+                while (read(wakeFd[0], drain, sizeof(drain)) > 0) {}
+            }
+
+            if ((pfds[1].revents & (POLLIN | POLLHUP | POLLERR)) && receive(buffer) == false) {
+                break;
+            }
+
+            bool lost = false;
+            while (pos < out.size()) {
+                // a coordinator that went away must not raise SIGPIPE
+                const auto n = send(fd, out.data() + pos, out.size() - pos, MSG_NOSIGNAL);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    break;
+                }
+                if (n <= 0) {
+                    fprintf(stderr, "ShardClient: lost the connection to the coordinator\n");
+                    lost = true;
+                    break;
+                }
+                pos += n;
+                tProgress = std::chrono::steady_clock::now();
+            }
+
+            if (lost) {
+                break;
+            }
+        }
+
+        {
+            std::lock_guard lock(mutex);
+            connected = false;
+        }
+
+        if (onReceived) {
+            onReceived();
+        }
+    }
+};
+
+ShardClient::ShardClient(Parameters parameters, CBOnReceived && onReceived) : m_impl(new Impl()) {
+    m_impl->parameters = std::move(parameters);
+    m_impl->onReceived = std::move(onReceived);
+
+    // a full pipe already wakes up the worker, so the calling thread never blocks on it
+    if (pipe(m_impl->wakeFd) != 0 || Net::setNonBlocking(m_impl->wakeFd[0]) == false || Net::setNonBlocking(m_impl->wakeFd[1]) == false) {
+        fprintf(stderr, "ShardClient: failed to create the wake pipe: %s\n", strerror(errno));
+    }
+}
+
+ShardClient::~ShardClient() {
+    m_impl->disconnect();
+
+    for (auto fd : m_impl->wakeFd) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+}
+
+bool ShardClient::connect() {
+    m_impl->disconnect();
+
+    if (m_impl->wakeFd[0] < 0) {
+        return false;
+    }
+
+    m_impl->fd = Net::connectTCP(m_impl->parameters.tcpPort);
+    if (m_impl->fd < 0) {
+        return false;
+    }
+
+    if (Net::setNonBlocking(m_impl->fd) == false) {
+        close(m_impl->fd);
+        m_impl->fd = -1;
+        return false;
+    }
+
+    {
+        std::lock_guard lock(m_impl->mutex);
+        m_impl->connected = true;
+        m_impl->hasRequest = false;
+    }
+
+    m_impl->worker = std::thread([this]() { m_impl->run(); });
+
+    beginMessage(m_impl->message, 'h');
+    m_impl->message += m_impl->parameters.name;
+
+    return m_impl->sendMessage();
+}
+
+bool ShardClient::isConnected() const {
+    std::lock_guard lock(m_impl->mutex);
+    return m_impl->connected;
+}
+
+bool ShardClient::fullRequested(uint32_t & generation) {
+    std::lock_guard lock(m_impl->mutex);
+    generation = m_impl->requestGeneration;
+    return m_impl->connected && m_impl->hasRequest;
+}
+
+bool ShardClient::sendFull(const StateDelta & delta, uint32_t generation) {
+    if (isConnected() == false) {
+        return false;
+    }
+
+    {
+        std::lock_guard lock(m_impl->mutex);
+        if (m_impl->requestGeneration == generation) {
+            m_impl->hasRequest = false;
+        }
+    }
+
+    beginMessage(m_impl->message, 'f');
+    append(m_impl->message, generation);
+    delta.serialize(m_impl->message);
+
+    return m_impl->sendMessage();
+}
+
+bool ShardClient::sendDelta(const StateDelta & delta) {
+    if (isConnected() == false) {
+        return false;
+    }
+
+    beginMessage(m_impl->message, 'd');
+    delta.serialize(m_impl->message);
+
+    return m_impl->sendMessage();
+}
+
+bool ShardClient::requestVotes() {
+    if (isConnected() == false) {
+        return false;
+    }
+
+    beginMessage(m_impl->message, 's');
+
+    return m_impl->sendMessage();
+}
+
+int64_t ShardClient::otherVotes() const {
+    std::lock_guard lock(m_impl->mutex);
+    return m_impl->otherVotes;
+}
+
+//
+// ShardCoordinator
+//
+
+struct ShardCoordinator::Impl {
+    // a message from a shard, 'x' when its connection is closed
+    struct Message {
+        Message(int32_t clientId, char type) : clientId(clientId), type(type) {}
+
+        int32_t clientId;
+        char type;
+
+        uint32_t generation = 0;
+        std::string name;
+        StateDelta delta;
+    };
+
+    struct Client {
+        int32_t id;
+        int fd;
+
+        std::string buffer;
+
+        // replies not written yet
+        std::string out;
+    };
+
+    // a connected shard, as seen by merge()
+    struct Shard {
+        std::string name;
+
+        // the deltas are ignored until the requested contribution arrives
+        bool awaitingFull = true;
+
+        // votes of the shard that are part of the state
+        int64_t votes = 0;
+    };
+
+    Parameters parameters;
+    CBOnReceived onReceived;
+
+    int listenFd = -1;
+    int wakeFd[2] = { -1, -1 };
+
+    std::atomic<bool> running { false };
+    std::thread worker;
+
+    // receiving thread
+    std::vector<Client> clients;
+    int32_t nextClientId = 0;
+
+    mutable std::mutex mutex;
+    std::vector<Message> queue;
+    std::vector<std::pair<int32_t, std::string>> replies;
+    Statistics statistics;
+
+    // merge()
+    std::map<int32_t, Shard> shards;
+    std::set<std::string> names;
+    uint32_t generation = 0;
+    std::vector<Message> messages;
+    std::vector<std::pair<int32_t, std::string>> pendingReplies;
+
+    void wake() {
+        const char c = 0;
+        [[maybe_unused]] auto res = write(wakeFd[1], &c, 1);
+    }
+
+    // the merge resizes the slots of the state up to the largest slot id of the delta
+    static bool slotsInRange(const StateDelta & delta) {
+        bool ok = true;
+        delta.slots.forEach([&](TSlotId slotId, const StateDelta::SlotData &) {
+            ok = ok && slotId < ::Shard::kMaxSlots;
+        });
+        return ok;
+    }
+
+    // parse complete messages from the client buffer
+    // returns false if the client sent a malformed message
+    bool process(Client & client, std::vector<Message> & received) {
+        return forEachMessage(client.buffer, [&](const char * payload, uint32_t size) {
+            Message message(client.id, payload[0]);
+            switch (payload[0]) {
+                case 'h':
+                    message.name.assign(payload + 1, size - 1);
+                    break;
+                case 'f':
+                    if (size < 1 + sizeof(uint32_t)) {
+                        return false;
+                    }
+                    memcpy(&message.generation, payload + 1, sizeof(uint32_t));
+                    if (message.delta.parse(payload + 1 + sizeof(uint32_t), size - 1 - sizeof(uint32_t)) == false || slotsInRange(message.delta) == false) {
+                        return false;
+                    }
+                    break;
+                case 'd':
+                    if (message.delta.parse(payload + 1, size - 1) == false || slotsInRange(message.delta) == false) {
+                        return false;
+                    }
+                    break;
+                case 's':
+                    break;
+                default:
+                    return false;
+            }
+
+            received.push_back(std::move(message));
+            return true;
+        });
+    }
+
+    // write as much of the pending replies as possible
+    // returns false if the connection is broken
+    bool flush(Client & client) {
+        while (client.out.empty() == false) {
+            const auto n = send(client.fd, client.out.data(), client.out.size(), MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    break;
+                }
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            client.out.erase(0, n);
+        }
+
+        return true;
+    }
+
+    void run() {
+        std::vector<pollfd> pfds;
+        std::vector<Message> received;
+        std::vector<std::pair<int32_t, std::string>> outgoing;
+        char buffer[64*1024];
+
+        while (running) {
+            pfds.clear();
+            pfds.push_back({ wakeFd[0], POLLIN, 0 });
+            pfds.push_back({ listenFd, POLLIN, 0 });
+            for (const auto & client : clients) {
+                pfds.push_back({ client.fd, (short) (client.out.empty() ? POLLIN : POLLIN | POLLOUT), 0 });
+            }
+
+            if (poll(pfds.data(), pfds.size(), -1) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                fprintf(stderr, "ShardCoordinator: poll failed: %s\n", strerror(errno));
+                break;
+            }
+
+            if (pfds[0].revents & POLLIN) {
+                while (read(wakeFd[0], buffer, sizeof(buffer)) > 0) {}
+            }
+
+            // replies from merge()
+            {
+                std::lock_guard lock(mutex);
+                outgoing.swap(replies);
+            }
+            for (auto & [clientId, data] : outgoing) {
+                for (auto & client : clients) {
+                    if (client.id == clientId) {
+                        client.out += data;
+                        break;
+                    }
+                }
+            }
+            outgoing.clear();
+
+            int64_t nBytes = 0;
+            const size_t nPolled = pfds.size() - 2;
+
+            // new connections
+            if (pfds[1].revents & POLLIN) {
+                while (true) {
+                    const int fd = accept(listenFd, nullptr, nullptr);
+                    if (fd < 0) {
+                        break;
+                    }
+                    Net::setNonBlocking(fd);
+                    clients.push_back({ nextClientId++, fd, {}, {} });
+                }
+            }
+
+            // incoming data and replies, the newly accepted clients are polled in the next iteration
+            for (size_t i = 0; i < clients.size(); ++i) {
+                auto & client = clients[i];
+
+                bool alive = true;
+                if (i < nPolled && (pfds[2 + i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                    while (true) {
+                        const auto n = read(client.fd, buffer, sizeof(buffer));
+                        if (n > 0) {
+                            nBytes += n;
+                            client.buffer.append(buffer, n);
+                            if (process(client, received) == false) {
+                                fprintf(stderr, "ShardCoordinator: closing shard connection after malformed message\n");
+                                alive = false;
+                                break;
+                            }
+                            continue;
+                        }
+                        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                            break;
+                        }
+                        if (n < 0 && errno == EINTR) {
+                            continue;
+                        }
+                        alive = false;
+                        break;
+                    }
+                }
+
+                if (alive && flush(client) == false) {
+                    alive = false;
+                }
+
+                if (alive == false) {
+                    close(client.fd);
+                    client.fd = -1;
+                    received.emplace_back(client.id, 'x');
+                }
+            }
+
+            clients.erase(std::remove_if(clients.begin(), clients.end(), [](const Client & c) { return c.fd < 0; }), clients.end());
+
+            if (received.empty()) {
+                continue;
+            }
+
+            {
+                std::lock_guard lock(mutex);
+                statistics.nBytesReceived += nBytes;
+                for (auto & message : received) {
+                    queue.push_back(std::move(message));
+                }
+            }
+            received.clear();
+
+            if (onReceived) {
+                onReceived();
+            }
+        }
+    }
+
+    void reply(int32_t clientId, const std::string & data) {
+        pendingReplies.emplace_back(clientId, data);
+    }
+
+    void replyVotes(int32_t clientId, const State & state) {
+        std::string data;
+        beginMessage(data, 'v');
+        append(data, state.statistics.votes);
+        append(data, shards[clientId].votes);
+        endMessage(data);
+
+        reply(clientId, data);
+    }
+
+    void requestFull(int32_t clientId) {
+        std::string data;
+        beginMessage(data, 'r');
+        append(data, generation);
+        endMessage(data);
+
+        reply(clientId, data);
+    }
+};
+
+ShardCoordinator::ShardCoordinator(Parameters parameters, CBOnReceived && onReceived) : m_impl(new Impl()) {
+    m_impl->parameters = std::move(parameters);
+    m_impl->onReceived = std::move(onReceived);
+}
+
+ShardCoordinator::~ShardCoordinator() {
+    if (m_impl->running) {
+        m_impl->running = false;
+        m_impl->wake();
+        m_impl->worker.join();
+    }
+
+    for (const auto & client : m_impl->clients) {
+        close(client.fd);
+    }
+    if (m_impl->listenFd >= 0) {
+        close(m_impl->listenFd);
+    }
+    for (auto fd : m_impl->wakeFd) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+}
+
+bool ShardCoordinator::start() {
+    m_impl->listenFd = Net::listenTCP(m_impl->parameters.tcpPort);
+    if (m_impl->listenFd < 0) {
+        return false;
+    }
+
+    if (pipe(m_impl->wakeFd) != 0 || Net::setNonBlocking(m_impl->wakeFd[0]) == false) {
+        return false;
+    }
+
+    m_impl->running = true;
+    m_impl->worker = std::thread([this] { m_impl->run(); });
+
+    return true;
+}
+
+bool ShardCoordinator::merge(State & state, const State::CBOnNewPeriodStart & onNewPeriodStart) {
+    auto & impl = *m_impl;
+
+    {
+        std::lock_guard lock(impl.mutex);
+        impl.messages.swap(impl.queue);
+    }
+
+    int64_t nDeltas = 0;
+    int64_t nResets = 0;
+
+    for (auto & message : impl.messages) {
+        const int32_t clientId = message.clientId;
+
+        switch (message.type) {
+            case 'h':
+                {
+                    auto & shard = impl.shards[clientId];
+                    shard.name = message.name;
+
+                    if (impl.names.insert(message.name).second) {
+                        printf("Shard '%s' connected, %d shards\n", message.name.c_str(), (int) impl.shards.size());
+                        impl.requestFull(clientId);
+                        break;
+                    }
+
+                    // the old contribution of the shard cannot be told apart from the others
+                    printf("Shard '%s' connected again, rebuilding the state from %d shards\n", message.name.c_str(), (int) impl.shards.size());
+
+                    impl.generation++;
+                    nResets++;
+
+                    state = State();
+                    state.init();
+
+                    for (auto & [id, other] : impl.shards) {
+                        other.awaitingFull = true;
+                        other.votes = 0;
+                        impl.requestFull(id);
+                    }
+                }
+                break;
+            case 'f':
+            case 'd':
+                {
+                    auto it = impl.shards.find(clientId);
+                    if (it == impl.shards.end()) {
+                        break;
+                    }
+
+                    auto & shard = it->second;
+                    if (message.type == 'f' && shard.awaitingFull && message.generation == impl.generation) {
+                        shard.awaitingFull = false;
+                        shard.votes = 0;
+                    }
+
+                    if (shard.awaitingFull == false) {
+                        state.merge(message.delta, onNewPeriodStart);
+                        shard.votes += message.delta.votes;
+                        nDeltas++;
+                    }
+
+                    impl.replyVotes(clientId, state);
+                }
+                break;
+            case 's':
+                if (impl.shards.count(clientId)) {
+                    impl.replyVotes(clientId, state);
+                }
+                break;
+            case 'x':
+                {
+                    auto it = impl.shards.find(clientId);
+                    if (it == impl.shards.end()) {
+                        break;
+                    }
+
+                    // the contribution of the shard stays in the state
+                    printf("Shard '%s' disconnected, %d shards\n", it->second.name.c_str(), (int) impl.shards.size() - 1);
+                    impl.shards.erase(it);
+                }
+                break;
+        }
+    }
+    impl.messages.clear();
+
+    bool isComplete = true;
+    for (const auto & [id, shard] : impl.shards) {
+        if (shard.awaitingFull) {
+            isComplete = false;
+        }
+    }
+
+    {
+        std::lock_guard lock(impl.mutex);
+        impl.replies.insert(impl.replies.end(), std::make_move_iterator(impl.pendingReplies.begin()), std::make_move_iterator(impl.pendingReplies.end()));
+        impl.statistics.nShards = impl.shards.size();
+        impl.statistics.nDeltas += nDeltas;
+        impl.statistics.nResets += nResets;
+    }
+
+    if (impl.pendingReplies.size() > 0) {
+        impl.pendingReplies.clear();
+        impl.wake();
+    }
+
+    return isComplete;
+}
+
+ShardCoordinator::Statistics ShardCoordinator::statistics() const {
+    std::lock_guard lock(m_impl->mutex);
+    return m_impl->statistics;
+}
+
+//
+// ShardParking
+//
+
+struct ShardParking::Impl {
+    int timeout_ms = 0;
+
+    std::deque<Entry> parked;
+    std::unordered_map<TIPAddress, int32_t> nParkedPerIP;
+
+    static TPeriodId periodOf(const SubmissionInput & input) {
+        return input.timestamp_s/State::secondsInPeriod;
+    }
+};
+
+ShardParking::ShardParking(int timeout_ms) : m_impl(new Impl()) {
+    m_impl->timeout_ms = timeout_ms;
+}
+
+ShardParking::~ShardParking() {
+}
+
+int ShardParking::timeout_ms() const {
+    return m_impl->timeout_ms;
+}
+
+size_t ShardParking::size() const {
+    return m_impl->parked.size();
+}
+
+bool ShardParking::empty() const {
+    return m_impl->parked.empty();
+}
+
+bool ShardParking::park(const SubmissionInput & input, std::string & file, bool isActive, Clock::time_point tNow) {
+    auto & parked = m_impl->parked;
+
+    const bool isParked = isActive == false || m_impl->nParkedPerIP.count(input.ip) > 0 ||
+        (parked.size() > 0 && Impl::periodOf(parked.front().input) != Impl::periodOf(input));
+    if (isParked == false) {
+        return false;
+    }
+
+    parked.push_back({ input, std::move(file), tNow });
+    m_impl->nParkedPerIP[input.ip]++;
+
+    return true;
+}
+
+int ShardParking::release(Clock::time_point tNow, const CBIsActive & isActive, const CBOnReady & onReady) {
+    const auto tExpired = tNow - std::chrono::milliseconds(m_impl->timeout_ms);
+
+    int nReleased = 0;
+
+    std::deque<Entry> waiting;
+    std::unordered_set<TIPAddress> waitingIPs;
+    for (auto & entry : m_impl->parked) {
+        const bool canApply = entry.tParked < tExpired || isActive(entry.input);
+        if (canApply == false || waitingIPs.count(entry.input.ip) > 0 ||
+            (waiting.size() > 0 && Impl::periodOf(waiting.front().input) != Impl::periodOf(entry.input))) {
+            waitingIPs.insert(entry.input.ip);
+            waiting.push_back(std::move(entry));
+            continue;
+        }
+
+        if (--m_impl->nParkedPerIP[entry.input.ip] == 0) {
+            m_impl->nParkedPerIP.erase(entry.input.ip);
+        }
+
+        nReleased++;
+        onReady(entry);
+    }
+    m_impl->parked.swap(waiting);
+
+    return nReleased;
+}
@@ -0,0 +1,175 @@
+#pragma once
+
+#include "types.h"
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+
+// horizontal sharding of the ingestion
+// - the front end routes each submission to the shard of its IP, see Shard::ofIP(). a shard is a the-story daemon
+//   with its own pending folder, submission log and state, which holds the contribution of its IPs
+// - the shards send the changes of their state as deltas to the coordinator (StateDelta), which merges them into the
+//   state that it publishes. the deltas add up to the state of a single daemon that gets all of the submissions
+// - a slot is active when the total votes allow it. the coordinator replies to each message with the total votes,
+//   so each shard knows a lower bound of the votes of the others. a submission for a slot that is not active for
+//   the known votes waits at the shard until the votes of the other shards activate it, or is rejected after a timeout,
+//   see ShardParking for how this can make the result differ from a single daemon
+// - the coordinator keeps no history: when it starts, and when a shard that it already knows connects again, it asks
+//   all shards for their whole contribution and rebuilds the state from them. the activity is not part of it
+//
+// the messages are a little-endian uint32 payload length followed by the payload, the first byte is the type:
+//   shard -> coordinator:
+//     'h' : hello "<name>", the name identifies the shard across restarts
+//     'f' : whole contribution, uint32 generation of the request and the StateDelta from the initial state
+//     'd' : StateDelta with the changes since the previous 'f' or 'd'
+//     's' : only asks for a reply with the latest total votes
+//   coordinator -> shard:
+//     'r' : request of the whole contribution, uint32 generation, the deltas are ignored until it arrives
+//     'v' : reply to 'f', 'd' and 's', int64 total votes and int64 votes of the shard that are part of them
+namespace Shard {
+
+// index of the shard of an IP, the same for all processes
+inline int32_t ofIP(TIPAddress ip, int32_t nShards) {
+    return (int32_t) (hash64(ip) % (uint64_t) nShards);
+}
+
+constexpr uint32_t kMaxMessageSize = 256*1024*1024;
+
+// upper bound of the slot ids in a delta, the coordinator allocates slots up to the largest id it receives
+// activeSlots() reaches it only after ~10^10 votes, a shard sending more is disconnected as malformed
+constexpr int32_t kMaxSlots = 1 << 20;
+
+}
+
+// connection of a shard to the coordinator
+// the messages are queued by the calling thread and sent by a background thread, which also receives the replies,
+// so a slow coordinator never blocks the calling thread. the connection is closed if the coordinator takes none of
+// the queued messages for 10 s, it asks for the whole contribution again when the shard reconnects
+class ShardClient {
+public:
+    struct Parameters {
+        int tcpPort = 0;
+
+        // identifies the shard across restarts, e.g. its data folder and prefix
+        std::string name;
+    };
+
+    // called from the receiving thread after a request or a reply has arrived
+    using CBOnReceived = std::function<void()>;
+
+    ShardClient(Parameters parameters, CBOnReceived && onReceived);
+    ~ShardClient();
+
+    // connect to the coordinator and say hello, returns false if it cannot be reached
+    bool connect();
+    bool isConnected() const;
+
+    // true if the coordinator waits for the whole contribution, with the generation of its request
+    bool fullRequested(uint32_t & generation);
+
+    // queue the whole contribution or the changes since the previous message
+    // returns false if the connection is lost
+    bool sendFull(const StateDelta & delta, uint32_t generation);
+    bool sendDelta(const StateDelta & delta);
+
+    // ask for the latest total votes, the reply updates otherVotes()
+    bool requestVotes();
+
+    // votes of the other shards as of the last reply
+    int64_t otherVotes() const;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> m_impl;
+};
+
+// the shards connect to the coordinator on a loopback TCP port
+// the messages are received by a background thread and merged into the state by merge()
+class ShardCoordinator {
+public:
+    struct Parameters {
+        int tcpPort = 0;
+    };
+
+    struct Statistics {
+        int32_t nShards        = 0; // connected right now
+        int64_t nDeltas        = 0;
+        int64_t nBytesReceived = 0;
+        int64_t nResets        = 0; // rebuilds of the state from the whole contributions
+    };
+
+    // called from the receiving thread after new messages have been queued
+    using CBOnReceived = std::function<void()>;
+
+    ShardCoordinator(Parameters parameters, CBOnReceived && onReceived);
+    ~ShardCoordinator();
+
+    // open the socket and start the receiving thread
+    bool start();
+
+    // merge the deltas received since the last call into the state, in the order of arrival, and reply to the shards
+    // the state is cleared when it has to be rebuilt, see above
+    // returns true if the state has the whole contribution of each connected shard
+    bool merge(State & state, const State::CBOnNewPeriodStart & onNewPeriodStart);
+
+    Statistics statistics() const;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> m_impl;
+};
+
+// the submissions of a shard for slots that are not active for the known votes, in the order of arrival
+// they wait until the votes of the other shards activate the slot, or until they expire. the later submissions of
+// their IPs and of the later periods wait as well, to keep the order per IP and per period
+//
+// the outcome of a parked submission depends on when the votes of the other shards arrive, so with sharding the
+// accepted submissions are not always the same as with a single daemon that gets all of the submissions:
+// - a submission for a slot that only the votes arriving after it activate is rejected by a single daemon, but
+//   accepted by the shard if the other shards report these votes before it expires
+// - a submission that a single daemon accepts is rejected by the shard if the votes that activate its slot arrive
+//   after it expired, e.g. while the coordinator or another shard is slow or not connected
+// only the submissions for the slots that become active while they wait are affected, the others are decided as by
+// a single daemon. the time is passed in by the caller, so the decisions are reproducible for the same arrivals
+class ShardParking {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        SubmissionInput input;
+
+        // pending file of the submission, kept until it is decided so that it is read again after a restart
+        std::string file;
+
+        Clock::time_point tParked;
+    };
+
+    // returns true if the slot of the submission is active for the votes known right now
+    using CBIsActive = std::function<bool(const SubmissionInput & input)>;
+
+    // called for the submissions that are decided, in the order of arrival
+    using CBOnReady = std::function<void(Entry & entry)>;
+
+    ShardParking(int timeout_ms);
+    ~ShardParking();
+
+    int timeout_ms() const;
+
+    size_t size() const;
+    bool empty() const;
+
+    // park the submission if it has to wait, the file is moved only then
+    // returns false if it can be applied right away
+    bool park(const SubmissionInput & input, std::string & file, bool isActive, Clock::time_point tNow);
+
+    // release the submissions whose slot is active by now and the ones that waited longer than the timeout
+    // isActive is checked again after each release, since the released submissions can activate more slots
+    // returns the number of released submissions
+    int release(Clock::time_point tNow, const CBIsActive & isActive, const CBOnReady & onReady);
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> m_impl;
+};
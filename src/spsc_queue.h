@@ -0,0 +1,117 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// bounded single-producer single-consumer queue
+// - push and pop are lock-free ring buffer operations
+// - the blocking variants park the thread on a condition variable, which the other side
+//   notifies only if a thread is actually waiting, so the fast path never takes the mutex
+template <typename T>
+class SPSCQueue {
+public:
+    // the capacity is rounded up to a power of 2
+    SPSCQueue(size_t capacity) {
+        size_t n = 1;
+        while (n < capacity) {
+            n *= 2;
+        }
+        m_items.resize(n);
+        m_mask = n - 1;
+    }
+
+    size_t capacity() const { return m_items.size(); }
+
+    // number of queued items, approximate while the other side is active
+    size_t size() const {
+        return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+    }
+
+    // largest number of queued items observed by push
+    size_t maxSize() const { return m_maxSize.load(std::memory_order_relaxed); }
+
+    // producer
+    bool tryPush(T && item) {
+        const uint64_t tail = m_tail.load(std::memory_order_relaxed);
+        const uint64_t head = m_head.load(std::memory_order_acquire);
+        if (tail - head == m_items.size()) {
+            return false;
+        }
+
+        m_items[tail & m_mask] = std::move(item);
+        m_tail.store(tail + 1, std::memory_order_seq_cst);
+
+        if (tail + 1 - head > m_maxSize.load(std::memory_order_relaxed)) {
+            m_maxSize.store(tail + 1 - head, std::memory_order_relaxed);
+        }
+
+        notify();
+        return true;
+    }
+
+    // producer, waits while the queue is full
+    void push(T && item) {
+        while (tryPush(std::move(item)) == false) {
+            wait([&]() { return size() < m_items.size(); }, std::chrono::milliseconds(100));
+        }
+    }
+
+    // consumer
+    bool tryPop(T & item) {
+        const uint64_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        item = std::move(m_items[head & m_mask]);
+        m_head.store(head + 1, std::memory_order_seq_cst);
+
+        notify();
+        return true;
+    }
+
+    // consumer, waits up to timeout for an item
+    bool pop(T & item, std::chrono::milliseconds timeout) {
+        if (tryPop(item)) {
+            return true;
+        }
+
+        wait([&]() { return size() > 0; }, timeout);
+
+        return tryPop(item);
+    }
+
+private:
+    template <typename TReady>
+    void wait(TReady && isReady, std::chrono::milliseconds timeout) {
+        std::unique_lock lock(m_mutex);
+
+        // seq_cst pairs with the stores of the indices, so either the waiter sees the new index
+        // or the other side sees the waiter
+        m_nWaiting.fetch_add(1, std::memory_order_seq_cst);
+        m_cv.wait_for(lock, timeout, isReady);
+        m_nWaiting.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void notify() {
+        if (m_nWaiting.load(std::memory_order_seq_cst) > 0) {
+            { std::lock_guard lock(m_mutex); }
+            m_cv.notify_all();
+        }
+    }
+
+    std::vector<T> m_items;
+    uint64_t m_mask = 0;
+
+    alignas(64) std::atomic<uint64_t> m_head { 0 };
+    alignas(64) std::atomic<uint64_t> m_tail { 0 };
+    alignas(64) std::atomic<uint64_t> m_maxSize { 0 };
+
+    std::atomic<int> m_nWaiting { 0 };
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+};
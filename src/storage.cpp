@@ -0,0 +1,902 @@
+#include "storage.h"
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <sstream>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace {
+
+constexpr char     kLogMagic[4] = { 'T', 'S', 'W', 'L' };
+constexpr uint32_t kLogVersion  = 1;
+constexpr size_t   kLogHeaderSize = sizeof(kLogMagic) + sizeof(uint32_t);
+
+// FNV-1a
+uint32_t checksum(const char * data, size_t size) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < size; ++i) {
+        h ^= (uint8_t) data[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+bool isLogHeader(const char * data, size_t size) {
+    uint32_t version = 0;
+    return size >= kLogHeaderSize && memcmp(data, kLogMagic, sizeof(kLogMagic)) == 0 &&
+        (memcpy(&version, data + sizeof(kLogMagic), sizeof(version)), version == kLogVersion);
+}
+
+// parse the complete and valid log records starting at pos, returns the position after the last one
+size_t parseLogRecords(const char * data, size_t size, size_t pos, std::vector<SubmissionInput> & entries) {
+    while (size - pos >= 2*sizeof(uint32_t)) {
+        uint32_t recordSize;
+        memcpy(&recordSize, data + pos, sizeof(recordSize));
+        if (size - pos < 2*sizeof(uint32_t) + recordSize) {
+            break;
+        }
+
+        const char * payload = data + pos + sizeof(uint32_t);
+
+        uint32_t expected;
+        memcpy(&expected, payload + recordSize, sizeof(expected));
+        if (checksum(payload, recordSize) != expected) {
+            break;
+        }
+
+        SubmissionInput entry;
+        if (entry.parse(payload, recordSize) == false) {
+            break;
+        }
+        entries.push_back(entry);
+
+        pos += 2*sizeof(uint32_t) + recordSize;
+    }
+
+    return pos;
+}
+
+constexpr char kPeriodMagic[4] = { 'T', 'S', 'P', 'F' };
+
+constexpr char     kSnapshotMagic[4] = { 'T', 'S', 'S', 'N' };
+// version 2: the votes of a group are shared per word instead of per user, see State::Group
+constexpr uint32_t kSnapshotVersion  = 2;
+
+// make a rename or a new file in the folder of the given file durable
+bool syncFolderOf(const std::string & fileName) {
+    const auto pos = fileName.rfind('/');
+    const std::string folder = pos == std::string::npos ? "." : fileName.substr(0, pos);
+
+    const int fd = ::open(folder.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        return false;
+    }
+
+    const bool ok = ::fsync(fd) == 0;
+    ::close(fd);
+
+    return ok;
+}
+
+// write a file via a temporary file, fsync and rename
+template <typename F>
+bool writeDurably(const std::string & fileName, F && write) {
+    const std::string fileNameTmp = fileName + ".tmp";
+
+    {
+        std::ofstream file(fileNameTmp, std::ios::binary);
+        write(file);
+
+        if (file.good() == false) {
+            fprintf(stderr, "Failed to write '%s'\n", fileNameTmp.c_str());
+            return false;
+        }
+    }
+
+    {
+        const int fd = ::open(fileNameTmp.c_str(), O_RDONLY);
+        const bool synced = fd >= 0 && ::fsync(fd) == 0;
+        if (fd >= 0) {
+            ::close(fd);
+        }
+
+        if (synced == false) {
+            fprintf(stderr, "Failed to fsync '%s'\n", fileNameTmp.c_str());
+            return false;
+        }
+    }
+
+    if (::rename(fileNameTmp.c_str(), fileName.c_str()) != 0) {
+        fprintf(stderr, "Failed to rename '%s' to '%s'\n", fileNameTmp.c_str(), fileName.c_str());
+        return false;
+    }
+
+    // the caller might discard the source of the data next, e.g. the submission log after storing the period
+    if (syncFolderOf(fileName) == false) {
+        fprintf(stderr, "Failed to sync the folder of '%s'\n", fileName.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+bool writeAll(int fd, const char * data, size_t size) {
+    while (size > 0) {
+        const auto n = ::write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+}
+
+namespace Storage {
+
+std::string periodFileName(const std::string & dataFolder, const std::string & prefix, TPeriodId periodId) {
+    const auto periodIdStr = std::to_string(periodId);
+    const auto periodIdStrPadded = std::string(5 - std::min<size_t>(5, periodIdStr.size()), '0') + periodIdStr;
+
+    return dataFolder + "/" + prefix + "-" + periodIdStrPadded + ".bin";
+}
+
+std::string logFileName(const std::string & dataFolder, const std::string & prefix) {
+    return dataFolder + "/" + prefix + ".wal";
+}
+
+std::string periodLogFileName(const std::string & dataFolder, const std::string & prefix, TPeriodId periodId) {
+    auto result = periodFileName(dataFolder, prefix, periodId);
+    result.replace(result.size() - 4, 4, ".wal");
+    return result;
+}
+
+bool serialize(const std::vector<SubmissionInput> & entries, const std::string & fileName) {
+    // build the word table of the file in the order of first occurrence
+    std::vector<std::string_view> words;
+    FlatMap<TWordId, uint32_t> wordIndex;
+
+    std::vector<PeriodFile::Record> records(entries.size());
+    for (size_t i = 0; i < entries.size(); ++i) {
+        const auto & entry = entries[i];
+
+        auto [index, isNew] = wordIndex.insert(entry.wordId, (uint32_t) words.size());
+        if (isNew) {
+            words.push_back(Dictionary::word(entry.wordId));
+        }
+
+        records[i] = PeriodFile::Record { entry.timestamp_s, entry.ip, entry.slotId, *index, entry.userId, 0 };
+    }
+
+    std::vector<uint32_t> offsets(words.size() + 1);
+    std::string arena;
+    for (size_t i = 0; i < words.size(); ++i) {
+        offsets[i] = (uint32_t) arena.size();
+        arena += words[i];
+    }
+    offsets[words.size()] = (uint32_t) arena.size();
+
+    PeriodFile::Header header;
+    memcpy(header.magic, kPeriodMagic, sizeof(header.magic));
+    header.version     = PeriodFile::kVersion;
+    header.nRecords    = records.size();
+    header.nWords      = (uint32_t) words.size();
+    header.reserved    = 0;
+    header.wordsOffset = sizeof(header) + records.size()*sizeof(PeriodFile::Record);
+
+    return writeDurably(fileName, [&](std::ofstream & file) {
+        file.write((const char *) &header, sizeof(header));
+        file.write((const char *) records.data(), records.size()*sizeof(PeriodFile::Record));
+        file.write((const char *) offsets.data(), offsets.size()*sizeof(uint32_t));
+        file.write(arena.data(), arena.size());
+    });
+}
+
+bool serializeLegacy(const std::vector<SubmissionInput> & entries, const std::string & fileName) {
+    return writeDurably(fileName, [&](std::ofstream & file) {
+        // output number of elements
+        const size_t numElements = entries.size();
+        file.write((char *)&numElements, sizeof(numElements));
+
+        // output each element
+        for (const auto & entry : entries) {
+            entry.serialize(file);
+        }
+    });
+}
+
+std::vector<SubmissionInput> deserializeAll(const std::string & fileName) {
+    std::vector<SubmissionInput> entries;
+
+    if (isLegacy(fileName) == false) {
+        PeriodFile file;
+        if (file.open(fileName)) {
+            entries.resize(file.nRecords());
+            for (uint64_t i = 0; i < file.nRecords(); ++i) {
+                entries[i] = file.input(i);
+            }
+        }
+
+        return entries;
+    }
+
+    std::ifstream file(fileName, std::ios::binary);
+
+    // read number of elements
+    size_t numElements;
+    file.read((char *)&numElements, sizeof(numElements));
+    entries.resize(numElements);
+
+    // read each element
+    for (uint32_t i = 0; i < numElements; ++i) {
+        entries[i].deserialize(file);
+    }
+
+    return entries;
+}
+
+bool deserializeOne(const std::string & fileName, SubmissionInput & entry, const SubmissionInput::CBIsValidWord & isValidWord) {
+    std::ifstream file(fileName);
+    if (file.is_open() == false) {
+        return false;
+    }
+
+    char buffer[256];
+    file.read(buffer, sizeof(buffer));
+
+    return entry.parse(std::string_view(buffer, file.gcount()), isValidWord);
+}
+
+bool isLegacy(const std::string & fileName) {
+    std::ifstream file(fileName, std::ios::binary);
+
+    char magic[4] = {};
+    file.read(magic, sizeof(magic));
+
+    return file.good() && memcmp(magic, kPeriodMagic, sizeof(magic)) != 0;
+}
+
+bool convert(const std::string & fileName) {
+    if (isLegacy(fileName) == false) {
+        return true;
+    }
+
+    const auto entries = deserializeAll(fileName);
+    if (serialize(entries, fileName) == false) {
+        return false;
+    }
+
+    // make sure that the new file reads back the same records
+    const auto check = deserializeAll(fileName);
+    if (check.size() != entries.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < check.size(); ++i) {
+        const auto & a = entries[i];
+        const auto & b = check[i];
+        if (a.timestamp_s != b.timestamp_s || a.ip != b.ip || a.slotId != b.slotId || a.userId != b.userId || a.wordId != b.wordId) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+TPeriodId periodIdFromFileName(const std::string & fileName) {
+    // "...-NNNNN.bin" or "...-NNNNN.wal"
+    const auto end = fileName.rfind('.');
+    const auto begin = fileName.rfind('-', end);
+    if (end == std::string::npos || begin == std::string::npos || begin + 1 >= end) {
+        return -1;
+    }
+
+    TPeriodId result = 0;
+    for (size_t i = begin + 1; i < end; ++i) {
+        if (fileName[i] < '0' || fileName[i] > '9') {
+            return -1;
+        }
+        result = 10*result + (fileName[i] - '0');
+    }
+
+    return result;
+}
+
+std::string lockFileName(const std::string & dataFolder, const std::string & prefix) {
+    return dataFolder + "/" + prefix + ".lock";
+}
+
+int tryLock(const std::string & fileName) {
+    const int fd = ::open(fileName.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open lock file '%s': %s\n", fileName.c_str(), strerror(errno));
+        return -1;
+    }
+
+    if (::flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        ::close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+std::string snapshotFileName(const std::string & dataFolder, const std::string & prefix) {
+    return dataFolder + "/" + prefix + ".snapshot";
+}
+
+bool saveSnapshot(const State & state, const SnapshotInfo & info, const std::string & fileName) {
+    std::ostringstream body(std::ios::binary);
+    state.save(body);
+
+    const auto data = body.str();
+    const uint32_t sum = checksum(data.data(), data.size());
+    const uint64_t size = data.size();
+
+    return writeDurably(fileName, [&](std::ofstream & file) {
+        file.write(kSnapshotMagic, sizeof(kSnapshotMagic));
+        file.write((const char *) &kSnapshotVersion,        sizeof(kSnapshotVersion));
+        file.write((const char *) &info.lastStoredPeriodId, sizeof(info.lastStoredPeriodId));
+        file.write((const char *) &info.nCurPeriodRecords,  sizeof(info.nCurPeriodRecords));
+        file.write((const char *) &size, sizeof(size));
+        file.write((const char *) &sum,  sizeof(sum));
+        file.write(data.data(), data.size());
+    });
+}
+
+bool loadSnapshot(State & state, SnapshotInfo & info, const std::string & fileName) {
+    std::ifstream file(fileName, std::ios::binary);
+    if (file.is_open() == false) {
+        return false;
+    }
+
+    char magic[4] = {};
+    uint32_t version = 0;
+    uint64_t size = 0;
+    uint32_t sum = 0;
+
+    file.read(magic, sizeof(magic));
+    file.read((char *) &version, sizeof(version));
+    file.read((char *) &info.lastStoredPeriodId, sizeof(info.lastStoredPeriodId));
+    file.read((char *) &info.nCurPeriodRecords,  sizeof(info.nCurPeriodRecords));
+    file.read((char *) &size, sizeof(size));
+    file.read((char *) &sum,  sizeof(sum));
+
+    if (file.good() == false || memcmp(magic, kSnapshotMagic, sizeof(magic)) != 0 || version != kSnapshotVersion) {
+        fprintf(stderr, "Invalid snapshot '%s'\n", fileName.c_str());
+        return false;
+    }
+
+    // the size in the header is not trusted before it matches the file, a mismatch is treated like a bad checksum
+    const auto headerSize = file.tellg();
+    file.seekg(0, std::ios::end);
+    const auto fileSize = file.tellg();
+    file.seekg(headerSize);
+
+    if (file.good() == false || headerSize < 0 || uint64_t(fileSize - headerSize) != size) {
+        fprintf(stderr, "Corrupted snapshot '%s'\n", fileName.c_str());
+        return false;
+    }
+
+    std::string data(size, '\0');
+    if (file.read(data.data(), size).good() == false || checksum(data.data(), data.size()) != sum) {
+        fprintf(stderr, "Corrupted snapshot '%s'\n", fileName.c_str());
+        return false;
+    }
+
+    // keep the state untouched if the snapshot turns out to be invalid
+    State result;
+    std::istringstream body(data, std::ios::binary);
+    if (result.load(body) == false) {
+        fprintf(stderr, "Failed to load snapshot '%s'\n", fileName.c_str());
+        return false;
+    }
+
+    // the settings of the state are not part of the snapshot
+    result.acceptAllSlots = state.acceptAllSlots;
+    result.otherVotes = state.otherVotes;
+    result.delta = state.delta;
+
+    state = std::move(result);
+
+    return true;
+}
+
+}
+
+struct PeriodFile::Impl {
+    const char * data = nullptr;
+    size_t size = 0;
+
+    const Header * header = nullptr;
+    const Record * records = nullptr;
+
+    std::vector<TWordId> wordIds;
+
+    void unmap() {
+        if (data) {
+            munmap((void *) data, size);
+            data = nullptr;
+        }
+    }
+};
+
+PeriodFile::PeriodFile() : m_impl(new Impl()) {}
+
+PeriodFile::~PeriodFile() {
+    m_impl->unmap();
+}
+
+bool PeriodFile::open(const std::string & fileName) {
+    m_impl->unmap();
+    m_impl->wordIds.clear();
+
+    const int fd = ::open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(Header)) {
+        ::close(fd);
+        return false;
+    }
+
+    void * data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+
+    m_impl->data = (const char *) data;
+    m_impl->size = st.st_size;
+
+    // the records are read sequentially
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    const auto * header = (const Header *) m_impl->data;
+    if (memcmp(header->magic, kPeriodMagic, sizeof(header->magic)) != 0 || header->version != kVersion) {
+        m_impl->unmap();
+        return false;
+    }
+
+    // validate the layout before handing out any pointers
+    const uint64_t recordsSize = header->nRecords*sizeof(Record);
+    const uint64_t offsetsSize = (uint64_t(header->nWords) + 1)*sizeof(uint32_t);
+    if (header->nRecords > m_impl->size/sizeof(Record) ||
+        header->wordsOffset != sizeof(Header) + recordsSize ||
+        header->wordsOffset + offsetsSize > m_impl->size) {
+        fprintf(stderr, "Invalid period file '%s'\n", fileName.c_str());
+        m_impl->unmap();
+        return false;
+    }
+
+    const auto * offsets = (const uint32_t *) (m_impl->data + header->wordsOffset);
+    const char * arena = m_impl->data + header->wordsOffset + offsetsSize;
+    const uint64_t arenaSize = m_impl->size - header->wordsOffset - offsetsSize;
+
+    m_impl->wordIds.resize(header->nWords);
+    for (uint32_t i = 0; i < header->nWords; ++i) {
+        if (offsets[i] > offsets[i + 1] || offsets[i + 1] > arenaSize) {
+            fprintf(stderr, "Invalid word table in period file '%s'\n", fileName.c_str());
+            m_impl->unmap();
+            return false;
+        }
+        m_impl->wordIds[i] = Dictionary::intern(std::string_view(arena + offsets[i], offsets[i + 1] - offsets[i]));
+    }
+
+    m_impl->header = header;
+    m_impl->records = (const Record *) (m_impl->data + sizeof(Header));
+
+    for (uint64_t i = 0; i < header->nRecords; ++i) {
+        if (m_impl->records[i].wordIndex >= header->nWords) {
+            fprintf(stderr, "Invalid record %lu in period file '%s'\n", i, fileName.c_str());
+            m_impl->unmap();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+uint64_t PeriodFile::nRecords() const {
+    return m_impl->data ? m_impl->header->nRecords : 0;
+}
+
+const PeriodFile::Record * PeriodFile::records() const {
+    return m_impl->records;
+}
+
+const std::vector<TWordId> & PeriodFile::wordIds() const {
+    return m_impl->wordIds;
+}
+
+struct SubmissionLog::Impl {
+    Parameters parameters;
+    Statistics statistics;
+
+    int fd = -1;
+
+    // records that have been appended but not written yet
+    std::string buffer;
+
+    // written, but not synced yet
+    bool dirty = false;
+    std::chrono::steady_clock::time_point tLastSync;
+
+    // the next log, created and synced in advance so that rotate() only has to rename it, -1 if not prepared
+    std::string nextFileName;
+    int nextFd = -1;
+
+    // finishes a rotation in the background: syncs the folder, closes the rotated log and prepares the next log
+    std::thread rotation;
+
+    // set once the renames of the last rotation are durable, the new log is not synced before that
+    std::future<bool> folderSynced;
+
+    ~Impl() {
+        if (rotation.joinable()) {
+            rotation.join();
+        }
+        if (nextFd >= 0) {
+            ::close(nextFd);
+        }
+    }
+
+    static bool writeHeader(int fd) {
+        char header[kLogHeaderSize];
+        memcpy(header, kLogMagic, sizeof(kLogMagic));
+        memcpy(header + sizeof(kLogMagic), &kLogVersion, sizeof(kLogVersion));
+
+        return writeAll(fd, header, sizeof(header));
+    }
+
+    // an empty log with a synced header, -1 on failure
+    static int prepare(const std::string & fileName) {
+        const int fd = ::open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            return -1;
+        }
+
+        if (writeHeader(fd) == false || ::fsync(fd) != 0) {
+            ::close(fd);
+            return -1;
+        }
+
+        return fd;
+    }
+};
+
+bool SubmissionLog::parseFsyncPolicy(const std::string & str, Parameters & parameters) {
+    if (str == "none") {
+        parameters.fsyncPolicy = FsyncPolicy::None;
+        return true;
+    }
+
+    if (str == "batch") {
+        parameters.fsyncPolicy = FsyncPolicy::Batch;
+        return true;
+    }
+
+    if (str.size() > 2 && str.compare(str.size() - 2, 2, "ms") == 0) {
+        const int interval_ms = atoi(str.c_str());
+        if (interval_ms <= 0) {
+            return false;
+        }
+        parameters.fsyncPolicy = FsyncPolicy::Interval;
+        parameters.fsyncInterval_ms = interval_ms;
+        return true;
+    }
+
+    return false;
+}
+
+bool SubmissionLog::read(const std::string & fileName, std::vector<SubmissionInput> & entries) {
+    std::string data;
+    {
+        std::ifstream file(fileName, std::ios::binary);
+        if (file.is_open() == false) {
+            return true;
+        }
+        data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    if (data.empty()) {
+        return true;
+    }
+
+    if (isLogHeader(data.data(), data.size()) == false) {
+        fprintf(stderr, "Invalid submission log '%s'\n", fileName.c_str());
+        return false;
+    }
+
+    const size_t pos = parseLogRecords(data.data(), data.size(), kLogHeaderSize, entries);
+
+    if (pos < data.size()) {
+        fprintf(stderr, "Warning: dropping %zu bytes of incomplete records from '%s'\n", data.size() - pos, fileName.c_str());
+        if (::truncate(fileName.c_str(), pos) != 0) {
+            fprintf(stderr, "Failed to truncate '%s'\n", fileName.c_str());
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool SubmissionLog::readFrom(int fd, uint64_t & offset, std::vector<SubmissionInput> & entries) {
+    std::string data;
+
+    char buffer[64*1024];
+    while (true) {
+        const auto n = ::pread(fd, buffer, sizeof(buffer), offset + data.size());
+        if (n < 0) {
+            return false;
+        }
+        if (n == 0) {
+            break;
+        }
+        data.append(buffer, n);
+    }
+
+    size_t pos = 0;
+    if (offset == 0) {
+        // the header is written when the log is created, it might not be there yet
+        if (data.size() < kLogHeaderSize) {
+            return true;
+        }
+        if (isLogHeader(data.data(), data.size()) == false) {
+            return false;
+        }
+        pos = kLogHeaderSize;
+    }
+
+    offset += parseLogRecords(data.data(), data.size(), pos, entries);
+
+    return true;
+}
+
+SubmissionLog::SubmissionLog(Parameters parameters) : m_impl(new Impl()) {
+    m_impl->parameters = std::move(parameters);
+    m_impl->nextFileName = m_impl->parameters.fileName + ".next";
+}
+
+SubmissionLog::~SubmissionLog() {
+    if (m_impl->fd >= 0) {
+        commit();
+        sync();
+        ::close(m_impl->fd);
+    }
+}
+
+bool SubmissionLog::open() {
+    m_impl->fd = ::open(m_impl->parameters.fileName.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (m_impl->fd < 0) {
+        fprintf(stderr, "Failed to open submission log '%s': %s\n", m_impl->parameters.fileName.c_str(), strerror(errno));
+        return false;
+    }
+
+    if (::lseek(m_impl->fd, 0, SEEK_END) == 0) {
+        if (Impl::writeHeader(m_impl->fd) == false) {
+            return false;
+        }
+        m_impl->dirty = true;
+    }
+
+    m_impl->tLastSync = std::chrono::steady_clock::now();
+
+    // the first rotation uses it, the later ones prepare the next log in the background
+    if (m_impl->rotation.joinable() == false && m_impl->nextFd < 0) {
+        m_impl->nextFd = Impl::prepare(m_impl->nextFileName);
+    }
+
+    return true;
+}
+
+void SubmissionLog::append(const SubmissionInput & input) {
+    auto & buffer = m_impl->buffer;
+
+    const size_t pos = buffer.size();
+    buffer.append(sizeof(uint32_t), '\0');
+    input.serialize(buffer);
+
+    const uint32_t size = buffer.size() - pos - sizeof(uint32_t);
+    memcpy(&buffer[pos], &size, sizeof(size));
+
+    const uint32_t sum = checksum(buffer.data() + pos + sizeof(uint32_t), size);
+    buffer.append((const char *) &sum, sizeof(sum));
+
+    m_impl->statistics.nRecords++;
+}
+
+bool SubmissionLog::commit() {
+    if (m_impl->fd < 0) {
+        return false;
+    }
+
+    if (m_impl->buffer.empty() == false) {
+        if (writeAll(m_impl->fd, m_impl->buffer.data(), m_impl->buffer.size()) == false) {
+            fprintf(stderr, "Failed to write to submission log: %s\n", strerror(errno));
+            return false;
+        }
+
+        m_impl->statistics.nCommits++;
+        m_impl->statistics.nBytes += m_impl->buffer.size();
+        m_impl->buffer.clear();
+        m_impl->dirty = true;
+    }
+
+    switch (m_impl->parameters.fsyncPolicy) {
+        case FsyncPolicy::None:
+            break;
+        case FsyncPolicy::Batch:
+            return sync();
+        case FsyncPolicy::Interval:
+            if (syncTimeout_ms() == 0) {
+                return sync();
+            }
+            break;
+    }
+
+    return true;
+}
+
+bool SubmissionLog::sync() {
+    // the records of the new log are durable only once it has replaced the rotated log on disk
+    if (m_impl->folderSynced.valid() && m_impl->folderSynced.get() == false) {
+        fprintf(stderr, "Failed to sync the folder of submission log '%s'\n", m_impl->parameters.fileName.c_str());
+        return false;
+    }
+
+    if (m_impl->fd < 0 || m_impl->dirty == false) {
+        return true;
+    }
+
+    if (::fsync(m_impl->fd) != 0) {
+        fprintf(stderr, "Failed to fsync submission log: %s\n", strerror(errno));
+        return false;
+    }
+
+    m_impl->dirty = false;
+    m_impl->tLastSync = std::chrono::steady_clock::now();
+    m_impl->statistics.nSyncs++;
+
+    return true;
+}
+
+int SubmissionLog::syncTimeout_ms() const {
+    if (m_impl->dirty == false || m_impl->parameters.fsyncPolicy == FsyncPolicy::None) {
+        return -1;
+    }
+
+    const auto elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - m_impl->tLastSync).count();
+
+    return std::max<int64_t>(0, m_impl->parameters.fsyncInterval_ms - elapsed_ms);
+}
+
+bool SubmissionLog::rotate(const std::string & fileName) {
+    auto & impl = *m_impl;
+
+    if (commit() == false) {
+        return false;
+    }
+
+    // started by the previous rotation, a period earlier
+    if (impl.rotation.joinable()) {
+        impl.rotation.join();
+    }
+
+    // without a prepared log, rotate synchronously
+    if (impl.nextFd < 0) {
+        if (sync() == false) {
+            return false;
+        }
+
+        if (::rename(impl.parameters.fileName.c_str(), fileName.c_str()) != 0) {
+            fprintf(stderr, "Failed to rename submission log to '%s': %s\n", fileName.c_str(), strerror(errno));
+            return false;
+        }
+
+        ::close(impl.fd);
+        impl.fd = -1;
+
+        // the records must not be found in both files after a crash
+        if (syncFolderOf(fileName) == false) {
+            fprintf(stderr, "Failed to sync the folder of '%s'\n", fileName.c_str());
+        }
+
+        return open() && sync();
+    }
+
+    if (::rename(impl.parameters.fileName.c_str(), fileName.c_str()) != 0) {
+        fprintf(stderr, "Failed to rename submission log to '%s': %s\n", fileName.c_str(), strerror(errno));
+        return false;
+    }
+
+    // a crash before this rename leaves no log, which is the same as an empty one
+    if (::rename(impl.nextFileName.c_str(), impl.parameters.fileName.c_str()) != 0) {
+        fprintf(stderr, "Failed to rename '%s' to '%s': %s\n", impl.nextFileName.c_str(), impl.parameters.fileName.c_str(), strerror(errno));
+
+        ::close(impl.nextFd);
+        impl.nextFd = -1;
+
+        if (sync() == false) {
+            return false;
+        }
+
+        ::close(impl.fd);
+        impl.fd = -1;
+
+        if (syncFolderOf(fileName) == false) {
+            fprintf(stderr, "Failed to sync the folder of '%s'\n", fileName.c_str());
+        }
+
+        return open() && sync();
+    }
+
+    // the rotated log is synced according to the fsync policy in the background, its records
+    // are in the period log either way
+    const int prevFd = impl.fd;
+    const bool prevDirty = impl.dirty && impl.parameters.fsyncPolicy != FsyncPolicy::None;
+
+    impl.fd = impl.nextFd;
+    impl.nextFd = -1;
+    impl.dirty = false;
+    impl.tLastSync = std::chrono::steady_clock::now();
+
+    std::promise<bool> folderSynced;
+    impl.folderSynced = folderSynced.get_future();
+
+    impl.rotation = std::thread([&impl, prevFd, prevDirty, folderSynced = std::move(folderSynced), folder = fileName]() mutable {
+        // the records must not be found in both files after a crash
+        folderSynced.set_value(syncFolderOf(folder));
+
+        if (prevDirty && ::fsync(prevFd) != 0) {
+            fprintf(stderr, "Failed to fsync the rotated submission log '%s': %s\n", folder.c_str(), strerror(errno));
+        }
+        ::close(prevFd);
+
+        impl.nextFd = Impl::prepare(impl.nextFileName);
+        if (impl.nextFd < 0) {
+            fprintf(stderr, "Failed to prepare the next submission log '%s', rotating synchronously\n", impl.nextFileName.c_str());
+        }
+    });
+
+    return true;
+}
+
+bool SubmissionLog::reset() {
+    m_impl->buffer.clear();
+
+    if (m_impl->fd < 0) {
+        return false;
+    }
+
+    if (::ftruncate(m_impl->fd, kLogHeaderSize) != 0) {
+        fprintf(stderr, "Failed to reset submission log: %s\n", strerror(errno));
+        return false;
+    }
+
+    m_impl->dirty = true;
+
+    return sync();
+}
+
+const SubmissionLog::Parameters & SubmissionLog::parameters() const {
+    return m_impl->parameters;
+}
+
+const SubmissionLog::Statistics & SubmissionLog::statistics() const {
+    return m_impl->statistics;
+}
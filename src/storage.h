@@ -0,0 +1,202 @@
+#pragma once
+
+#include "types.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Storage {
+
+// "<dataFolder>/<prefix>-<periodId>.bin", the periodId is padded to 5 digits
+std::string periodFileName(const std::string & dataFolder, const std::string & prefix, TPeriodId periodId);
+
+// "<dataFolder>/<prefix>.wal"
+std::string logFileName(const std::string & dataFolder, const std::string & prefix);
+
+// "<dataFolder>/<prefix>-<periodId>.wal", the log of a finished period until its period file is written
+std::string periodLogFileName(const std::string & dataFolder, const std::string & prefix, TPeriodId periodId);
+
+// serialize vector of SubmissionInput to a binary period file (see PeriodFile for the layout)
+// the data is written to a temporary file, synced to disk and then renamed, and the rename is synced as well,
+// so a crash never leaves a partially written file behind and the file is durable once this returns true
+bool serialize(const std::vector<SubmissionInput> & entries, const std::string & fileName);
+
+// serialize in the legacy format: element count followed by variable-length SubmissionInput records
+bool serializeLegacy(const std::vector<SubmissionInput> & entries, const std::string & fileName);
+
+// get SubmissionInput vector from a binary file, supports both the current and the legacy format
+std::vector<SubmissionInput> deserializeAll(const std::string & fileName);
+
+// parse a pending submission file, as written by submit.php
+// returns false if the file does not exist, is malformed or isValidWord rejects the word
+bool deserializeOne(const std::string & fileName, SubmissionInput & entry, const SubmissionInput::CBIsValidWord & isValidWord = nullptr);
+
+// true if the file is in the legacy format
+bool isLegacy(const std::string & fileName);
+
+// rewrite a legacy period file in the current format
+bool convert(const std::string & fileName);
+
+// parse the period id from a period file or period log name, returns -1 on failure
+TPeriodId periodIdFromFileName(const std::string & fileName);
+
+// "<dataFolder>/<prefix>.lock", locked by the daemon that writes the data folder
+std::string lockFileName(const std::string & dataFolder, const std::string & prefix);
+
+// lock the file without waiting, creating it if needed
+// returns the descriptor that holds the lock until it is closed or the process exits,
+// or -1 if another process holds it
+int tryLock(const std::string & fileName);
+
+// describes which part of the submission history is contained in a snapshot
+struct SnapshotInfo {
+    // all period files up to and including this period
+    // the last ones might still exist only as period logs, they are turned into period files on startup
+    TPeriodId lastStoredPeriodId = -1;
+
+    // the first records of the current period (State::curPeriodId), as stored in the log
+    int64_t nCurPeriodRecords = 0;
+};
+
+// "<dataFolder>/<prefix>.snapshot"
+std::string snapshotFileName(const std::string & dataFolder, const std::string & prefix);
+
+// store a checksummed snapshot of the state, replacing the file atomically
+bool saveSnapshot(const State & state, const SnapshotInfo & info, const std::string & fileName);
+
+// returns false if the file does not exist or is not a valid snapshot
+bool loadSnapshot(State & state, SnapshotInfo & info, const std::string & fileName);
+
+}
+
+// read-only, memory-mapped period file
+//
+// layout (little-endian):
+//   Header    : magic "TSPF", version, number of records, number of words, offset of the word table
+//   Record[n] : fixed-width records, the word is an index into the word table of the file
+//   uint32[w + 1] : offsets of the words in the string arena
+//   char[]        : string arena
+//
+// the words of the file are interned once when opening, so iterating the records
+// requires no allocations or copies
+class PeriodFile {
+public:
+    static constexpr uint32_t kVersion = 2;
+
+    struct Header {
+        char     magic[4];
+        uint32_t version;
+        uint64_t nRecords;
+        uint32_t nWords;
+        uint32_t reserved;
+        uint64_t wordsOffset;
+    };
+
+    struct Record {
+        TTimestamp timestamp_s;
+        TIPAddress ip;
+        TSlotId    slotId;
+        uint32_t   wordIndex;
+        TUserId    userId;
+        uint16_t   reserved;
+    };
+
+    static_assert(sizeof(Header) == 32, "unexpected header size");
+    static_assert(sizeof(Record) == 20, "unexpected record size");
+
+    PeriodFile();
+    ~PeriodFile();
+
+    // map the file and validate it
+    // returns false if the file cannot be mapped or is not a valid period file
+    bool open(const std::string & fileName);
+
+    uint64_t nRecords() const;
+    const Record * records() const;
+
+    // global word ids of the words in the word table of the file
+    const std::vector<TWordId> & wordIds() const;
+
+    SubmissionInput input(uint64_t i) const {
+        const auto & r = records()[i];
+        return SubmissionInput { r.timestamp_s, r.ip, r.slotId, r.userId, wordIds()[r.wordIndex] };
+    }
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> m_impl;
+};
+
+// append-only write-ahead log of the submissions in the current period
+// - records are buffered by append() and written with a single write() by commit()
+// - each record is framed with its size and a checksum, so a torn tail after a crash is detected and dropped
+// - the log is reset once the period file with the same submissions has been stored
+class SubmissionLog {
+public:
+    enum class FsyncPolicy {
+        None,     // never fsync, leave it to the OS
+        Batch,    // fsync on every commit
+        Interval, // fsync on commit if at least fsyncInterval_ms passed since the last fsync
+    };
+
+    struct Parameters {
+        std::string fileName;
+
+        FsyncPolicy fsyncPolicy = FsyncPolicy::Batch;
+        int fsyncInterval_ms = 100;
+    };
+
+    struct Statistics {
+        int64_t nRecords = 0;
+        int64_t nCommits = 0;
+        int64_t nSyncs   = 0;
+        int64_t nBytes   = 0;
+    };
+
+    // parse fsync policy from string: "none", "batch" or "<N>ms"
+    static bool parseFsyncPolicy(const std::string & str, Parameters & parameters);
+
+    // read all valid records from a log file, truncating a torn tail
+    // returns false if the file exists but is not a valid log
+    static bool read(const std::string & fileName, std::vector<SubmissionInput> & entries);
+
+    // read the complete records after offset without modifying the file, e.g. of a log that another process appends to
+    // offset 0 is the start of the file, it is advanced past the records that were read
+    // returns false if the file is not a valid log
+    static bool readFrom(int fd, uint64_t & offset, std::vector<SubmissionInput> & entries);
+
+    SubmissionLog(Parameters parameters);
+    ~SubmissionLog();
+
+    // open the log for appending, creating it if needed
+    bool open();
+
+    // buffer a record
+    void append(const SubmissionInput & input);
+
+    // write the buffered records and fsync according to the policy
+    bool commit();
+
+    // fsync data that was written but not synced yet
+    bool sync();
+
+    // time until the written but unsynced data is due for fsync, -1 if there is none
+    int syncTimeout_ms() const;
+
+    // move all records to a new file and continue with an empty log
+    // the empty log is prepared in advance as "<log>.next", so this only writes the buffered records and renames
+    // the two files; the folder sync, the fsync of the rotated records according to the policy and the preparation
+    // of the next log run in the background, and sync() waits for the folder before the new records count as durable
+    bool rotate(const std::string & fileName);
+
+    // discard all records
+    bool reset();
+
+    const Parameters & parameters() const;
+    const Statistics & statistics() const;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> m_impl;
+};
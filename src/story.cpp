@@ -0,0 +1,1352 @@
+#include "story.h"
+
+#include "utils.h"
+#include "watcher.h"
+#include "ingest.h"
+#include "http.h"
+#include "publisher.h"
+#include "replay.h"
+#include "metrics.h"
+#include "lexicon.h"
+#include "spsc_queue.h"
+#include "worker_pool.h"
+#include "shard.h"
+#include "follower.h"
+
+#include <cstdio>
+#include <chrono>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <regex>
+#include <filesystem>
+#include <unordered_set>
+
+#include <unistd.h>
+
+namespace {
+
+// remove files
+int removeFiles(const std::vector<std::string> & files) {
+    int count = 0;
+
+    for (const auto & file : files) {
+        if (std::filesystem::remove(file)) {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+}
+
+void storePeriodLogs(const std::string & dataFolder, const std::string & prefix) {
+    for (const auto & file : Utils::getFiles(dataFolder, prefix + "-\\d+\\.wal")) {
+        const TPeriodId periodId = Storage::periodIdFromFileName(file);
+        const auto fileName = Storage::periodFileName(dataFolder, prefix, periodId);
+
+        if (std::filesystem::exists(fileName) == false) {
+            std::vector<SubmissionInput> entries;
+            if (SubmissionLog::read(file, entries) == false) {
+                fprintf(stderr, "Failed to read the period log '%s'\n", file.c_str());
+                continue;
+            }
+
+            // the log might start with records of an earlier period that is already stored, see processOld
+            std::map<TPeriodId, bool> isStored;
+            entries.erase(std::remove_if(entries.begin(), entries.end(), [&](const SubmissionInput & entry) {
+                const TPeriodId entryPeriodId = entry.timestamp_s/State::secondsInPeriod;
+                if (entryPeriodId == periodId) {
+                    return false;
+                }
+                if (isStored.count(entryPeriodId) == 0) {
+                    isStored[entryPeriodId] = std::filesystem::exists(Storage::periodFileName(dataFolder, prefix, entryPeriodId));
+                }
+                return isStored[entryPeriodId];
+            }), entries.end());
+
+            if (Storage::serialize(entries, fileName) == false) {
+                fprintf(stderr, "Failed to store the period log '%s'\n", file.c_str());
+                continue;
+            }
+
+            printf("Stored %lu entries from '%s' to '%s'\n", entries.size(), file.c_str(), fileName.c_str());
+        }
+
+        std::error_code ec;
+        std::filesystem::remove(file, ec);
+    }
+}
+
+TPeriodId processOld(State & state, const std::string & dataFolder, const std::string & prefix, int nThreads,
+                     std::vector<SubmissionInput> * curPeriodInput, TPeriodId * lastStoredPeriodIdOut) {
+    TPeriodId lastPeriodId = 0;
+    TPeriodId lastStoredPeriodId = -1;
+
+    // check if data folder exists
+    if (!std::filesystem::exists(dataFolder)) {
+        printf("Error: data folder \"%s\" does not exist\n", dataFolder.c_str());
+        return lastPeriodId;
+    }
+
+    printf("Reading input files from '%s'\n", dataFolder.c_str());
+    printf("Input file prefix: '%s'\n", prefix.c_str());
+
+    // only the daemon writes to the data folder
+    if (curPeriodInput) {
+        storePeriodLogs(dataFolder, prefix);
+    }
+
+    const auto tStart = std::chrono::steady_clock::now();
+
+    // records of the snapshot period that are already part of the state
+    TPeriodId coveredPeriodId = -1;
+    int64_t nCovered = 0;
+
+    {
+        const auto snapshotFileName = Storage::snapshotFileName(dataFolder, prefix);
+
+        Storage::SnapshotInfo info;
+        if (Storage::loadSnapshot(state, info, snapshotFileName)) {
+            lastPeriodId = std::max(0, info.lastStoredPeriodId);
+            lastStoredPeriodId = info.lastStoredPeriodId;
+            coveredPeriodId = state.curPeriodId;
+            nCovered = info.nCurPeriodRecords;
+
+            const auto tEnd = std::chrono::steady_clock::now();
+            printf("Loaded snapshot '%s' in %.3f s, last stored period id: %d, records of period %d: %ld\n",
+                   snapshotFileName.c_str(), std::chrono::duration<double>(tEnd - tStart).count(),
+                   lastStoredPeriodId, coveredPeriodId, nCovered);
+        }
+    }
+
+    // get all files in the data folder and sort them by name
+    std::vector<std::string> files = Utils::getFiles(dataFolder, prefix + "-\\d+\\.bin");
+
+    // sort the files by name
+    std::sort(files.begin(), files.end());
+
+    auto onNewPeriodStart = [&](TPeriodId periodId) {
+        lastPeriodId = periodId;
+    };
+
+    std::vector<Replay::File> replayFiles;
+    int nSkippedFiles = 0;
+
+    printf("Found %lu files\n", files.size());
+    for (const auto & file : files) {
+        const TPeriodId periodId = Storage::periodIdFromFileName(file);
+        if (periodId >= 0 && periodId <= lastStoredPeriodId) {
+            nSkippedFiles++;
+            continue;
+        }
+
+        // the period was stored after the snapshot was taken
+        const uint64_t nSkip = periodId == coveredPeriodId ? nCovered : 0;
+        if (nSkip > 0) {
+            nCovered = 0;
+        }
+
+        replayFiles.push_back({ file, nSkip });
+    }
+
+    const auto replayStatistics = Replay::apply(state, replayFiles, nThreads, onNewPeriodStart);
+    const int64_t nProcessed = replayStatistics.nRecords;
+    if (replayStatistics.nFiles > 0) {
+        lastStoredPeriodId = state.curPeriodId;
+    }
+
+    if (nSkippedFiles > 0) {
+        printf("Skipped %d files that are already contained in the snapshot\n", nSkippedFiles);
+    }
+
+    {
+        const auto tEnd = std::chrono::steady_clock::now();
+        printf("Processed %ld entries in %.3f s\n", nProcessed, std::chrono::duration<double>(tEnd - tStart).count());
+    }
+
+    if (nThreads > 1 && replayStatistics.nRuns > 0) {
+        printf("Parallel replay on %d threads: %d of %d periods merged in parallel (%d partitions each), %ld entries submitted sequentially\n",
+               nThreads, replayStatistics.nParallelRuns, replayStatistics.nRuns, replayStatistics.nPartitions, replayStatistics.nSequentialRecords);
+    }
+
+    if (curPeriodInput) {
+        const auto logFileName = Storage::logFileName(dataFolder, prefix);
+
+        std::vector<SubmissionInput> entries;
+        if (SubmissionLog::read(logFileName, entries) == false) {
+            // keep the file for manual recovery and start a new log
+            const auto backupFileName = logFileName + ".bad";
+            fprintf(stderr, "Moving invalid submission log to '%s'\n", backupFileName.c_str());
+            std::filesystem::rename(logFileName, backupFileName);
+        }
+
+        printf("Replaying %lu entries from '%s'\n", entries.size(), logFileName.c_str());
+
+        int nSkipped = 0;
+        for (auto & entry : entries) {
+            const TPeriodId periodId = entry.timestamp_s/State::secondsInPeriod;
+
+            // the log might still contain the records of the last stored period,
+            // if the process stopped after writing the period file but before resetting the log
+            if (periodId <= lastStoredPeriodId) {
+                nSkipped++;
+                continue;
+            }
+
+            // records contained in the snapshot are kept for the period file, but not applied again
+            if (periodId == coveredPeriodId && nCovered > 0) {
+                nCovered--;
+                nSkipped++;
+            } else {
+                state.submit(SubmissionInput { entry }, onNewPeriodStart);
+            }
+            curPeriodInput->push_back(std::move(entry));
+        }
+
+        if (nSkipped > 0) {
+            printf("Skipped %d entries that are already stored in period files or in the snapshot\n", nSkipped);
+        }
+    }
+
+    if (nCovered > 0) {
+        fprintf(stderr, "Warning: %ld records of the snapshot were not found in the period files or in the submission log\n", nCovered);
+    }
+
+    if (lastStoredPeriodIdOut) {
+        *lastStoredPeriodIdOut = lastStoredPeriodId;
+    }
+
+    return lastPeriodId;
+}
+
+struct Story::Impl {
+    // a batch of parsed submissions and the pending files that they came from
+    struct Batch {
+        std::vector<SubmissionInput> inputs;
+        std::vector<std::string> files;
+
+        Metrics::Clock::time_point tRead;
+    };
+
+    // pending files that have been applied, they can be removed if their records are stored in the log
+    struct Processed {
+        std::vector<std::string> files;
+        bool stored = false;
+    };
+
+    // the apply stage pushes at most one entry per processed batch, so the processed queue never fills up
+    static constexpr int kQueueCapacity = 64;
+
+    // work done by a single run of the read and the apply stage
+    static constexpr int kMaxRead = 4*1024;
+
+    // submissions received by the ingest server and not read yet, the clients wait while there are this many
+    static constexpr int kMaxQueuedSocket = 16*kMaxRead;
+    static constexpr int kMaxApplied = 64*1024;
+    static constexpr int kMinPublishInterval_ms = 50;
+    static constexpr int kMetricsInterval_ms = 1000;
+    static constexpr int kShardReconnectInterval_ms = 1000;
+    static constexpr int kParkTimeout_ms = 5000;
+    static constexpr int kParkRetryInterval_ms = 20;
+    static constexpr int kFollowInterval_ms = 10;
+
+    const std::string name;
+    const Parameters parameters;
+
+    // prefix of the log messages of the story
+    const std::string tag;
+
+    WorkerPool & pool;
+    WorkerPool::TaskId readTask;
+    WorkerPool::TaskId applyTask;
+    WorkerPool::TaskId publishTask;
+
+    State state;
+
+    TPeriodId lastStoredPeriodId = -1;
+    std::vector<SubmissionInput> curPeriodInput;
+
+    // write-ahead log with the submissions of the current period
+    std::unique_ptr<SubmissionLog> log;
+
+    // snapshots are written at each period rollover and optionally every snapshotInterval_ms
+    std::chrono::steady_clock::time_point tLastSnapshot;
+    bool snapshotDue = false;
+
+    // counters and latencies of the pipeline, written to the metrics file by the publish stage
+    Metrics metrics;
+
+    // writes the period file of the previous period, so that the submissions of the new one are not delayed
+    std::thread periodWriter;
+
+    std::string pendingFolder;
+
+    // optional socket endpoint, the pending folder remains available as a fallback
+    std::unique_ptr<IngestServer> server;
+
+    // optional HTTP endpoint for the statistics, the files are written as well
+    std::unique_ptr<HttpServer> httpServer;
+
+    // ingestion shard: the connection to the coordinator and the changes not sent yet
+    std::unique_ptr<ShardClient> shard;
+    StateDelta delta;
+    std::chrono::steady_clock::time_point tLastConnect;
+
+    // submissions of a shard for slots that are not active for the known votes
+    ShardParking parking { kParkTimeout_ms };
+    std::chrono::steady_clock::time_point tLastVotesRequest;
+
+    // read replica or hot standby of the daemon that writes the data folder
+    std::unique_ptr<LogFollower> follower;
+    std::atomic<bool> isFollowing { false };
+
+    // set when the story cannot continue, its stages do nothing after that
+    std::atomic<int> exitCode { 0 };
+    CBOnStopped onStopped;
+
+    // held by the daemon that writes the data folder
+    int lockFd = -1;
+
+    // coordinator of the ingestion shards, all slots are published again after the state is rebuilt
+    std::unique_ptr<ShardCoordinator> coordinator;
+    int64_t nResets = 0;
+    bool publishAll = true;
+
+    SPSCQueue<Batch> readQueue;
+    SPSCQueue<Processed> processedQueue;
+    SPSCQueue<StatsPublisher::Update> publishQueue;
+
+    // set when a stage stops because the queue after it is full, the next stage schedules it again
+    std::atomic<bool> readBlocked { false };
+    std::atomic<bool> applyBlocked { false };
+
+    // files reported by the watcher
+    std::mutex notifiedMutex;
+    std::vector<std::string> notified;
+    bool needScan = true;
+
+    // read stage
+    std::vector<std::string> files;
+    std::unordered_set<std::string> inFlight; // files that have been read, but not removed yet
+    std::unordered_set<std::string> invalid;  // malformed files, counted only once
+
+    // apply stage
+    std::vector<TSlotId> updatedSlots;
+    Processed processed;
+    StatsPublisher::Update pending; // update that could not be queued because the publisher is behind
+    bool hasPending = false;
+    Metrics::Clock::time_point tOldestRead = Metrics::Clock::time_point::max();
+
+    // publish stage
+    std::unique_ptr<StatsPublisher> publisher;
+    StatsPublisher::Update update;
+    bool hasUpdate = false;
+    int nMerged = 0;
+    std::chrono::steady_clock::time_point tLastPublish;
+    std::chrono::steady_clock::time_point tLastMetrics;
+
+    // submissions processed up to the last throughput report
+    int64_t nReported = 0;
+
+    Impl(const std::string & name, Parameters parameters, WorkerPool & pool, CBOnStopped && onStopped) :
+        name(name), parameters(std::move(parameters)), tag(name.empty() ? "" : "[" + name + "] "), pool(pool),
+        metrics(name),
+        readQueue(kQueueCapacity), processedQueue(kQueueCapacity + 2), publishQueue(kQueueCapacity) {
+        readTask    = pool.add([this]() { read(); });
+        applyTask   = pool.add([this]() { apply(); });
+        publishTask = pool.add([this]() { publish(); });
+
+        this->onStopped = std::move(onStopped);
+
+        state.init();
+    }
+
+    ~Impl() {
+        if (periodWriter.joinable()) {
+            periodWriter.join();
+        }
+
+        if (lockFd >= 0) {
+            ::close(lockFd);
+        }
+    }
+
+    bool hasData() const {
+        return parameters.dataFolder.empty() == false && parameters.prefix.empty() == false;
+    }
+
+    // a follower with a source of submissions takes over when the daemon that it follows stops
+    bool isStandby() const {
+        return parameters.pendingFolder.empty() == false || parameters.unixSocketPath.empty() == false || parameters.tcpPort > 0;
+    }
+
+    // returns false if another daemon writes the data folder
+    bool lockData() {
+        if (lockFd < 0) {
+            lockFd = Storage::tryLock(Storage::lockFileName(parameters.dataFolder, parameters.prefix));
+        }
+
+        return lockFd >= 0;
+    }
+
+    int init() {
+        if (parameters.shardPort > 0) {
+            return initCoordinator();
+        }
+
+        if (parameters.follow) {
+            return initFollower();
+        }
+
+        if (hasData() && lockData() == false) {
+            fprintf(stderr, "%sThe data folder '%s' with prefix '%s' is used by another daemon, see -fo\n",
+                    tag.c_str(), parameters.dataFolder.c_str(), parameters.prefix.c_str());
+            return 6;
+        }
+
+        TPeriodId lastPeriodId = 0;
+
+        // if data folder and prefix are specified, read and process the input files
+        if (hasData()) {
+            int nThreads = parameters.nThreads;
+
+            // the history of a shard has only the accepted submissions, their slots were activated by the votes of all shards
+            if (parameters.coordinatorPort > 0) {
+                state.acceptAllSlots = true;
+                if (nThreads > 1) {
+                    printf("%sThe history of a shard is replayed on a single thread\n", tag.c_str());
+                    nThreads = 1;
+                }
+            }
+
+            lastPeriodId = processOld(state, parameters.dataFolder, parameters.prefix, nThreads, &curPeriodInput, &lastStoredPeriodId);
+
+            state.acceptAllSlots = false;
+        } else {
+            printf("Skipping data processing.\n");
+        }
+
+        printf("%sLast period id: %d\n", tag.c_str(), lastPeriodId);
+
+        return initIngestion();
+    }
+
+    // open the submission log, start the ingest server and the publisher, or connect to the coordinator
+    int initIngestion() {
+        if (hasData()) {
+            SubmissionLog::Parameters logParameters;
+            logParameters.fileName = Storage::logFileName(parameters.dataFolder, parameters.prefix);
+            logParameters.fsyncPolicy = parameters.fsyncPolicy;
+            logParameters.fsyncInterval_ms = parameters.fsyncInterval_ms;
+
+            log = std::make_unique<SubmissionLog>(logParameters);
+            if (log->open() == false) {
+                return 5;
+            }
+        } else {
+            printf("%sWarning: data folder or prefix not specified - submissions will not be stored\n", tag.c_str());
+        }
+
+        tLastSnapshot = std::chrono::steady_clock::now();
+
+        // store the replayed state right away, so the next start does not have to replay it again
+        snapshotDue = log != nullptr;
+
+        pendingFolder = parameters.pendingFolder;
+
+        if (parameters.unixSocketPath.empty() == false || parameters.tcpPort > 0) {
+            IngestServer::Parameters serverParameters;
+            serverParameters.unixSocketPath = parameters.unixSocketPath;
+            serverParameters.tcpPort = parameters.tcpPort;
+            serverParameters.lexicon = parameters.lexicon;
+            serverParameters.maxQueued = kMaxQueuedSocket;
+
+            server = std::make_unique<IngestServer>(serverParameters, [this]() { this->pool.schedule(readTask); });
+            if (server->start() == false) {
+                fprintf(stderr, "%sFailed to start the ingest server\n", tag.c_str());
+                return 4;
+            }
+
+            printf("%sListening for submissions on%s%s%s\n", tag.c_str(),
+                   serverParameters.unixSocketPath.empty() ? "" : (" unix:" + serverParameters.unixSocketPath).c_str(),
+                   serverParameters.tcpPort > 0 ? " tcp:127.0.0.1:" : "",
+                   serverParameters.tcpPort > 0 ? std::to_string(serverParameters.tcpPort).c_str() : "");
+        }
+
+        if (parameters.coordinatorPort > 0) {
+            ShardClient::Parameters shardParameters;
+            shardParameters.tcpPort = parameters.coordinatorPort;
+
+            // stays the same across restarts
+            shardParameters.name = hasData() ?
+                (std::filesystem::absolute(parameters.dataFolder) / parameters.prefix).string() :
+                std::filesystem::absolute(pendingFolder).string();
+
+            shard = std::make_unique<ShardClient>(shardParameters, [this]() { this->pool.schedule(applyTask); });
+            state.delta = &delta;
+
+            printf("%sRunning as shard '%s' of the coordinator on tcp:127.0.0.1:%d\n", tag.c_str(), shardParameters.name.c_str(), shardParameters.tcpPort);
+
+            // the coordinator publishes the statistics
+            tLastMetrics = std::chrono::steady_clock::now();
+            tLastConnect = std::chrono::steady_clock::now() - std::chrono::milliseconds(kShardReconnectInterval_ms);
+
+            return 0;
+        }
+
+        return initPublisher();
+    }
+
+    // the follower applies the history of another daemon, so it has no log or ingest server of its own until it takes over
+    int initFollower() {
+        LogFollower::Parameters followerParameters;
+        followerParameters.dataFolder = parameters.dataFolder;
+        followerParameters.prefix = parameters.prefix;
+
+        follower = std::make_unique<LogFollower>(followerParameters);
+        isFollowing = true;
+
+        const TPeriodId lastPeriodId = follower->restore(state, parameters.nThreads, [](TPeriodId) {});
+        printf("%sLast period id: %d\n", tag.c_str(), lastPeriodId);
+
+        tLastMetrics = std::chrono::steady_clock::now();
+
+        if (isStandby()) {
+            printf("%sHot standby of '%s' with prefix '%s', taking over when its daemon stops\n", tag.c_str(),
+                   parameters.dataFolder.c_str(), parameters.prefix.c_str());
+
+            // watched from the start, the files are read once the standby takes over
+            pendingFolder = parameters.pendingFolder;
+
+            return 0;
+        }
+
+        printf("%sRead replica of '%s' with prefix '%s'\n", tag.c_str(), parameters.dataFolder.c_str(), parameters.prefix.c_str());
+
+        return initPublisher();
+    }
+
+    // the daemon that wrote the data folder has stopped and the whole history is applied: continue as that daemon
+    // returns 0 on success or the exit code of the process
+    int takeOver() {
+        const auto tStart = std::chrono::steady_clock::now();
+
+        const std::string & dataFolder = parameters.dataFolder;
+        const std::string & prefix = parameters.prefix;
+
+        // the same as on the startup of the daemon, except that the state is already there
+        storePeriodLogs(dataFolder, prefix);
+
+        std::vector<SubmissionInput> entries;
+        const auto logFileName = Storage::logFileName(dataFolder, prefix);
+        if (SubmissionLog::read(logFileName, entries) == false) {
+            const auto backupFileName = logFileName + ".bad";
+            fprintf(stderr, "%sMoving invalid submission log to '%s'\n", tag.c_str(), backupFileName.c_str());
+            std::filesystem::rename(logFileName, backupFileName);
+        }
+
+        lastStoredPeriodId = -1;
+        for (const auto & file : Utils::getFiles(dataFolder, prefix + "-\\d+\\.bin")) {
+            lastStoredPeriodId = std::max(lastStoredPeriodId, Storage::periodIdFromFileName(file));
+        }
+
+        for (auto & entry : entries) {
+            if ((TPeriodId) (entry.timestamp_s/State::secondsInPeriod) > lastStoredPeriodId) {
+                curPeriodInput.push_back(std::move(entry));
+            }
+        }
+
+        follower.reset();
+
+        if (const int res = initIngestion(); res != 0) {
+            return res;
+        }
+
+        isFollowing = false;
+
+        const auto tEnd = std::chrono::steady_clock::now();
+        printf("%sTook over '%s' with prefix '%s' in %.3f s, %lu records of the current period\n", tag.c_str(),
+               dataFolder.c_str(), prefix.c_str(), std::chrono::duration<double>(tEnd - tStart).count(), curPeriodInput.size());
+
+        notify({}, true);
+
+        return 0;
+    }
+
+    // the coordinator gets the submissions from the shards, so it has no history, log or ingest server of its own
+    int initCoordinator() {
+        ShardCoordinator::Parameters coordinatorParameters;
+        coordinatorParameters.tcpPort = parameters.shardPort;
+
+        coordinator = std::make_unique<ShardCoordinator>(coordinatorParameters, [this]() { this->pool.schedule(applyTask); });
+        if (coordinator->start() == false) {
+            fprintf(stderr, "%sFailed to start the shard coordinator\n", tag.c_str());
+            return 4;
+        }
+
+        printf("%sCoordinating the shards connecting on tcp:127.0.0.1:%d\n", tag.c_str(), coordinatorParameters.tcpPort);
+
+        return initPublisher();
+    }
+
+    int initPublisher() {
+        // the web page fetches the statistics incrementally, see StatsPublisher
+        StatsPublisher::Parameters publisherParameters;
+        publisherParameters.fileName = parameters.statsFile;
+
+        if (parameters.httpPort > 0) {
+            HttpServer::Parameters httpParameters;
+            httpParameters.tcpPort = parameters.httpPort;
+
+            httpServer = std::make_unique<HttpServer>(httpParameters);
+            if (httpServer->start() == false) {
+                fprintf(stderr, "%sFailed to start the HTTP server\n", tag.c_str());
+                return 4;
+            }
+
+            // the documents are compressed once here, on the publisher stage
+            publisherParameters.onWrite = [this](const std::string & name, const std::string & data, int64_t revision, bool immutable) {
+                httpServer->set("/" + name, data, revision, immutable);
+            };
+            publisherParameters.onRemove = [this](const std::string & name) {
+                httpServer->remove("/" + name);
+            };
+
+            printf("%sServing statistics on http://127.0.0.1:%d/%s\n", tag.c_str(), httpParameters.tcpPort,
+                   std::filesystem::path(publisherParameters.fileName).filename().string().c_str());
+        }
+
+        publisher = std::make_unique<StatsPublisher>(publisherParameters);
+
+        tLastPublish = std::chrono::steady_clock::now() - std::chrono::milliseconds(kMinPublishInterval_ms);
+        tLastMetrics = std::chrono::steady_clock::now();
+
+        // the publisher needs the data of all slots for its first revision
+        // the coordinator publishes once it has the contributions of the shards
+        if (coordinator == nullptr) {
+            publishStats(true);
+            publishAll = false;
+        }
+
+        return 0;
+    }
+
+    // called by the watcher, files are new files in the pending folder
+    void notify(std::vector<std::string> && newFiles, bool rescan) {
+        {
+            std::lock_guard lock(notifiedMutex);
+            if (rescan) {
+                needScan = true;
+            } else {
+                notified.insert(notified.end(), std::make_move_iterator(newFiles.begin()), std::make_move_iterator(newFiles.end()));
+            }
+        }
+
+        pool.schedule(readTask);
+    }
+
+    void saveSnapshot() {
+        tLastSnapshot = std::chrono::steady_clock::now();
+        snapshotDue = false;
+
+        // the snapshot can refer only to records that are durably stored in the log
+        if (log->commit() == false || log->sync() == false) {
+            return;
+        }
+
+        // the period file of the previous period has not been stored
+        if (curPeriodInput.size() > 0 && (TPeriodId) (curPeriodInput.front().timestamp_s/State::secondsInPeriod) != state.curPeriodId) {
+            return;
+        }
+
+        Storage::SnapshotInfo info;
+        info.lastStoredPeriodId = lastStoredPeriodId;
+        info.nCurPeriodRecords = curPeriodInput.size();
+
+        const auto fileName = Storage::snapshotFileName(parameters.dataFolder, parameters.prefix);
+        if (Storage::saveSnapshot(state, info, fileName) == false) {
+            fprintf(stderr, "%sFailed to write snapshot '%s'\n", tag.c_str(), fileName.c_str());
+            return;
+        }
+
+        const auto tEnd = std::chrono::steady_clock::now();
+        printf("%sSnapshot written to '%s' in %.3f s\n", tag.c_str(), fileName.c_str(), std::chrono::duration<double>(tEnd - tLastSnapshot).count());
+    }
+
+    void storePeriod(TPeriodId periodId) {
+        printf("%sNew period has started, old period id: %d\n", tag.c_str(), periodId);
+
+        if (curPeriodInput.empty()) {
+            printf("%sNo submissions in current period.\n", tag.c_str());
+            return;
+        }
+
+        if (hasData() == false) {
+            printf("%sSkipping input storage\n", tag.c_str());
+            return;
+        }
+
+        const std::string & dataFolder = parameters.dataFolder;
+        const std::string & prefix = parameters.prefix;
+
+        // serialize the current period input
+        const std::string fileName = Storage::periodFileName(dataFolder, prefix, periodId);
+
+        // the records of the period stay durable in the period log until the file is written,
+        // so the period counts as stored right away
+        const std::string periodLogFileName = Storage::periodLogFileName(dataFolder, prefix, periodId);
+        if (log && log->rotate(periodLogFileName)) {
+            if (periodWriter.joinable()) {
+                periodWriter.join();
+            }
+
+            periodWriter = std::thread([fileName, periodLogFileName, entries = std::move(curPeriodInput)]() {
+                const auto tStart = std::chrono::steady_clock::now();
+                if (Storage::serialize(entries, fileName) == false) {
+                    fprintf(stderr, "Failed to store period file '%s', the records are kept in '%s'\n", fileName.c_str(), periodLogFileName.c_str());
+                    return;
+                }
+
+                std::error_code ec;
+                std::filesystem::remove(periodLogFileName, ec);
+
+                const auto tEnd = std::chrono::steady_clock::now();
+                printf("Written %lu entries to file '%s' in %.3f s\n", entries.size(), fileName.c_str(), std::chrono::duration<double>(tEnd - tStart).count());
+            });
+
+            curPeriodInput.clear();
+            lastStoredPeriodId = periodId;
+            snapshotDue = true;
+
+            return;
+        }
+
+        printf("%sWriting %lu entries to file '%s'\n", tag.c_str(), curPeriodInput.size(), fileName.c_str());
+        if (Storage::serialize(curPeriodInput, fileName) == false) {
+            // keep the log, it still has all records of the period
+            fprintf(stderr, "%sFailed to store period %d, keeping the submission log\n", tag.c_str(), periodId);
+            return;
+        }
+        curPeriodInput.clear();
+        lastStoredPeriodId = periodId;
+
+        // the records are now stored in the period file, and its rename is durable
+        if (log) {
+            log->reset();
+        }
+
+        // written once the submissions being processed are applied
+        snapshotDue = true;
+    }
+
+    void onNewPeriodStart(TPeriodId periodId) {
+        const auto tStart = Metrics::Clock::now();
+        storePeriod(periodId);
+        metrics.periodRollover.observe(tStart);
+    }
+
+    void removeProcessed() {
+        Processed processed;
+        while (processedQueue.tryPop(processed)) {
+            if (processed.stored) {
+                printf("%sRemoving %d files\n", tag.c_str(), (int) processed.files.size());
+
+                const auto nRemoved = removeFiles(processed.files);
+                if (nRemoved != (int) processed.files.size()) {
+                    fprintf(stderr, "%sWarning: %lu files were not removed\n", tag.c_str(), processed.files.size() - nRemoved);
+                }
+            } else {
+                fprintf(stderr, "%sWarning: failed to write the submission log, keeping %d pending files\n", tag.c_str(), (int) processed.files.size());
+            }
+
+            for (const auto & file : processed.files) {
+                inFlight.erase(file);
+            }
+        }
+    }
+
+    // the read stage
+    void read() {
+        removeProcessed();
+
+        // the coordinator
+        if (pendingFolder.empty()) {
+            return;
+        }
+
+        // the pending files are processed by the daemon that is followed
+        if (isFollowing) {
+            std::lock_guard lock(notifiedMutex);
+            notified.clear();
+            needScan = false;
+            return;
+        }
+
+        // the apply stage schedules the read stage again once there is room in the queue
+        if (readQueue.size() >= readQueue.capacity()) {
+            readBlocked = true;
+            if (readQueue.size() >= readQueue.capacity()) {
+                return;
+            }
+            readBlocked = false;
+        }
+
+        // submit.php writes "t<uid>" and then renames it to "s<uid>"
+        static const std::regex pendingRegex("s.*");
+
+        bool scan = false;
+        {
+            std::lock_guard lock(notifiedMutex);
+            scan = needScan;
+            needScan = false;
+
+            if (scan == false) {
+                files.insert(files.end(), std::make_move_iterator(notified.begin()), std::make_move_iterator(notified.end()));
+            }
+            notified.clear();
+        }
+
+        if (scan) {
+            files = Utils::getFiles(pendingFolder, pendingRegex);
+        } else {
+            files.erase(std::remove_if(files.begin(), files.end(), [&](const std::string & file) {
+                return std::regex_match(std::filesystem::path(file).filename().string(), pendingRegex) == false;
+            }), files.end());
+        }
+
+        Batch batch;
+        batch.tRead = Metrics::Clock::now();
+
+        // the submissions of the ingest server and the pending files share the kMaxRead of a run, the server gets
+        // at most half of it while there are files. the rest of the submissions is drained by the next run
+        size_t nQueued = 0;
+        if (server) {
+            nQueued = server->drain(batch.inputs, files.empty() ? kMaxRead : kMaxRead/2);
+
+            if (batch.inputs.size() > 0) {
+                printf("%sProcessing %d submissions from the ingest server ...\n", tag.c_str(), (int) batch.inputs.size());
+            }
+        }
+
+        // sort the files by name
+        std::sort(files.begin(), files.end());
+        files.erase(std::unique(files.begin(), files.end()), files.end());
+
+        // the rest of the files is read by the next run, after the other tasks that are waiting
+        int nRead = batch.inputs.size();
+        auto it = files.begin();
+        for (; it != files.end() && nRead < kMaxRead; ++it) {
+            const auto & fileName = *it;
+            if (inFlight.count(fileName)) {
+                continue;
+            }
+
+            printf("%sProcessing pending submission from '%s' ...\n", tag.c_str(), fileName.c_str());
+            nRead++;
+
+            // the file might have already been processed by a previous scan
+            // the word is checked before it is interned, so that unknown words never enter the dictionary
+            SubmissionInput entry;
+            bool isUnknownWord = false;
+            const bool parsed = Storage::deserializeOne(fileName, entry, [&](std::string_view word) {
+                isUnknownWord = parameters.lexicon && parameters.lexicon->contains(word) == false;
+                return isUnknownWord == false;
+            });
+            if (parsed == false) {
+                if ((isUnknownWord || std::filesystem::exists(fileName)) && invalid.insert(fileName).second) {
+                    fprintf(stderr, "%sWarning: %s pending submission '%s'\n", tag.c_str(), isUnknownWord ? "unknown word in" : "malformed", fileName.c_str());
+                    metrics.nInvalidPending++;
+                }
+                continue;
+            }
+
+            printf("%sword = '%s'\n", tag.c_str(), std::string(Dictionary::word(entry.wordId)).c_str());
+            batch.inputs.push_back(entry);
+            batch.files.push_back(fileName);
+            inFlight.insert(fileName);
+        }
+        files.erase(files.begin(), it);
+
+        if (batch.inputs.size() > 0) {
+            metrics.backlog += batch.inputs.size();
+            readQueue.push(std::move(batch));
+            pool.schedule(applyTask);
+        }
+
+        if (files.size() > 0 || nQueued > 0) {
+            pool.schedule(readTask);
+        }
+    }
+
+    void publishStats(bool isFirst) {
+        const auto tStart = Metrics::Clock::now();
+
+        updatedSlots.clear();
+        state.update(parameters.topVoted, &updatedSlots);
+
+        if (isFirst) {
+            updatedSlots.resize(state.slots.size());
+            for (int i = 0; i < (int) updatedSlots.size(); ++i) {
+                updatedSlots[i] = i;
+            }
+        }
+
+        StatsPublisher::Update update;
+        update.collect(state, updatedSlots);
+        update.tRead = tOldestRead;
+        tOldestRead = Metrics::Clock::time_point::max();
+
+        metrics.batchUpdate.observe(tStart);
+        metrics.votes = state.statistics.votes;
+        metrics.submissions = state.statistics.submissions;
+        metrics.slots = state.slots.size();
+        metrics.periodMemory = state.periodMemoryUsage();
+
+        pending.merge(std::move(update));
+        hasPending = true;
+
+        // the publish stage schedules the apply stage again once there is room in the queue
+        applyBlocked = true;
+        if (publishQueue.tryPush(std::move(pending))) {
+            pending = {};
+            hasPending = false;
+            applyBlocked = false;
+        }
+
+        pool.schedule(publishTask);
+    }
+
+    // send the changes to the coordinator, or the whole contribution if it asks for it
+    // while the coordinator cannot be reached, the changes are dropped, it asks for the whole contribution anyway
+    void sendDelta() {
+        if (shard->isConnected() == false) {
+            const auto tNow = std::chrono::steady_clock::now();
+            if (tNow - tLastConnect >= std::chrono::milliseconds(kShardReconnectInterval_ms)) {
+                tLastConnect = tNow;
+                if (shard->connect()) {
+                    printf("%sConnected to the coordinator\n", tag.c_str());
+                }
+            }
+
+            if (shard->isConnected() == false) {
+                delta.clear();
+                pool.scheduleAt(applyTask, tLastConnect + std::chrono::milliseconds(kShardReconnectInterval_ms));
+                return;
+            }
+        }
+
+        uint32_t generation = 0;
+        if (shard->fullRequested(generation)) {
+            StateDelta full;
+            state.contribution(full);
+            shard->sendFull(full, generation);
+            delta.clear();
+
+            printf("%sSent the whole contribution to the coordinator: %ld votes, %ld submissions, %d slots\n",
+                   tag.c_str(), full.votes, full.submissions, (int) full.slots.size());
+        } else if (delta.empty() == false) {
+            shard->sendDelta(delta);
+            delta.clear();
+        }
+
+        state.setOtherVotes(shard->otherVotes());
+    }
+
+    // the apply stage of the coordinator
+    void applyShards() {
+        const auto nDeltas = coordinator->statistics().nDeltas;
+
+        const bool isComplete = coordinator->merge(state, [this](TPeriodId periodId) {
+            printf("%sNew period has started, old period id: %d\n", tag.c_str(), periodId);
+        });
+
+        const auto statistics = coordinator->statistics();
+        if (statistics.nResets != nResets) {
+            nResets = statistics.nResets;
+            publishAll = true;
+        }
+
+        metrics.nApplied += statistics.nDeltas - nDeltas;
+
+        // a rebuilt state is published once all shards have sent their contribution
+        if (isComplete && (statistics.nDeltas != nDeltas || publishAll || hasPending)) {
+            publishStats(publishAll);
+            publishAll = false;
+        }
+    }
+
+    // apply a submission and store it, returns false if it is rejected
+    // rejected submissions are stored as well, so that replaying the history gives the same state,
+    // except by the shards, which replay their history without the slot checks
+    bool submit(SubmissionInput & entry) {
+        const bool accepted = state.submit(entry, [this](TPeriodId periodId) { onNewPeriodStart(periodId); });
+
+        if (accepted || shard == nullptr) {
+            if (log) {
+                log->append(entry);
+            }
+            curPeriodInput.push_back(std::move(entry));
+        }
+
+        return accepted;
+    }
+
+    bool isActive(const SubmissionInput & entry) const {
+        return entry.slotId < (TSlotId) state.slots.size();
+    }
+
+    // shard: park the submission if it has to wait, see ShardParking, returns true if it is parked
+    bool park(const SubmissionInput & entry, std::string & file) {
+        const bool wasEmpty = parking.empty();
+        if (parking.park(entry, file, isActive(entry), std::chrono::steady_clock::now()) == false) {
+            return false;
+        }
+
+        // the reply to the changes brings the latest votes of the other shards
+        if (wasEmpty) {
+            sendDelta();
+        }
+
+        return true;
+    }
+
+    // apply the parked submissions whose slots are active by now, and the ones that have waited too long
+    // returns the number of rejected submissions
+    int retryParked() {
+        state.setOtherVotes(shard->otherVotes());
+
+        int nRejected = 0;
+        parking.release(std::chrono::steady_clock::now(), [this](const SubmissionInput & entry) { return isActive(entry); },
+                        [&](ShardParking::Entry & entry) {
+            if (entry.file.empty() == false) {
+                processed.files.push_back(std::move(entry.file));
+            }
+
+            if (submit(entry.input) == false) {
+                nRejected++;
+            }
+        });
+
+        return nRejected;
+    }
+
+    // the apply stage of a follower
+    void applyFollower() {
+        // the daemon has stopped once its lock can be taken, the history is complete then
+        const bool isComplete = isStandby() && lockData();
+
+        const auto tStart = Metrics::Clock::now();
+
+        int64_t nRejected = 0;
+        const int64_t nRecords = follower->poll([&](const SubmissionInput & entry) {
+            if (state.submit(SubmissionInput { entry }, [this](TPeriodId periodId) {
+                printf("%sNew period has started, old period id: %d\n", tag.c_str(), periodId);
+            }) == false) {
+                nRejected++;
+            }
+        });
+
+        if (nRecords > 0) {
+            metrics.batchSubmit.observe(tStart);
+            metrics.nApplied += nRecords - nRejected;
+            metrics.nRejected += nRejected;
+
+            // a standby publishes nothing until it takes over
+            if (publisher) {
+                tOldestRead = std::min(tOldestRead, tStart);
+            }
+        }
+
+        const auto & statistics = follower->statistics();
+        metrics.followerLagRecords = statistics.lagRecords;
+        metrics.followerLag_ms = statistics.lag_ms;
+
+        if (isComplete) {
+            if (const int res = takeOver(); res != 0) {
+                fprintf(stderr, "%sFailed to take over, stopping\n", tag.c_str());
+                exitCode = res;
+                if (onStopped) {
+                    onStopped();
+                }
+            }
+            return;
+        }
+
+        if (publisher && (nRecords > 0 || hasPending)) {
+            publishStats(false);
+        } else {
+            pool.schedule(publishTask);
+        }
+
+        pool.scheduleAt(applyTask, std::chrono::steady_clock::now() + std::chrono::milliseconds(kFollowInterval_ms));
+    }
+
+    // the apply stage
+    void apply() {
+        if (exitCode != 0) {
+            return;
+        }
+
+        if (coordinator) {
+            applyShards();
+            return;
+        }
+
+        if (follower) {
+            applyFollower();
+            return;
+        }
+
+        // apply what is queued before writing the log, but publish at least every kMaxApplied submissions
+        int nApplied = 0;
+
+        if (shard && parking.empty() == false) {
+            const auto nParked = parking.size();
+            const int nRejected = retryParked();
+
+            nApplied += nParked - parking.size();
+            metrics.nApplied += nParked - parking.size() - nRejected;
+            metrics.nRejected += nRejected;
+        }
+
+        Batch batch;
+        while (nApplied < kMaxApplied && readQueue.tryPop(batch)) {
+            const auto tStart = Metrics::Clock::now();
+
+            // the submissions from the ingest server come first and have no pending files
+            const int nWithoutFile = batch.inputs.size() - batch.files.size();
+
+            int nRejected = 0;
+            int nParked = 0;
+            for (int i = 0; i < (int) batch.inputs.size(); ++i) {
+                auto & entry = batch.inputs[i];
+
+                std::string noFile;
+                if (shard && park(entry, i < nWithoutFile ? noFile : batch.files[i - nWithoutFile])) {
+                    nParked++;
+                    continue;
+                }
+
+                if (submit(entry) == false) {
+                    nRejected++;
+                }
+            }
+            nApplied += batch.inputs.size();
+
+            metrics.batchSubmit.observe(tStart);
+            metrics.backlog -= batch.inputs.size();
+            metrics.nApplied += batch.inputs.size() - nParked - nRejected;
+            metrics.nRejected += nRejected;
+
+            tOldestRead = std::min(tOldestRead, batch.tRead);
+
+            for (auto & file : batch.files) {
+                // moved to the parked submissions
+                if (file.empty() == false) {
+                    processed.files.push_back(std::move(file));
+                }
+            }
+        }
+
+        if (readBlocked.exchange(false)) {
+            pool.schedule(readTask);
+        }
+
+        // the pending files can be removed only after their records are in the log
+        processed.stored = true;
+        if (log && log->commit() == false) {
+            processed.stored = false;
+        }
+
+        if (processed.files.size() > 0) {
+            processedQueue.push(std::move(processed));
+            processed = {};
+
+            pool.schedule(readTask);
+        }
+
+        if (log && (snapshotDue || (parameters.snapshotInterval_ms > 0 && nApplied > 0 &&
+                                    std::chrono::steady_clock::now() - tLastSnapshot > std::chrono::milliseconds(parameters.snapshotInterval_ms)))) {
+            saveSnapshot();
+        }
+
+        if (shard) {
+            sendDelta();
+            pool.schedule(publishTask);
+
+            // the parked submissions are retried with the votes from the replies, ask for them if nothing else does
+            if (parking.empty() == false) {
+                const auto tNow = std::chrono::steady_clock::now();
+                if (tNow - tLastVotesRequest >= std::chrono::milliseconds(kParkRetryInterval_ms)) {
+                    tLastVotesRequest = tNow;
+                    shard->requestVotes();
+                }
+                pool.scheduleAt(applyTask, tLastVotesRequest + std::chrono::milliseconds(kParkRetryInterval_ms));
+            }
+        } else if (nApplied > 0 || hasPending) {
+            publishStats(false);
+        }
+
+        // with interval fsync policy, run again in time to sync the log
+        if (log) {
+            const int syncTimeout_ms = log->syncTimeout_ms();
+            if (syncTimeout_ms == 0) {
+                log->sync();
+            } else if (syncTimeout_ms > 0) {
+                pool.scheduleAt(applyTask, std::chrono::steady_clock::now() + std::chrono::milliseconds(syncTimeout_ms));
+            }
+        }
+
+        // the rest of the queue is applied by the next run, after the other tasks that are waiting
+        if (readQueue.size() > 0) {
+            pool.schedule(applyTask);
+        }
+    }
+
+    // the publish stage
+    void publish() {
+        const auto tNow = std::chrono::steady_clock::now();
+
+        if (parameters.metricsFile.empty() == false && tNow - tLastMetrics >= std::chrono::milliseconds(kMetricsInterval_ms)) {
+            tLastMetrics = tNow;
+
+            metrics.readQueueDepth = readQueue.size();
+            metrics.publishQueueDepth = publishQueue.size();
+            if (server) {
+                const auto statistics = server->statistics();
+                metrics.nInvalidSocket = statistics.nRejected;
+                metrics.ingestQueueDepth = statistics.nQueued;
+            }
+            if (httpServer) {
+                const auto statistics = httpServer->statistics();
+                metrics.httpRequests = statistics.nRequests;
+                metrics.httpNotModified = statistics.nNotModified;
+                metrics.httpBytesSent = statistics.nBytesSent;
+            }
+
+            if (metrics.write(parameters.metricsFile) == false) {
+                fprintf(stderr, "%sFailed to write metrics to '%s'\n", tag.c_str(), parameters.metricsFile.c_str());
+            }
+        }
+
+        // under load, combine the updates that arrive within kMinPublishInterval_ms of the last revision
+        StatsPublisher::Update next;
+        while (publishQueue.tryPop(next)) {
+            if (hasUpdate) {
+                update.merge(std::move(next));
+                nMerged++;
+            } else {
+                update = std::move(next);
+                hasUpdate = true;
+                nMerged = 1;
+            }
+        }
+
+        if (applyBlocked.exchange(false)) {
+            pool.schedule(applyTask);
+        }
+
+        const auto tNext = tLastPublish + std::chrono::milliseconds(kMinPublishInterval_ms);
+        if (hasUpdate && tNow < tNext) {
+            pool.scheduleAt(publishTask, tNext);
+        } else if (hasUpdate) {
+            tLastPublish = tNow;
+
+            const int nSlots = update.slots.size();
+            const auto tRead = update.tRead;
+            const auto tPublish = Metrics::Clock::now();
+            const bool published = publisher->publish(std::move(update));
+            metrics.batchOutput.observe(tPublish);
+
+            if (published == false) {
+                fprintf(stderr, "%sFailed to publish statistics revision %ld\n", tag.c_str(), publisher->revision());
+            } else {
+                if (tRead != Metrics::Clock::time_point::max()) {
+                    metrics.submissionLatency.observe(tRead);
+                }
+
+                const auto & statistics = publisher->statistics();
+                printf("%sPublished statistics revision %ld to '%s', %d slots changed, %d updates, head: %ld bytes, chunks written: %ld\n",
+                       tag.c_str(), publisher->revision(), parameters.statsFile.c_str(), nSlots, nMerged, statistics.nBytesHead, statistics.nChunksWritten);
+            }
+
+            if (server) {
+                const auto statistics = server->statistics();
+                printf("%sQueue depths: ingest -> read %ld (max %ld), read -> apply %lu (max %lu), apply -> publish %lu (max %lu)\n",
+                       tag.c_str(), statistics.nQueued, statistics.nMaxQueued,
+                       readQueue.size(), readQueue.maxSize(), publishQueue.size(), publishQueue.maxSize());
+            } else {
+                printf("%sQueue depths: read -> apply %lu (max %lu), apply -> publish %lu (max %lu)\n",
+                       tag.c_str(), readQueue.size(), readQueue.maxSize(), publishQueue.size(), publishQueue.maxSize());
+            }
+
+            update = {};
+            hasUpdate = false;
+        }
+
+        if (parameters.metricsFile.empty() == false) {
+            pool.scheduleAt(publishTask, tLastMetrics + std::chrono::milliseconds(kMetricsInterval_ms));
+        }
+    }
+};
+
+Story::Story(const std::string & name, Parameters parameters, WorkerPool & pool, CBOnStopped && onStopped) :
+    m_impl(new Impl(name, std::move(parameters), pool, std::move(onStopped))) {
+}
+
+Story::~Story() {
+}
+
+const std::string & Story::name() const {
+    return m_impl->name;
+}
+
+const std::string & Story::tag() const {
+    return m_impl->tag;
+}
+
+const std::string & Story::pendingFolder() const {
+    return m_impl->pendingFolder;
+}
+
+int Story::init() {
+    return m_impl->init();
+}
+
+int Story::exitCode() const {
+    return m_impl->exitCode;
+}
+
+void Story::start() {
+    m_impl->notify({}, true);
+
+    // the shards connect to the coordinator right away, the followers start following
+    if (m_impl->shard || m_impl->follower) {
+        m_impl->pool.schedule(m_impl->applyTask);
+    }
+}
+
+void Story::notify(std::vector<std::string> && files, bool rescan) {
+    m_impl->notify(std::move(files), rescan);
+}
+
+void Story::report() {
+    auto & metrics = m_impl->metrics;
+
+    const int64_t nProcessed = metrics.nApplied + metrics.nRejected;
+    const std::string summary = metrics.summary();
+    if (nProcessed == m_impl->nReported && metrics.backlog == 0) {
+        return;
+    }
+    m_impl->nReported = nProcessed;
+
+    const std::string & name = m_impl->name;
+    if (m_impl->isFollowing) {
+        printf("Story%s%s: %s, following with a lag of %ld records, %ld ms\n", name.empty() ? "" : " ", name.c_str(), summary.c_str(),
+               metrics.followerLagRecords.load(), metrics.followerLag_ms.load());
+    } else {
+        printf("Story%s%s: %s\n", name.empty() ? "" : " ", name.c_str(), summary.c_str());
+    }
+}
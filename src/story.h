@@ -0,0 +1,116 @@
+#pragma once
+
+#include "types.h"
+#include "storage.h"
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+class Lexicon;
+class WorkerPool;
+
+// write the period files of the period logs left behind by a process that stopped while storing a period
+void storePeriodLogs(const std::string & dataFolder, const std::string & prefix);
+
+// return last processed periodId
+// the state is restored from the latest snapshot if there is a valid one, so only the period files and
+// submission log records that came after it are processed
+// if curPeriodInput is provided, the submission log is replayed as well and its records are appended to it
+// with nThreads > 1 the period files are replayed in parallel, see Replay::apply
+TPeriodId processOld(State & state, const std::string & dataFolder, const std::string & prefix, int nThreads,
+                     std::vector<SubmissionInput> * curPeriodInput = nullptr, TPeriodId * lastStoredPeriodIdOut = nullptr);
+
+// a story hosted by the daemon, with its own state, submission log, pending folder and statistics
+// the submissions are processed by a pipeline of 3 stages, connected by bounded lock-free queues:
+// - read    : parses the pending files reported by the watcher and drains the ingest server
+//             the queue of the ingest server is bounded as well, its clients wait while the read stage is behind
+// - apply   : owns the state, applies the submissions and appends them to the log
+// - publish : writes the statistics from the slot data copied by the apply stage
+// the stages are tasks of the worker pool that is shared by all stories: a slow stage only makes the queue
+// in front of it grow, and since each stage runs on one worker at a time and handles a bounded amount of
+// work per run, a busy story cannot keep the other stories from being served
+// with ingestion sharding (see shard.h), a shard sends the changes of its state to the coordinator instead of
+// publishing, and the apply stage of the coordinator merges the changes of the shards instead of submissions
+// a follower has no read stage: its apply stage tails the history that another daemon writes to the data folder
+// (see LogFollower). a read replica publishes its own statistics, a hot standby publishes nothing until the daemon
+// releases the lock of the data folder, then it applies the rest of the history and takes over as that daemon
+class Story {
+public:
+    struct Parameters {
+        // the history of the story, the submissions are not stored if either is empty
+        std::string dataFolder;
+        std::string prefix;
+
+        // watched for new submission files, empty for the coordinator and for a read replica
+        std::string pendingFolder;
+
+        // the slot chunks are written next to it
+        std::string statsFile = "stats.json";
+        int topVoted = 10;
+
+        // optional ingest and HTTP endpoints, 0 - disabled
+        std::string unixSocketPath;
+        int tcpPort = 0;
+        int httpPort = 0;
+
+        SubmissionLog::FsyncPolicy fsyncPolicy = SubmissionLog::FsyncPolicy::Batch;
+        int fsyncInterval_ms = 100;
+
+        // 0 - snapshots only at period rollover
+        int snapshotInterval_ms = 0;
+
+        // threads for replaying the period files on startup
+        int nThreads = 1;
+
+        // empty - no metrics
+        std::string metricsFile;
+
+        // run as an ingestion shard of the coordinator on this port, or as the coordinator of the shards, 0 - neither
+        int coordinatorPort = 0;
+        int shardPort = 0;
+
+        // follow the daemon that writes the data folder, a standby if it has a pending folder or an ingest endpoint
+        bool follow = false;
+
+        // the valid words, nullptr - accept all words
+        const Lexicon * lexicon = nullptr;
+    };
+
+    // called from a worker of the pool when the story has stopped because it cannot continue, see exitCode()
+    using CBOnStopped = std::function<void()>;
+
+    // the pipeline stages are added to the pool, so the stories must be created before the pool is started
+    Story(const std::string & name, Parameters parameters, WorkerPool & pool, CBOnStopped && onStopped = nullptr);
+    ~Story();
+
+    const std::string & name() const;
+
+    // prefix of the log messages of the story
+    const std::string & tag() const;
+
+    // empty if the story does not read pending files
+    const std::string & pendingFolder() const;
+
+    // restore the state, open the submission log and start the ingest server
+    // returns 0 on success or the exit code of the process
+    int init();
+
+    // 0 while the story is running, the exit code of the process once it has stopped
+    // e.g. a hot standby that fails to open the submission log when it takes over
+    int exitCode() const;
+
+    // start processing once the pool is running: scan the pending folder, connect to the coordinator or start following
+    void start();
+
+    // called by the watcher, files are new files in the pending folder
+    void notify(std::vector<std::string> && files, bool rescan);
+
+    // print the throughput and latency if there were submissions since the previous report
+    void report();
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> m_impl;
+};
@@ -1,5 +1,34 @@
 <?php
 
+// ingest socket of the-story (see the "-us" argument), used to validate the words
+$socketPath = '/tmp/the-story.sock';
+
+// check if $word exists in 'words-alpha.txt'
+// the-story answers from the dictionary in its memory, the file is searched only if the service is not available
+function isValidWord($word) {
+    global $socketPath;
+
+    $socket = @stream_socket_client('unix://' . $socketPath, $errno, $errstr, 0.5);
+    if ($socket !== false) {
+        stream_set_timeout($socket, 1);
+
+        // length-prefixed validation request, the reply is a single byte
+        fwrite($socket, pack('V', strlen($word) + 1) . 'v' . $word);
+        $reply = fread($socket, 1);
+        fclose($socket);
+
+        if ($reply === '1') {
+            return true;
+        }
+        if ($reply === '0') {
+            return false;
+        }
+    }
+
+    $command = 'grep -Fx ' . escapeshellarg($word) . ' words-alpha.txt';
+    return shell_exec($command) !== null;
+}
+
 // parse GET parameters
 $slot_raw   = $_GET['s'];
 $input_raw  = $_GET['i'];
@@ -35,11 +64,7 @@ if ($slot === null || $input === null || $userId === null || $slot != $slot_raw
     exit;
 }
 
-// check if $input exists in file 'words-alpha.txt' using 'grep -Fx'
-$command = 'grep -Fx ' . escapeshellarg($input) . ' words-alpha.txt';
-$output = shell_exec($command);
-
-if ($output === null) {
+if (!isValidWord($input)) {
     $response = array(
         'error' => 1,
         'message' => 'Word not found'
@@ -0,0 +1,833 @@
+// the-story-test : regression tests of the-story, run by ctest
+//
+// each test prints its name and the checks that failed, the exit code is the number of failed tests
+//
+// command line arguments:
+//    -h, --help : print help
+//    -f, --filter : run only the tests which name contains this string
+
+#include "types.h"
+#include "dictionary.h"
+#include "storage.h"
+#include "lexicon.h"
+#include "ingest.h"
+#include "shard.h"
+#include "replay.h"
+#include "follower.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+enum CLIArgument {
+    EHelp,
+    EFilter,
+};
+
+using TCLIArguments = std::map<CLIArgument, std::string>;
+
+// the checks of the test that is running
+int g_nFailedChecks = 0;
+
+#define CHECK(cond) do { \
+    if ((cond) == false) { \
+        fprintf(stderr, "    %s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        g_nFailedChecks++; \
+    } \
+} while (0)
+
+struct Test {
+    std::string name;
+
+    // gets a temporary folder that is removed after the test
+    std::function<void(const std::string & tmpDir)> run;
+};
+
+std::vector<Test> & tests() {
+    static std::vector<Test> result;
+    return result;
+}
+
+void add(std::string name, std::function<void(const std::string & tmpDir)> run) {
+    tests().push_back({ std::move(name), std::move(run) });
+}
+
+template <typename T>
+void writeValue(std::ofstream & out, const T & value) {
+    out.write((const char *) &value, sizeof(T));
+}
+
+// legacy period file: a word longer than kMaxWordLength must not shift the records that follow it
+void testLegacyOversizedWord(const std::string & tmpDir) {
+    const std::string fileName = tmpDir + "/legacy.bin";
+
+    const std::string longWord(kMaxWordLength + 8, 'x');
+    const std::string word = "valid";
+
+    {
+        std::ofstream out(fileName, std::ios::binary);
+
+        writeValue(out, (size_t) 2);
+
+        for (const auto & w : { longWord, word }) {
+            writeValue(out, (TTimestamp) 1000);
+            writeValue(out, (TIPAddress) 0x0100007f);
+            writeValue(out, (TSlotId) 7);
+            writeValue(out, (TUserId) 3);
+            writeValue(out, (uint32_t) w.size());
+            out.write(w.data(), w.size());
+        }
+    }
+
+    CHECK(Storage::isLegacy(fileName));
+
+    const auto entries = Storage::deserializeAll(fileName);
+    CHECK(entries.size() == 2);
+    if (entries.size() != 2) {
+        return;
+    }
+
+    CHECK(Dictionary::word(entries[0].wordId) == longWord.substr(0, kMaxWordLength));
+
+    CHECK(entries[1].timestamp_s == 1000);
+    CHECK(entries[1].ip == 0x0100007f);
+    CHECK(entries[1].slotId == 7);
+    CHECK(entries[1].userId == 3);
+    CHECK(Dictionary::word(entries[1].wordId) == word);
+}
+
+// a snapshot with a wrong size in the header or with counts larger than its data is rejected before anything is
+// allocated for them, and the state that was loaded before is kept
+void testCorruptedSnapshot(const std::string & tmpDir) {
+    const TTimestamp t_s = 10*State::secondsInPeriod;
+    const TWordId wordId = Dictionary::intern("snapshot");
+
+    State state;
+    state.init();
+    for (TIPAddress ip = 1; ip <= 4; ++ip) {
+        CHECK(state.submit({ t_s + ip, ip, 0, 1, wordId }, nullptr));
+    }
+
+    const std::string fileName = tmpDir + "/state.snapshot";
+    const Storage::SnapshotInfo info { 9, 4 };
+    CHECK(Storage::saveSnapshot(state, info, fileName));
+
+    std::string saved;
+    {
+        std::ostringstream out(std::ios::binary);
+        state.save(out);
+        saved = out.str();
+    }
+
+    const auto loads = [&](const std::string & contents) {
+        std::ofstream(fileName, std::ios::binary | std::ios::trunc).write(contents.data(), contents.size());
+
+        State loaded;
+        loaded.init();
+        Storage::SnapshotInfo loadedInfo;
+        const bool ok = Storage::loadSnapshot(loaded, loadedInfo, fileName);
+        CHECK(ok || loaded.statistics.submissions == 0);
+        return ok;
+    };
+
+    std::string file;
+    {
+        std::ifstream in(fileName, std::ios::binary);
+        file.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    CHECK(loads(file));
+
+    // magic, version, lastStoredPeriodId and nCurPeriodRecords come before the size
+    const size_t sizeOffset = 4 + sizeof(uint32_t) + sizeof(TPeriodId) + sizeof(int64_t);
+    {
+        std::string huge = file;
+        const uint64_t size = uint64_t(1) << 60;
+        memcpy(&huge[sizeOffset], &size, sizeof(size));
+        CHECK(loads(huge) == false);
+    }
+    CHECK(loads(file.substr(0, file.size() - 1)) == false);
+    CHECK(loads(file + '\0') == false);
+
+    // counts that pass the checksum but not the data: the number of words, then the number of slots after them
+    const size_t wordsOffset = sizeof(TPeriodId) + 3*sizeof(int64_t);
+    uint32_t nWords = 0;
+    memcpy(&nWords, &saved[wordsOffset], sizeof(nWords));
+
+    size_t slotsOffset = wordsOffset + sizeof(uint32_t);
+    for (uint32_t i = 0; i < nWords; ++i) {
+        uint32_t length = 0;
+        memcpy(&length, &saved[slotsOffset], sizeof(length));
+        slotsOffset += sizeof(uint32_t) + length;
+    }
+
+    for (const size_t offset : { wordsOffset, slotsOffset }) {
+        std::string data = saved;
+        const uint32_t n = 0x7fffffff;
+        memcpy(&data[offset], &n, sizeof(n));
+
+        State loaded;
+        std::istringstream in(data, std::ios::binary);
+        CHECK(loaded.load(in) == false);
+    }
+
+    State loaded;
+    std::istringstream in(saved, std::ios::binary);
+    CHECK(loaded.load(in));
+    CHECK(loaded.statistics.submissions == 4);
+}
+
+// words that the lexicon rejects must not be interned: the dictionary is never freed and is stored in every snapshot
+void testRejectedWordsNotInterned(const std::string & tmpDir) {
+    Lexicon lexicon;
+    lexicon.build({ "apple", "banana" });
+
+    const SubmissionInput::CBIsValidWord isValidWord = [&](std::string_view word) { return lexicon.contains(word); };
+
+    const TWordId appleId = Dictionary::intern("apple");
+    const size_t nWords = Dictionary::size();
+
+    SubmissionInput input;
+    CHECK(input.parse("1000 1.2.3.4 1 1 rejected-text-word", isValidWord) == false);
+
+    {
+        SubmissionInput entry { 1000, 0x04030201, 1, 1, appleId };
+
+        std::string record;
+        entry.serialize(record);
+
+        // same length as "apple", replaced after serializing so that it is never interned
+        memcpy(&record[record.size() - 5], "zzzzz", 5);
+        CHECK(input.parse(record.data(), record.size(), isValidWord) == false);
+    }
+
+    {
+        const std::string fileName = tmpDir + "/pending";
+        std::ofstream(fileName) << "1000 1.2.3.4 1 1 rejected-pending-word";
+
+        CHECK(Storage::deserializeOne(fileName, input, isValidWord) == false);
+    }
+
+    // through the ingest socket, the validation request is answered after the submission is processed
+    {
+        IngestServer::Parameters parameters;
+        parameters.unixSocketPath = tmpDir + "/ingest.sock";
+        parameters.lexicon = &lexicon;
+
+        IngestServer server(parameters, nullptr);
+        CHECK(server.start());
+
+        sockaddr_un addr {};
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, parameters.unixSocketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+        std::string request;
+        for (const auto & payload : { std::string("t1000 1.2.3.4 1 1 rejected-socket-word"), std::string("vbanana") }) {
+            const uint32_t size = payload.size();
+            request.append((const char *) &size, sizeof(size));
+            request += payload;
+        }
+
+        char reply = 0;
+        const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        CHECK(fd >= 0 && connect(fd, (sockaddr *) &addr, sizeof(addr)) == 0);
+        CHECK(write(fd, request.data(), request.size()) == (ssize_t) request.size());
+        CHECK(read(fd, &reply, 1) == 1 && reply == '1');
+        close(fd);
+
+        // the statistics are updated after the replies are sent
+        for (int i = 0; i < 100 && server.statistics().nRejected == 0; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        CHECK(server.statistics().nRejected == 1);
+    }
+
+    CHECK(Dictionary::size() == nWords);
+    CHECK(Dictionary::find("rejected-text-word") == kInvalidWordId);
+    CHECK(Dictionary::find("zzzzz") == kInvalidWordId);
+    CHECK(Dictionary::find("rejected-pending-word") == kInvalidWordId);
+    CHECK(Dictionary::find("rejected-socket-word") == kInvalidWordId);
+
+    // accepted words are still interned
+    CHECK(input.parse("1000 1.2.3.4 1 1 banana", isValidWord));
+    CHECK(Dictionary::word(input.wordId) == "banana");
+}
+
+// the ingest server stops reading the clients while its queue is full and continues once it has been drained
+void testIngestBoundedQueue(const std::string & tmpDir) {
+    IngestServer::Parameters parameters;
+    parameters.unixSocketPath = tmpDir + "/ingest.sock";
+    parameters.maxQueued = 10;
+
+    IngestServer server(parameters, nullptr);
+    CHECK(server.start());
+
+    const int nSent = 100;
+
+    std::string request;
+    for (int i = 0; i < nSent; ++i) {
+        const std::string payload = "t" + std::to_string(1000 + i) + " 1.2.3.4 1 1 word";
+        const uint32_t size = payload.size();
+        request.append((const char *) &size, sizeof(size));
+        request += payload;
+    }
+
+    sockaddr_un addr {};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, parameters.unixSocketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    CHECK(fd >= 0 && connect(fd, (sockaddr *) &addr, sizeof(addr)) == 0);
+    CHECK(write(fd, request.data(), request.size()) == (ssize_t) request.size());
+
+    // the client has closed its side, the rest of its messages is still read once there is room
+    close(fd);
+
+    const auto waitReceived = [&](int64_t n) {
+        for (int i = 0; i < 100 && server.statistics().nReceived < n; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return server.statistics().nReceived;
+    };
+
+    CHECK(waitReceived(parameters.maxQueued) == (int64_t) parameters.maxQueued);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    CHECK(server.statistics().nReceived == (int64_t) parameters.maxQueued);
+
+    std::vector<SubmissionInput> inputs;
+    CHECK(server.drain(inputs, 4) == parameters.maxQueued - 4);
+    CHECK(inputs.size() == 4);
+
+    // drained in portions of at most 4, the queue never holds more than maxQueued
+    for (int i = 0; i < 100 && (int) inputs.size() < nSent; ++i) {
+        waitReceived(std::min<int64_t>(nSent, inputs.size() + parameters.maxQueued));
+        CHECK(server.drain(inputs, 4) <= parameters.maxQueued);
+    }
+
+    CHECK((int) inputs.size() == nSent);
+    for (int i = 0; i < std::min(nSent, (int) inputs.size()); ++i) {
+        CHECK(inputs[i].timestamp_s == (TTimestamp) (1000 + i));
+    }
+}
+
+// the millivotes of the slot words, maintained incrementally through the count buckets of the groups, are the same as
+// a recount of all submissions: each IP splits its vote of a slot among its users, share_mv(c, n) per distinct word.
+// a NAT'd IP has many users that add and edit words, so that the words keep moving between the buckets
+void testMillivotesMatchRecount([[maybe_unused]] const std::string & tmpDir) {
+    const TTimestamp t_s = 10*State::secondsInPeriod;
+
+    std::vector<TWordId> wordIds;
+    for (const auto & word : { "vote-a", "vote-b", "vote-c", "vote-d", "vote-e", "vote-f" }) {
+        wordIds.push_back(Dictionary::intern(word));
+    }
+
+    State state;
+    state.init();
+
+    // the word of each user by (ip, slot, user)
+    std::map<std::tuple<TIPAddress, TSlotId, TUserId>, TWordId> users;
+
+    const auto recount = [&](TSlotId slotId) {
+        // users by IP, then their number by word
+        std::map<TIPAddress, std::map<TWordId, int32_t>> groups;
+        for (const auto & [key, wordId] : users) {
+            if (std::get<1>(key) == slotId) {
+                groups[std::get<0>(key)][wordId]++;
+            }
+        }
+
+        std::map<TWordId, int64_t> result;
+        for (const auto & [ip, words] : groups) {
+            int32_t n = 0;
+            for (const auto & [wordId, c] : words) {
+                n += c;
+            }
+            for (const auto & [wordId, c] : words) {
+                result[wordId] += State::share_mv(c, n);
+            }
+        }
+        return result;
+    };
+
+    const auto slotWords = [&](TSlotId slotId) {
+        std::map<TWordId, int64_t> result;
+        state.slots[slotId].words.forEach([&](TWordId wordId, const Slot::WordData & data) {
+            if (data.votes_mv != 0) {
+                result[wordId] = data.votes_mv;
+            }
+        });
+        return result;
+    };
+
+    std::mt19937 rng(7);
+    const auto pick = [&](int n) { return (int) (rng() % (uint32_t) n); };
+
+    // the first users of the NAT'd IP agree on the word, so that it starts with the whole vote of the group
+    const TIPAddress nat = 0x0a000001;
+    TTimestamp t = t_s;
+    for (int i = 0; i < 3000; ++i) {
+        SubmissionInput input;
+        input.timestamp_s = t++;
+        input.slotId = pick(3);
+        if (pick(4) == 0) {
+            input.ip = 0x0b000000 + pick(8);
+            input.userId = pick(3);
+        } else {
+            input.ip = nat;
+            input.userId = i < 20 ? i : pick(60);
+        }
+        input.wordId = i < 20 ? wordIds[0] : wordIds[pick(pick(2) == 0 ? 2 : (int) wordIds.size())];
+
+        CHECK(state.submit(input, nullptr));
+        users[{ input.ip, input.slotId, input.userId }] = input.wordId;
+
+        // stop at the first mismatch, the later ones follow from it
+        const bool matches = slotWords(input.slotId) == recount(input.slotId);
+        CHECK(matches);
+        if (matches == false) {
+            break;
+        }
+    }
+
+    for (TSlotId slotId = 0; slotId < 3; ++slotId) {
+        CHECK(slotWords(slotId) == recount(slotId));
+    }
+}
+
+// the parked submissions of a shard keep the order per IP and per period, and are decided by the votes known when
+// they are released: the same arrivals give a different outcome depending on when the votes of the other shards arrive
+void testShardParking([[maybe_unused]] const std::string & tmpDir) {
+    const TTimestamp t_s = 10*State::secondsInPeriod;
+    const auto t0 = ShardParking::Clock::now();
+
+    // in the order of arrival: A waits for its slot, B for A (same IP), C goes through, D waits for the earlier period
+    const std::vector<SubmissionInput> inputs = {
+        { t_s,                          1, 5, 1, 0 }, // A
+        { t_s + 1,                      1, 0, 1, 0 }, // B
+        { t_s + 2,                      2, 1, 1, 0 }, // C
+        { t_s + State::secondsInPeriod, 3, 0, 1, 0 }, // D
+    };
+
+    // 3 slots are active when the submissions arrive, the votes of the other shards activate the slot of A
+    // returns the IPs of the submissions released at tRelease_ms and whether their slot was active then
+    const auto run = [&](int tRelease_ms, int nSlotsAtRelease, std::vector<TIPAddress> & released, std::vector<bool> & wasActive) {
+        ShardParking parking(1000);
+
+        int nSlots = 3;
+        const auto isActive = [&](const SubmissionInput & input) { return input.slotId < nSlots; };
+
+        std::vector<TIPAddress> applied;
+        for (const auto & input : inputs) {
+            std::string file = "s" + std::to_string(input.ip);
+            if (parking.park(input, file, isActive(input), t0) == false) {
+                applied.push_back(input.ip);
+            }
+        }
+        CHECK(applied == std::vector<TIPAddress>({ 2 }));
+        CHECK(parking.size() == 3);
+
+        // nothing is released until the votes arrive or the submissions expire
+        CHECK(parking.release(t0 + std::chrono::milliseconds(500), isActive, [](ShardParking::Entry &) {}) == 0);
+
+        nSlots = nSlotsAtRelease;
+        parking.release(t0 + std::chrono::milliseconds(tRelease_ms), isActive, [&](ShardParking::Entry & entry) {
+            CHECK(entry.file == "s" + std::to_string(entry.input.ip));
+            released.push_back(entry.input.ip);
+            wasActive.push_back(isActive(entry.input));
+        });
+        CHECK(parking.empty());
+    };
+
+    // the votes arrive before the timeout: A is accepted
+    {
+        std::vector<TIPAddress> released;
+        std::vector<bool> wasActive;
+        run(900, 6, released, wasActive);
+        CHECK(released == std::vector<TIPAddress>({ 1, 1, 3 }));
+        CHECK(wasActive == std::vector<bool>({ true, true, true }));
+    }
+
+    // the votes arrive after the timeout: A expires with its slot not active and is rejected, the order is the same
+    {
+        std::vector<TIPAddress> released;
+        std::vector<bool> wasActive;
+        run(1001, 3, released, wasActive);
+        CHECK(released == std::vector<TIPAddress>({ 1, 1, 3 }));
+        CHECK(wasActive == std::vector<bool>({ false, true, true }));
+    }
+}
+
+// the coordinator merges the changes of the shards into the same slots and top words as a single daemon that gets all
+// of the submissions, in any order of the shards. the ties of the votes are ordered by the word and not by the word id,
+// since a process assigns the ids in the order in which it sees the words
+void testShardMergeMatchesSingleNode([[maybe_unused]] const std::string & tmpDir) {
+    const TTimestamp t_s = 10*State::secondsInPeriod;
+
+    // interned in reverse order, so that the ids order the words differently, two of them share the first 8 bytes
+    std::vector<TWordId> ids;
+    for (const auto & word : { "zulu", "yankee", "mergetie-b", "mergetie-a", "alpha" }) {
+        ids.push_back(Dictionary::intern(word));
+    }
+    const TWordId zulu = ids[0], yankee = ids[1], tieB = ids[2], tieA = ids[3], alpha = ids[4];
+
+    // { t, ip, slotId, userId, wordId }
+    const std::vector<SubmissionInput> inputs = {
+        { t_s + 0,  1, 0, 1, zulu   },
+        { t_s + 1,  2, 0, 1, alpha  },
+        { t_s + 2,  3, 0, 1, tieB   },
+        { t_s + 3,  4, 0, 1, tieA   },
+        { t_s + 4,  5, 0, 1, yankee },
+        { t_s + 5,  6, 0, 1, alpha  }, // two users of an IP share its vote
+        { t_s + 6,  6, 0, 2, zulu   },
+        { t_s + 7,  7, 1, 1, tieB   },
+        { t_s + 8,  8, 1, 1, tieA   },
+        { t_s + 9,  5, 0, 1, tieB   }, // an edit moves the vote of the IP
+        { t_s + 10, 9, 2, 1, zulu   },
+        { t_s + 11, 9, 2, 2, alpha  },
+    };
+
+    State single;
+    single.init();
+
+    State shards[2];
+    StateDelta deltas[2];
+    for (int i = 0; i < 2; ++i) {
+        shards[i].init();
+        shards[i].delta = &deltas[i];
+    }
+
+    for (const auto & input : inputs) {
+        CHECK(single.submit(input, nullptr));
+        CHECK(shards[Shard::ofIP(input.ip, 2)].submit(input, nullptr));
+    }
+
+    CHECK(deltas[0].empty() == false && deltas[1].empty() == false);
+
+    // through the binary form, as sent to the coordinator: the recorded changes of one shard, the whole
+    // contribution of the other
+    StateDelta full;
+    shards[1].contribution(full);
+
+    std::string messages[2];
+    deltas[0].serialize(messages[0]);
+    full.serialize(messages[1]);
+
+    const auto check = [&](const State & merged) {
+        CHECK(merged.statistics.votes == single.statistics.votes);
+        CHECK(merged.statistics.submissions == single.statistics.submissions);
+        CHECK(merged.slots.size() == single.slots.size());
+
+        for (size_t i = 0; i < std::min(merged.slots.size(), single.slots.size()); ++i) {
+            const auto & a = merged.slots[i];
+            const auto & b = single.slots[i];
+
+            CHECK(a.statistics.votes == b.statistics.votes);
+            CHECK(a.statistics.submissions == b.statistics.submissions);
+            CHECK(a.statistics.topVoted == b.statistics.topVoted);
+            CHECK(a.words.size() == b.words.size());
+            b.words.forEach([&](TWordId wordId, const Slot::WordData & data) {
+                const auto * other = a.words.find(wordId);
+                CHECK(other && other->votes_mv == data.votes_mv);
+            });
+        }
+    };
+
+    single.update(10);
+
+    for (const auto & order : { std::vector<int>({ 0, 1 }), std::vector<int>({ 1, 0 }) }) {
+        State merged;
+        merged.init();
+
+        for (const int i : order) {
+            StateDelta delta;
+            CHECK(delta.parse(messages[i].data(), messages[i].size()));
+            merged.merge(delta, nullptr);
+        }
+        merged.update(10);
+
+        check(merged);
+    }
+
+    // the ties are ordered by the word
+    using TopVoted = std::vector<std::pair<TWordId, int64_t>>;
+    CHECK(single.slots[0].statistics.topVoted == TopVoted({ { tieB, 2000 }, { alpha, 1500 }, { zulu, 1500 }, { tieA, 1000 }, { yankee, 0 } }));
+    CHECK(single.slots[1].statistics.topVoted == TopVoted({ { tieA, 1000 }, { tieB, 1000 } }));
+    CHECK(single.slots[2].statistics.topVoted == TopVoted({ { alpha, 500 }, { zulu, 500 } }));
+}
+
+// the parallel replay of the history gives the same state as submitting the records one by one: the same snapshot,
+// dirty slots and period starts. the history has slot ids that are not active yet and become active as the votes
+// grow, a period in which all records are rejected, and periods that span files
+void testReplayParallelMatchesSequential(const std::string & tmpDir) {
+    const TPeriodId firstPeriodId = 10;
+
+    std::vector<TWordId> wordIds;
+    for (int i = 0; i < 8; ++i) {
+        wordIds.push_back(Dictionary::intern("replay-" + std::to_string(i)));
+    }
+
+    std::mt19937 rng(11);
+    const auto pick = [&](int n) { return (int) (rng() % (uint32_t) n); };
+
+    // records of a period with slot ids in [0, nSlots), some of them beyond the active slots
+    const auto period = [&](int p, int n, int nSlots) {
+        std::vector<SubmissionInput> result;
+        for (int i = 0; i < n; ++i) {
+            SubmissionInput input;
+            input.timestamp_s = (firstPeriodId + p)*State::secondsInPeriod + i;
+            input.ip = 0x0c000000 + pick(300);
+            input.slotId = pick(nSlots);
+            input.userId = pick(3);
+            input.wordId = wordIds[pick((int) wordIds.size())];
+            result.push_back(input);
+        }
+        return result;
+    };
+
+    const auto join = [](std::vector<SubmissionInput> a, const std::vector<SubmissionInput> & b) {
+        a.insert(a.end(), b.begin(), b.end());
+        return a;
+    };
+
+    // only the initial slots, then slots that become active as the votes grow, then a period with only invalid
+    // slot ids, and the period after it spans two files
+    auto rejected = period(2, 4, 1);
+    for (auto & input : rejected) {
+        input.slotId = pick(2) == 0 ? -1 : 1000;
+    }
+    const auto split = period(3, 400, 54);
+    const std::vector<std::vector<SubmissionInput>> contents = {
+        join(period(0, 200, kInitialSlots), period(1, 400, 28)),
+        join(rejected, std::vector<SubmissionInput>(split.begin(), split.begin() + 150)),
+        join(join(std::vector<SubmissionInput>(split.begin() + 150, split.end()), period(4, 400, 68)), period(5, 200, 80)),
+    };
+
+    std::vector<Replay::File> files;
+    for (size_t i = 0; i < contents.size(); ++i) {
+        files.push_back({ tmpDir + "/replay-" + std::to_string(i) + ".bin", 0 });
+        CHECK(Storage::serialize(contents[i], files.back().fileName));
+    }
+
+    struct Result {
+        std::string snapshot;
+        std::vector<TSlotId> dirtySlots;
+        std::vector<TPeriodId> periodStarts;
+        TTimestamp lastSubmissionTimestamp_s = 0;
+        Replay::Statistics statistics;
+    };
+
+    // the state has the first records of the history already if nSkip > 0, so that the replay continues its period
+    const auto replay = [&](int nThreads, uint64_t nSkip) {
+        Result result;
+
+        State state;
+        state.init();
+
+        auto toReplay = files;
+        for (uint64_t i = 0; i < nSkip; ++i) {
+            state.submit(contents[0][i], nullptr);
+        }
+        toReplay[0].nSkip = nSkip;
+
+        result.statistics = Replay::apply(state, toReplay, nThreads, [&](TPeriodId periodId) {
+            result.periodStarts.push_back(periodId);
+        });
+
+        std::ostringstream out(std::ios::binary);
+        state.save(out);
+        result.snapshot = out.str();
+
+        result.lastSubmissionTimestamp_s = state.statistics.lastSubmissionTimestamp_s;
+
+        result.dirtySlots = state.dirtySlots;
+        std::sort(result.dirtySlots.begin(), result.dirtySlots.end());
+
+        return result;
+    };
+
+    for (const uint64_t nSkip : { (uint64_t) 0, (uint64_t) 300 }) {
+        const auto sequential = replay(1, nSkip);
+        const auto parallel = replay(4, nSkip);
+
+        CHECK(parallel.statistics.nParallelRuns > 0);
+        CHECK(parallel.statistics.nRecords == sequential.statistics.nRecords);
+        CHECK(parallel.snapshot == sequential.snapshot);
+        CHECK(parallel.dirtySlots == sequential.dirtySlots);
+        CHECK(parallel.periodStarts == sequential.periodStarts);
+        CHECK(parallel.lastSubmissionTimestamp_s == sequential.lastSubmissionTimestamp_s);
+    }
+}
+
+// a daemon that stores the period without rotating the log truncates it in place, the follower has to notice that
+// even if the log has grown past the position that it read up to, and take the rest of the period from the period file
+void testFollowerLogResetInPlace(const std::string & tmpDir) {
+    const std::string prefix = "story";
+    const TPeriodId periodId = 10;
+    const TWordId wordId = Dictionary::intern("follower");
+
+    const auto input = [&](TPeriodId p, int i) {
+        return SubmissionInput { (TTimestamp) (p*State::secondsInPeriod + i), (TIPAddress) (i + 1), 0, 1, wordId };
+    };
+
+    SubmissionLog::Parameters logParameters;
+    logParameters.fileName = Storage::logFileName(tmpDir, prefix);
+    logParameters.fsyncPolicy = SubmissionLog::FsyncPolicy::None;
+
+    SubmissionLog log(logParameters);
+    CHECK(log.open());
+
+    LogFollower::Parameters parameters;
+    parameters.dataFolder = tmpDir;
+    parameters.prefix = prefix;
+
+    LogFollower follower(parameters);
+
+    std::vector<SubmissionInput> applied;
+    const auto poll = [&]() {
+        return follower.poll([&](const SubmissionInput & entry) { applied.push_back(entry); });
+    };
+
+    std::vector<SubmissionInput> period;
+    for (int i = 0; i < 2; ++i) {
+        period.push_back(input(periodId, i));
+        log.append(period.back());
+    }
+    CHECK(log.commit());
+    CHECK(poll() == 2);
+
+    // one more record that the follower does not see before the period is stored
+    period.push_back(input(periodId, 2));
+    log.append(period.back());
+    CHECK(log.commit());
+
+    CHECK(Storage::serialize(period, Storage::periodFileName(tmpDir, prefix, periodId)));
+    CHECK(log.reset());
+
+    std::vector<SubmissionInput> expected = period;
+    for (int i = 0; i < 5; ++i) {
+        expected.push_back(input(periodId + 1, i));
+        log.append(expected.back());
+    }
+    CHECK(log.commit());
+
+    CHECK(poll() == 6);
+    CHECK(poll() == 0);
+
+    CHECK(applied.size() == expected.size());
+    for (size_t i = 0; i < std::min(applied.size(), expected.size()); ++i) {
+        CHECK(applied[i].timestamp_s == expected[i].timestamp_s && applied[i].ip == expected[i].ip);
+    }
+
+    // while the log is missing, the period file is not applied again
+    std::filesystem::remove(logParameters.fileName);
+    CHECK(poll() == 0);
+    CHECK(follower.statistics().nRecords == (int64_t) expected.size());
+}
+
+TCLIArguments parseCmdArguments(int argc, char ** argv) {
+    const std::map<std::string, CLIArgument> kArgs = {
+        { "-h",       EHelp },
+        { "--help",   EHelp },
+        { "-f",       EFilter },
+        { "--filter", EFilter },
+    };
+
+    TCLIArguments res;
+    for (int i = 1; i < argc; ++i) {
+        const auto it = kArgs.find(argv[i]);
+        if (it == kArgs.end()) {
+            fprintf(stderr, "Unknown argument: %s\n", argv[i]);
+            res[EHelp] = "";
+            break;
+        }
+
+        if (it->second == EHelp) {
+            res[EHelp] = "";
+            break;
+        }
+
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Missing value for argument: %s\n", argv[i]);
+            res[EHelp] = "";
+            break;
+        }
+
+        res[it->second] = argv[++i];
+    }
+
+    return res;
+}
+
+void printHelp(const char * name) {
+    printf("Usage: %s [options]\n", name);
+    printf("Options:\n");
+    printf("  -h, --help : print help\n");
+    printf("  -f, --filter : run only the tests which name contains this string\n");
+}
+
+}
+
+int main(int argc, char ** argv) {
+    const auto args = parseCmdArguments(argc, argv);
+    if (args.count(EHelp)) {
+        printHelp(argv[0]);
+        return 0;
+    }
+
+    const std::string filter = args.count(EFilter) ? args.at(EFilter) : "";
+
+    add("storage/legacy-oversized-word", testLegacyOversizedWord);
+    add("storage/corrupted-snapshot", testCorruptedSnapshot);
+    add("lexicon/rejected-words-not-interned", testRejectedWordsNotInterned);
+    add("ingest/bounded-queue", testIngestBoundedQueue);
+    add("state/millivotes-match-recount", testMillivotesMatchRecount);
+    add("shard/parking", testShardParking);
+    add("shard/merge-matches-single-node", testShardMergeMatchesSingleNode);
+    add("replay/parallel-matches-sequential", testReplayParallelMatchesSequential);
+    add("follower/log-reset-in-place", testFollowerLogResetInPlace);
+
+    const std::string tmpDir = (std::filesystem::temp_directory_path()/("the-story-test-" + std::to_string(getpid()))).string();
+
+    int nRun = 0;
+    int nFailed = 0;
+    for (const auto & test : tests()) {
+        if (filter.empty() == false && test.name.find(filter) == std::string::npos) {
+            continue;
+        }
+
+        std::filesystem::create_directories(tmpDir);
+
+        g_nFailedChecks = 0;
+        test.run(tmpDir);
+
+        printf("%-40s %s\n", test.name.c_str(), g_nFailedChecks == 0 ? "ok" : "FAILED");
+
+        nRun++;
+        nFailed += g_nFailedChecks > 0;
+
+        std::filesystem::remove_all(tmpDir);
+    }
+
+    printf("%d tests, %d failed\n", nRun, nFailed);
+
+    return nFailed;
+}
@@ -1,7 +1,12 @@
 #include "types.h"
 
+#include "utils.h"
+
 #include <cmath>
 #include <cassert>
+#include <algorithm>
+#include <cstring>
+#include <tuple>
 
 void SubmissionInput::serialize(std::ofstream& out) const {
     out.write((char *)&timestamp_s, sizeof(TTimestamp));
@@ -10,9 +15,22 @@ void SubmissionInput::serialize(std::ofstream& out) const {
     out.write((char *)&userId,      sizeof(TUserId));
 
     // serialize string as length and data
+    const auto word = Dictionary::word(wordId);
     uint32_t length = (uint32_t) word.length();
     out.write((char *)&length, sizeof(uint32_t));
-    out.write(word.c_str(), length);
+    out.write(word.data(), length);
+}
+
+void SubmissionInput::serialize(std::string & out) const {
+    out.append((const char *)&timestamp_s, sizeof(TTimestamp));
+    out.append((const char *)&ip,          sizeof(TIPAddress));
+    out.append((const char *)&slotId,      sizeof(TSlotId));
+    out.append((const char *)&userId,      sizeof(TUserId));
+
+    const auto word = Dictionary::word(wordId);
+    uint32_t length = (uint32_t) word.length();
+    out.append((const char *)&length, sizeof(uint32_t));
+    out.append(word.data(), length);
 }
 
 void SubmissionInput::deserialize(std::ifstream& in) {
@@ -25,51 +43,357 @@ void SubmissionInput::deserialize(std::ifstream& in) {
     uint32_t length;
     in.read((char *)&length, sizeof(uint32_t));
     char buffer[kMaxWordLength + 1];
-    in.read(buffer, length);
-    word = std::string(buffer, length);
+    const uint32_t nRead = std::min<uint32_t>(length, kMaxWordLength);
+    in.read(buffer, nRead);
+
+    // skip the rest of an oversized word, so that the next record is read from its start
+    if (length > nRead) {
+        in.ignore(length - nRead);
+    }
+
+    wordId = Dictionary::intern(std::string_view(buffer, nRead));
+}
+
+bool SubmissionInput::parse(std::string_view text, const CBIsValidWord & isValidWord) {
+    // split into whitespace separated tokens
+    std::string_view tokens[5];
+    int n = 0;
+    size_t pos = 0;
+    while (n < 5) {
+        pos = text.find_first_not_of(" \t\r\n", pos);
+        if (pos == std::string_view::npos) {
+            break;
+        }
+        const auto end = std::min(text.find_first_of(" \t\r\n", pos), text.size());
+        tokens[n++] = text.substr(pos, end - pos);
+        pos = end;
+    }
+
+    if (n != 5 || tokens[4].size() > (size_t) kMaxWordLength) {
+        return false;
+    }
+
+    auto toInt = [](std::string_view s, int64_t & res) {
+        if (s.empty()) {
+            return false;
+        }
+        bool neg = false;
+        if (s[0] == '-') {
+            neg = true;
+            s.remove_prefix(1);
+        }
+        if (s.empty() || s.size() > 18) {
+            return false;
+        }
+        res = 0;
+        for (auto c : s) {
+            if (c < '0' || c > '9') {
+                return false;
+            }
+            res = 10*res + (c - '0');
+        }
+        if (neg) {
+            res = -res;
+        }
+        return true;
+    };
+
+    int64_t v[3];
+    if (toInt(tokens[0], v[0]) == false || toInt(tokens[2], v[1]) == false || toInt(tokens[3], v[2]) == false) {
+        return false;
+    }
+
+    TIPAddress ipNew;
+    if (convertIPAddress(std::string(tokens[1]), ipNew) == false) {
+        return false;
+    }
+
+    if (isValidWord && isValidWord(tokens[4]) == false) {
+        return false;
+    }
+
+    timestamp_s = (TTimestamp) v[0];
+    ip          = ipNew;
+    slotId      = (TSlotId) v[1];
+    userId      = (TUserId) v[2];
+    wordId      = Dictionary::intern(tokens[4]);
+
+    return true;
+}
+
+bool SubmissionInput::parse(const char * data, size_t size, const CBIsValidWord & isValidWord) {
+    constexpr size_t kHeaderSize = sizeof(TTimestamp) + sizeof(TIPAddress) + sizeof(TSlotId) + sizeof(TUserId) + sizeof(uint32_t);
+    if (size < kHeaderSize) {
+        return false;
+    }
+
+    uint32_t length;
+    memcpy(&timestamp_s, data,      sizeof(TTimestamp));
+    memcpy(&ip,          data +  4, sizeof(TIPAddress));
+    memcpy(&slotId,      data +  8, sizeof(TSlotId));
+    memcpy(&userId,      data + 12, sizeof(TUserId));
+    memcpy(&length,      data + 14, sizeof(uint32_t));
+
+    if (length == 0 || length > (uint32_t) kMaxWordLength || kHeaderSize + length != size) {
+        return false;
+    }
+
+    const std::string_view word(data + kHeaderSize, length);
+    if (isValidWord && isValidWord(word) == false) {
+        return false;
+    }
+
+    wordId = Dictionary::intern(word);
+
+    return true;
+}
+
+namespace {
+
+template <typename T>
+void append(std::string & out, const T & value) {
+    out.append((const char *) &value, sizeof(T));
+}
+
+// reads values from a buffer, failing once the end is passed
+struct BufferReader {
+    const char * data;
+    size_t size;
+    size_t pos = 0;
+
+    template <typename T>
+    bool read(T & value) {
+        if (size - pos < sizeof(T)) {
+            return false;
+        }
+        memcpy(&value, data + pos, sizeof(T));
+        pos += sizeof(T);
+        return true;
+    }
+
+    bool read(std::string_view & value, size_t length) {
+        if (size - pos < length) {
+            return false;
+        }
+        value = std::string_view(data + pos, length);
+        pos += length;
+        return true;
+    }
+};
+
+}
+
+void StateDelta::clear() {
+    periodId    = 0;
+    votes       = 0;
+    submissions = 0;
+    uniqueIPs   = 0;
+    lastSubmissionTimestamp_s = 0;
+
+    slots.clear();
+    words.clear();
+    activity.clear();
+    slotActivity.clear();
+}
+
+void StateDelta::serialize(std::string & out) const {
+    append(out, periodId);
+    append(out, votes);
+    append(out, submissions);
+    append(out, uniqueIPs);
+    append(out, lastSubmissionTimestamp_s);
+
+    append(out, (uint32_t) slots.size());
+    slots.forEach([&](TSlotId slotId, const SlotData & data) {
+        append(out, slotId);
+        append(out, data.votes);
+        append(out, data.submissions);
+        append(out, data.lastSubmissionTimestamp_s);
+    });
+
+    // each word once, referenced by its index
+    FlatMap<TWordId, uint32_t> wordIndex;
+    std::vector<TWordId> wordIds;
+    words.forEach([&](uint64_t slotWord, int64_t) {
+        if (wordIndex.insert(TWordId(slotWord), (uint32_t) wordIds.size()).second) {
+            wordIds.push_back(TWordId(slotWord));
+        }
+    });
+
+    append(out, (uint32_t) wordIds.size());
+    for (const auto wordId : wordIds) {
+        const auto word = Dictionary::word(wordId);
+        append(out, (uint32_t) word.size());
+        out.append(word.data(), word.size());
+    }
+
+    append(out, (uint32_t) words.size());
+    words.forEach([&](uint64_t slotWord, int64_t delta_mv) {
+        append(out, TSlotId(slotWord >> 32));
+        append(out, *wordIndex.find(TWordId(slotWord)));
+        append(out, delta_mv);
+    });
+
+    append(out, (uint32_t) activity.size());
+    activity.forEach([&](TTimestamp t_s, const ActivityData & data) {
+        append(out, t_s);
+        append(out, data.submissions);
+        append(out, data.votes);
+        append(out, data.newIPs);
+    });
+
+    append(out, (uint32_t) slotActivity.size());
+    slotActivity.forEach([&](uint64_t slotTime, int32_t n) {
+        append(out, slotTime);
+        append(out, n);
+    });
+}
+
+bool StateDelta::parse(const char * data, size_t size) {
+    clear();
+
+    BufferReader in { data, size };
+
+    bool ok = true;
+    ok = ok && in.read(periodId);
+    ok = ok && in.read(votes);
+    ok = ok && in.read(submissions);
+    ok = ok && in.read(uniqueIPs);
+    ok = ok && in.read(lastSubmissionTimestamp_s);
+
+    uint32_t n = 0;
+    ok = ok && in.read(n);
+    for (uint32_t i = 0; i < n && ok; ++i) {
+        TSlotId slotId = 0;
+        SlotData slot;
+        ok = ok && in.read(slotId) && in.read(slot.votes) && in.read(slot.submissions) && in.read(slot.lastSubmissionTimestamp_s) && slotId >= 0;
+        if (ok) {
+            slots.insert(slotId, slot);
+        }
+    }
+
+    std::vector<TWordId> wordIds;
+    ok = ok && in.read(n);
+    for (uint32_t i = 0; i < n && ok; ++i) {
+        uint32_t length = 0;
+        std::string_view word;
+        ok = ok && in.read(length) && length <= (uint32_t) kMaxWordLength && in.read(word, length);
+        if (ok) {
+            wordIds.push_back(Dictionary::intern(word));
+        }
+    }
+
+    ok = ok && in.read(n);
+    for (uint32_t i = 0; i < n && ok; ++i) {
+        TSlotId slotId = 0;
+        uint32_t index = 0;
+        int64_t delta_mv = 0;
+        ok = ok && in.read(slotId) && in.read(index) && in.read(delta_mv) && index < wordIds.size() && slots.find(slotId);
+        if (ok) {
+            words.insert(packSlotWord(slotId, wordIds[index]), delta_mv);
+        }
+    }
+
+    ok = ok && in.read(n);
+    for (uint32_t i = 0; i < n && ok; ++i) {
+        TTimestamp t_s = 0;
+        ActivityData data;
+        ok = ok && in.read(t_s) && in.read(data.submissions) && in.read(data.votes) && in.read(data.newIPs);
+        if (ok) {
+            activity.insert(t_s, data);
+        }
+    }
+
+    ok = ok && in.read(n);
+    for (uint32_t i = 0; i < n && ok; ++i) {
+        uint64_t slotTime = 0;
+        int32_t count = 0;
+        ok = ok && in.read(slotTime) && in.read(count) && slots.find(TSlotId(slotTime >> 32));
+        if (ok) {
+            slotActivity.insert(slotTime, count);
+        }
+    }
+
+    return ok && in.pos == size;
 }
 
 bool convertIPAddress(const std::string & ipAddress, TIPAddress & ip) {
-    auto parts = std::vector<uint32_t>();
-    parts.reserve(4);
+    uint32_t parts[4];
+    int nParts = 0;
 
-    auto part = std::string();
+    uint32_t part = 0;
+    int nDigits = 0;
     for (auto c : ipAddress) {
         if (c == '.') {
-            if (part.empty()) {
+            if (nDigits == 0 || nParts == 3) {
                 return false;
             }
-            parts.push_back(std::stoi(part));
-            part.clear();
+            parts[nParts++] = part;
+            part = 0;
+            nDigits = 0;
+        } else if (c >= '0' && c <= '9' && nDigits < 3) {
+            part = 10*part + (c - '0');
+            nDigits++;
         } else {
-            part += c;
+            return false;
         }
-    }
-    if (part.empty()) {
-        return false;
-    }
-    parts.push_back(std::stoi(part));
 
-    if (parts.size() != 4) {
+        if (part > 255) {
+            return false;
+        }
+    }
+    if (nDigits == 0 || nParts != 3) {
         return false;
     }
+    parts[nParts++] = part;
 
     ip = (parts[0] << 24) | (parts[1] << 16) | (parts[2] << 8) | parts[3];
     return true;
 }
 
-void Slot::update() {
+void Slot::addVotes(TWordId wordId, int64_t delta_mv) {
+    auto [data, isNew] = words.insert(wordId);
+    if (isNew) {
+        data->prefix = prefixOf(Dictionary::word(wordId));
+        ranking.insert({ 0, data->prefix, wordId });
+    }
+
+    dirty = true;
+
+    if (delta_mv == 0) {
+        return;
+    }
+
+    // re-key the ranking node in place, avoiding a new allocation
+    auto node = ranking.extract({ data->votes_mv, data->prefix, wordId });
+    data->votes_mv += delta_mv;
+    assert(data->votes_mv >= 0);
+    node.value().votes_mv = data->votes_mv;
+    ranking.insert(std::move(node));
+}
+
+void Slot::update(size_t nTopWords) {
     statistics.topVoted.clear();
 
-    for (auto& word : words) {
-        statistics.topVoted.push_back(std::make_pair(word.first, word.second.votes_mv));
+    for (const auto & entry : ranking) {
+        if (statistics.topVoted.size() >= nTopWords) {
+            break;
+        }
+        statistics.topVoted.push_back(std::make_pair(entry.wordId, entry.votes_mv));
     }
 
-    std::sort(statistics.topVoted.begin(), statistics.topVoted.end(),
-              [](const std::pair<std::string, uint32_t>& a,
-                 const std::pair<std::string, uint32_t>& b) {
-                  return a.second > b.second;
-              });
+    dirty = false;
+}
+
+size_t State::periodMemoryUsage() const {
+    return
+        submissions.capacity()*sizeof(Submission) +
+        submissionIndex.memoryUsage() +
+        groups.memoryUsage() +
+        groupCounts.capacity()*sizeof(GroupCount) +
+        groupWords.capacity()*sizeof(GroupWord) +
+        groupWordIndex.memoryUsage() +
+        ips.memoryUsage();
 }
 
 int64_t State::votesNeeded(int32_t slots) const {
@@ -81,17 +405,137 @@ int32_t State::activeSlots(int64_t votes) const {
 }
 
 int32_t State::activeSlots() const {
-    return activeSlots(statistics.votes);
+    return activeSlots(statistics.votes + otherVotes);
 }
 
 void State::init() {
-    slots.resize(kInitialSlots);
+    resizeSlots(kInitialSlots);
 }
 
-void State::submit(SubmissionInput input, CBOnNewPeriodStart&& onNewPeriodStart) {
-    if (input.slotId >= (TSlotId) slots.size()) {
+void State::resizeSlots(int32_t nSlots) {
+    const int32_t nSlotsOld = slots.size();
+    slots.resize(nSlots);
+
+    // new slots are published by the next update()
+    for (int32_t i = nSlotsOld; i < nSlots; ++i) {
+        slots[i].dirty = true;
+        dirtySlots.push_back(i);
+    }
+}
+
+int32_t State::groupWord(uint64_t ipSlot, TWordId wordId) {
+    auto [index, isNew] = groupWordIndex.insert({ ipSlot, wordId }, (int32_t) groupWords.size());
+    if (isNew) {
+        groupWords.push_back(GroupWord { wordId, -1, -1, -1 });
+    }
+
+    return *index;
+}
+
+int32_t State::newGroupCount(const GroupCount & count) {
+    if (groupCountsFree == -1) {
+        groupCounts.push_back(count);
+        return (int32_t) groupCounts.size() - 1;
+    }
+
+    const int32_t index = groupCountsFree;
+    groupCountsFree = groupCounts[index].next;
+    groupCounts[index] = count;
+
+    return index;
+}
+
+void State::splitGroup(Group & group, uint64_t ipSlot) {
+    const int32_t iWord = groupWord(ipSlot, group.wordId);
+
+    group.head = newGroupCount(GroupCount { group.nUsers, iWord, -1, -1 });
+    groupWords[iWord].count = group.head;
+}
+
+int32_t State::addGroupWordUser(Group & group, int32_t iWord, int32_t delta) {
+    const int32_t iOld = groupWords[iWord].count;
+    const int32_t nOld = iOld == -1 ? 0 : groupCounts[iOld].nUsers;
+    const int32_t nNew = nOld + delta;
+
+    // the counts are sorted, so the new count is either next to the old one or has to be inserted there
+    int32_t prev = -1;
+    int32_t next = group.head;
+    if (iOld != -1) {
+        prev = delta > 0 ? iOld : groupCounts[iOld].prev;
+        next = delta > 0 ? groupCounts[iOld].next : iOld;
+    }
+
+    int32_t iNew = -1;
+    if (nNew > 0) {
+        if (delta > 0 && next != -1 && groupCounts[next].nUsers == nNew) {
+            iNew = next;
+        } else if (delta < 0 && prev != -1 && groupCounts[prev].nUsers == nNew) {
+            iNew = prev;
+        } else {
+            iNew = newGroupCount(GroupCount { nNew, -1, prev, next });
+
+            if (prev == -1) {
+                group.head = iNew;
+            } else {
+                groupCounts[prev].next = iNew;
+            }
+            if (next != -1) {
+                groupCounts[next].prev = iNew;
+            }
+        }
+    }
+
+    auto & word = groupWords[iWord];
+
+    // unlink the word from its old count, dropping the count if it becomes empty
+    if (iOld != -1) {
+        if (word.prev == -1) {
+            groupCounts[iOld].head = word.next;
+        } else {
+            groupWords[word.prev].next = word.next;
+        }
+        if (word.next != -1) {
+            groupWords[word.next].prev = word.prev;
+        }
+
+        auto & count = groupCounts[iOld];
+        if (count.head == -1) {
+            if (count.prev == -1) {
+                group.head = count.next;
+            } else {
+                groupCounts[count.prev].next = count.next;
+            }
+            if (count.next != -1) {
+                groupCounts[count.next].prev = count.prev;
+            }
+
+            count.next = groupCountsFree;
+            groupCountsFree = iOld;
+        }
+    }
+
+    word.count = iNew;
+    word.prev = -1;
+    word.next = -1;
+    if (iNew != -1) {
+        word.next = groupCounts[iNew].head;
+        if (word.next != -1) {
+            groupWords[word.next].prev = iWord;
+        }
+        groupCounts[iNew].head = iWord;
+    }
+
+    return nNew;
+}
+
+bool State::submit(SubmissionInput input, CBOnNewPeriodStart&& onNewPeriodStart) {
+    if (input.slotId < 0 || (input.slotId >= (TSlotId) slots.size() && acceptAllSlots == false)) {
         fprintf(stderr, "Invalid slot id: %d, current active slots: %lu\n", input.slotId, slots.size());
-        return;
+        return false;
+    }
+
+    if (input.slotId >= (TSlotId) slots.size()) {
+        resizeSlots(input.slotId + 1);
     }
 
     const int32_t newPeriodId = input.timestamp_s/secondsInPeriod;
@@ -103,59 +547,141 @@ void State::submit(SubmissionInput input, CBOnNewPeriodStart&& onNewPeriodStart)
         curPeriodId = newPeriodId;
 
         submissions.clear();
+        submissionIndex.clear();
+        groups.clear();
+        groupCounts.clear();
+        groupCountsFree = -1;
+        groupWords.clear();
+        groupWordIndex.clear();
+        ips.clear();
     }
 
-    if (auto itIP = submissions.find(input.ip); itIP == submissions.end()) {
-        // this IP submits for the frist time
-        statistics.uniqueIPs++;
+    auto & slot = slots[input.slotId];
+    slot.statistics.lastSubmissionTimestamp_s = input.timestamp_s;
+    statistics.lastSubmissionTimestamp_s = std::max(statistics.lastSubmissionTimestamp_s, input.timestamp_s);
+    if (slot.dirty == false) {
+        slot.dirty = true;
+        dirtySlots.push_back(input.slotId);
     }
 
-    slots[input.slotId].statistics.lastSubmissionTimestamp_s = input.timestamp_s;
+    // the changes are recorded next to the state updates below
+    StateDelta::SlotData * slotDelta = nullptr;
+    StateDelta::ActivityData * activityDelta = nullptr;
+    if (delta) {
+        delta->periodId = curPeriodId;
+        delta->lastSubmissionTimestamp_s = std::max(delta->lastSubmissionTimestamp_s, input.timestamp_s);
 
-    {
-        auto & curIP = submissions[input.ip];
-        if (auto itSlot = curIP.find(input.slotId); itSlot == curIP.end()) {
-            // this IP submits for the frist time for that slot
-            statistics.votes++;
-            slots[input.slotId].statistics.votes++;
-        }
-
-        {
-            auto & curSlot = curIP[input.slotId];
-            if (auto itUser = curSlot.find(input.userId); itUser == curSlot.end()) {
-                // remove old contributions for this slot
-                if (curSlot.size() > 0) {
-                    const int64_t v_mv = std::round(1000.0/curSlot.size());
-                    for (const auto & sub : curSlot) {
-                        slots[input.slotId].words[sub.second.word].votes_mv -= v_mv;
-                        assert(slots[input.slotId].words[sub.second.word].votes_mv >= 0);
-                    }
+        slotDelta = delta->slots.insert(input.slotId).first;
+        slotDelta->lastSubmissionTimestamp_s = input.timestamp_s;
+        activityDelta = delta->activity.insert(input.timestamp_s).first;
+    }
+
+    auto addVotes = [&](TWordId wordId, int64_t delta_mv) {
+        slot.addVotes(wordId, delta_mv);
+        if (delta) {
+            *delta->words.insert(StateDelta::packSlotWord(input.slotId, wordId), 0).first += delta_mv;
+        }
+    };
+
+    const uint64_t ipSlot = packIPSlot(input.ip, input.slotId);
+
+    auto [group, isNewGroup] = groups.insert(ipSlot);
+    if (isNewGroup) {
+        if (ips.insert(input.ip).second) {
+            // this IP submits for the frist time
+            statistics.uniqueIPs++;
+            activity.newIPs.add(input.timestamp_s);
+
+            if (delta) {
+                delta->uniqueIPs++;
+                activityDelta->newIPs++;
+            }
+        }
+
+        // this IP submits for the frist time for that slot
+        statistics.votes++;
+        slot.statistics.votes++;
+        activity.votes.add(input.timestamp_s);
+
+        if (delta) {
+            delta->votes++;
+            slotDelta->votes++;
+            activityDelta->votes++;
+        }
+    }
+
+    auto [index, isNewUser] = submissionIndex.insert({ ipSlot, input.userId }, (int32_t) submissions.size());
+    if (isNewUser) {
+        const int32_t n = group->nUsers;
+
+        int32_t iWord = -1;
+        if (group->hasOnlyWord(input.wordId)) {
+            // the word keeps the whole vote of the group
+            group->wordId = input.wordId;
+            addVotes(input.wordId, share_mv(n + 1, n + 1) - share_mv(n, n));
+        } else {
+            if (group->head == -1) {
+                splitGroup(*group, ipSlot);
+            }
+
+            // the group is shared by n + 1 users now, the words with the same count get the same correction
+            for (int32_t i = group->head; i != -1; i = groupCounts[i].next) {
+                const int64_t delta_mv = share_mv(groupCounts[i].nUsers, n + 1) - share_mv(groupCounts[i].nUsers, n);
+                if (delta_mv == 0) {
+                    continue;
                 }
 
-                // new submission
-                curSlot.emplace(input.userId, Submission { std::move(input.word) });
-                statistics.submissions++;
-                slots[input.slotId].statistics.submissions++;
-
-                // recompute contributions for this slot
-                {
-                    const int64_t v_mv = std::round(1000.0/curSlot.size());
-                    for (const auto & sub : curSlot) {
-                        slots[input.slotId].words[sub.second.word].votes_mv += v_mv;
-                    }
+                for (int32_t j = groupCounts[i].head; j != -1; j = groupWords[j].next) {
+                    addVotes(groupWords[j].wordId, delta_mv);
                 }
-            } else {
-                // remove old contribution by this user
-                const int64_t v_mv = std::round(1000.0/curSlot.size());
-                slots[input.slotId].words[itUser->second.word].votes_mv -= v_mv;
-                assert(slots[input.slotId].words[itUser->second.word].votes_mv >= 0);
+            }
 
-                // edit existing submission
-                itUser->second.word = std::move(input.word);
+            // contribution by the new user
+            iWord = groupWord(ipSlot, input.wordId);
+            const int32_t c = addGroupWordUser(*group, iWord, 1);
+            addVotes(input.wordId, share_mv(c, n + 1) - share_mv(c - 1, n + 1));
+        }
+
+        // new submission
+        submissions.push_back(Submission { input.wordId, iWord });
+        group->nUsers++;
+        statistics.submissions++;
+        slot.statistics.submissions++;
+
+        activity.submissions.add(input.timestamp_s);
+        addSlotActivity(input.slotId, input.timestamp_s, 1);
+
+        if (delta) {
+            delta->submissions++;
+            slotDelta->submissions++;
+            activityDelta->submissions++;
+            (*delta->slotActivity.insert(StateDelta::packSlotTime(input.slotId, input.timestamp_s), 0).first)++;
+        }
+    } else {
+        auto & submission = submissions[*index];
 
-                // recompute contribution by this user
-                slots[input.slotId].words[itUser->second.word].votes_mv += v_mv;
+        if (submission.wordId != input.wordId) {
+            const int32_t n = group->nUsers;
+
+            if (group->head == -1) {
+                splitGroup(*group, ipSlot);
+            }
+
+            // remove old contribution by this user
+            const int32_t iOld = submission.groupWord != -1 ? submission.groupWord : groupWord(ipSlot, submission.wordId);
+            const int32_t cOld = addGroupWordUser(*group, iOld, -1);
+            const int64_t deltaOld_mv = share_mv(cOld, n) - share_mv(cOld + 1, n);
+            if (deltaOld_mv != 0) {
+                addVotes(submission.wordId, deltaOld_mv);
             }
+
+            // edit existing submission
+            submission.wordId = input.wordId;
+
+            // recompute contribution by this user
+            submission.groupWord = groupWord(ipSlot, submission.wordId);
+            const int32_t cNew = addGroupWordUser(*group, submission.groupWord, 1);
+            addVotes(submission.wordId, share_mv(cNew, n) - share_mv(cNew - 1, n));
         }
     }
 
@@ -163,119 +689,459 @@ void State::submit(SubmissionInput input, CBOnNewPeriodStart&& onNewPeriodStart)
     {
         const auto nSlotsNew = activeSlots();
         if (nSlotsNew > (int32_t) slots.size()) {
-            slots.resize(nSlotsNew);
+            resizeSlots(nSlotsNew);
             //printf("Resized slots to %d\n", nSlotsNew);
         }
     }
+
+    return true;
 }
 
-void State::update() {
-    for (auto & slot : slots) {
-        slot.update();
+void State::setOtherVotes(int64_t votes) {
+    otherVotes = std::max(otherVotes, votes);
+
+    const auto nSlotsNew = activeSlots();
+    if (nSlotsNew > (int32_t) slots.size()) {
+        resizeSlots(nSlotsNew);
     }
 }
 
-void State::output(const std::string & filename, size_t nTopWordsPerSlot) const {
-    std::ofstream file(filename);
+void State::merge(const StateDelta & delta, const CBOnNewPeriodStart & onNewPeriodStart) {
+    if (delta.empty()) {
+        return;
+    }
 
-    file << "{" << std::endl;
-    file << "  \"votes\": " << statistics.votes << "," << std::endl;
-    file << "  \"submissions\": " << statistics.submissions << "," << std::endl;
-    file << "  \"next\": " << votesNeeded(activeSlots() + 1) << "," << std::endl;
-    file << "  \"ips\": " << statistics.uniqueIPs << "," << std::endl;
+    // the shards start a new period with their first submission in it, the merged state with the first delta
+    if (delta.periodId > curPeriodId) {
+        if (onNewPeriodStart) {
+            onNewPeriodStart(curPeriodId);
+        }
+        curPeriodId = delta.periodId;
+    }
 
-    file << "  \"slots\": [" << std::endl;
-    for (uint32_t i = 0; i < slots.size(); ++i) {
-        const auto & slot = slots[i];
-        file << "    {" << std::endl;
-        file << "      \"id\": " << i << "," << std::endl;
-        file << "      \"votes\": " << slot.statistics.votes << "," << std::endl;
-        file << "      \"submissions\": " << slot.statistics.submissions << "," << std::endl;
-
-        file << "      \"top\": [" << std::endl;
-        const size_t nTopWords = std::min(nTopWordsPerSlot, slot.statistics.topVoted.size());
-        for (size_t j = 0; j < nTopWords; ++j) {
-            const auto & word = slot.statistics.topVoted[j];
-            file << "        {" << std::endl;
-            file << "          \"word\": \"" << word.first << "\"," << std::endl;
-            file << "          \"votes\": " << word.second << std::endl;
-            file << "        }";
-            if (j < nTopWords - 1) {
-                file << ",";
-            }
-            file << std::endl;
+    statistics.votes       += delta.votes;
+    statistics.submissions += delta.submissions;
+    statistics.uniqueIPs   += delta.uniqueIPs;
+    statistics.lastSubmissionTimestamp_s = std::max(statistics.lastSubmissionTimestamp_s, delta.lastSubmissionTimestamp_s);
+
+    // the slots of the delta are active for the shard, so they are active for the total votes as well
+    {
+        TSlotId maxSlotId = -1;
+        delta.slots.forEach([&](TSlotId slotId, const StateDelta::SlotData &) {
+            maxSlotId = std::max(maxSlotId, slotId);
+        });
+
+        const auto nSlotsNew = std::max(activeSlots(), maxSlotId + 1);
+        if (nSlotsNew > (int32_t) slots.size()) {
+            resizeSlots(nSlotsNew);
+        }
+    }
+
+    delta.slots.forEach([&](TSlotId slotId, const StateDelta::SlotData & data) {
+        auto & slot = slots[slotId];
+        slot.statistics.votes       += data.votes;
+        slot.statistics.submissions += data.submissions;
+        slot.statistics.lastSubmissionTimestamp_s = std::max(slot.statistics.lastSubmissionTimestamp_s, data.lastSubmissionTimestamp_s);
+
+        if (slot.dirty == false) {
+            slot.dirty = true;
+            dirtySlots.push_back(slotId);
+        }
+    });
+
+    delta.words.forEach([&](uint64_t slotWord, int64_t delta_mv) {
+        slots[TSlotId(slotWord >> 32)].addVotes(TWordId(slotWord), delta_mv);
+    });
+
+    delta.activity.forEach([&](TTimestamp t_s, const StateDelta::ActivityData & data) {
+        activity.submissions.add(t_s, data.submissions);
+        activity.votes.add(t_s, data.votes);
+        activity.newIPs.add(t_s, data.newIPs);
+    });
+
+    delta.slotActivity.forEach([&](uint64_t slotTime, int32_t n) {
+        addSlotActivity(TSlotId(slotTime >> 32), TTimestamp(slotTime), n);
+    });
+}
+
+void State::addSlotActivity(TSlotId slotId, TTimestamp t_s, int32_t n) {
+    auto & slot = slots[slotId];
+    if (slot.activity == -1) {
+        // too old to be counted in the last hour, the slot would be removed by the next update() anyway
+        constexpr auto T = decltype(ActivityCounters::perMinute)::kIntervalSeconds;
+        constexpr auto N = decltype(ActivityCounters::perMinute)::kIntervals;
+        if (statistics.lastSubmissionTimestamp_s/T >= t_s/T + N) {
+            return;
         }
-        file << "      ]" << std::endl;
-        file << "    }" << std::endl;
-        if (i < slots.size() - 1) {
-            file << ",";
+
+        slot.activity = slotActivity.size();
+        slotActivity.push_back(SlotActivity { slotId, {} });
+    }
+    slotActivity[slot.activity].submissions.add(t_s, n);
+}
+
+void State::contribution(StateDelta & delta) const {
+    delta.clear();
+
+    delta.periodId    = curPeriodId;
+    delta.votes       = statistics.votes;
+    delta.submissions = statistics.submissions;
+    delta.uniqueIPs   = statistics.uniqueIPs;
+    delta.lastSubmissionTimestamp_s = statistics.lastSubmissionTimestamp_s;
+
+    // the slots without submissions do not change the merged state
+    for (TSlotId slotId = 0; slotId < (TSlotId) slots.size(); ++slotId) {
+        const auto & slot = slots[slotId];
+        if (slot.statistics.submissions == 0 && slot.words.empty()) {
+            continue;
         }
+
+        auto & data = *delta.slots.insert(slotId).first;
+        data.votes       = slot.statistics.votes;
+        data.submissions = slot.statistics.submissions;
+        data.lastSubmissionTimestamp_s = slot.statistics.lastSubmissionTimestamp_s;
+
+        slot.words.forEach([&](TWordId wordId, const Slot::WordData & word) {
+            delta.words.insert(StateDelta::packSlotWord(slotId, wordId), word.votes_mv);
+        });
     }
-    file << "  ]" << std::endl;
-    file << "}" << std::endl;
 }
 
-namespace Gen {
+namespace {
 
-TTimestamp timestamp() {
-    TTimestamp result;
+void writeSlot(JSONWriter & json, uint32_t id, const Slot & slot) {
+    json.beginObject();
+    json.key("id");          json.value((int64_t) id);
+    json.key("votes");       json.value(slot.statistics.votes);
+    json.key("submissions"); json.value(slot.statistics.submissions);
 
-    static TTimestamp lastTimestamp = 0;
-    result = lastTimestamp++;
+    json.key("top");
+    json.beginArray();
+    for (const auto & [wordId, votes] : slot.statistics.topVoted) {
+        json.beginObject();
+        json.key("word");  json.value(Dictionary::word(wordId));
+        json.key("votes"); json.value(votes);
+        json.endObject();
+    }
+    json.endArray();
 
-    return result;
+    json.endObject();
 }
 
-TIPAddress ip() {
-    return rand()%std::numeric_limits<TIPAddress>::max();
 }
 
-TSlotId slotId(int32_t n) {
-    return rand()%n;
+void State::update(size_t nTopWordsPerSlot, std::vector<TSlotId> * updated) {
+    if (updated) {
+        updated->insert(updated->end(), dirtySlots.begin(), dirtySlots.end());
+    }
+
+    for (auto slotId : dirtySlots) {
+        auto & slot = slots[slotId];
+        slot.update(nTopWordsPerSlot);
+
+        slot.json.clear();
+        JSONWriter json(slot.json);
+        writeSlot(json, slotId, slot);
+    }
+    dirtySlots.clear();
+
+    // forget the slots that had no submissions in the last hour
+    // the hour is counted in whole minutes, so the slots can drop out of it only when a new minute starts,
+    // and addSlotActivity() does not add slots that are out of it already
+    const uint32_t minute = statistics.lastSubmissionTimestamp_s/decltype(ActivityCounters::perMinute)::kIntervalSeconds;
+    if (minute == activityPruneMinute) {
+        return;
+    }
+    activityPruneMinute = minute;
+
+    for (size_t i = 0; i < slotActivity.size(); ) {
+        if (slotActivity[i].submissions.perMinute.sum(statistics.lastSubmissionTimestamp_s) > 0) {
+            ++i;
+            continue;
+        }
+
+        slots[slotActivity[i].slotId].activity = -1;
+        if (i + 1 < slotActivity.size()) {
+            slotActivity[i] = slotActivity.back();
+            slots[slotActivity[i].slotId].activity = i;
+        }
+        slotActivity.pop_back();
+    }
 }
 
-TUserId userId() {
-    return rand()%std::numeric_limits<TUserId>::max();
+void State::outputSlot(JSONWriter & json, TSlotId slotId) const {
+    const auto & slot = slots[slotId];
+    if (slot.json.empty()) {
+        // not updated yet
+        writeSlot(json, slotId, slot);
+    } else {
+        json.raw(slot.json);
+    }
 }
 
-TWord word() {
-    static const std::vector<std::string> kWords = {
-        "apple",
-        "banana",
-        "orange",
-        "pear",
-        "grape",
-        "strawberry",
-        "watermelon",
-        "cherry",
-        "peach",
-        "kiwi",
-        "pineapple",
-        "mango",
-        "coconut",
-        "avocado",
-        "papaya",
-        "plum",
-        "peach",
-        "lemon",
-        "lime",
+void State::outputActivity(JSONWriter & json) const {
+    const auto now_s = statistics.lastSubmissionTimestamp_s;
+
+    auto writeTotals = [&](const char * name, auto counter) {
+        json.key(name);
+        json.beginObject();
+        json.key("submissions"); json.value((activity.submissions.*counter).sum(now_s));
+        json.key("votes");       json.value((activity.votes.*counter).sum(now_s));
+        json.key("ips");         json.value((activity.newIPs.*counter).sum(now_s));
+        json.endObject();
     };
 
-    return kWords[rand()%kWords.size()];
+    auto writeHistogram = [&](const char * name, const auto & counter) {
+        json.key(name);
+        json.beginArray();
+        for (int i = counter.kIntervals - 1; i >= 0; --i) {
+            json.value((int64_t) counter.get(now_s, i));
+        }
+        json.endArray();
+    };
+
+    // (submissions in the last minute, submissions in the last hour, slot id)
+    std::vector<std::tuple<int64_t, int64_t, TSlotId>> trending;
+    trending.reserve(slotActivity.size());
+    for (const auto & slot : slotActivity) {
+        trending.emplace_back(slot.submissions.perSecond.sum(now_s), slot.submissions.perMinute.sum(now_s), slot.slotId);
+    }
+
+    const size_t nTrending = std::min<size_t>(nTrendingSlots, trending.size());
+    std::partial_sort(trending.begin(), trending.begin() + nTrending, trending.end(), [](const auto & a, const auto & b) {
+        return std::get<0>(a) != std::get<0>(b) ? std::get<0>(a) > std::get<0>(b) :
+               std::get<1>(a) != std::get<1>(b) ? std::get<1>(a) > std::get<1>(b) : std::get<2>(a) < std::get<2>(b);
+    });
+
+    json.beginObject();
+    json.key("last"); json.value((int64_t) now_s);
+
+    writeTotals("minute", &ActivityCounters::perSecond);
+    writeTotals("hour",   &ActivityCounters::perMinute);
+
+    writeHistogram("perSecond", activity.submissions.perSecond);
+    writeHistogram("perMinute", activity.submissions.perMinute);
+
+    json.key("trending");
+    json.beginArray();
+    for (size_t i = 0; i < nTrending; ++i) {
+        json.beginObject();
+        json.key("id");     json.value((int64_t) std::get<2>(trending[i]));
+        json.key("minute"); json.value(std::get<0>(trending[i]));
+        json.key("hour");   json.value(std::get<1>(trending[i]));
+        json.endObject();
+    }
+    json.endArray();
+
+    json.endObject();
 }
 
-SubmissionInput submissionInput(int32_t n) {
-    SubmissionInput result {
-        timestamp(),
-        ip(),
-        slotId(n),
-        userId(),
-        word(),
-    };
+void State::output(std::string & out) const {
+    JSONWriter json(out);
+
+    json.beginObject();
+    json.key("votes");       json.value(statistics.votes);
+    json.key("submissions"); json.value(statistics.submissions);
+    json.key("next");        json.value(votesNeeded(activeSlots() + 1));
+    json.key("ips");         json.value(statistics.uniqueIPs);
+
+    json.key("activity");
+    outputActivity(json);
+
+    json.key("slots");
+    json.beginArray();
+    for (uint32_t i = 0; i < slots.size(); ++i) {
+        outputSlot(json, i);
+    }
+    json.endArray();
+
+    json.endObject();
+}
+
+bool State::output(const std::string & filename) const {
+    // reused between calls to avoid growing a new buffer every time
+    static std::string buffer;
+
+    buffer.clear();
+    output(buffer);
+
+    return Utils::writeFile(filename, buffer);
+}
+
+namespace {
+
+template <typename T>
+void write(std::ostream & out, const T & value) {
+    out.write((const char *) &value, sizeof(T));
+}
+
+template <typename T>
+bool read(std::istream & in, T & value) {
+    return (bool) in.read((char *) &value, sizeof(T));
+}
+
+// whether the rest of the stream can hold n records of the given size, the stream must be seekable
+bool fits(std::istream & in, uint32_t n, size_t recordSize) {
+    const auto pos = in.tellg();
+    if (pos < 0 || in.seekg(0, std::ios::end).good() == false) {
+        return false;
+    }
+    const auto end = in.tellg();
+    in.seekg(pos);
+
+    return in.good() && uint64_t(n)*recordSize <= uint64_t(end - pos);
+}
+
+}
+
+void State::save(std::ostream & out) const {
+    write(out, curPeriodId);
+    write(out, statistics.votes);
+    write(out, statistics.submissions);
+    write(out, statistics.uniqueIPs);
+
+    // the whole dictionary in id order, so that interning it again reproduces the same word ids
+    const auto nWords = Dictionary::size();
+    write(out, (uint32_t) nWords);
+    for (size_t i = 0; i < nWords; ++i) {
+        const auto word = Dictionary::word((TWordId) i);
+        write(out, (uint32_t) word.size());
+        out.write(word.data(), word.size());
+    }
+
+    write(out, (uint32_t) slots.size());
+    for (const auto & slot : slots) {
+        write(out, slot.statistics.lastSubmissionTimestamp_s);
+        write(out, slot.statistics.votes);
+        write(out, slot.statistics.submissions);
+
+        write(out, (uint32_t) slot.words.size());
+        slot.words.forEach([&](TWordId wordId, const Slot::WordData & data) {
+            write(out, wordId);
+            write(out, data.votes_mv);
+        });
+    }
+
+    // submissions of the current period, in the order of arrival
+    std::vector<SubmissionKey> keys(submissions.size());
+    submissionIndex.forEach([&](const SubmissionKey & key, int32_t index) {
+        keys[index] = key;
+    });
 
-    return result;
+    write(out, (uint32_t) submissions.size());
+    for (size_t i = 0; i < submissions.size(); ++i) {
+        write(out, keys[i].ipSlot);
+        write(out, keys[i].userId);
+        write(out, submissions[i].wordId);
+    }
 }
 
+bool State::load(std::istream & in) {
+    *this = State();
+
+    auto readWords = [&](std::vector<TWordId> & wordIds) {
+        uint32_t nWords = 0;
+        if (read(in, nWords) == false || fits(in, nWords, sizeof(uint32_t)) == false) {
+            return false;
+        }
+        wordIds.resize(nWords);
+
+        char buffer[kMaxWordLength + 1];
+        for (auto & wordId : wordIds) {
+            uint32_t length = 0;
+            if (read(in, length) == false || length > (uint32_t) kMaxWordLength || in.read(buffer, length).good() == false) {
+                return false;
+            }
+            wordId = Dictionary::intern(std::string_view(buffer, length));
+        }
+
+        return true;
+    };
+
+    std::vector<TWordId> wordIds;
+
+    bool ok = true;
+    ok = ok && read(in, curPeriodId);
+    ok = ok && read(in, statistics.votes);
+    ok = ok && read(in, statistics.submissions);
+    ok = ok && read(in, statistics.uniqueIPs);
+    ok = ok && readWords(wordIds);
+
+    // the counts are checked against the rest of the data before anything is allocated for them
+    uint32_t nSlots = 0;
+    ok = ok && read(in, nSlots);
+    ok = ok && fits(in, nSlots, sizeof(TTimestamp) + 2*sizeof(int64_t) + sizeof(uint32_t));
+    if (ok == false) {
+        return false;
+    }
+
+    resizeSlots(std::max<int32_t>(nSlots, kInitialSlots));
+    for (uint32_t i = 0; i < nSlots && ok; ++i) {
+        auto & slot = slots[i];
+        ok = ok && read(in, slot.statistics.lastSubmissionTimestamp_s);
+        statistics.lastSubmissionTimestamp_s = std::max(statistics.lastSubmissionTimestamp_s, slot.statistics.lastSubmissionTimestamp_s);
+        ok = ok && read(in, slot.statistics.votes);
+        ok = ok && read(in, slot.statistics.submissions);
+
+        uint32_t nWords = 0;
+        ok = ok && read(in, nWords) && fits(in, nWords, sizeof(TWordId) + sizeof(int64_t));
+        for (uint32_t j = 0; j < nWords && ok; ++j) {
+            uint32_t index = 0;
+            int64_t votes_mv = 0;
+            ok = ok && read(in, index) && read(in, votes_mv) && index < wordIds.size() && votes_mv >= 0;
+            if (ok) {
+                slot.addVotes(wordIds[index], votes_mv);
+            }
+        }
+    }
+
+    uint32_t nSubmissions = 0;
+    ok = ok && read(in, nSubmissions) && fits(in, nSubmissions, sizeof(uint64_t) + sizeof(TUserId) + sizeof(TWordId));
+
+    std::vector<std::pair<SubmissionKey, uint32_t>> entries(ok ? nSubmissions : 0);
+    for (auto & entry : entries) {
+        ok = ok && read(in, entry.first.ipSlot) && read(in, entry.first.userId) && read(in, entry.second);
+        if (ok == false) {
+            break;
+        }
+    }
+
+    if (ok == false) {
+        return false;
+    }
+
+    // rebuild the lookup tables
+    submissions.reserve(entries.size());
+    for (const auto & [key, index] : entries) {
+        if (index >= wordIds.size()) {
+            return false;
+        }
+
+        auto [group, isNewGroup] = groups.insert(key.ipSlot);
+        if (isNewGroup) {
+            ips.insert(TIPAddress(key.ipSlot >> 32));
+        }
+
+        if (submissionIndex.insert(key, (int32_t) submissions.size()).second == false) {
+            return false;
+        }
+
+        int32_t iWord = -1;
+        if (group->hasOnlyWord(wordIds[index])) {
+            group->wordId = wordIds[index];
+        } else {
+            if (group->head == -1) {
+                splitGroup(*group, key.ipSlot);
+            }
+            iWord = groupWord(key.ipSlot, wordIds[index]);
+            addGroupWordUser(*group, iWord, 1);
+        }
+
+        submissions.push_back(Submission { wordIds[index], iWord });
+        group->nUsers++;
+    }
+
+    return true;
 }
 
 namespace Print {
@@ -285,7 +1151,7 @@ void submissionInput(const SubmissionInput& input) {
         input.ip >> 24, (input.ip >> 16) & 0xff, (input.ip >> 8) & 0xff, input.ip & 0xff,
         input.slotId,
         input.userId%256,
-        input.word.c_str());
+        std::string(Dictionary::word(input.wordId)).c_str());
 }
 
 }
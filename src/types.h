@@ -1,10 +1,17 @@
 #pragma once
 
+#include "flat_map.h"
+#include "json.h"
+#include "dictionary.h"
+#include "rolling_counter.h"
+
 #include <cstdint>
 #include <cstdio>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <map>
+#include <set>
 #include <unordered_map>
 #include <fstream>
 #include <functional>
@@ -25,13 +32,26 @@ struct SubmissionInput {
     TIPAddress ip;
     TSlotId    slotId;
     TUserId    userId;
-    TWord      word;
+    TWordId    wordId;
 
     // serialize to binary file
     void serialize(std::ofstream & out) const;
 
-    // deserialize from binary file
+    // append the binary record to a buffer, same layout as serialize(std::ofstream &)
+    void serialize(std::string & out) const;
+
+    // deserialize from binary file, a word longer than kMaxWordLength is truncated
     void deserialize(std::ifstream & in);
+
+    // checks a word before it is interned, so that rejected words never enter the Dictionary
+    using CBIsValidWord = std::function<bool(std::string_view word)>;
+
+    // parse space separated text: "<timestamp> <ip> <slotId> <userId> <word>"
+    // this is the format of the pending submission files written by submit.php
+    bool parse(std::string_view text, const CBIsValidWord & isValidWord = nullptr);
+
+    // parse binary record, as written by serialize()
+    bool parse(const char * data, size_t size, const CBIsValidWord & isValidWord = nullptr);
 };
 
 bool convertIPAddress(const std::string & ipAddress, TIPAddress & ip);
@@ -44,18 +64,124 @@ struct Slot {
         int64_t votes;
         int64_t submissions;
 
-        // top voted words
-        std::vector<std::pair<TWord, int64_t>> topVoted;
+        // top voted words, refreshed by update()
+        std::vector<std::pair<TWordId, int64_t>> topVoted;
     } statistics;
 
     struct WordData {
         int64_t votes_mv; // millivotes
+
+        // see RankedWord
+        uint64_t prefix;
+    };
+
+    // a word in the ranking
+    // the first 8 bytes of the word as a big-endian number order most ties without looking up the words
+    struct RankedWord {
+        int64_t votes_mv;
+        uint64_t prefix;
+        TWordId wordId;
+    };
+
+    static uint64_t prefixOf(std::string_view word) {
+        uint64_t result = 0;
+        for (size_t i = 0; i < sizeof(result); ++i) {
+            result = (result << 8) | (i < word.size() ? (uint8_t) word[i] : 0);
+        }
+        return result;
+    }
+
+    // orders words by votes (descending) and then by the word (ascending)
+    // not by word id, since the ids depend on the order in which a process has seen the words,
+    // e.g. the coordinator of the ingestion shards interns them in the order in which the shards report them
+    struct RankingOrder {
+        bool operator()(const RankedWord & a, const RankedWord & b) const {
+            if (a.votes_mv != b.votes_mv) {
+                return a.votes_mv > b.votes_mv;
+            }
+            if (a.prefix != b.prefix) {
+                return a.prefix < b.prefix;
+            }
+            return a.wordId != b.wordId && Dictionary::word(a.wordId) < Dictionary::word(b.wordId);
+        }
     };
 
     // submitted words for the current slot
-    std::unordered_map<TWord, WordData> words;
+    FlatMap<TWordId, WordData> words;
+
+    // all words of the slot, kept sorted as votes change
+    std::set<RankedWord, RankingOrder> ranking;
+
+    // set when the votes changed since the last update()
+    bool dirty = false;
+
+    // index in State::slotActivity, -1 if the slot has no submissions in the activity window
+    int32_t activity = -1;
+
+    // the slot serialized as JSON object, refreshed by State::update()
+    std::string json;
+
+    // change the votes of a word, adding it to the slot if needed
+    void addVotes(TWordId wordId, int64_t delta_mv);
+
+    // refresh the top voted words statistics
+    void update(size_t nTopWords);
+};
+
+// changes made to a state by submit(), recorded if State::delta is set
+// - the states of ingestion shards that get disjoint sets of IPs add up to the state of a single process that gets
+//   all of the submissions: the (ip, slot) deduplication depends only on the submissions of the IP, the votes of
+//   the words are sums of the contributions of the groups and the rest are counts, see State::merge
+// - the words that submit() added to a slot are kept even if their votes did not change, as they are ranked
+// - the activity is recorded per second, so that the rolling counters of the merged state are the same
+struct StateDelta {
+    struct SlotData {
+        int64_t votes       = 0;
+        int64_t submissions = 0;
 
-    void update();
+        TTimestamp lastSubmissionTimestamp_s = 0;
+    };
+
+    struct ActivityData {
+        int32_t submissions = 0;
+        int32_t votes       = 0;
+        int32_t newIPs      = 0;
+    };
+
+    TPeriodId periodId = 0;
+
+    int64_t votes       = 0;
+    int64_t submissions = 0;
+    int64_t uniqueIPs   = 0;
+
+    TTimestamp lastSubmissionTimestamp_s = 0;
+
+    FlatMap<TSlotId, SlotData> slots;
+
+    // millivotes by packSlotWord(slotId, wordId)
+    FlatMap<uint64_t, int64_t> words;
+
+    // by second, and the submissions of each slot by packSlotTime(slotId, timestamp_s)
+    FlatMap<TTimestamp, ActivityData> activity;
+    FlatMap<uint64_t, int32_t> slotActivity;
+
+    static uint64_t packSlotWord(TSlotId slotId, TWordId wordId) {
+        return (uint64_t(uint32_t(slotId)) << 32) | wordId;
+    }
+
+    static uint64_t packSlotTime(TSlotId slotId, TTimestamp t_s) {
+        return (uint64_t(uint32_t(slotId)) << 32) | t_s;
+    }
+
+    bool empty() const { return slots.empty(); }
+
+    void clear();
+
+    // append the binary form to a buffer, the words are stored as strings since word ids are valid only within a process
+    void serialize(std::string & out) const;
+
+    // parse the binary form written by serialize()
+    bool parse(const char * data, size_t size);
 };
 
 struct State {
@@ -67,12 +193,44 @@ struct State {
         int64_t submissions = 0;
         int64_t uniqueIPs   = 0;
 
-        // todo:
-        // - time of last submission
-        // - number of submissions during last N minutes
-        // - histogram of submissions during last N minutes
+        TTimestamp lastSubmissionTimestamp_s = 0;
     } statistics;
 
+    // submissions counted at 1 second resolution for the last minute and at 1 minute resolution for the last hour
+    struct ActivityCounters {
+        RollingCounter<60, 1>  perSecond;
+        RollingCounter<60, 60> perMinute;
+
+        void add(TTimestamp t_s, int32_t n = 1) {
+            perSecond.add(t_s, n);
+            perMinute.add(t_s, n);
+        }
+    };
+
+    // recent activity, updated by submit() in constant time and memory
+    // - the windows end with the newest submission, so replaying the same submissions gives the same numbers
+    // - the activity is not stored in snapshots and the parallel replay does not add to it,
+    //   in these cases it fills up again with the following submissions
+    struct Activity {
+        ActivityCounters submissions;
+        ActivityCounters votes;
+        ActivityCounters newIPs;
+    } activity;
+
+    // activity of the slots with submissions in the last hour, in no particular order
+    struct SlotActivity {
+        TSlotId slotId;
+        ActivityCounters submissions;
+    };
+
+    std::vector<SlotActivity> slotActivity;
+
+    // the minute at which update() last removed the inactive slots from slotActivity
+    uint32_t activityPruneMinute = UINT32_MAX;
+
+    // number of slots in the "trending" list of the activity output
+    static const int32_t nTrendingSlots = 10;
+
     // submission history is cleard when a new period starts
     static const int32_t secondsInPeriod = 1*24*3600;
 
@@ -81,15 +239,141 @@ struct State {
     // the currently active word slots
     std::vector<Slot> slots;
 
+    // with ingestion shards, the votes of the other shards as last reported by the coordinator
+    // the slots are activated by the total votes, see setOtherVotes()
+    int64_t otherVotes = 0;
+
+    // submissions for slots that are not active are accepted, activating the slots
+    // used by the shards to replay their history, which contains only the submissions accepted at the time
+    bool acceptAllSlots = false;
+
+    // if set, submit() records the changes made to the state here
+    StateDelta * delta = nullptr;
+
+    // slots with votes changed since the last update()
+    std::vector<TSlotId> dirtySlots;
+
     // the data that we store for each submission
     struct Submission {
-        TWord word;
+        TWordId wordId;
+
+        // index of the word in groupWords, -1 if not known yet
+        int32_t groupWord;
+    };
+
+    // submissions from a single IP for a single slot
+    // the group contributes 1 vote to the slot, shared by its words in proportion to their users:
+    // a word submitted by c of the n users of the group gets round(1000*c/n) millivotes
+    // while all users of the group submit the same word, the word is kept here and the counts are not built
+    struct Group {
+        int32_t nUsers = 0;
+
+        // the count with the fewest users, -1 if none
+        int32_t head = -1;
+
+        // the word of all users, valid only if there are no counts
+        TWordId wordId = 0;
+
+        bool hasOnlyWord(TWordId other) const {
+            return head == -1 && (nUsers == 0 || wordId == other);
+        }
+    };
+
+    // the words of a group submitted by the same number of users
+    // all of them get the same share of the group, so they are reweighted together
+    struct GroupCount {
+        int32_t nUsers;
+
+        // first word with this count, -1 if none
+        int32_t head;
+
+        // neighbouring counts of the same group, sorted by number of users, -1 if none
+        int32_t prev;
+        int32_t next;
     };
 
-    // all submissions
-    std::unordered_map<TIPAddress,
-        std::unordered_map<TSlotId,
-            std::unordered_map<TUserId, Submission>>> submissions;
+    // a word submitted by some of the users of a group
+    struct GroupWord {
+        TWordId wordId;
+
+        // index of the count of the word, -1 if no user submits it anymore
+        int32_t count;
+
+        // neighbouring words with the same count, -1 if none
+        int32_t prev;
+        int32_t next;
+    };
+
+    // key identifying a single word of a group
+    struct GroupWordKey {
+        uint64_t ipSlot;
+        TWordId  wordId;
+
+        bool operator==(const GroupWordKey & other) const {
+            return ipSlot == other.ipSlot && wordId == other.wordId;
+        }
+    };
+
+    struct GroupWordKeyHash {
+        uint64_t operator()(const GroupWordKey & key) const {
+            return hash64(key.ipSlot ^ (uint64_t(key.wordId)*0x9e3779b97f4a7c15ull));
+        }
+    };
+
+    // key identifying a single user of a group
+    struct SubmissionKey {
+        uint64_t ipSlot;
+        TUserId  userId;
+
+        bool operator==(const SubmissionKey & other) const {
+            return ipSlot == other.ipSlot && userId == other.userId;
+        }
+    };
+
+    struct SubmissionKeyHash {
+        uint64_t operator()(const SubmissionKey & key) const {
+            return hash64(key.ipSlot ^ (uint64_t(key.userId) << 48) ^ key.userId);
+        }
+    };
+
+    static uint64_t packIPSlot(TIPAddress ip, TSlotId slotId) {
+        return (uint64_t(ip) << 32) | uint32_t(slotId);
+    }
+
+    // millivotes of a word submitted by nWordUsers of the nUsers users of a group
+    static int64_t share_mv(int32_t nWordUsers, int32_t nUsers) {
+        return nUsers > 0 ? (2000*int64_t(nWordUsers) + nUsers)/(2*int64_t(nUsers)) : 0;
+    }
+
+    // all submissions for the current period
+    // - submissions are stored contiguously in the order of arrival
+    // - the index maps each (ip, slot, user) to its position in the submissions array
+    // - the words of each group are bucketed by their number of users in groupCounts, so a new user of the group
+    //   reweights each bucket once and visits only the words whose share actually changes
+    std::vector<Submission> submissions;
+    FlatMap<SubmissionKey, int32_t, SubmissionKeyHash> submissionIndex;
+    FlatMap<uint64_t, Group> groups;
+    std::vector<GroupCount> groupCounts;
+    int32_t groupCountsFree = -1; // first unused count, linked via GroupCount::next
+    std::vector<GroupWord> groupWords;
+    FlatMap<GroupWordKey, int32_t, GroupWordKeyHash> groupWordIndex;
+    FlatMap<TIPAddress, bool> ips;
+
+    // index of a free count, initialized with the given values
+    int32_t newGroupCount(const GroupCount & count);
+
+    // index of a word of a group, added without users if missing
+    int32_t groupWord(uint64_t ipSlot, TWordId wordId);
+
+    // build the counts of a group with a single word
+    void splitGroup(Group & group, uint64_t ipSlot);
+
+    // add or remove (delta = +1/-1) a user of a word of the group, returns the new number of users of the word
+    int32_t addGroupWordUser(Group & group, int32_t iWord, int32_t delta);
+
+    // bytes reserved by the containers of the current period
+    // the memory is kept at rollover and reused by the next period, so it follows the busiest period so far
+    size_t periodMemoryUsage() const;
 
     int64_t votesNeeded(int32_t slots) const;
     int32_t activeSlots(int64_t votes) const;
@@ -97,26 +381,52 @@ struct State {
 
     void init();
 
-    void submit(SubmissionInput input, CBOnNewPeriodStart && onNewPeriodStart);
+    // add slots, marking them as changed
+    void resizeSlots(int32_t nSlots);
 
-    // update slot statistics
-    void update();
+    // count n submissions of the slot at t_s in its activity, adding the slot to slotActivity if needed
+    void addSlotActivity(TSlotId slotId, TTimestamp t_s, int32_t n);
 
-    void output(const std::string & filename, size_t nTopWordsPerSlot) const;
-};
+    // returns false if the submission is rejected, e.g. because its slot is not active
+    bool submit(SubmissionInput input, CBOnNewPeriodStart && onNewPeriodStart);
 
-// generators of random input data, used for debugging/testing purposes
-namespace Gen {
+    // raise the votes of the other shards, activating the slots that the total votes allow
+    void setOtherVotes(int64_t votes);
 
-TTimestamp timestamp();
-TIPAddress ip();
-TSlotId    slotId(int32_t n);
-TUserId    userId();
-TWord      word();
+    // add the changes recorded by another state, e.g. by an ingestion shard
+    // the per-period lookup tables are not touched, they stay with the shards
+    void merge(const StateDelta & delta, const CBOnNewPeriodStart & onNewPeriodStart);
 
-SubmissionInput submissionInput(int32_t n);
+    // the changes from the initial state to this one, without the activity
+    // merged into an empty state, this gives the same statistics
+    void contribution(StateDelta & delta) const;
 
-}
+    // update statistics of the slots that changed since the last call
+    // refresh the statistics of the changed slots, their ids are appended to updated if provided
+    // the slots without submissions in the last hour are removed from slotActivity once per minute
+    void update(size_t nTopWordsPerSlot, std::vector<TSlotId> * updated = nullptr);
+
+    // append the JSON object of a slot
+    void outputSlot(JSONWriter & json, TSlotId slotId) const;
+
+    // append the JSON object of the recent activity: the totals of the last minute and of the last hour,
+    // the histograms of the submissions, oldest first, and the slots with the most submissions in the last minute
+    void outputActivity(JSONWriter & json) const;
+
+    // append the statistics as minified JSON to out
+    // the slots are copied from the fragments cached by update(), so only the changed slots are serialized again
+    void output(std::string & out) const;
+
+    // write the statistics JSON to a file with a single write
+    bool output(const std::string & filename) const;
+
+    // binary snapshot of the state
+    // - only the primary data is stored, the lookup tables and the word rankings are rebuilt on load
+    // - words are stored as strings, since word ids are valid only within a process
+    // - load() checks the counts against the size of the stream, which must be seekable
+    void save(std::ostream & out) const;
+    bool load(std::istream & in);
+};
 
 // helper methods for printing stuff
 namespace Print {
@@ -1,7 +1,19 @@
 #include "utils.h"
 
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
 #ifdef __APPLE__
 #include <mach/mach.h>
+#elif defined(__linux__)
+#include <unistd.h>
+#endif
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+#include <malloc.h>
+#define HAS_MALLINFO2
 #endif
 
 namespace Utils {
@@ -16,8 +28,108 @@ int64_t getMemoryUsage() {
     }
 
     return t_info.resident_size;
-#endif
+#elif defined(__linux__)
+    // "<size> <resident> ..." in pages
+    FILE * file = fopen("/proc/self/statm", "r");
+    if (file == nullptr) {
+        return -1;
+    }
+
+    long nPages = 0;
+    long nResident = 0;
+    const int n = fscanf(file, "%ld %ld", &nPages, &nResident);
+    fclose(file);
+
+    if (n != 2) {
+        return -1;
+    }
+
+    return int64_t(nResident)*sysconf(_SC_PAGESIZE);
+#else
     return -1;
+#endif
+}
+
+bool getHeapUsage(int64_t & inUse, int64_t & free) {
+#ifdef HAS_MALLINFO2
+    // summed over all arenas, large blocks are mmapped separately
+    const auto info = mallinfo2();
+
+    inUse = info.uordblks + info.hblkhd;
+    free  = info.fordblks;
+
+    return true;
+#else
+    (void) inUse;
+    (void) free;
+    return false;
+#endif
+}
+
+bool writeFile(const std::string & fileName, const std::string & data) {
+    FILE * file = fopen(fileName.c_str(), "wb");
+    if (file == nullptr) {
+        fprintf(stderr, "Failed to open '%s' for writing\n", fileName.c_str());
+        return false;
+    }
+
+    // unbuffered, so the data is passed to write() as a whole
+    setvbuf(file, nullptr, _IONBF, 0);
+
+    const bool ok = fwrite(data.data(), 1, data.size(), file) == data.size();
+    if (fclose(file) != 0 || ok == false) {
+        fprintf(stderr, "Failed to write '%s'\n", fileName.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+bool readWords(const std::string & fileName, std::string & data, std::vector<std::string_view> & words) {
+    std::ifstream file(fileName);
+    if (file.is_open() == false) {
+        return false;
+    }
+
+    // keep all lines in a single buffer, so the views stay valid
+    data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+    words.clear();
+    size_t pos = 0;
+    while (pos < data.size()) {
+        auto end = data.find('\n', pos);
+        if (end == std::string::npos) {
+            end = data.size();
+        }
+
+        std::string_view word(data.data() + pos, end - pos);
+        if (word.empty() == false && word.back() == '\r') {
+            word.remove_suffix(1);
+        }
+        words.push_back(word);
+
+        pos = end + 1;
+    }
+
+    return true;
+}
+
+std::vector<std::string> getFiles(const std::string & folder, const std::regex & regex) {
+    std::vector<std::string> files;
+
+    for (const auto & entry : std::filesystem::directory_iterator(folder)) {
+        if (entry.is_regular_file()) {
+            if (std::regex_match(entry.path().filename().string(), regex)) {
+                files.push_back(entry.path().string());
+            }
+        }
+    }
+
+    return files;
+}
+
+std::vector<std::string> getFiles(const std::string & folder, const std::string & regex) {
+    return getFiles(folder, std::regex(regex));
 }
 
 }
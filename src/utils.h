@@ -1,9 +1,30 @@
 #pragma once
 
 #include <cstdint>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <vector>
 
 namespace Utils {
 
+// resident set size of the process in bytes, -1 if not supported on this platform
 int64_t getMemoryUsage();
 
+// bytes of the malloc heap in use and bytes freed but still held by the allocator
+// returns false if not supported on this platform
+bool getHeapUsage(int64_t & inUse, int64_t & free);
+
+// write the data to a file with a single write()
+bool writeFile(const std::string & fileName, const std::string & data);
+
+// read a text file with one word per line, e.g. words-alpha.txt
+// the words point into data and have the line endings ("\n" or "\r\n") removed, empty lines are kept
+// returns false if the file cannot be read
+bool readWords(const std::string & fileName, std::string & data, std::vector<std::string_view> & words);
+
+// get files in folder with names matching the regex
+std::vector<std::string> getFiles(const std::string & folder, const std::regex & regex);
+std::vector<std::string> getFiles(const std::string & folder, const std::string & regex);
+
 }
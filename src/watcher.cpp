@@ -0,0 +1,154 @@
+#include "watcher.h"
+
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+
+#ifdef __linux__
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#endif
+
+struct Watcher::Impl {
+    int fd = -1;
+
+    // the watched folder of each watch descriptor
+    std::map<int, std::string> folders;
+
+    // used to interrupt poll() in event mode
+    int wakeFd = -1;
+
+    // used to interrupt the sleep in polling mode
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool woken = false;
+};
+
+Watcher::Watcher() : m_impl(new Impl()) {
+#ifdef __linux__
+    m_impl->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    m_impl->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_impl->fd < 0) {
+        fprintf(stderr, "Warning: inotify is not available, falling back to polling\n");
+    }
+#endif
+}
+
+Watcher::Watcher(const std::string & folder) : Watcher() {
+    add(folder);
+}
+
+Watcher::~Watcher() {
+#ifdef __linux__
+    if (m_impl->fd >= 0) {
+        close(m_impl->fd);
+    }
+    if (m_impl->wakeFd >= 0) {
+        close(m_impl->wakeFd);
+    }
+#endif
+}
+
+void Watcher::add([[maybe_unused]] const std::string & folder) {
+#ifdef __linux__
+    if (m_impl->fd < 0) {
+        return;
+    }
+
+    // submit.php writes to a temporary file and atomically renames it, which results in IN_MOVED_TO
+    const int wd = inotify_add_watch(m_impl->fd, folder.c_str(), IN_MOVED_TO | IN_CLOSE_WRITE);
+    if (wd < 0) {
+        fprintf(stderr, "Warning: failed to watch '%s', falling back to polling\n", folder.c_str());
+        close(m_impl->fd);
+        m_impl->fd = -1;
+        return;
+    }
+
+    m_impl->folders[wd] = folder;
+#endif
+}
+
+bool Watcher::isEventDriven() const {
+    return m_impl->fd >= 0;
+}
+
+bool Watcher::wait(int timeout_ms, std::vector<std::string> & files) {
+    if (isEventDriven() == false || m_impl->wakeFd < 0) {
+        std::unique_lock lock(m_impl->mutex);
+        const bool woken = m_impl->cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), [&] { return m_impl->woken; });
+        m_impl->woken = false;
+        return woken;
+    }
+
+#ifdef __linux__
+    pollfd pfds[2] = {
+        { m_impl->fd,     POLLIN, 0 },
+        { m_impl->wakeFd, POLLIN, 0 },
+    };
+    if (poll(pfds, 2, timeout_ms) <= 0) {
+        return false;
+    }
+
+    if (pfds[1].revents & POLLIN) {
+        uint64_t value;
+        [[maybe_unused]] auto res = read(m_impl->wakeFd, &value, sizeof(value));
+    }
+
+    bool ok = true;
+
+    // drain all queued events so that they are processed as a single batch
+    alignas(inotify_event) char buffer[16*1024];
+    while (true) {
+        const auto n = read(m_impl->fd, buffer, sizeof(buffer));
+        if (n <= 0) {
+            break;
+        }
+
+        for (char * p = buffer; p < buffer + n; ) {
+            const auto * event = (const inotify_event *) p;
+            p += sizeof(inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                ok = false;
+                continue;
+            }
+
+            if (event->len == 0 || (event->mask & IN_ISDIR)) {
+                continue;
+            }
+
+            const auto it = m_impl->folders.find(event->wd);
+            if (it == m_impl->folders.end()) {
+                continue;
+            }
+
+            files.push_back(it->second + "/" + event->name);
+        }
+    }
+
+    return ok;
+#else
+    return false;
+#endif
+}
+
+void Watcher::wake() {
+#ifdef __linux__
+    if (isEventDriven() && m_impl->wakeFd >= 0) {
+        const uint64_t value = 1;
+        [[maybe_unused]] auto res = write(m_impl->wakeFd, &value, sizeof(value));
+        return;
+    }
+#endif
+
+    {
+        std::lock_guard lock(m_impl->mutex);
+        m_impl->woken = true;
+    }
+    m_impl->cv.notify_one();
+}
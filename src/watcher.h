@@ -0,0 +1,35 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// watches one or more folders for files that are moved into them
+// - on Linux uses inotify and reacts to IN_MOVED_TO / IN_CLOSE_WRITE events
+// - elsewhere it simply sleeps and asks the caller to rescan the folders
+// - wait() can be interrupted from another thread with wake()
+class Watcher {
+public:
+    Watcher();
+    Watcher(const std::string & folder);
+    ~Watcher();
+
+    // watch another folder, all folders fall back to polling if it cannot be watched
+    void add(const std::string & folder);
+
+    // true if the watcher receives notifications for new files
+    bool isEventDriven() const;
+
+    // wait up to timeout_ms for new files and append their paths to files
+    // returns false if the caller should rescan the whole folders instead
+    // (timeout, event queue overflow or no event support)
+    // returns true without new files if woken up via wake()
+    bool wait(int timeout_ms, std::vector<std::string> & files);
+
+    // make the current or the next wait() return immediately
+    void wake();
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> m_impl;
+};
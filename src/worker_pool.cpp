@@ -0,0 +1,163 @@
+#include "worker_pool.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+struct WorkerPool::Impl {
+    struct TaskData {
+        Task task;
+
+        bool queued  = false;
+        bool running = false;
+        bool again   = false;
+
+        // time of the armed timer, max if none
+        Clock::time_point tTimer = Clock::time_point::max();
+    };
+
+    struct Timer {
+        Clock::time_point t;
+        TaskId id;
+
+        bool operator>(const Timer & other) const { return t > other.t; }
+    };
+
+    int nThreads = 1;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    std::vector<TaskData> tasks;
+    std::deque<TaskId> ready;
+
+    // a timer that was re-armed earlier leaves a stale entry behind, it is dropped when it expires
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers;
+
+    bool stopping = false;
+    std::vector<std::thread> workers;
+
+    // requires the lock
+    void enqueue(TaskId id) {
+        auto & data = tasks[id];
+        if (data.running) {
+            data.again = true;
+            return;
+        }
+        if (data.queued) {
+            return;
+        }
+
+        data.queued = true;
+        ready.push_back(id);
+        cv.notify_one();
+    }
+
+    void run() {
+        std::unique_lock lock(mutex);
+        while (stopping == false) {
+            const auto tNow = Clock::now();
+            while (timers.empty() == false && timers.top().t <= tNow) {
+                const auto timer = timers.top();
+                timers.pop();
+
+                if (tasks[timer.id].tTimer == timer.t) {
+                    tasks[timer.id].tTimer = Clock::time_point::max();
+                    enqueue(timer.id);
+                }
+            }
+
+            if (ready.empty()) {
+                if (timers.empty()) {
+                    cv.wait(lock);
+                } else {
+                    cv.wait_until(lock, timers.top().t);
+                }
+                continue;
+            }
+
+            const TaskId id = ready.front();
+            ready.pop_front();
+
+            auto & data = tasks[id];
+            data.queued = false;
+            data.running = true;
+
+            lock.unlock();
+            data.task();
+            lock.lock();
+
+            data.running = false;
+            if (data.again) {
+                data.again = false;
+                enqueue(id);
+            }
+        }
+    }
+};
+
+WorkerPool::WorkerPool(int nThreads) : m_impl(new Impl()) {
+    m_impl->nThreads = std::max(1, nThreads);
+}
+
+WorkerPool::~WorkerPool() {
+    stop();
+}
+
+int WorkerPool::nThreads() const {
+    return m_impl->nThreads;
+}
+
+WorkerPool::TaskId WorkerPool::add(Task && task) {
+    std::lock_guard lock(m_impl->mutex);
+
+    m_impl->tasks.emplace_back();
+    m_impl->tasks.back().task = std::move(task);
+
+    return (TaskId) m_impl->tasks.size() - 1;
+}
+
+void WorkerPool::start() {
+    for (int i = 0; i < m_impl->nThreads; ++i) {
+        m_impl->workers.emplace_back([this]() { m_impl->run(); });
+    }
+}
+
+void WorkerPool::schedule(TaskId id) {
+    std::lock_guard lock(m_impl->mutex);
+    m_impl->enqueue(id);
+}
+
+void WorkerPool::scheduleAt(TaskId id, Clock::time_point t) {
+    std::lock_guard lock(m_impl->mutex);
+
+    auto & data = m_impl->tasks[id];
+    if (data.queued || t >= data.tTimer) {
+        return;
+    }
+
+    data.tTimer = t;
+
+    // wake a worker only if the new timer is the first one to expire
+    const bool isFirst = m_impl->timers.empty() || t < m_impl->timers.top().t;
+    m_impl->timers.push({ t, id });
+    if (isFirst) {
+        m_impl->cv.notify_one();
+    }
+}
+
+void WorkerPool::stop() {
+    {
+        std::lock_guard lock(m_impl->mutex);
+        m_impl->stopping = true;
+    }
+    m_impl->cv.notify_all();
+
+    for (auto & worker : m_impl->workers) {
+        worker.join();
+    }
+    m_impl->workers.clear();
+}
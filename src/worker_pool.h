@@ -0,0 +1,43 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+// fixed set of worker threads shared by independent pipelines, e.g. the stories hosted by the daemon
+// - the work is registered once as a task and then scheduled any number of times, the schedules that
+//   arrive before the task starts are combined into a single run
+// - a task never runs on two workers at once, so it can own state that is not thread-safe
+// - the scheduled tasks run in FIFO order and a task that is scheduled while running goes to the back of
+//   the queue, so tasks that handle a bounded amount of work per run share the workers fairly
+// - timers schedule a task at a later time without holding a worker while waiting
+class WorkerPool {
+public:
+    using Clock = std::chrono::steady_clock;
+    using TaskId = int32_t;
+    using Task = std::function<void()>;
+
+    WorkerPool(int nThreads);
+    ~WorkerPool();
+
+    int nThreads() const;
+
+    // register a task, all tasks must be added before start()
+    TaskId add(Task && task);
+
+    void start();
+
+    // run the task as soon as a worker is free, once more if it is running right now
+    void schedule(TaskId id);
+
+    // run the task at time t, unless it is already due earlier
+    void scheduleAt(TaskId id, Clock::time_point t);
+
+    // wait for the running tasks to return and stop the workers, the scheduled tasks are dropped
+    void stop();
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> m_impl;
+};